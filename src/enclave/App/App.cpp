@@ -35,7 +35,13 @@
 #endif
 
 #include <climits>
+#include <cpuid.h>
 #include <cstdarg>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <vector>
 #include <cstdio>
 #include <cstdlib>
 #include <sys/time.h> // struct timeval
@@ -48,6 +54,7 @@
 #include <sgx_ukey_exchange.h>
 
 #include "Enclave_u.h"
+#include "sgxaes.h"
 
 #ifndef TRUE
 # define TRUE 1
@@ -271,6 +278,29 @@ void ocall_throw(const char *message) {
   env->ThrowNew(exception, message);
 }
 
+/**
+ * Number of host threads lent to each enclave's worker pool, which decrypts blocks ahead of the
+ * operators. Each worker permanently occupies one of the enclave's TCSs, so TCSNum in
+ * Enclave.config.xml reserves this many TCSs on top of the ones for the ECALLs of concurrent Spark
+ * tasks. Keep the two in sync.
+ */
+static const int NUM_ENCLAVE_WORKERS = 2;
+
+/** The worker threads of each running enclave. */
+static std::map<sgx_enclave_id_t, std::vector<pthread_t>> enclave_workers;
+static pthread_mutex_t enclave_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *enclave_worker(void *arg) {
+  sgx_enclave_id_t eid = *static_cast<sgx_enclave_id_t *>(arg);
+  delete static_cast<sgx_enclave_id_t *>(arg);
+  sgx_status_t ret = ecall_worker_loop(eid);
+  if (ret != SGX_SUCCESS) {
+    // There is no Java caller to throw to on this thread
+    fprintf(stderr, "Enclave worker failed. %s\n", sgx_error_message(ret).c_str());
+  }
+  return nullptr;
+}
+
 JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_StartEnclave(
   JNIEnv *env, jobject obj, jstring library_path) {
   (void)obj;
@@ -287,6 +317,21 @@ JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_St
                        library_path_str, SGX_DEBUG_FLAG, &token, &updated, &eid, nullptr));
   env->ReleaseStringUTFChars(library_path, library_path_str);
 
+  // Running without workers is still correct, only slower
+  std::vector<pthread_t> workers;
+  for (int i = 0; i < NUM_ENCLAVE_WORKERS; i++) {
+    pthread_t worker;
+    sgx_enclave_id_t *arg = new sgx_enclave_id_t(eid);
+    if (pthread_create(&worker, nullptr, enclave_worker, arg) == 0) {
+      workers.push_back(worker);
+    } else {
+      delete arg;
+    }
+  }
+  pthread_mutex_lock(&enclave_workers_lock);
+  enclave_workers[eid] = workers;
+  pthread_mutex_unlock(&enclave_workers_lock);
+
   return eid;
 }
 
@@ -374,6 +419,15 @@ JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sto
   (void)env;
   (void)obj;
 
+  pthread_mutex_lock(&enclave_workers_lock);
+  std::vector<pthread_t> workers = enclave_workers[eid];
+  enclave_workers.erase(eid);
+  pthread_mutex_unlock(&enclave_workers_lock);
+  sgx_check("StopEnclave", ecall_stop_workers(eid));
+  for (auto worker : workers) {
+    pthread_join(worker, nullptr);
+  }
+
   sgx_check("StopEnclave", sgx_destroy_enclave(eid));
 }
 
@@ -450,36 +504,270 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
 }
 
 JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Encrypt(
-  JNIEnv *env, jobject obj, jlong eid, jbyteArray plaintext) {
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray plaintext, jbyteArray aad) {
   (void)obj;
 
   uint32_t plength = (uint32_t) env->GetArrayLength(plaintext);
   jboolean if_copy = false;
   uint8_t *plaintext_ptr = (uint8_t *) env->GetByteArrayElements(plaintext, &if_copy);
 
+  uint32_t aad_length = (uint32_t) env->GetArrayLength(aad);
+  uint8_t *aad_ptr = (uint8_t *) env->GetByteArrayElements(aad, &if_copy);
+
   uint8_t *ciphertext_copy = nullptr;
   jsize clength = 0;
 
-  if (plaintext_ptr == nullptr) {
+  if (plaintext_ptr == nullptr || aad_ptr == nullptr) {
     ocall_throw("Encrypt: JNI failed to get input byte array.");
   } else {
     clength = plength + SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE;
     ciphertext_copy = new uint8_t[clength];
 
     sgx_check("Encrypt",
-              ecall_encrypt(eid, plaintext_ptr, plength, ciphertext_copy, (uint32_t) clength));
+              ecall_encrypt(eid, plaintext_ptr, plength, ciphertext_copy, (uint32_t) clength,
+                            aad_length > 0 ? aad_ptr : nullptr, aad_length));
   }
 
   jbyteArray ciphertext = env->NewByteArray(clength);
   env->SetByteArrayRegion(ciphertext, 0, clength, (jbyte *) ciphertext_copy);
 
   env->ReleaseByteArrayElements(plaintext, (jbyte *) plaintext_ptr, 0);
+  env->ReleaseByteArrayElements(aad, (jbyte *) aad_ptr, JNI_ABORT);
 
   delete[] ciphertext_copy;
 
   return ciphertext;
 }
 
+/*
+ * Driver-side AES-GCM.
+ *
+ * The driver encrypts and decrypts blocks under the shared key without an enclave (see
+ * edu.berkeley.cs.rise.opaque.Utils.encrypt). These functions run the enclave's AES-NI/PCLMULQDQ
+ * implementation in sgxaes_asm.S on the host, in batches of buffers allocated by the caller, using
+ * the same IV || ciphertext || MAC layout as the enclave.
+ */
+
+static void jni_throw(JNIEnv *env, const std::string &message) {
+  jclass exception = env->FindClass("edu/berkeley/cs/rise/opaque/OpaqueException");
+  env->ThrowNew(exception, message.c_str());
+}
+
+/** Overwrite `len` bytes at `p` with zeros in a way the compiler cannot elide. */
+static void secure_zero(void *p, size_t len) {
+  volatile uint8_t *bytes = static_cast<volatile uint8_t *>(p);
+  while (len--) {
+    *bytes++ = 0;
+  }
+}
+
+/**
+ * A key schedule together with the GHASH table derived from it. Expanded once per batch call and
+ * wiped when it goes out of scope, so that no key material outlives the call.
+ */
+struct HostGcmKey {
+  HostGcmKey(const unsigned char *key, size_t key_len) : ks(key, key_len), gcm_key(&ks) {}
+  ~HostGcmKey() {
+    secure_zero(&ks, sizeof(ks));
+    secure_zero(&gcm_key, sizeof(gcm_key));
+  }
+
+  KeySchedule ks;
+  GcmKey gcm_key;
+
+private:
+  // gcm_key points into ks
+  HostGcmKey(const HostGcmKey &);
+  HostGcmKey &operator=(const HostGcmKey &);
+};
+
+/** Copy the given additional authenticated data out of its Java array. */
+static std::vector<uint8_t> get_aad(JNIEnv *env, jbyteArray aad) {
+  std::vector<uint8_t> result(env->GetArrayLength(aad));
+  env->GetByteArrayRegion(aad, 0, result.size(), (jbyte *) result.data());
+  return result;
+}
+
+/** Expand the given key, or return null after throwing if the key is invalid. */
+static std::unique_ptr<HostGcmKey> expand_host_gcm_key(JNIEnv *env, jbyteArray key) {
+  jsize key_len = env->GetArrayLength(key);
+  if (key_len != 16 && key_len != 24 && key_len != 32) {
+    jni_throw(env, std::string("Invalid AES key size: ") + std::to_string(key_len));
+    return nullptr;
+  }
+  unsigned char key_bytes[32];
+  env->GetByteArrayRegion(key, 0, key_len, (jbyte *) key_bytes);
+  std::unique_ptr<HostGcmKey> result(new HostGcmKey(key_bytes, key_len));
+  secure_zero(key_bytes, sizeof(key_bytes));
+  return result;
+}
+
+/** Whether this CPU can run the driver-side AES-GCM functions below. */
+JNIEXPORT jboolean JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostAesGcmSupported(
+  JNIEnv *env, jobject obj) {
+  (void)env;
+  (void)obj;
+
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  // sgxaes_asm.S uses VEX-encoded AES-NI and PCLMULQDQ instructions, which also need the OS to
+  // save the AVX register state
+  if (!(ecx & bit_AES) || !(ecx & bit_PCLMUL) || !(ecx & bit_AVX) || !(ecx & bit_OSXSAVE)) {
+    return false;
+  }
+  uint32_t xcr0_lo, xcr0_hi;
+  __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  return (xcr0_lo & 0x6) == 0x6;
+}
+
+/**
+ * Encrypt each plaintext under the IV at the same index of `ivs` into the ciphertext array of the
+ * same index, which must be exactly large enough. Each MAC also covers the additional
+ * authenticated data `aad`.
+ */
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostEncryptBatch(
+  JNIEnv *env, jobject obj, jbyteArray key, jbyteArray aad, jbyteArray ivs,
+  jobjectArray plaintexts, jobjectArray ciphertexts) {
+  (void)obj;
+
+  std::unique_ptr<HostGcmKey> host_key = expand_host_gcm_key(env, key);
+  if (!host_key) {
+    return;
+  }
+  const GcmKey *gcm_key = &host_key->gcm_key;
+  const std::vector<uint8_t> aad_bytes = get_aad(env, aad);
+  jsize n = env->GetArrayLength(plaintexts);
+  if (env->GetArrayLength(ciphertexts) != n
+      || env->GetArrayLength(ivs) != n * SGX_AESGCM_IV_SIZE) {
+    jni_throw(env, "HostEncryptBatch: mismatched batch sizes");
+    return;
+  }
+
+  for (jsize i = 0; i < n; i++) {
+    jbyteArray plaintext = (jbyteArray) env->GetObjectArrayElement(plaintexts, i);
+    jbyteArray ciphertext = (jbyteArray) env->GetObjectArrayElement(ciphertexts, i);
+    jsize plength = env->GetArrayLength(plaintext);
+    if (env->GetArrayLength(ciphertext) != plength + SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE) {
+      jni_throw(env, std::string("HostEncryptBatch: wrong output size for buffer ")
+                + std::to_string(i));
+      return;
+    }
+
+    uint8_t iv[SGX_AESGCM_IV_SIZE];
+    env->GetByteArrayRegion(ivs, i * SGX_AESGCM_IV_SIZE, SGX_AESGCM_IV_SIZE, (jbyte *) iv);
+
+    // No other JNI calls may be made while the arrays are pinned
+    uint8_t *plaintext_ptr = (uint8_t *) env->GetPrimitiveArrayCritical(plaintext, nullptr);
+    uint8_t *ciphertext_ptr = (uint8_t *) env->GetPrimitiveArrayCritical(ciphertext, nullptr);
+    bool pinned = plaintext_ptr != nullptr && ciphertext_ptr != nullptr;
+    if (pinned) {
+      memcpy(ciphertext_ptr, iv, SGX_AESGCM_IV_SIZE);
+      AesGcm cipher(gcm_key, iv, SGX_AESGCM_IV_SIZE);
+      if (!aad_bytes.empty()) {
+        cipher.aad(aad_bytes.data(), aad_bytes.size());
+      }
+      cipher.encrypt(plaintext_ptr, plength, ciphertext_ptr + SGX_AESGCM_IV_SIZE, plength);
+      memcpy(ciphertext_ptr + SGX_AESGCM_IV_SIZE + plength, cipher.tag().t, SGX_AESGCM_MAC_SIZE);
+      // The context holds a copy of the GHASH table
+      secure_zero(&cipher.gctx, sizeof(cipher.gctx));
+    }
+    if (ciphertext_ptr != nullptr) {
+      env->ReleasePrimitiveArrayCritical(ciphertext, ciphertext_ptr, 0);
+    }
+    if (plaintext_ptr != nullptr) {
+      env->ReleasePrimitiveArrayCritical(plaintext, plaintext_ptr, JNI_ABORT);
+    }
+    if (!pinned) {
+      if (!env->ExceptionCheck()) {
+        jni_throw(env, "HostEncryptBatch: JNI failed to get byte array.");
+      }
+      return;
+    }
+
+    env->DeleteLocalRef(plaintext);
+    env->DeleteLocalRef(ciphertext);
+  }
+}
+
+/**
+ * Decrypt and verify each ciphertext, whose MAC must also cover the additional authenticated data
+ * `aad`, into the plaintext array of the same index, which must be exactly large enough. Throws an
+ * OpaqueException if any buffer fails authentication.
+ */
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostDecryptBatch(
+  JNIEnv *env, jobject obj, jbyteArray key, jbyteArray aad, jobjectArray ciphertexts,
+  jobjectArray plaintexts) {
+  (void)obj;
+
+  std::unique_ptr<HostGcmKey> host_key = expand_host_gcm_key(env, key);
+  if (!host_key) {
+    return;
+  }
+  const GcmKey *gcm_key = &host_key->gcm_key;
+  const std::vector<uint8_t> aad_bytes = get_aad(env, aad);
+  jsize n = env->GetArrayLength(ciphertexts);
+  if (env->GetArrayLength(plaintexts) != n) {
+    jni_throw(env, "HostDecryptBatch: mismatched batch sizes");
+    return;
+  }
+
+  for (jsize i = 0; i < n; i++) {
+    jbyteArray ciphertext = (jbyteArray) env->GetObjectArrayElement(ciphertexts, i);
+    jbyteArray plaintext = (jbyteArray) env->GetObjectArrayElement(plaintexts, i);
+    jsize clength = env->GetArrayLength(ciphertext);
+    jsize plength = env->GetArrayLength(plaintext);
+    if (clength < SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE
+        || plength != clength - SGX_AESGCM_IV_SIZE - SGX_AESGCM_MAC_SIZE) {
+      jni_throw(env, std::string("HostDecryptBatch: wrong output size for buffer ")
+                + std::to_string(i));
+      return;
+    }
+
+    // No other JNI calls may be made while the arrays are pinned
+    uint8_t *ciphertext_ptr = (uint8_t *) env->GetPrimitiveArrayCritical(ciphertext, nullptr);
+    uint8_t *plaintext_ptr = (uint8_t *) env->GetPrimitiveArrayCritical(plaintext, nullptr);
+    bool pinned = plaintext_ptr != nullptr && ciphertext_ptr != nullptr;
+    bool valid = false;
+    if (pinned) {
+      const uint8_t *mac_ptr = ciphertext_ptr + SGX_AESGCM_IV_SIZE + plength;
+      AesGcm decipher(gcm_key, ciphertext_ptr, SGX_AESGCM_IV_SIZE);
+      if (!aad_bytes.empty()) {
+        decipher.aad(aad_bytes.data(), aad_bytes.size());
+      }
+      decipher.decrypt(ciphertext_ptr + SGX_AESGCM_IV_SIZE, plength, plaintext_ptr, plength);
+      valid = memcmp(mac_ptr, decipher.tag().t, SGX_AESGCM_MAC_SIZE) == 0;
+      secure_zero(&decipher.gctx, sizeof(decipher.gctx));
+      if (!valid) {
+        // Do not release unauthenticated plaintext to the caller
+        memset(plaintext_ptr, 0, plength);
+      }
+    }
+    if (plaintext_ptr != nullptr) {
+      env->ReleasePrimitiveArrayCritical(plaintext, plaintext_ptr, 0);
+    }
+    if (ciphertext_ptr != nullptr) {
+      env->ReleasePrimitiveArrayCritical(ciphertext, ciphertext_ptr, JNI_ABORT);
+    }
+    if (!pinned) {
+      if (!env->ExceptionCheck()) {
+        jni_throw(env, "HostDecryptBatch: JNI failed to get byte array.");
+      }
+      return;
+    }
+    if (!valid) {
+      jni_throw(env, std::string("HostDecryptBatch: invalid MAC for buffer ")
+                + std::to_string(i));
+      return;
+    }
+
+    env->DeleteLocalRef(ciphertext);
+    env->DeleteLocalRef(plaintext);
+  }
+}
+
 JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sample(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray input_rows) {
   (void)obj;
@@ -642,6 +930,105 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   return ret;
 }
 
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_MergeSortedRuns(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_runs) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_runs_length = static_cast<size_t>(env->GetArrayLength(input_runs));
+  uint8_t *input_runs_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_runs, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_runs_ptr == nullptr) {
+    ocall_throw("MergeSortedRuns: JNI failed to get input byte array.");
+  } else {
+    sgx_check_and_time("Merge Sorted Runs",
+                       ecall_merge_sorted_runs(eid,
+                                               sort_order_ptr, sort_order_length,
+                                               input_runs_ptr, input_runs_length,
+                                               &output_rows, &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_runs, reinterpret_cast<jbyte *>(input_runs_ptr), 0);
+
+  return ret;
+}
+
+/**
+ * Return the output of a testing entry point as a scala.Tuple2 of the output rows and the given
+ * count, which is boxed as a java.lang.Integer.
+ */
+static jobject rows_and_count(JNIEnv *env, jbyteArray rows, uint32_t count) {
+  jclass integer_class = env->FindClass("java/lang/Integer");
+  jobject boxed_count = env->CallStaticObjectMethod(
+    integer_class,
+    env->GetStaticMethodID(integer_class, "valueOf", "(I)Ljava/lang/Integer;"),
+    static_cast<jint>(count));
+
+  jclass tuple2_class = env->FindClass("scala/Tuple2");
+  return env->NewObject(
+    tuple2_class,
+    env->GetMethodID(tuple2_class, "<init>", "(Ljava/lang/Object;Ljava/lang/Object;)V"),
+    rows, boxed_count);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestExternalSort(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_rows,
+  jint max_num_streams) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+  uint32_t num_intermediate_passes = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("TestExternalSort: JNI failed to get input byte array.");
+  } else {
+    sgx_check("Test External Sort",
+              ecall_test_external_sort(eid,
+                                       sort_order_ptr, sort_order_length,
+                                       input_rows_ptr, input_rows_length,
+                                       static_cast<uint32_t>(max_num_streams),
+                                       &output_rows, &output_rows_length,
+                                       &num_intermediate_passes));
+  }
+
+  jbyteArray output_rows_array = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(
+    output_rows_array, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return rows_and_count(env, output_rows_array, num_intermediate_passes);
+}
+
 JNIEXPORT jbyteArray JNICALL
 Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectLastPrimary(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows) {
@@ -723,7 +1110,142 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoin(
 }
 
 JNIEXPORT jobject JNICALL
-Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep1(
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestSortMergeJoin(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows,
+  jbyteArray join_row, jlong max_group_cache_size) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  size_t join_row_length = static_cast<size_t>(env->GetArrayLength(join_row));
+  uint8_t *join_row_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_row, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+  uint32_t num_spilled_groups = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("TestSortMergeJoin: JNI failed to get input byte array.");
+  } else {
+    sgx_check("Test Sort-Merge Join",
+              ecall_test_sort_merge_join(eid,
+                                         join_expr_ptr, join_expr_length,
+                                         input_rows_ptr, input_rows_length,
+                                         join_row_ptr, join_row_length,
+                                         static_cast<size_t>(max_group_cache_size),
+                                         &output_rows, &output_rows_length,
+                                         &num_spilled_groups));
+  }
+
+  jbyteArray output_rows_array = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(
+    output_rows_array, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+  env->ReleaseByteArrayElements(join_row, reinterpret_cast<jbyte *>(join_row_ptr), 0);
+
+  return rows_and_count(env, output_rows_array, num_spilled_groups);
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousHashJoin(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray primary_rows,
+  jbyteArray foreign_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t join_expr_length = (uint32_t) env->GetArrayLength(join_expr);
+  uint8_t *join_expr_ptr = (uint8_t *) env->GetByteArrayElements(join_expr, &if_copy);
+
+  uint32_t primary_rows_length = (uint32_t) env->GetArrayLength(primary_rows);
+  uint8_t *primary_rows_ptr = (uint8_t *) env->GetByteArrayElements(primary_rows, &if_copy);
+
+  uint32_t foreign_rows_length = (uint32_t) env->GetArrayLength(foreign_rows);
+  uint8_t *foreign_rows_ptr = (uint8_t *) env->GetByteArrayElements(foreign_rows, &if_copy);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (primary_rows_ptr == nullptr || foreign_rows_ptr == nullptr) {
+    ocall_throw("NonObliviousHashJoin: JNI failed to get input byte array.");
+  } else {
+    sgx_check_and_time("Non-Oblivious Hash Join",
+                       ecall_non_oblivious_hash_join(
+                         eid,
+                         join_expr_ptr, join_expr_length,
+                         primary_rows_ptr, primary_rows_length,
+                         foreign_rows_ptr, foreign_rows_length,
+                         &output_rows, &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, (jbyte *) join_expr_ptr, 0);
+  env->ReleaseByteArrayElements(primary_rows, (jbyte *) primary_rows_ptr, 0);
+  env->ReleaseByteArrayElements(foreign_rows, (jbyte *) foreign_rows_ptr, 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastHashJoin(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray build_rows,
+  jbyteArray stream_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t join_expr_length = (uint32_t) env->GetArrayLength(join_expr);
+  uint8_t *join_expr_ptr = (uint8_t *) env->GetByteArrayElements(join_expr, &if_copy);
+
+  uint32_t build_rows_length = (uint32_t) env->GetArrayLength(build_rows);
+  uint8_t *build_rows_ptr = (uint8_t *) env->GetByteArrayElements(build_rows, &if_copy);
+
+  uint32_t stream_rows_length = (uint32_t) env->GetArrayLength(stream_rows);
+  uint8_t *stream_rows_ptr = (uint8_t *) env->GetByteArrayElements(stream_rows, &if_copy);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (build_rows_ptr == nullptr || stream_rows_ptr == nullptr) {
+    ocall_throw("BroadcastHashJoin: JNI failed to get input byte array.");
+  } else {
+    sgx_check_and_time("Broadcast Hash Join",
+                       ecall_broadcast_hash_join(
+                         eid,
+                         join_expr_ptr, join_expr_length,
+                         build_rows_ptr, build_rows_length,
+                         stream_rows_ptr, stream_rows_length,
+                         &output_rows, &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, (jbyte *) join_expr_ptr, 0);
+  env->ReleaseByteArrayElements(build_rows, (jbyte *) build_rows_ptr, 0);
+  env->ReleaseByteArrayElements(stream_rows, (jbyte *) stream_rows_ptr, 0);
+
+  return ret;
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregate(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
   (void)obj;
 
@@ -735,112 +1257,162 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep1
   uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
   uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
 
-  uint8_t *first_row = nullptr;
-  size_t first_row_length = 0;
-
-  uint8_t *last_group = nullptr;
-  size_t last_group_length = 0;
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
 
-  uint8_t *last_row = nullptr;
-  size_t last_row_length = 0;
+  uint8_t *boundary_partials = nullptr;
+  size_t boundary_partials_length = 0;
 
   if (input_rows_ptr == nullptr) {
-    ocall_throw("NonObliviousAggregateStep1: JNI failed to get input byte array.");
+    ocall_throw("NonObliviousAggregate: JNI failed to get input byte array.");
   } else {
-    sgx_check_and_time("Non-Oblivious Aggregate Step 1",
-                       ecall_non_oblivious_aggregate_step1(
+    sgx_check_and_time("Non-Oblivious Aggregate",
+                       ecall_non_oblivious_aggregate(
                          eid,
                          agg_op_ptr, agg_op_length,
                          input_rows_ptr, input_rows_length,
-                         &first_row, &first_row_length,
-                         &last_group, &last_group_length,
-                         &last_row, &last_row_length));
+                         &output_rows, &output_rows_length,
+                         &boundary_partials, &boundary_partials_length));
   }
 
-  jbyteArray first_row_array = env->NewByteArray(first_row_length);
-  env->SetByteArrayRegion(first_row_array, 0, first_row_length, (jbyte *) first_row);
-  free(first_row);
-
-  jbyteArray last_group_array = env->NewByteArray(last_group_length);
-  env->SetByteArrayRegion(last_group_array, 0, last_group_length, (jbyte *) last_group);
-  free(last_group);
+  jbyteArray output_rows_array = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(output_rows_array, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
 
-  jbyteArray last_row_array = env->NewByteArray(last_row_length);
-  env->SetByteArrayRegion(last_row_array, 0, last_row_length, (jbyte *) last_row);
-  free(last_row);
+  jbyteArray boundary_partials_array = env->NewByteArray(boundary_partials_length);
+  env->SetByteArrayRegion(
+    boundary_partials_array, 0, boundary_partials_length, (jbyte *) boundary_partials);
+  free(boundary_partials);
 
   env->ReleaseByteArrayElements(agg_op, (jbyte *) agg_op_ptr, 0);
   env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
 
-  jclass tuple3_class = env->FindClass("scala/Tuple3");
+  jclass tuple2_class = env->FindClass("scala/Tuple2");
   jobject ret = env->NewObject(
-    tuple3_class,
-    env->GetMethodID(tuple3_class, "<init>",
-                     "(Ljava/lang/Object;Ljava/lang/Object;Ljava/lang/Object;)V"),
-    first_row_array, last_group_array, last_row_array);
+    tuple2_class,
+    env->GetMethodID(tuple2_class, "<init>", "(Ljava/lang/Object;Ljava/lang/Object;)V"),
+    output_rows_array, boundary_partials_array);
 
   return ret;
 }
 
 JNIEXPORT jbyteArray JNICALL
-Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep2(
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousHashAggregate(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t agg_op_length = static_cast<size_t>(env->GetArrayLength(agg_op));
+  uint8_t *agg_op_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(agg_op, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("NonObliviousHashAggregate: JNI failed to get input byte array.");
+  } else {
+    sgx_check_and_time("Non-Oblivious Hash Aggregate",
+                       ecall_non_oblivious_hash_aggregate(
+                         eid,
+                         agg_op_ptr, agg_op_length,
+                         input_rows_ptr, input_rows_length,
+                         &output_rows, &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, reinterpret_cast<jbyte *>(agg_op_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestHashAggregate(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows,
-  jbyteArray next_partition_first_row, jbyteArray prev_partition_last_group,
-  jbyteArray prev_partition_last_row) {
+  jlong max_table_size) {
   (void)obj;
 
   jboolean if_copy;
 
-  uint32_t agg_op_length = (uint32_t) env->GetArrayLength(agg_op);
-  uint8_t *agg_op_ptr = (uint8_t *) env->GetByteArrayElements(agg_op, &if_copy);
+  size_t agg_op_length = static_cast<size_t>(env->GetArrayLength(agg_op));
+  uint8_t *agg_op_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(agg_op, &if_copy));
 
-  uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
-  uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+  uint32_t spill_depth = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("TestHashAggregate: JNI failed to get input byte array.");
+  } else {
+    sgx_check("Test Hash Aggregate",
+              ecall_test_hash_aggregate(eid,
+                                        agg_op_ptr, agg_op_length,
+                                        input_rows_ptr, input_rows_length,
+                                        static_cast<size_t>(max_table_size),
+                                        &output_rows, &output_rows_length,
+                                        &spill_depth));
+  }
+
+  jbyteArray output_rows_array = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(
+    output_rows_array, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, reinterpret_cast<jbyte *>(agg_op_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return rows_and_count(env, output_rows_array, spill_depth);
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousPartialAggregate(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
+  (void)obj;
 
-  uint32_t next_partition_first_row_length =
-    (uint32_t) env->GetArrayLength(next_partition_first_row);
-  uint8_t *next_partition_first_row_ptr =
-    (uint8_t *) env->GetByteArrayElements(next_partition_first_row, &if_copy);
+  jboolean if_copy;
 
-  uint32_t prev_partition_last_group_length =
-    (uint32_t) env->GetArrayLength(prev_partition_last_group);
-  uint8_t *prev_partition_last_group_ptr =
-    (uint8_t *) env->GetByteArrayElements(prev_partition_last_group, &if_copy);
+  size_t agg_op_length = static_cast<size_t>(env->GetArrayLength(agg_op));
+  uint8_t *agg_op_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(agg_op, &if_copy));
 
-  uint32_t prev_partition_last_row_length =
-    (uint32_t) env->GetArrayLength(prev_partition_last_row);
-  uint8_t *prev_partition_last_row_ptr =
-    (uint8_t *) env->GetByteArrayElements(prev_partition_last_row, &if_copy);
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
 
   uint8_t *output_rows = nullptr;
   size_t output_rows_length = 0;
 
   if (input_rows_ptr == nullptr) {
-    ocall_throw("NonObliviousAggregateStep2: JNI failed to get input byte array.");
+    ocall_throw("NonObliviousPartialAggregate: JNI failed to get input byte array.");
   } else {
-    sgx_check_and_time("Non-Oblivious Aggregate Step 2",
-                       ecall_non_oblivious_aggregate_step2(
+    sgx_check_and_time("Non-Oblivious Partial Aggregate",
+                       ecall_non_oblivious_partial_aggregate(
                          eid,
                          agg_op_ptr, agg_op_length,
                          input_rows_ptr, input_rows_length,
-                         next_partition_first_row_ptr, next_partition_first_row_length,
-                         prev_partition_last_group_ptr, prev_partition_last_group_length,
-                         prev_partition_last_row_ptr, prev_partition_last_row_length,
                          &output_rows, &output_rows_length));
   }
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
-  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
   free(output_rows);
 
-  env->ReleaseByteArrayElements(agg_op, (jbyte *) agg_op_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
-  env->ReleaseByteArrayElements(
-    next_partition_first_row, (jbyte *) next_partition_first_row_ptr, 0);
-  env->ReleaseByteArrayElements(
-    prev_partition_last_group, (jbyte *) prev_partition_last_group_ptr, 0);
-  env->ReleaseByteArrayElements(
-    prev_partition_last_row, (jbyte *) prev_partition_last_row_ptr, 0);
+  env->ReleaseByteArrayElements(agg_op, reinterpret_cast<jbyte *>(agg_op_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
 
   return ret;
 }
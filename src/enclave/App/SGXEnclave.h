@@ -18,11 +18,21 @@ extern "C" {
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Encrypt(
-    JNIEnv *, jobject, jlong, jbyteArray);
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Decrypt(
     JNIEnv *, jobject, jlong, jbyteArray);
 
+  JNIEXPORT jboolean JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostAesGcmSupported(
+    JNIEnv *, jobject);
+
+  JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostEncryptBatch(
+    JNIEnv *, jobject, jbyteArray, jbyteArray, jbyteArray, jobjectArray, jobjectArray);
+
+  JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostDecryptBatch(
+    JNIEnv *, jobject, jbyteArray, jbyteArray, jobjectArray, jobjectArray);
+
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sample(
     JNIEnv *, jobject, jlong, jbyteArray);
 
@@ -37,6 +47,14 @@ extern "C" {
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalSort(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_MergeSortedRuns(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jobject JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestExternalSort(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jint);
+
   JNIEXPORT jbyteArray JNICALL
   Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectLastPrimary(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
@@ -46,12 +64,32 @@ extern "C" {
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray);
 
   JNIEXPORT jobject JNICALL
-  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep1(
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestSortMergeJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray, jlong);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousHashJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastHashJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray);
+
+  JNIEXPORT jobject JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregate(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL
-  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep2(
-    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray, jbyteArray, jbyteArray);
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousHashAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jobject JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TestHashAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jlong);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousPartialAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_RemoteAttestation0(
     JNIEnv *, jobject, jlong);
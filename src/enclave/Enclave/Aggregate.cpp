@@ -1,120 +1,292 @@
 #include "Aggregate.h"
 
+#include <memory>
+
 #include "ExpressionEvaluation.h"
 #include "FlatbuffersReaders.h"
 #include "FlatbuffersWriters.h"
+#include "HashTable.h"
 #include "common.h"
 
-void non_oblivious_aggregate_step1(
+void non_oblivious_aggregate(
   uint8_t *agg_op, size_t agg_op_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t **first_row, size_t *first_row_length,
-  uint8_t **last_group, size_t *last_group_length,
-  uint8_t **last_row, size_t *last_row_length) {
+  uint8_t **output_rows, size_t *output_rows_length,
+  uint8_t **boundary_partials, size_t *boundary_partials_length) {
 
   FlatbuffersAggOpEvaluator agg_op_eval(agg_op, agg_op_length);
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
-  RowWriter first_row_writer;
-  RowWriter last_group_writer;
-  RowWriter last_row_writer;
+  r.enable_prefetch();
+  RowWriter w;
+  RowWriter boundary_writer;
 
   FlatbuffersTemporaryRow prev, cur;
+  bool in_first_group = true;
   while (r.has_next()) {
     prev.set(cur.get());
     cur.set(r.next());
 
-    if (prev.get() == nullptr) {
-      first_row_writer.append(cur.get());
+    if (prev.get() != nullptr && !agg_op_eval.is_same_group(prev.get(), cur.get())) {
+      if (in_first_group) {
+        // The first group may have started in the previous partition
+        boundary_writer.append(agg_op_eval.group_values(prev.get()), agg_op_eval.get_partial_agg());
+        in_first_group = false;
+      } else {
+        w.append(agg_op_eval.evaluate());
+      }
+      agg_op_eval.reset_group();
     }
+    agg_op_eval.aggregate(cur.get());
+  }
+
+  if (cur.get() != nullptr) {
+    // The last group may continue in the next partition
+    boundary_writer.append(agg_op_eval.group_values(cur.get()), agg_op_eval.get_partial_agg());
+  }
 
-    if (!r.has_next()) {
-      last_row_writer.append(cur.get());
+  w.output_buffer(output_rows, output_rows_length);
+  boundary_writer.output_buffer(boundary_partials, boundary_partials_length);
+}
+
+static const uint32_t NO_GROUP = UINT32_MAX;
+
+/**
+ * The partial aggregates of a set of groups, keyed by normalized grouping key.
+ *
+ * When the aggregates have native accumulators, each group's aggregation buffer is held in typed
+ * form by the FlatbuffersAggOpEvaluator itself, and moving between groups only selects another
+ * slot. Otherwise the evaluator holds the partial aggregate of one group at a time; the others are
+ * stored as finished flatbuffers and reloaded with set() when their group is next updated, so
+ * consecutive rows of the same group are aggregated without saving and reloading.
+ */
+class GroupTable {
+public:
+  GroupTable(FlatbuffersAggOpEvaluator &agg_op_eval)
+    : agg_op_eval(agg_op_eval), typed(agg_op_eval.has_group_slots()), groups(), group_slots(),
+      partials(), partials_size(0), group_values(), partial_builder(), current(NO_GROUP) {}
+
+  /** Load the partial aggregate of the group with the given key, returning false if it is absent. */
+  bool load(const std::vector<uint8_t> &key) {
+    const uint32_t *group = groups.find(key.data(), key.size());
+    if (group == nullptr) {
+      return false;
     }
+    if (*group != current) {
+      save_current();
+      current = *group;
+      if (typed) {
+        agg_op_eval.select_group(group_slots[current]);
+      } else {
+        agg_op_eval.set(flatbuffers::GetRoot<tuix::Row>(partials[current].data()));
+      }
+    }
+    return true;
+  }
 
-    if (prev.get() != nullptr && !agg_op_eval.is_same_group(prev.get(), cur.get())) {
+  /** Add a group for the given key, to which `row` belongs, and load its initial values. */
+  void insert(const std::vector<uint8_t> &key, const tuix::Row *row) {
+    save_current();
+    bool inserted;
+    current = groups.insert(key.data(), key.size(), num_groups(), &inserted);
+    group_values.append(agg_op_eval.group_values(row));
+    if (typed) {
+      group_slots.push_back(agg_op_eval.add_group());
+    } else {
+      partials.emplace_back();
       agg_op_eval.reset_group();
     }
-    agg_op_eval.aggregate(cur.get());
   }
-  last_group_writer.append(agg_op_eval.get_partial_agg());
 
-  first_row_writer.output_buffer(first_row, first_row_length);
-  last_group_writer.output_buffer(last_group, last_group_length);
-  last_row_writer.output_buffer(last_row, last_row_length);
+  /** The number of bytes of enclave memory held by the table. */
+  size_t memory_usage() const {
+    size_t result = groups.memory_usage() + group_values.size();
+    if (typed) {
+      result += agg_op_eval.groups_memory_usage() + group_slots.size() * sizeof(uint32_t);
+    } else {
+      result += partials_size;
+    }
+    return result;
+  }
+
+  uint32_t num_groups() const {
+    return group_values.num_rows();
+  }
+
+  /**
+   * Load each group's partial aggregate in turn, in insertion order, and call f on a Row of the
+   * group's grouping values.
+   */
+  template<typename F>
+  void for_each(F f) {
+    save_current();
+    current = NO_GROUP;
+    for (uint32_t i = 0; i < num_groups(); i++) {
+      if (typed) {
+        agg_op_eval.select_group(group_slots[i]);
+      } else {
+        agg_op_eval.set(flatbuffers::GetRoot<tuix::Row>(partials[i].data()));
+      }
+      f(group_values.get(i));
+    }
+  }
+
+  void clear() {
+    groups.clear();
+    std::vector<uint32_t>().swap(group_slots);
+    std::vector<std::vector<uint8_t>>().swap(partials);
+    partials_size = 0;
+    group_values.clear();
+    if (typed) {
+      agg_op_eval.clear_groups();
+    }
+    current = NO_GROUP;
+  }
+
+private:
+  void save_current() {
+    // Typed aggregation buffers are updated in place
+    if (typed || current == NO_GROUP) return;
+    partial_builder.Clear();
+    partial_builder.Finish(flatbuffers_copy(agg_op_eval.get_partial_agg(), partial_builder));
+    std::vector<uint8_t> &partial = partials[current];
+    partials_size -= partial.size();
+    partial.assign(partial_builder.GetBufferPointer(),
+                   partial_builder.GetBufferPointer() + partial_builder.GetSize());
+    partials_size += partial.size();
+  }
+
+  FlatbuffersAggOpEvaluator &agg_op_eval;
+  const bool typed;
+  ByteKeyHashTable groups;
+  // With typed aggregation buffers, the evaluator's slot for each group, indexed by the group's
+  // value in `groups`
+  std::vector<uint32_t> group_slots;
+  // Otherwise, the partial aggregate of each group
+  std::vector<std::vector<uint8_t>> partials;
+  size_t partials_size;
+  RowArena group_values;
+  flatbuffers::FlatBufferBuilder partial_builder;
+  uint32_t current;
+};
+
+/**
+ * Aggregate the rows from `r` into `w` using a GroupTable. Once the table exceeds
+ * `max_table_size` bytes, rows of groups that are not already in it are spilled to
+ * HASH_AGGREGATE_SPILL_FANOUT encrypted partitions by a hash of their key, while rows of resident
+ * groups continue to be aggregated in place. Each spilled partition therefore holds complete groups
+ * disjoint from the resident ones and is aggregated by a recursive call after the resident groups
+ * have been written out and freed. The deepest `depth` reached is recorded in `spill_depth` if it
+ * is given.
+ */
+static void hash_aggregate(
+  FlatbuffersAggOpEvaluator &agg_op_eval, RowReader &r, uint32_t depth, size_t max_table_size,
+  uint32_t *spill_depth, RowWriter &w) {
+
+  if (spill_depth != nullptr && depth > *spill_depth) {
+    *spill_depth = depth;
+  }
+
+  GroupTable table(agg_op_eval);
+  std::vector<std::unique_ptr<RowWriter>> spills;
+
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    key.clear();
+    agg_op_eval.append_group_key(row, key);
+
+    if (!table.load(key)) {
+      if (depth < MAX_HASH_AGGREGATE_SPILL_DEPTH
+          && table.memory_usage() > max_table_size) {
+        if (spills.empty()) {
+          for (uint32_t i = 0; i < HASH_AGGREGATE_SPILL_FANOUT; i++) {
+            spills.emplace_back(std::unique_ptr<RowWriter>(new RowWriter));
+          }
+        }
+        uint64_t h = ByteKeyHashTable::hash(key.data(), key.size(), depth + 1);
+        spills[h % HASH_AGGREGATE_SPILL_FANOUT]->append(row);
+        continue;
+      }
+      table.insert(key, row);
+    }
+
+    agg_op_eval.aggregate(row);
+  }
+
+  table.for_each([&](const tuix::Row *) {
+      w.append(agg_op_eval.evaluate());
+    });
+
+  // Free the resident groups before aggregating the spilled ones
+  table.clear();
+
+  for (auto it = spills.begin(); it != spills.end(); ++it) {
+    if ((*it)->num_rows() == 0) continue;
+    UntrustedBufferRef<tuix::EncryptedBlocks> spilled = (*it)->output_buffer();
+    it->reset();
+    RowReader spill_reader(spilled.view());
+    hash_aggregate(agg_op_eval, spill_reader, depth + 1, max_table_size, spill_depth, w);
+  }
 }
 
-void non_oblivious_aggregate_step2(
+void non_oblivious_hash_aggregate(
   uint8_t *agg_op, size_t agg_op_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t *next_partition_first_row, size_t next_partition_first_row_length,
-  uint8_t *prev_partition_last_group, size_t prev_partition_last_group_length,
-  uint8_t *prev_partition_last_row, size_t prev_partition_last_row_length,
-  uint8_t **output_rows, size_t *output_rows_length) {
+  uint8_t **output_rows, size_t *output_rows_length,
+  size_t max_table_size, uint32_t *spill_depth) {
 
   FlatbuffersAggOpEvaluator agg_op_eval(agg_op, agg_op_length);
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
-  RowReader next_partition_first_row_reader(
-    BufferRefView<tuix::EncryptedBlocks>(
-      next_partition_first_row, next_partition_first_row_length));
-  RowReader prev_partition_last_group_reader(
-    BufferRefView<tuix::EncryptedBlocks>(
-      prev_partition_last_group, prev_partition_last_group_length));
-  RowReader prev_partition_last_row_reader(
-    BufferRefView<tuix::EncryptedBlocks>(
-      prev_partition_last_row, prev_partition_last_row_length));
+  r.enable_prefetch();
   RowWriter w;
 
-  if (next_partition_first_row_reader.num_rows() > 1) {
-      throw std::runtime_error(
-          std::string("Incorrect number of starting rows from next partition passed: expected 0 or 1, got ")
-          + std::to_string(next_partition_first_row_reader.num_rows()));
-  }
-  if (prev_partition_last_group_reader.num_rows() > 1) {
-      throw std::runtime_error(
-          std::string("Incorrect number of ending groups from prev partition passed: expected 0 or 1, got ")
-          + std::to_string(prev_partition_last_group_reader.num_rows()));
-  }
-  if (prev_partition_last_row_reader.num_rows() > 1) {
-      throw std::runtime_error(
-          std::string("Incorrect number of ending rows from prev partition passed: expected 0 or 1, got ")
-          + std::to_string(prev_partition_last_row_reader.num_rows()));
-  }
+  hash_aggregate(agg_op_eval, r, 0, max_table_size, spill_depth, w);
 
-  const tuix::Row *next_partition_first_row_ptr =
-    next_partition_first_row_reader.has_next() ? next_partition_first_row_reader.next() : nullptr;
-  agg_op_eval.set(prev_partition_last_group_reader.has_next() ?
-                  prev_partition_last_group_reader.next() : nullptr);
-  const tuix::Row *prev_partition_last_row_ptr =
-    prev_partition_last_row_reader.has_next() ? prev_partition_last_row_reader.next() : nullptr;
-
-  FlatbuffersTemporaryRow prev, cur(prev_partition_last_row_ptr), next;
-  bool stop = false;
-  if (r.has_next()) {
-    next.set(r.next());
-  } else {
-    stop = true;
+  if (agg_op_eval.is_global() && w.num_rows() == 0) {
+    // The single group of a global aggregate exists even without input rows
+    agg_op_eval.reset_group();
+    w.append(agg_op_eval.evaluate());
   }
-  while (!stop) {
-    // Populate prev, cur, next to enable lookbehind and lookahead
-    prev.set(cur.get());
-    cur.set(next.get());
-    if (r.has_next()) {
-      next.set(r.next());
-    } else {
-      next.set(next_partition_first_row_ptr);
-      stop = true;
-    }
 
-    if (prev.get() != nullptr && !agg_op_eval.is_same_group(prev.get(), cur.get())) {
-      agg_op_eval.reset_group();
-    }
-    agg_op_eval.aggregate(cur.get());
+  w.output_buffer(output_rows, output_rows_length);
+}
 
-    // Output the current aggregate if it is the last aggregate for its run
-    if (next.get() == nullptr || !agg_op_eval.is_same_group(cur.get(), next.get())) {
-      w.append(agg_op_eval.evaluate());
+void non_oblivious_partial_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersAggOpEvaluator agg_op_eval(agg_op, agg_op_length);
+  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  r.enable_prefetch();
+  RowWriter w;
+
+  GroupTable table(agg_op_eval);
+  auto flush = [&]() {
+    table.for_each([&](const tuix::Row *group_values) {
+        w.append(group_values, agg_op_eval.get_partial_agg());
+      });
+    table.clear();
+  };
+
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    key.clear();
+    agg_op_eval.append_group_key(row, key);
+
+    if (!table.load(key)) {
+      // Partial aggregates are merged after the shuffle, so rather than spilling, emit the
+      // resident groups early and start over when the table is full
+      if (table.memory_usage() > MAX_HASH_AGGREGATE_TABLE_SIZE) {
+        flush();
+      }
+      table.insert(key, row);
     }
+
+    agg_op_eval.aggregate(row);
   }
+  flush();
 
   w.output_buffer(output_rows, output_rows_length);
 }
@@ -1,22 +1,54 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "define.h"
+
 #ifndef AGGREGATE_H
 #define AGGREGATE_H
 
-void non_oblivious_aggregate_step1(
+/**
+ * Aggregate the given rows, which must be sorted by group, in a single pass. Groups that lie
+ * entirely within the input are evaluated and written to `output_rows`. The first and last groups
+ * may continue in the neighboring partitions, so their partial aggregates are instead written to
+ * `boundary_partials`, in the format of non_oblivious_partial_aggregate, to be merged with those
+ * of the other partitions.
+ */
+void non_oblivious_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length,
+  uint8_t **boundary_partials, size_t *boundary_partials_length);
+
+/**
+ * Aggregate the given rows by hashing their grouping keys rather than sorting them. All rows of a
+ * group must be in `input_rows`, which need not be in any particular order; one output row is
+ * written per group, in unspecified order. Groups that do not fit in the enclave's memory budget
+ * are spilled to encrypted partitions in untrusted memory and aggregated recursively.
+ *
+ * The budget is max_table_size bytes. Only tests pass a smaller value, so that small inputs spill;
+ * the deepest level of recursion that aggregated spilled rows is then stored in spill_depth if it
+ * is given.
+ *
+ * As in Spark, an aggregate without grouping expressions has a single group even if the input is
+ * empty, in which case its output row holds the result of the initial aggregation buffer.
+ */
+void non_oblivious_hash_aggregate(
   uint8_t *agg_op, size_t agg_op_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t **first_row, size_t *first_row_length,
-  uint8_t **last_group, size_t *last_group_length,
-  uint8_t **last_row, size_t *last_row_length);
+  uint8_t **output_rows, size_t *output_rows_length,
+  size_t max_table_size = MAX_HASH_AGGREGATE_TABLE_SIZE,
+  uint32_t *spill_depth = nullptr);
 
-void non_oblivious_aggregate_step2(
+/**
+ * Aggregate the given rows by hashing their grouping keys, but instead of evaluating each group's
+ * aggregate, write one partial row per group holding the values of the grouping expressions
+ * followed by the group's aggregation buffer. Unlike non_oblivious_hash_aggregate, the input need
+ * not contain all rows of a group, and a group may be written more than once; the partial rows
+ * are combined after a shuffle by hash-aggregating them with the merge AggregateOp.
+ */
+void non_oblivious_partial_aggregate(
   uint8_t *agg_op, size_t agg_op_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t *next_partition_first_row, size_t next_partition_first_row_length,
-  uint8_t *prev_partition_last_group, size_t prev_partition_last_group_length,
-  uint8_t *prev_partition_last_row, size_t prev_partition_last_row_length,
   uint8_t **output_rows, size_t *output_rows_length);
 
 #endif // AGGREGATE_H
@@ -0,0 +1,254 @@
+#include "BlockStats.h"
+
+#include "ExpressionEvaluation.h"
+
+namespace {
+
+/** Whether fields of the given type have a sort key encoding (see encode_field). */
+bool is_orderable(tuix::FieldUnion type) {
+  switch (type) {
+  case tuix::FieldUnion_BooleanField:
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_LongField:
+  case tuix::FieldUnion_FloatField:
+  case tuix::FieldUnion_DoubleField:
+  case tuix::FieldUnion_StringField:
+  case tuix::FieldUnion_DateField:
+  case tuix::FieldUnion_TimestampField:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** The smallest and largest values seen so far in one column. */
+struct ColumnExtremes {
+  ColumnExtremes()
+    : type(tuix::FieldUnion_NONE), ordered(true), min(nullptr), max(nullptr), null_count(0) {}
+
+  tuix::FieldUnion type;
+  bool ordered;
+  const tuix::Field *min;
+  const tuix::Field *max;
+  std::vector<uint8_t> min_key;
+  std::vector<uint8_t> max_key;
+  uint32_t null_count;
+};
+
+/** Swap the operands of a comparison, so that `a op b` is equivalent to `b flip(op) a`. */
+tuix::ExprUnion flip(tuix::ExprUnion expr_type) {
+  switch (expr_type) {
+  case tuix::ExprUnion_LessThan: return tuix::ExprUnion_GreaterThan;
+  case tuix::ExprUnion_LessThanOrEqual: return tuix::ExprUnion_GreaterThanOrEqual;
+  case tuix::ExprUnion_GreaterThan: return tuix::ExprUnion_LessThan;
+  case tuix::ExprUnion_GreaterThanOrEqual: return tuix::ExprUnion_LessThanOrEqual;
+  default: return expr_type;
+  }
+}
+
+}
+
+bool write_block_stats(const tuix::Rows *rows, const std::vector<uint8_t> &block_tag,
+                       flatbuffers::FlatBufferBuilder &builder) {
+  const uint32_t num_rows = rows->rows()->size();
+  if (num_rows == 0) {
+    return false;
+  }
+
+  const uint32_t num_cols = rows->rows()->Get(0)->field_values()->size();
+  std::vector<ColumnExtremes> columns(num_cols);
+  std::vector<uint8_t> key;
+  for (auto it = rows->rows()->begin(); it != rows->rows()->end(); ++it) {
+    if (it->is_dummy() || it->field_values()->size() != num_cols) {
+      return false;
+    }
+    for (uint32_t j = 0; j < num_cols; j++) {
+      const tuix::Field *f = it->field_values()->Get(j);
+      ColumnExtremes &c = columns[j];
+      if (c.type == tuix::FieldUnion_NONE) {
+        c.type = f->value_type();
+        c.ordered = is_orderable(c.type);
+      } else if (f->value_type() != c.type) {
+        c.ordered = false;
+      }
+
+      if (f->is_null()) {
+        c.null_count++;
+        continue;
+      }
+      if (!c.ordered) {
+        continue;
+      }
+      key.clear();
+      FlatbuffersSortOrderEvaluator::encode_field(f, key);
+      if (c.min == nullptr || FlatbuffersSortOrderEvaluator::compare_keys(key, c.min_key) < 0) {
+        c.min = f;
+        c.min_key = key;
+      }
+      if (c.max == nullptr || FlatbuffersSortOrderEvaluator::compare_keys(key, c.max_key) > 0) {
+        c.max = f;
+        c.max_key = key;
+      }
+    }
+  }
+
+  std::vector<flatbuffers::Offset<tuix::ColumnStats>> column_stats(num_cols);
+  for (uint32_t j = 0; j < num_cols; j++) {
+    const ColumnExtremes &c = columns[j];
+    flatbuffers::Offset<tuix::Field> min, max;
+    if (c.ordered && c.min != nullptr) {
+      min = flatbuffers_copy(c.min, builder);
+      max = flatbuffers_copy(c.max, builder);
+    }
+    column_stats[j] = tuix::CreateColumnStats(builder, min, max, c.null_count);
+  }
+  builder.Finish(tuix::CreateBlockStatsDirect(builder, &block_tag, num_rows, &column_stats));
+  return true;
+}
+
+std::vector<uint8_t> block_tag(const tuix::EncryptedBlock *block) {
+  if (block->format() == tuix::BlockFormat_ColumnChunks
+      || block->format() == tuix::BlockFormat_RowChunks) {
+    if (block->block_id() == nullptr) {
+      return std::vector<uint8_t>();
+    }
+    return std::vector<uint8_t>(block->block_id()->begin(), block->block_id()->end());
+  }
+  if (block->enc_rows() == nullptr || block->enc_rows()->size() < SGX_AESGCM_MAC_SIZE) {
+    return std::vector<uint8_t>();
+  }
+  return std::vector<uint8_t>(
+    block->enc_rows()->end() - SGX_AESGCM_MAC_SIZE, block->enc_rows()->end());
+}
+
+bool BlockStatsFilter::may_match(const tuix::EncryptedBlock *block) {
+  auto enc_stats = block->enc_stats();
+  if (enc_stats == nullptr) {
+    return true;
+  }
+
+  const size_t stats_len = dec_size(enc_stats->size());
+  stats_buf.reset(new uint8_t[stats_len]);
+  decrypt(enc_stats->data(), enc_stats->size(), stats_buf.get());
+  BufferRefView<tuix::BlockStats> buf(stats_buf.get(), stats_len);
+  buf.verify();
+  const tuix::BlockStats *stats = buf.root();
+
+  std::vector<uint8_t> tag = block_tag(block);
+  if (stats->block_tag() == nullptr || tag.empty() || stats->block_tag()->size() != tag.size()
+      || !std::equal(tag.begin(), tag.end(), stats->block_tag()->begin())
+      || stats->num_rows() != block->num_rows() || stats->columns() == nullptr) {
+    throw std::runtime_error("BlockStats do not belong to their EncryptedBlock");
+  }
+
+  return may_match(condition, stats);
+}
+
+bool BlockStatsFilter::may_match(const tuix::Expr *expr, const tuix::BlockStats *stats) {
+  switch (expr->expr_type()) {
+  case tuix::ExprUnion_And:
+    return may_match(expr->expr_as_And()->left(), stats)
+      && may_match(expr->expr_as_And()->right(), stats);
+  case tuix::ExprUnion_Or:
+    return may_match(expr->expr_as_Or()->left(), stats)
+      || may_match(expr->expr_as_Or()->right(), stats);
+  case tuix::ExprUnion_Literal:
+  {
+    const tuix::Field *value = expr->expr_as_Literal()->value();
+    if (value->value_type() != tuix::FieldUnion_BooleanField) {
+      return true;
+    }
+    return !value->is_null() && value->value_as_BooleanField()->value();
+  }
+  case tuix::ExprUnion_IsNull:
+  {
+    const tuix::Expr *child = expr->expr_as_IsNull()->child();
+    if (child->expr_type() != tuix::ExprUnion_Col
+        || child->expr_as_Col()->col_num() >= stats->columns()->size()) {
+      return true;
+    }
+    return stats->columns()->Get(child->expr_as_Col()->col_num())->null_count() > 0;
+  }
+  case tuix::ExprUnion_Not:
+  {
+    // Spark's IsNotNull is written as Not(IsNull)
+    const tuix::Expr *child = expr->expr_as_Not()->child();
+    if (child->expr_type() != tuix::ExprUnion_IsNull) {
+      return true;
+    }
+    const tuix::Expr *grandchild = child->expr_as_IsNull()->child();
+    if (grandchild->expr_type() != tuix::ExprUnion_Col
+        || grandchild->expr_as_Col()->col_num() >= stats->columns()->size()) {
+      return true;
+    }
+    return stats->columns()->Get(grandchild->expr_as_Col()->col_num())->null_count()
+      < stats->num_rows();
+  }
+  case tuix::ExprUnion_LessThan:
+    return comparison_may_match(
+      expr->expr_type(), expr->expr_as_LessThan()->left(), expr->expr_as_LessThan()->right(),
+      stats);
+  case tuix::ExprUnion_LessThanOrEqual:
+    return comparison_may_match(
+      expr->expr_type(), expr->expr_as_LessThanOrEqual()->left(),
+      expr->expr_as_LessThanOrEqual()->right(), stats);
+  case tuix::ExprUnion_GreaterThan:
+    return comparison_may_match(
+      expr->expr_type(), expr->expr_as_GreaterThan()->left(),
+      expr->expr_as_GreaterThan()->right(), stats);
+  case tuix::ExprUnion_GreaterThanOrEqual:
+    return comparison_may_match(
+      expr->expr_type(), expr->expr_as_GreaterThanOrEqual()->left(),
+      expr->expr_as_GreaterThanOrEqual()->right(), stats);
+  case tuix::ExprUnion_EqualTo:
+    return comparison_may_match(
+      expr->expr_type(), expr->expr_as_EqualTo()->left(), expr->expr_as_EqualTo()->right(),
+      stats);
+  default:
+    return true;
+  }
+}
+
+bool BlockStatsFilter::comparison_may_match(
+  tuix::ExprUnion expr_type, const tuix::Expr *left, const tuix::Expr *right,
+  const tuix::BlockStats *stats) {
+  // Rewrite the comparison as `col op lit`
+  if (left->expr_type() == tuix::ExprUnion_Literal && right->expr_type() == tuix::ExprUnion_Col) {
+    std::swap(left, right);
+    expr_type = flip(expr_type);
+  }
+  if (left->expr_type() != tuix::ExprUnion_Col || right->expr_type() != tuix::ExprUnion_Literal
+      || left->expr_as_Col()->col_num() >= stats->columns()->size()) {
+    return true;
+  }
+
+  const tuix::ColumnStats *col = stats->columns()->Get(left->expr_as_Col()->col_num());
+  const tuix::Field *lit = right->expr_as_Literal()->value();
+  if (col->null_count() == stats->num_rows() || lit->is_null()) {
+    // Comparisons with null are never true
+    return false;
+  }
+  if (col->min() == nullptr || col->max() == nullptr
+      || col->min()->value_type() != lit->value_type()
+      || col->max()->value_type() != lit->value_type()
+      || !is_orderable(lit->value_type())) {
+    return true;
+  }
+
+  lit_key.clear();
+  min_key.clear();
+  max_key.clear();
+  FlatbuffersSortOrderEvaluator::encode_field(lit, lit_key);
+  FlatbuffersSortOrderEvaluator::encode_field(col->min(), min_key);
+  FlatbuffersSortOrderEvaluator::encode_field(col->max(), max_key);
+  int min_cmp = FlatbuffersSortOrderEvaluator::compare_keys(min_key, lit_key);
+  int max_cmp = FlatbuffersSortOrderEvaluator::compare_keys(max_key, lit_key);
+  switch (expr_type) {
+  case tuix::ExprUnion_LessThan: return min_cmp < 0;
+  case tuix::ExprUnion_LessThanOrEqual: return min_cmp <= 0;
+  case tuix::ExprUnion_GreaterThan: return max_cmp > 0;
+  case tuix::ExprUnion_GreaterThanOrEqual: return max_cmp >= 0;
+  case tuix::ExprUnion_EqualTo: return min_cmp <= 0 && max_cmp >= 0;
+  default: return true;
+  }
+}
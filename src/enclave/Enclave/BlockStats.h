@@ -0,0 +1,59 @@
+#include "Flatbuffers.h"
+
+#ifndef BLOCK_STATS_H
+#define BLOCK_STATS_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * Compute the per-column statistics of the given Rows as a BlockStats object bound to
+ * `block_tag`, and finish it as the root of `builder`. Returns false, leaving `builder` untouched,
+ * if the rows are empty, contain dummy rows, or differ in their number of fields.
+ */
+bool write_block_stats(const tuix::Rows *rows, const std::vector<uint8_t> &block_tag,
+                       flatbuffers::FlatBufferBuilder &builder);
+
+/**
+ * The tag that binds the statistics of the given block to its contents: the MAC at the end of
+ * enc_rows, or block_id for the ColumnChunks and RowChunks formats.
+ */
+std::vector<uint8_t> block_tag(const tuix::EncryptedBlock *block);
+
+/**
+ * Decides from the encrypted statistics of a block whether any of its rows can satisfy a filter
+ * condition, so that blocks that cannot are skipped without decrypting their rows.
+ *
+ * Comparisons (<, <=, >, >=, =) between a column and a literal, IsNull and Not(IsNull) on a column,
+ * boolean literals, And, and Or are checked against the statistics. Any other expression is
+ * assumed to possibly match.
+ */
+class BlockStatsFilter {
+public:
+  BlockStatsFilter(const tuix::Expr *condition) : condition(condition) {}
+
+  /**
+   * Return false only if no row of the given block can satisfy the condition. Blocks without
+   * statistics always return true. Throws if the statistics do not belong to the block.
+   */
+  bool may_match(const tuix::EncryptedBlock *block);
+
+private:
+  bool may_match(const tuix::Expr *expr, const tuix::BlockStats *stats);
+
+  /**
+   * Whether the comparison `expr_type` between `left` and `right` can hold for some row. Only
+   * comparisons between a column and a literal are checked.
+   */
+  bool comparison_may_match(
+    tuix::ExprUnion expr_type, const tuix::Expr *left, const tuix::Expr *right,
+    const tuix::BlockStats *stats);
+
+  const tuix::Expr *condition;
+  std::unique_ptr<uint8_t[]> stats_buf;
+  // Scratch space for comparisons
+  std::vector<uint8_t> lit_key;
+  std::vector<uint8_t> min_key;
+  std::vector<uint8_t> max_key;
+};
+
+#endif
@@ -0,0 +1,711 @@
+#include "Columnar.h"
+
+#include "ExpressionEvaluation.h"
+#include "HashTable.h"
+
+namespace {
+
+/** Whether values of the given type are stored in the ints vector. */
+bool is_int_type(tuix::ColType type) {
+  return type == tuix::ColType_ShortType || type == tuix::ColType_IntegerType
+    || type == tuix::ColType_DateType;
+}
+
+/** Whether values of the given type are stored in the longs vector. */
+bool is_long_type(tuix::ColType type) {
+  return type == tuix::ColType_LongType || type == tuix::ColType_TimestampType;
+}
+
+bool is_var_len_type(tuix::ColType type) {
+  return type == tuix::ColType_StringType || type == tuix::ColType_BinaryType;
+}
+
+bool bit_is_set(const uint8_t *bitmap, uint32_t i) {
+  return (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+/** The number of bits needed to represent the given value. */
+uint8_t bits_needed(uint64_t value) {
+  uint8_t bits = 0;
+  for (; value != 0; value >>= 1) {
+    bits++;
+  }
+  return bits;
+}
+
+uint64_t packed_size(uint32_t count, uint8_t bit_width) {
+  return (static_cast<uint64_t>(count) * bit_width + 7) / 8;
+}
+
+/** Pack the given values into `bit_width` bits each, least significant bit first. */
+std::vector<uint8_t> bit_pack(const std::vector<uint64_t> &values, uint8_t bit_width) {
+  std::vector<uint8_t> packed(packed_size(values.size(), bit_width));
+  uint64_t bit = 0;
+  for (auto it = values.begin(); it != values.end(); ++it) {
+    for (uint32_t b = 0; b < bit_width; ) {
+      uint32_t shift = bit % 8;
+      uint32_t take = std::min(8 - shift, bit_width - b);
+      packed[bit / 8] |= static_cast<uint8_t>(((*it >> b) & ((1u << take) - 1)) << shift);
+      b += take;
+      bit += take;
+    }
+  }
+  return packed;
+}
+
+/** Unpack `count` values of `bit_width` bits each, as written by bit_pack. */
+void bit_unpack(const uint8_t *packed, uint8_t bit_width, uint32_t count,
+                std::vector<uint64_t> *values) {
+  values->assign(count, 0);
+  uint64_t bit = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t value = 0;
+    for (uint32_t b = 0; b < bit_width; ) {
+      uint32_t shift = bit % 8;
+      uint32_t take = std::min(8 - shift, bit_width - b);
+      value |= static_cast<uint64_t>((packed[bit / 8] >> shift) & ((1u << take) - 1)) << b;
+      b += take;
+      bit += take;
+    }
+    (*values)[i] = value;
+  }
+}
+
+/** The vectors and encoding parameters of a Column being written. */
+struct ColumnParts {
+  ColumnParts() : encoding(tuix::ColumnEncoding_Plain), bit_width(0), base(0) {}
+
+  tuix::ColumnEncoding encoding;
+  flatbuffers::Offset<flatbuffers::Vector<int32_t>> ints;
+  flatbuffers::Offset<flatbuffers::Vector<int64_t>> longs;
+  flatbuffers::Offset<flatbuffers::Vector<float>> floats;
+  flatbuffers::Offset<flatbuffers::Vector<double>> doubles;
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> data;
+  flatbuffers::Offset<flatbuffers::Vector<uint32_t>> offsets;
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> packed;
+  uint8_t bit_width;
+  int64_t base;
+  flatbuffers::Offset<flatbuffers::Vector<uint32_t>> run_ends;
+};
+
+/** Gather the values of column `j` into a vector of T, storing zero for nulls. */
+template<typename T, typename TuixField>
+std::vector<T> column_values(const tuix::Rows *rows, uint32_t j) {
+  std::vector<T> values;
+  values.reserve(rows->rows()->size());
+  for (auto it = rows->rows()->begin(); it != rows->rows()->end(); ++it) {
+    const tuix::Field *field = it->field_values()->Get(j);
+    const TuixField *value = static_cast<const TuixField *>(field->value());
+    values.push_back(
+      field->is_null() || value == nullptr ? T() : static_cast<T>(value->value()));
+  }
+  return values;
+}
+
+/**
+ * Write the given integral values using whichever of the plain, run-length, and frame-of-reference
+ * encodings is smallest. Returns the plain or per-run values, which the caller stores in the ints
+ * or longs vector, or a null offset for frame-of-reference. Null rows take the value of the row
+ * before them so that they neither break runs nor widen the range of values.
+ */
+template<typename T>
+flatbuffers::Offset<flatbuffers::Vector<T>> encode_integral(
+  std::vector<T> &values, const std::vector<uint8_t> &nulls,
+  flatbuffers::FlatBufferBuilder &builder, ColumnParts *parts) {
+  const uint32_t n = values.size();
+  uint32_t first_valid = 0;
+  while (first_valid < n && bit_is_set(nulls.data(), first_valid)) {
+    first_valid++;
+  }
+
+  T prev = first_valid < n ? values[first_valid] : T();
+  T min = prev, max = prev;
+  uint32_t num_runs = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    if (bit_is_set(nulls.data(), i)) {
+      values[i] = prev;
+    }
+    if (i == 0 || values[i] != values[i - 1]) {
+      num_runs++;
+    }
+    min = std::min(min, values[i]);
+    max = std::max(max, values[i]);
+    prev = values[i];
+  }
+
+  // Differences are taken modulo 2^64 so that they cannot overflow
+  const uint64_t base = static_cast<uint64_t>(static_cast<int64_t>(min));
+  const uint8_t bit_width = bits_needed(static_cast<uint64_t>(static_cast<int64_t>(max)) - base);
+  const uint64_t plain_size = static_cast<uint64_t>(n) * sizeof(T);
+  const uint64_t rle_size = static_cast<uint64_t>(num_runs) * (sizeof(T) + sizeof(uint32_t));
+  const uint64_t for_size = packed_size(n, bit_width) + sizeof(int64_t);
+
+  if (rle_size < plain_size && rle_size <= for_size) {
+    std::vector<T> run_values;
+    std::vector<uint32_t> run_ends;
+    run_values.reserve(num_runs);
+    run_ends.reserve(num_runs);
+    for (uint32_t i = 1; i <= n; i++) {
+      if (i == n || values[i] != values[i - 1]) {
+        run_values.push_back(values[i - 1]);
+        run_ends.push_back(i);
+      }
+    }
+    parts->encoding = tuix::ColumnEncoding_RunLength;
+    parts->run_ends = builder.CreateVector(run_ends);
+    return builder.CreateVector(run_values);
+  } else if (for_size < plain_size) {
+    std::vector<uint64_t> deltas(n);
+    for (uint32_t i = 0; i < n; i++) {
+      deltas[i] = static_cast<uint64_t>(static_cast<int64_t>(values[i])) - base;
+    }
+    parts->encoding = tuix::ColumnEncoding_FrameOfReference;
+    parts->packed = builder.CreateVector(bit_pack(deltas, bit_width));
+    parts->bit_width = bit_width;
+    parts->base = static_cast<int64_t>(min);
+    return flatbuffers::Offset<flatbuffers::Vector<T>>();
+  } else {
+    return builder.CreateVector(values);
+  }
+}
+
+/**
+ * Write the values of variable-length column `j` either plainly or, if it is smaller, as a
+ * dictionary of the distinct values and a packed index into it for each row. Nulls are stored as
+ * empty values.
+ */
+template<typename TuixField>
+void encode_var_len(
+  const tuix::Rows *rows, uint32_t j, flatbuffers::FlatBufferBuilder &builder,
+  ColumnParts *parts) {
+  const uint32_t n = rows->rows()->size();
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> ends;
+  ends.reserve(n + 1);
+  ends.push_back(0);
+  for (auto it = rows->rows()->begin(); it != rows->rows()->end(); ++it) {
+    const tuix::Field *field = it->field_values()->Get(j);
+    const TuixField *value = static_cast<const TuixField *>(field->value());
+    if (!field->is_null() && value != nullptr && value->value() != nullptr) {
+      uint32_t len = std::min(value->length(), value->value()->size());
+      bytes.insert(bytes.end(), value->value()->data(), value->value()->data() + len);
+    }
+    ends.push_back(bytes.size());
+  }
+
+  ByteKeyHashTable dictionary;
+  std::vector<uint8_t> dict_bytes;
+  std::vector<uint32_t> dict_ends(1, 0);
+  std::vector<uint64_t> codes(n);
+  for (uint32_t i = 0; i < n; i++) {
+    bool inserted;
+    codes[i] = dictionary.insert(
+      bytes.data() + ends[i], ends[i + 1] - ends[i], dictionary.size(), &inserted);
+    if (inserted) {
+      dict_bytes.insert(dict_bytes.end(), bytes.data() + ends[i], bytes.data() + ends[i + 1]);
+      dict_ends.push_back(dict_bytes.size());
+    }
+  }
+
+  const uint8_t bit_width = dictionary.size() > 1 ? bits_needed(dictionary.size() - 1) : 0;
+  const uint64_t plain_size = bytes.size() + sizeof(uint32_t) * ends.size();
+  const uint64_t dict_size =
+    dict_bytes.size() + sizeof(uint32_t) * dict_ends.size() + packed_size(n, bit_width);
+  if (dict_size < plain_size) {
+    parts->encoding = tuix::ColumnEncoding_Dictionary;
+    parts->data = builder.CreateVector(dict_bytes);
+    parts->offsets = builder.CreateVector(dict_ends);
+    parts->packed = builder.CreateVector(bit_pack(codes, bit_width));
+    parts->bit_width = bit_width;
+  } else {
+    parts->data = builder.CreateVector(bytes);
+    parts->offsets = builder.CreateVector(ends);
+  }
+}
+
+template<typename T>
+bool has_size(const flatbuffers::Vector<T> *v, uint32_t size) {
+  return v != nullptr && v->size() == size;
+}
+
+/** Check that `offsets` has `count` entries delimiting consecutive ranges of `data`. */
+bool valid_offsets(const flatbuffers::Vector<uint32_t> *offsets, uint32_t count,
+                   const flatbuffers::Vector<uint8_t> *data) {
+  if (data == nullptr || count == 0 || !has_size(offsets, count) || offsets->Get(0) != 0
+      || offsets->Get(count - 1) > data->size()) {
+    return false;
+  }
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    if (offsets->Get(i) > offsets->Get(i + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool valid_packed(const tuix::Column *col, uint32_t num_rows, uint8_t max_bit_width) {
+  return col->bit_width() <= max_bit_width && col->packed() != nullptr
+    && col->packed()->size() >= packed_size(num_rows, col->bit_width());
+}
+
+}
+
+/**
+ * Random access to the values of a Column. Compressed integral columns are decoded, and the
+ * indices of a dictionary-encoded column unpacked, when the reader is created.
+ */
+class ColumnReader {
+public:
+  /** Check the given column and prepare to read it. Throws if the column is corrupt. */
+  ColumnReader(const tuix::Column *col, uint32_t num_rows) : col(col), decoded(), codes() {
+    if (!check(num_rows)) {
+      throw std::runtime_error(
+        std::string("Corrupt column of type ")
+        + std::string(tuix::EnumNameColType(col->type()))
+        + std::string(" with encoding ")
+        + std::to_string(col->encoding())
+        + std::string(" in ColumnarRows of ")
+        + std::to_string(num_rows)
+        + std::string(" rows"));
+    }
+  }
+
+  tuix::FieldUnion field_type() const {
+    return column_field_type(col->type());
+  }
+
+  /**
+   * Load rows [start, start + n) into `out`. Returns false for the types that a ColumnVector holds
+   * as Fields.
+   */
+  bool load(uint32_t start, uint32_t n, ColumnVector &out) const {
+    out.resize(field_type(), n);
+    switch (col->type()) {
+    case tuix::ColType_BooleanType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.b[k] = col->data()->Get(start + k) != 0;
+      }
+      break;
+    case tuix::ColType_IntegerType:
+    case tuix::ColType_DateType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.i[k] = static_cast<int32_t>(integral(start + k));
+      }
+      break;
+    case tuix::ColType_LongType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.l[k] = integral(start + k);
+      }
+      break;
+    case tuix::ColType_TimestampType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.u[k] = static_cast<uint64_t>(integral(start + k));
+      }
+      break;
+    case tuix::ColType_FloatType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.f[k] = col->floats()->Get(start + k);
+      }
+      break;
+    case tuix::ColType_DoubleType:
+      for (uint32_t k = 0; k < n; k++) {
+        out.d[k] = col->doubles()->Get(start + k);
+      }
+      break;
+    case tuix::ColType_StringType:
+      for (uint32_t k = 0; k < n; k++) {
+        uint32_t c = col->encoding() == tuix::ColumnEncoding_Dictionary
+          ? codes[start + k] : start + k;
+        uint32_t offset = col->offsets()->Get(c);
+        out.str[k] = col->data()->data() + offset;
+        out.str_len[k] = col->offsets()->Get(c + 1) - offset;
+      }
+      break;
+    default:
+      return false;
+    }
+    for (uint32_t k = 0; k < n; k++) {
+      out.is_null[k] = bit_is_set(col->nulls()->data(), start + k);
+    }
+    return true;
+  }
+
+  /** Write the value in row `i` as a Field. */
+  flatbuffers::Offset<tuix::Field> write_field(
+    uint32_t i, flatbuffers::FlatBufferBuilder &builder) const {
+    bool is_null = bit_is_set(col->nulls()->data(), i);
+    switch (col->type()) {
+    case tuix::ColType_BooleanType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_BooleanField,
+        tuix::CreateBooleanField(builder, col->data()->Get(i) != 0).Union(), is_null);
+    case tuix::ColType_ByteType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_ByteField,
+        tuix::CreateByteField(builder, static_cast<int8_t>(col->data()->Get(i))).Union(),
+        is_null);
+    case tuix::ColType_ShortType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_ShortField,
+        tuix::CreateShortField(builder, static_cast<int16_t>(integral(i))).Union(), is_null);
+    case tuix::ColType_IntegerType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_IntegerField,
+        tuix::CreateIntegerField(builder, static_cast<int32_t>(integral(i))).Union(), is_null);
+    case tuix::ColType_DateType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_DateField,
+        tuix::CreateDateField(builder, static_cast<int32_t>(integral(i))).Union(), is_null);
+    case tuix::ColType_LongType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_LongField,
+        tuix::CreateLongField(builder, integral(i)).Union(), is_null);
+    case tuix::ColType_TimestampType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_TimestampField,
+        tuix::CreateTimestampField(builder, static_cast<uint64_t>(integral(i))).Union(), is_null);
+    case tuix::ColType_FloatType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_FloatField,
+        tuix::CreateFloatField(builder, col->floats()->Get(i)).Union(), is_null);
+    case tuix::ColType_DoubleType:
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_DoubleField,
+        tuix::CreateDoubleField(builder, col->doubles()->Get(i)).Union(), is_null);
+    default:
+    {
+      uint32_t k = col->encoding() == tuix::ColumnEncoding_Dictionary ? codes[i] : i;
+      uint32_t start = col->offsets()->Get(k);
+      uint32_t len = col->offsets()->Get(k + 1) - start;
+      auto value = builder.CreateVector(col->data()->data() + start, len);
+      if (col->type() == tuix::ColType_StringType) {
+        return tuix::CreateField(
+          builder, tuix::FieldUnion_StringField,
+          tuix::CreateStringField(builder, value, len).Union(), is_null);
+      } else {
+        return tuix::CreateField(
+          builder, tuix::FieldUnion_BinaryField,
+          tuix::CreateBinaryField(builder, value, len).Union(), is_null);
+      }
+    }
+    }
+  }
+
+private:
+  bool check(uint32_t num_rows) {
+    const tuix::ColType type = col->type();
+    if (!has_size(col->nulls(), (num_rows + 7) / 8)) {
+      return false;
+    }
+
+    switch (col->encoding()) {
+    case tuix::ColumnEncoding_Plain:
+      switch (type) {
+      case tuix::ColType_BooleanType:
+      case tuix::ColType_ByteType:
+        return has_size(col->data(), num_rows);
+      case tuix::ColType_ShortType:
+      case tuix::ColType_IntegerType:
+      case tuix::ColType_DateType:
+        return has_size(col->ints(), num_rows);
+      case tuix::ColType_LongType:
+      case tuix::ColType_TimestampType:
+        return has_size(col->longs(), num_rows);
+      case tuix::ColType_FloatType:
+        return has_size(col->floats(), num_rows);
+      case tuix::ColType_DoubleType:
+        return has_size(col->doubles(), num_rows);
+      case tuix::ColType_StringType:
+      case tuix::ColType_BinaryType:
+        return valid_offsets(col->offsets(), num_rows + 1, col->data());
+      default:
+        return false;
+      }
+
+    case tuix::ColumnEncoding_Dictionary:
+    {
+      if (!is_var_len_type(type) || col->offsets() == nullptr
+          || !valid_offsets(col->offsets(), col->offsets()->size(), col->data())
+          || !valid_packed(col, num_rows, 32)) {
+        return false;
+      }
+      std::vector<uint64_t> indices;
+      bit_unpack(col->packed()->data(), col->bit_width(), num_rows, &indices);
+      codes.resize(num_rows);
+      for (uint32_t i = 0; i < num_rows; i++) {
+        if (indices[i] + 1 >= col->offsets()->size()) {
+          return false;
+        }
+        codes[i] = indices[i];
+      }
+      return true;
+    }
+
+    case tuix::ColumnEncoding_FrameOfReference:
+    {
+      if (!(is_int_type(type) || is_long_type(type)) || !valid_packed(col, num_rows, 64)) {
+        return false;
+      }
+      std::vector<uint64_t> deltas;
+      bit_unpack(col->packed()->data(), col->bit_width(), num_rows, &deltas);
+      decoded.resize(num_rows);
+      for (uint32_t i = 0; i < num_rows; i++) {
+        decoded[i] = static_cast<int64_t>(static_cast<uint64_t>(col->base()) + deltas[i]);
+      }
+      return true;
+    }
+
+    case tuix::ColumnEncoding_RunLength:
+    {
+      uint32_t num_runs;
+      if (is_int_type(type) && col->ints() != nullptr) {
+        num_runs = col->ints()->size();
+      } else if (is_long_type(type) && col->longs() != nullptr) {
+        num_runs = col->longs()->size();
+      } else {
+        return false;
+      }
+      if (!has_size(col->run_ends(), num_runs)
+          || (num_runs == 0 ? num_rows != 0 : col->run_ends()->Get(num_runs - 1) != num_rows)) {
+        return false;
+      }
+      decoded.resize(num_rows);
+      uint32_t start = 0;
+      for (uint32_t r = 0; r < num_runs; r++) {
+        uint32_t end = col->run_ends()->Get(r);
+        if (end <= start || end > num_rows) {
+          return false;
+        }
+        int64_t value = is_int_type(type) ? col->ints()->Get(r) : col->longs()->Get(r);
+        std::fill(decoded.begin() + start, decoded.begin() + end, value);
+        start = end;
+      }
+      return true;
+    }
+
+    default:
+      return false;
+    }
+  }
+
+  int64_t integral(uint32_t i) const {
+    if (col->encoding() != tuix::ColumnEncoding_Plain) {
+      return decoded[i];
+    }
+    return is_int_type(col->type()) ? col->ints()->Get(i) : col->longs()->Get(i);
+  }
+
+  const tuix::Column *col;
+  // Values of a compressed integral column
+  std::vector<int64_t> decoded;
+  // Dictionary indices of a dictionary-encoded column
+  std::vector<uint32_t> codes;
+};
+
+bool column_type_for(tuix::FieldUnion field_type, tuix::ColType *col_type) {
+  switch (field_type) {
+  case tuix::FieldUnion_BooleanField: *col_type = tuix::ColType_BooleanType; return true;
+  case tuix::FieldUnion_IntegerField: *col_type = tuix::ColType_IntegerType; return true;
+  case tuix::FieldUnion_LongField: *col_type = tuix::ColType_LongType; return true;
+  case tuix::FieldUnion_FloatField: *col_type = tuix::ColType_FloatType; return true;
+  case tuix::FieldUnion_DoubleField: *col_type = tuix::ColType_DoubleType; return true;
+  case tuix::FieldUnion_StringField: *col_type = tuix::ColType_StringType; return true;
+  case tuix::FieldUnion_DateField: *col_type = tuix::ColType_DateType; return true;
+  case tuix::FieldUnion_BinaryField: *col_type = tuix::ColType_BinaryType; return true;
+  case tuix::FieldUnion_ByteField: *col_type = tuix::ColType_ByteType; return true;
+  case tuix::FieldUnion_ShortField: *col_type = tuix::ColType_ShortType; return true;
+  case tuix::FieldUnion_TimestampField: *col_type = tuix::ColType_TimestampType; return true;
+  default: return false;
+  }
+}
+
+tuix::FieldUnion column_field_type(tuix::ColType col_type) {
+  switch (col_type) {
+  case tuix::ColType_BooleanType: return tuix::FieldUnion_BooleanField;
+  case tuix::ColType_IntegerType: return tuix::FieldUnion_IntegerField;
+  case tuix::ColType_LongType: return tuix::FieldUnion_LongField;
+  case tuix::ColType_FloatType: return tuix::FieldUnion_FloatField;
+  case tuix::ColType_DoubleType: return tuix::FieldUnion_DoubleField;
+  case tuix::ColType_StringType: return tuix::FieldUnion_StringField;
+  case tuix::ColType_DateType: return tuix::FieldUnion_DateField;
+  case tuix::ColType_BinaryType: return tuix::FieldUnion_BinaryField;
+  case tuix::ColType_ByteType: return tuix::FieldUnion_ByteField;
+  case tuix::ColType_ShortType: return tuix::FieldUnion_ShortField;
+  case tuix::ColType_TimestampType: return tuix::FieldUnion_TimestampField;
+  default: return tuix::FieldUnion_NONE;
+  }
+}
+
+bool columnar_field_types(const tuix::Rows *rows, std::vector<tuix::FieldUnion> *field_types) {
+  if (rows->rows()->size() == 0) {
+    return false;
+  }
+
+  // Every row must have the same number of fields, and every field in a column the same type
+  const uint32_t num_cols = rows->rows()->Get(0)->field_values()->size();
+  field_types->resize(num_cols);
+  tuix::ColType col_type;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    (*field_types)[j] = rows->rows()->Get(0)->field_values()->Get(j)->value_type();
+    if (!column_type_for((*field_types)[j], &col_type)) {
+      return false;
+    }
+  }
+  for (auto it = rows->rows()->begin(); it != rows->rows()->end(); ++it) {
+    if (it->is_dummy() || it->field_values()->size() != num_cols) {
+      return false;
+    }
+    for (uint32_t j = 0; j < num_cols; j++) {
+      if (it->field_values()->Get(j)->value_type() != (*field_types)[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+flatbuffers::Offset<tuix::Column> build_column(
+  const tuix::Rows *rows, uint32_t j, tuix::FieldUnion field_type,
+  flatbuffers::FlatBufferBuilder &builder) {
+  const uint32_t num_rows = rows->rows()->size();
+  tuix::ColType col_type;
+  if (!column_type_for(field_type, &col_type)) {
+    throw std::runtime_error(
+      std::string("No columnar encoding for ")
+      + std::string(tuix::EnumNameFieldUnion(field_type)));
+  }
+
+  std::vector<uint8_t> nulls((num_rows + 7) / 8);
+  for (uint32_t i = 0; i < num_rows; i++) {
+    if (rows->rows()->Get(i)->field_values()->Get(j)->is_null()) {
+      nulls[i / 8] |= 1 << (i % 8);
+    }
+  }
+  auto nulls_offset = builder.CreateVector(nulls);
+
+  ColumnParts parts;
+  switch (field_type) {
+  case tuix::FieldUnion_BooleanField:
+    parts.data = builder.CreateVector(column_values<uint8_t, tuix::BooleanField>(rows, j));
+    break;
+  case tuix::FieldUnion_ByteField:
+    parts.data = builder.CreateVector(column_values<uint8_t, tuix::ByteField>(rows, j));
+    break;
+  case tuix::FieldUnion_ShortField:
+  {
+    auto values = column_values<int32_t, tuix::ShortField>(rows, j);
+    parts.ints = encode_integral(values, nulls, builder, &parts);
+    break;
+  }
+  case tuix::FieldUnion_IntegerField:
+  {
+    auto values = column_values<int32_t, tuix::IntegerField>(rows, j);
+    parts.ints = encode_integral(values, nulls, builder, &parts);
+    break;
+  }
+  case tuix::FieldUnion_DateField:
+  {
+    auto values = column_values<int32_t, tuix::DateField>(rows, j);
+    parts.ints = encode_integral(values, nulls, builder, &parts);
+    break;
+  }
+  case tuix::FieldUnion_LongField:
+  {
+    auto values = column_values<int64_t, tuix::LongField>(rows, j);
+    parts.longs = encode_integral(values, nulls, builder, &parts);
+    break;
+  }
+  case tuix::FieldUnion_TimestampField:
+  {
+    auto values = column_values<int64_t, tuix::TimestampField>(rows, j);
+    parts.longs = encode_integral(values, nulls, builder, &parts);
+    break;
+  }
+  case tuix::FieldUnion_FloatField:
+    parts.floats = builder.CreateVector(column_values<float, tuix::FloatField>(rows, j));
+    break;
+  case tuix::FieldUnion_DoubleField:
+    parts.doubles = builder.CreateVector(column_values<double, tuix::DoubleField>(rows, j));
+    break;
+  case tuix::FieldUnion_StringField:
+    encode_var_len<tuix::StringField>(rows, j, builder, &parts);
+    break;
+  case tuix::FieldUnion_BinaryField:
+    encode_var_len<tuix::BinaryField>(rows, j, builder, &parts);
+    break;
+  default:
+    break;
+  }
+
+  return tuix::CreateColumn(
+    builder, col_type, nulls_offset, parts.ints, parts.longs, parts.floats, parts.doubles,
+    parts.data, parts.offsets, parts.encoding, parts.packed, parts.bit_width, parts.base,
+    parts.run_ends);
+}
+
+bool rows_to_columnar(const tuix::Rows *rows, flatbuffers::FlatBufferBuilder &builder) {
+  std::vector<tuix::FieldUnion> field_types;
+  if (!columnar_field_types(rows, &field_types)) {
+    return false;
+  }
+
+  std::vector<flatbuffers::Offset<tuix::Column>> columns(field_types.size());
+  for (uint32_t j = 0; j < field_types.size(); j++) {
+    columns[j] = build_column(rows, j, field_types[j], builder);
+  }
+
+  builder.Finish(tuix::CreateColumnarRowsDirect(builder, rows->rows()->size(), &columns));
+  return true;
+}
+
+void ColumnSource::write_rows(flatbuffers::FlatBufferBuilder &builder) const {
+  const uint32_t num_cols = num_columns();
+
+  // Columns that were not read all share one placeholder Field
+  flatbuffers::Offset<tuix::Field> placeholder;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    if (!has_column(j)) {
+      placeholder = tuix::CreateField(
+        builder, tuix::FieldUnion_NullField, tuix::CreateNullField(builder).Union(), true);
+      break;
+    }
+  }
+
+  std::vector<flatbuffers::Offset<tuix::Row>> rows(num_rows());
+  std::vector<flatbuffers::Offset<tuix::Field>> field_values(num_cols);
+  for (uint32_t i = 0; i < num_rows(); i++) {
+    for (uint32_t j = 0; j < num_cols; j++) {
+      field_values[j] = has_column(j) ? write_field(i, j, builder) : placeholder;
+    }
+    rows[i] = tuix::CreateRowDirect(builder, &field_values);
+  }
+  builder.Finish(tuix::CreateRowsDirect(builder, &rows));
+}
+
+ColumnsReader::ColumnsReader() : rows(0), readers() {}
+
+ColumnsReader::~ColumnsReader() {}
+
+void ColumnsReader::reset(uint32_t num_rows, const std::vector<const tuix::Column *> &columns) {
+  rows = num_rows;
+  readers.clear();
+  readers.resize(columns.size());
+  for (uint32_t j = 0; j < columns.size(); j++) {
+    if (columns[j] != nullptr) {
+      readers[j].reset(new ColumnReader(columns[j], num_rows));
+    }
+  }
+}
+
+tuix::FieldUnion ColumnsReader::field_type(uint32_t j) const {
+  return readers[j]->field_type();
+}
+
+bool ColumnsReader::load(uint32_t j, uint32_t start, uint32_t n, ColumnVector &out) const {
+  return readers[j] && readers[j]->load(start, n, out);
+}
+
+flatbuffers::Offset<tuix::Field> ColumnsReader::write_field(
+  uint32_t i, uint32_t j, flatbuffers::FlatBufferBuilder &builder) const {
+  return readers[j]->write_field(i, builder);
+}
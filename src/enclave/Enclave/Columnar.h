@@ -0,0 +1,101 @@
+#include <memory>
+
+#include "Flatbuffers.h"
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * Find the column type that stores fields of the given type. Returns false if there is none.
+ */
+bool column_type_for(tuix::FieldUnion field_type, tuix::ColType *col_type);
+
+/** The type of the fields stored in a column of the given type, or NONE if it is not known. */
+tuix::FieldUnion column_field_type(tuix::ColType col_type);
+
+/**
+ * Find the type of the fields in each column of the given Rows. Returns false if the rows have no
+ * columnar representation: if there are none, if any is a dummy row, or if any column is not made
+ * up of fields of a single type that has a columnar encoding (see tuix::Column).
+ */
+bool columnar_field_types(const tuix::Rows *rows, std::vector<tuix::FieldUnion> *field_types);
+
+/**
+ * Write column `j` of the given Rows, whose fields have the given type as found by
+ * columnar_field_types, as a Column.
+ */
+flatbuffers::Offset<tuix::Column> build_column(
+  const tuix::Rows *rows, uint32_t j, tuix::FieldUnion field_type,
+  flatbuffers::FlatBufferBuilder &builder);
+
+/**
+ * Transpose the given Rows into a ColumnarRows object and finish it as the root of `builder`.
+ * Returns false, leaving `builder` in an unspecified state, if the rows have no columnar
+ * representation (see columnar_field_types).
+ */
+bool rows_to_columnar(const tuix::Rows *rows, flatbuffers::FlatBufferBuilder &builder);
+
+struct ColumnVector;
+
+/**
+ * Column-at-a-time access to the rows of a block, so that operators can evaluate expressions over
+ * whole columns and copy out only the rows they keep, instead of first assembling every row.
+ */
+class ColumnSource {
+public:
+  virtual ~ColumnSource() {}
+
+  virtual uint32_t num_rows() const = 0;
+  virtual uint32_t num_columns() const = 0;
+  /** Whether column `j` was read. Columns that were skipped cannot be loaded. */
+  virtual bool has_column(uint32_t j) const = 0;
+  /** The type of the fields in column `j`, which must have been read. */
+  virtual tuix::FieldUnion field_type(uint32_t j) const = 0;
+  /**
+   * Load rows [start, start + n) of column `j` into `out`. Returns false if the column was not
+   * read, or if its type is not held unboxed in a ColumnVector. Loaded strings point into the
+   * source, so they are only valid as long as it is.
+   */
+  virtual bool load(uint32_t j, uint32_t start, uint32_t n, ColumnVector &out) const = 0;
+  /** Write the value in row `i` of column `j`, which must have been read, as a Field. */
+  virtual flatbuffers::Offset<tuix::Field> write_field(
+    uint32_t i, uint32_t j, flatbuffers::FlatBufferBuilder &builder) const = 0;
+
+  /**
+   * Transpose the columns into a Rows object and finish it as the root of `builder`. The fields of
+   * columns that were not read are written as null NullFields.
+   */
+  void write_rows(flatbuffers::FlatBufferBuilder &builder) const;
+};
+
+class ColumnReader;
+
+/** A ColumnSource over the Columns of a ColumnarRows object or of separately stored chunks. */
+class ColumnsReader : public ColumnSource {
+public:
+  ColumnsReader();
+  ~ColumnsReader();
+
+  /**
+   * Check the given columns and prepare to read them. A null entry in `columns` stands for a
+   * column that was not read. Throws if any column is inconsistent with `num_rows` or with its
+   * declared type.
+   */
+  void reset(uint32_t num_rows, const std::vector<const tuix::Column *> &columns);
+
+  uint32_t num_rows() const { return rows; }
+  uint32_t num_columns() const { return readers.size(); }
+  bool has_column(uint32_t j) const { return readers[j] != nullptr; }
+  tuix::FieldUnion field_type(uint32_t j) const;
+  bool load(uint32_t j, uint32_t start, uint32_t n, ColumnVector &out) const;
+  flatbuffers::Offset<tuix::Field> write_field(
+    uint32_t i, uint32_t j, flatbuffers::FlatBufferBuilder &builder) const;
+
+private:
+  uint32_t rows;
+  std::vector<std::unique_ptr<ColumnReader>> readers;
+};
+
+#endif
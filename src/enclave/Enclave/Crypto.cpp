@@ -1,5 +1,6 @@
 #include "Crypto.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <sgx_trts.h>
 #include <sgx_tkey_exchange.h>
@@ -18,8 +19,79 @@ sgx_aes_gcm_128bit_key_t shared_key = {0};
 
 std::unique_ptr<KeySchedule> ks;
 
+/** The GHASH table of `ks`, computed once per key rather than once per encrypted buffer. */
+std::unique_ptr<GcmKey> gcm_key;
+
 void initKeySchedule() {
   ks.reset(new KeySchedule(reinterpret_cast<unsigned char *>(shared_key), SGX_AESGCM_KEY_SIZE));
+  gcm_key.reset(new GcmKey(ks.get()));
+}
+
+namespace {
+
+const size_t IV_PREFIX_SIZE = 8;
+
+// The IV state of the calling thread
+thread_local uint8_t iv_prefix[IV_PREFIX_SIZE];
+thread_local uint32_t iv_counter = 0;
+
+/**
+ * Write the next IV of the calling thread: a random 64-bit prefix followed by a 32-bit counter. A
+ * new prefix is drawn whenever the counter wraps, so a thread never repeats an IV, and distinct
+ * threads and enclaves only collide if they draw the same 64-bit prefix. This keeps IVs unique
+ * under the shared key without a call to the random number generator per encrypted buffer.
+ */
+void next_iv(uint8_t *iv) {
+  if (iv_counter == 0) {
+    sgx_read_rand(iv_prefix, IV_PREFIX_SIZE);
+  }
+  memcpy(iv, iv_prefix, IV_PREFIX_SIZE);
+  memcpy(iv + IV_PREFIX_SIZE, &iv_counter, SGX_AESGCM_IV_SIZE - IV_PREFIX_SIZE);
+  iv_counter++;
+}
+
+void check_key() {
+  if (!ks) {
+    throw std::runtime_error(
+      "Cannot encrypt without a shared key. Ensure all enclaves have completed attestation.");
+  }
+}
+
+/** Encrypt using the IV already written at the start of `ciphertext`. */
+void encrypt_with_iv(const uint8_t *plaintext, uint32_t plaintext_length, uint8_t *ciphertext,
+                     const uint8_t *aad, uint32_t aad_length) {
+  uint8_t *iv_ptr = ciphertext;
+  uint8_t *ciphertext_ptr = ciphertext + SGX_AESGCM_IV_SIZE;
+  sgx_aes_gcm_128bit_tag_t *mac_ptr =
+    (sgx_aes_gcm_128bit_tag_t *) (ciphertext + SGX_AESGCM_IV_SIZE + plaintext_length);
+
+  AesGcm cipher(gcm_key.get(), iv_ptr, SGX_AESGCM_IV_SIZE);
+  if (aad_length > 0) {
+    cipher.aad(aad, aad_length);
+  }
+  cipher.encrypt(plaintext, plaintext_length, ciphertext_ptr, plaintext_length);
+  memcpy(mac_ptr, cipher.tag().t, SGX_AESGCM_MAC_SIZE);
+}
+
+void decrypt_unchecked(const uint8_t *ciphertext, uint32_t ciphertext_length,
+                       uint8_t *plaintext, const uint8_t *aad, uint32_t aad_length) {
+  uint32_t plaintext_length = dec_size(ciphertext_length);
+
+  uint8_t *iv_ptr = (uint8_t *) ciphertext;
+  uint8_t *ciphertext_ptr = (uint8_t *) (ciphertext + SGX_AESGCM_IV_SIZE);
+  sgx_aes_gcm_128bit_tag_t *mac_ptr =
+    (sgx_aes_gcm_128bit_tag_t *) (ciphertext + SGX_AESGCM_IV_SIZE + plaintext_length);
+
+  AesGcm decipher(gcm_key.get(), iv_ptr, SGX_AESGCM_IV_SIZE);
+  if (aad_length > 0) {
+    decipher.aad(aad, aad_length);
+  }
+  decipher.decrypt(ciphertext_ptr, plaintext_length, plaintext, plaintext_length);
+  if (memcmp(mac_ptr, decipher.tag().t, SGX_AESGCM_MAC_SIZE) != 0) {
+    throw std::runtime_error("Decrypt: invalid MAC");
+  }
+}
+
 }
 
 void set_shared_key(sgx_ra_context_t context, uint8_t *msg4_bytes, uint32_t msg4_size) {
@@ -46,43 +118,46 @@ void set_shared_key(sgx_ra_context_t context, uint8_t *msg4_bytes, uint32_t msg4
 
 
 void encrypt(uint8_t *plaintext, uint32_t plaintext_length,
-             uint8_t *ciphertext) {
-
-  if (!ks) {
-    throw std::runtime_error(
-      "Cannot encrypt without a shared key. Ensure all enclaves have completed attestation.");
-  }
-
-  uint8_t *iv_ptr = ciphertext;
-  uint8_t *ciphertext_ptr = ciphertext + SGX_AESGCM_IV_SIZE;
-  sgx_aes_gcm_128bit_tag_t *mac_ptr =
-    (sgx_aes_gcm_128bit_tag_t *) (ciphertext + SGX_AESGCM_IV_SIZE + plaintext_length);
-
-  sgx_read_rand(iv_ptr, SGX_AESGCM_IV_SIZE);
-
-  AesGcm cipher(ks.get(), iv_ptr, SGX_AESGCM_IV_SIZE);
-  cipher.encrypt(plaintext, plaintext_length, ciphertext_ptr, plaintext_length);
-  memcpy(mac_ptr, cipher.tag().t, SGX_AESGCM_MAC_SIZE);
+             uint8_t *ciphertext, const uint8_t *aad, uint32_t aad_length) {
+  check_key();
+  next_iv(ciphertext);
+  encrypt_with_iv(plaintext, plaintext_length, ciphertext, aad, aad_length);
 }
 
+void decrypt(const uint8_t *ciphertext, uint32_t ciphertext_length, uint8_t *plaintext,
+             const uint8_t *aad, uint32_t aad_length) {
+  check_key();
+  decrypt_unchecked(ciphertext, ciphertext_length, plaintext, aad, aad_length);
+}
 
-void decrypt(const uint8_t *ciphertext, uint32_t ciphertext_length, uint8_t *plaintext) {
-  if (!ks) {
-    throw std::runtime_error(
-      "Cannot encrypt without a shared key. Ensure all enclaves have completed attestation.");
+void encrypt_batch(const std::vector<CryptoBatchItem> &batch,
+                   const uint8_t *aad, uint32_t aad_length) {
+  check_key();
+  for (auto it = batch.begin(); it != batch.end(); ++it) {
+    next_iv(it->output);
+    encrypt_with_iv(it->input, it->input_length, it->output, aad, aad_length);
   }
+}
 
-  uint32_t plaintext_length = dec_size(ciphertext_length);
-
-  uint8_t *iv_ptr = (uint8_t *) ciphertext;
-  uint8_t *ciphertext_ptr = (uint8_t *) (ciphertext + SGX_AESGCM_IV_SIZE);
-  sgx_aes_gcm_128bit_tag_t *mac_ptr =
-    (sgx_aes_gcm_128bit_tag_t *) (ciphertext + SGX_AESGCM_IV_SIZE + plaintext_length);
+void decrypt_batch(const std::vector<CryptoBatchItem> &batch,
+                   const uint8_t *aad, uint32_t aad_length) {
+  check_key();
+  for (auto it = batch.begin(); it != batch.end(); ++it) {
+    decrypt_unchecked(it->input, it->input_length, it->output, aad, aad_length);
+  }
+}
 
-  AesGcm decipher(ks.get(), iv_ptr, SGX_AESGCM_IV_SIZE);
-  decipher.decrypt(ciphertext_ptr, plaintext_length, plaintext, plaintext_length);
-  if (memcmp(mac_ptr, decipher.tag().t, SGX_AESGCM_MAC_SIZE) != 0) {
-    printf("Decrypt: invalid mac\n");
+void BufferedRandom::read(uint8_t *out, size_t len) {
+  while (len > 0) {
+    if (pos == sizeof(buf)) {
+      sgx_read_rand(buf, sizeof(buf));
+      pos = 0;
+    }
+    size_t n = std::min(len, sizeof(buf) - pos);
+    memcpy(out, buf + pos, n);
+    pos += n;
+    out += n;
+    len -= n;
   }
 }
 
@@ -1,6 +1,7 @@
 #include <sgx_tcrypto.h>
 #include <sgxaes.h>
 #include <sgx_key_exchange.h>
+#include <vector>
 
 #ifndef CRYPTO_H
 #define CRYPTO_H
@@ -24,16 +25,66 @@ void set_shared_key(sgx_ra_context_t context, uint8_t *msg4, uint32_t msg4_size)
  *
  * The IV is 12 bytes (96 bits). The key is 16 bytes (128 bits).  The MAC is 16 bytes (128 bits).
  *
- * A random IV will be used.
+ * Each IV is a random per-thread prefix followed by a counter (see next_iv in Crypto.cpp), so IVs
+ * do not repeat under the shared key.
+ *
+ * The MAC also covers the `aad_length` bytes at `aad`, which are not written to `ciphertext`. The
+ * same additional authenticated data must be passed to `decrypt`.
  */
-void encrypt(uint8_t *plaintext, uint32_t plaintext_length, uint8_t *ciphertext);
+void encrypt(uint8_t *plaintext, uint32_t plaintext_length, uint8_t *ciphertext,
+             const uint8_t *aad = nullptr, uint32_t aad_length = 0);
 
 /**
  * Decrypt the given ciphertext using AES-GCM with a 128-bit key and write the result to
  * `plaintext`. The encrypted data must be formatted as described in the documentation for
- * `encrypt`.
+ * `encrypt`. Throws if the MAC does not match, including if `aad` differs from the additional
+ * authenticated data passed to `encrypt`, in which case `plaintext` must not be used.
+ */
+void decrypt(const uint8_t *ciphertext, uint32_t ciphertext_length, uint8_t *plaintext,
+             const uint8_t *aad = nullptr, uint32_t aad_length = 0);
+
+/** One buffer of a batch passed to `encrypt_batch` or `decrypt_batch`. */
+struct CryptoBatchItem {
+  const uint8_t *input;
+  uint32_t input_length;
+  uint8_t *output;
+};
+
+/**
+ * Encrypt each input of the batch into its output, as if by calling `encrypt` on it with the given
+ * additional authenticated data.
+ */
+void encrypt_batch(const std::vector<CryptoBatchItem> &batch,
+                   const uint8_t *aad = nullptr, uint32_t aad_length = 0);
+
+/**
+ * Decrypt each input of the batch into its output, as if by calling `decrypt` on it with the given
+ * additional authenticated data.
+ */
+void decrypt_batch(const std::vector<CryptoBatchItem> &batch,
+                   const uint8_t *aad = nullptr, uint32_t aad_length = 0);
+
+/**
+ * Random bytes drawn from sgx_read_rand in large chunks, for callers that need many small random
+ * values, such as one per row. Not thread-safe; each thread should use its own instance.
  */
-void decrypt(const uint8_t *ciphertext, uint32_t ciphertext_length, uint8_t *plaintext);
+class BufferedRandom {
+public:
+  BufferedRandom() : pos(sizeof(buf)) {}
+
+  /** Fill `out` with `len` random bytes. */
+  void read(uint8_t *out, size_t len);
+
+  uint16_t next_uint16() {
+    uint16_t result;
+    read(reinterpret_cast<uint8_t *>(&result), sizeof(result));
+    return result;
+  }
+
+private:
+  uint8_t buf[4096];
+  size_t pos;
+};
 
 /** Calculate how many bytes `encrypt` will write if invoked on plaintext of the given length. */
 uint32_t enc_size(uint32_t plaintext_size);
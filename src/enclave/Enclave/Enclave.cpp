@@ -12,6 +12,7 @@
 #include "Join.h"
 #include "Project.h"
 #include "Sort.h"
+#include "WorkerPool.h"
 #include "util.h"
 
 // This file contains definitions of the ecalls declared in Enclave.edl. Errors originating within
@@ -20,7 +21,8 @@
 // ocall_throw.
 
 void ecall_encrypt(uint8_t *plaintext, uint32_t plaintext_length,
-                   uint8_t *ciphertext, uint32_t cipher_length) {
+                   uint8_t *ciphertext, uint32_t cipher_length,
+                   uint8_t *aad, uint32_t aad_length) {
   // Guard against encrypting or overwriting enclave memory
   assert(sgx_is_outside_enclave(plaintext, plaintext_length) == 1);
   assert(sgx_is_outside_enclave(ciphertext, cipher_length) == 1);
@@ -31,7 +33,7 @@ void ecall_encrypt(uint8_t *plaintext, uint32_t plaintext_length,
     assert(cipher_length >= plaintext_length + SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE);
     (void)cipher_length;
     (void)plaintext_length;
-    encrypt(plaintext, plaintext_length, ciphertext);
+    encrypt(plaintext, plaintext_length, ciphertext, aad, aad_length);
   } catch (const std::runtime_error &e) {
     ocall_throw(e.what());
   }
@@ -138,6 +140,42 @@ void ecall_external_sort(uint8_t *sort_order, size_t sort_order_length,
   }
 }
 
+void ecall_merge_sorted_runs(uint8_t *sort_order, size_t sort_order_length,
+                             uint8_t *input_runs, size_t input_runs_length,
+                             uint8_t **output_rows, size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(input_runs, input_runs_length) == 1);
+  sgx_lfence();
+
+  try {
+    merge_sorted_runs(sort_order, sort_order_length,
+                      input_runs, input_runs_length,
+                      output_rows, output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_test_external_sort(uint8_t *sort_order, size_t sort_order_length,
+                              uint8_t *input_rows, size_t input_rows_length,
+                              uint32_t max_num_streams,
+                              uint8_t **output_rows, size_t *output_rows_length,
+                              uint32_t *num_intermediate_passes) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    *num_intermediate_passes = 0;
+    external_sort(sort_order, sort_order_length,
+                  input_rows, input_rows_length,
+                  output_rows, output_rows_length,
+                  max_num_streams, num_intermediate_passes);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
 void ecall_scan_collect_last_primary(uint8_t *join_expr, size_t join_expr_length,
                                      uint8_t *input_rows, size_t input_rows_length,
                                      uint8_t **output_rows, size_t *output_rows_length) {
@@ -173,55 +211,147 @@ void ecall_non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_le
   }
 }
 
-void ecall_non_oblivious_aggregate_step1(
-  uint8_t *agg_op, size_t agg_op_length,
-  uint8_t *input_rows, size_t input_rows_length,
-  uint8_t **first_row, size_t *first_row_length,
-  uint8_t **last_group, size_t *last_group_length,
-  uint8_t **last_row, size_t *last_row_length) {
+void ecall_test_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
+                                uint8_t *input_rows, size_t input_rows_length,
+                                uint8_t *join_row, size_t join_row_length,
+                                size_t max_group_cache_size,
+                                uint8_t **output_rows, size_t *output_rows_length,
+                                uint32_t *num_spilled_groups) {
   // Guard against operating on arbitrary enclave memory
   assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
+  assert(sgx_is_outside_enclave(join_row, join_row_length) == 1);
   sgx_lfence();
 
   try {
-    non_oblivious_aggregate_step1(
-      agg_op, agg_op_length,
-      input_rows, input_rows_length,
-      first_row, first_row_length,
-      last_group, last_group_length,
-      last_row, last_row_length);
+    *num_spilled_groups = 0;
+    non_oblivious_sort_merge_join(join_expr, join_expr_length,
+                                  input_rows, input_rows_length,
+                                  join_row, join_row_length,
+                                  output_rows, output_rows_length,
+                                  max_group_cache_size, num_spilled_groups);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_non_oblivious_hash_join(uint8_t *join_expr, size_t join_expr_length,
+                                   uint8_t *primary_rows, size_t primary_rows_length,
+                                   uint8_t *foreign_rows, size_t foreign_rows_length,
+                                   uint8_t **output_rows, size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(primary_rows, primary_rows_length) == 1);
+  assert(sgx_is_outside_enclave(foreign_rows, foreign_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    non_oblivious_hash_join(join_expr, join_expr_length,
+                            primary_rows, primary_rows_length,
+                            foreign_rows, foreign_rows_length,
+                            output_rows, output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_broadcast_hash_join(uint8_t *join_expr, size_t join_expr_length,
+                               uint8_t *build_rows, size_t build_rows_length,
+                               uint8_t *stream_rows, size_t stream_rows_length,
+                               uint8_t **output_rows, size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(build_rows, build_rows_length) == 1);
+  assert(sgx_is_outside_enclave(stream_rows, stream_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    broadcast_hash_join(join_expr, join_expr_length,
+                        build_rows, build_rows_length,
+                        stream_rows, stream_rows_length,
+                        output_rows, output_rows_length);
   } catch (const std::runtime_error &e) {
     ocall_throw(e.what());
   }
 }
 
-void ecall_non_oblivious_aggregate_step2(
+void ecall_non_oblivious_aggregate(
   uint8_t *agg_op, size_t agg_op_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t *next_partition_first_row, size_t next_partition_first_row_length,
-  uint8_t *prev_partition_last_group, size_t prev_partition_last_group_length,
-  uint8_t *prev_partition_last_row, size_t prev_partition_last_row_length,
-  uint8_t **output_rows, size_t *output_rows_length) {
+  uint8_t **output_rows, size_t *output_rows_length,
+  uint8_t **boundary_partials, size_t *boundary_partials_length) {
   // Guard against operating on arbitrary enclave memory
   assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
-  assert(sgx_is_outside_enclave(next_partition_first_row, next_partition_first_row_length) == 1);
-  assert(sgx_is_outside_enclave(prev_partition_last_group, prev_partition_last_group_length) == 1);
-  assert(sgx_is_outside_enclave(prev_partition_last_row, prev_partition_last_row_length) == 1);
   sgx_lfence();
 
   try {
-    non_oblivious_aggregate_step2(
+    non_oblivious_aggregate(
       agg_op, agg_op_length,
       input_rows, input_rows_length,
-      next_partition_first_row, next_partition_first_row_length,
-      prev_partition_last_group, prev_partition_last_group_length,
-      prev_partition_last_row, prev_partition_last_row_length,
-      output_rows, output_rows_length);
+      output_rows, output_rows_length,
+      boundary_partials, boundary_partials_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_non_oblivious_hash_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                                        uint8_t *input_rows, size_t input_rows_length,
+                                        uint8_t **output_rows, size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    non_oblivious_hash_aggregate(agg_op, agg_op_length,
+                                 input_rows, input_rows_length,
+                                 output_rows, output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_test_hash_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                               uint8_t *input_rows, size_t input_rows_length,
+                               size_t max_table_size,
+                               uint8_t **output_rows, size_t *output_rows_length,
+                               uint32_t *spill_depth) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    *spill_depth = 0;
+    non_oblivious_hash_aggregate(agg_op, agg_op_length,
+                                 input_rows, input_rows_length,
+                                 output_rows, output_rows_length,
+                                 max_table_size, spill_depth);
   } catch (const std::runtime_error &e) {
     ocall_throw(e.what());
   }
 }
 
+void ecall_non_oblivious_partial_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                                           uint8_t *input_rows, size_t input_rows_length,
+                                           uint8_t **output_rows, size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(sgx_is_outside_enclave(input_rows, input_rows_length) == 1);
+  sgx_lfence();
+
+  try {
+    non_oblivious_partial_aggregate(agg_op, agg_op_length,
+                                    input_rows, input_rows_length,
+                                    output_rows, output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_worker_loop() {
+  worker_loop();
+}
+
+void ecall_stop_workers() {
+  stop_workers();
+}
+
 sgx_status_t ecall_enclave_init_ra(sgx_ra_context_t *context) {
   try {
     return sgx_ra_init(&g_sp_pub_key, false, context);
@@ -1,10 +1,13 @@
 // -*- c-basic-offset: 2; fill-column: 100 -*-
 
+#include <algorithm>
 #include <functional>
 #include <typeinfo>
 #include <cmath>
+#include <cstring>
 #include <limits>
 
+#include "Columnar.h"
 #include "Flatbuffers.h"
 
 int printf(const char *fmt, ...);
@@ -207,22 +210,1277 @@ flatbuffers::Offset<tuix::Field> eval_binary_comparison(
     result_is_null);
 }
 
+/**
+ * An unboxed value held in one register of a compiled expression plan. Primitive values are stored
+ * inline. Strings are views into the row or expression buffer they came from, and any other type
+ * is carried as a pointer to the tuix::Field it was loaded from. Views are therefore only valid
+ * until the next call to eval.
+ *
+ * field points to the tuix::Field the value was loaded from, or is null if the value was computed.
+ * When it is set and agrees with is_null, the value can be handed out without materializing it.
+ */
+struct PlanValue {
+  tuix::FieldUnion type;
+  bool is_null;
+  union {
+    bool b;
+    int32_t i;  // IntegerField, DateField
+    int64_t l;
+    float f;
+    double d;
+    uint64_t u; // TimestampField
+  };
+  const uint8_t *str;
+  uint32_t str_len;
+  const tuix::Field *field;
+};
+
+/** Compare two string PlanValues bytewise, returning <0, 0, or >0 as memcmp does. */
+inline int compare_plan_strings(const PlanValue &a, const PlanValue &b) {
+  uint32_t n = std::min(a.str_len, b.str_len);
+  int c = n == 0 ? 0 : memcmp(a.str, b.str, n);
+  if (c != 0) return c;
+  return a.str_len < b.str_len ? -1 : (a.str_len > b.str_len ? 1 : 0);
+}
+
+/**
+ * A batch of values of a single type, stored column-wise so that expression steps can run over the
+ * whole batch in tight loops. Only the array matching the type is populated: b for booleans; i for
+ * integers and dates; l, f, d, and u for longs, floats, doubles, and timestamps; str and str_len for
+ * strings; and field for any other type. The null mask uses one byte per value rather than one bit
+ * so that the loops stay free of bit manipulation.
+ */
+struct ColumnVector {
+  ColumnVector() : type(tuix::FieldUnion_NONE), size(0) {}
+
+  void resize(tuix::FieldUnion t, uint32_t n) {
+    type = t;
+    size = n;
+    is_null.resize(n);
+    switch (t) {
+    case tuix::FieldUnion_BooleanField: b.resize(n); break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField: i.resize(n); break;
+    case tuix::FieldUnion_LongField: l.resize(n); break;
+    case tuix::FieldUnion_FloatField: f.resize(n); break;
+    case tuix::FieldUnion_DoubleField: d.resize(n); break;
+    case tuix::FieldUnion_TimestampField: u.resize(n); break;
+    case tuix::FieldUnion_StringField: str.resize(n); str_len.resize(n); break;
+    default: field.resize(n); break;
+    }
+  }
+
+  void get(uint32_t k, PlanValue &v) const {
+    v.type = type;
+    v.is_null = is_null[k];
+    v.field = nullptr;
+    switch (type) {
+    case tuix::FieldUnion_BooleanField: v.b = b[k]; break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField: v.i = i[k]; break;
+    case tuix::FieldUnion_LongField: v.l = l[k]; break;
+    case tuix::FieldUnion_FloatField: v.f = f[k]; break;
+    case tuix::FieldUnion_DoubleField: v.d = d[k]; break;
+    case tuix::FieldUnion_TimestampField: v.u = u[k]; break;
+    case tuix::FieldUnion_StringField: v.str = str[k]; v.str_len = str_len[k]; break;
+    default: v.field = field[k]; break;
+    }
+  }
+
+  void set(uint32_t k, const PlanValue &v) {
+    is_null[k] = v.is_null;
+    switch (type) {
+    case tuix::FieldUnion_BooleanField: b[k] = v.b; break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField: i[k] = v.i; break;
+    case tuix::FieldUnion_LongField: l[k] = v.l; break;
+    case tuix::FieldUnion_FloatField: f[k] = v.f; break;
+    case tuix::FieldUnion_DoubleField: d[k] = v.d; break;
+    case tuix::FieldUnion_TimestampField: u[k] = v.u; break;
+    case tuix::FieldUnion_StringField: str[k] = v.str; str_len[k] = v.str_len; break;
+    default: field[k] = v.field; break;
+    }
+  }
+
+  tuix::FieldUnion type;
+  uint32_t size;
+  std::vector<uint8_t> is_null;
+  std::vector<uint8_t> b;
+  std::vector<int32_t> i;
+  std::vector<int64_t> l;
+  std::vector<float> f;
+  std::vector<double> d;
+  std::vector<uint64_t> u;
+  std::vector<const uint8_t *> str;
+  std::vector<uint32_t> str_len;
+  std::vector<const tuix::Field *> field;
+};
+
+/**
+ * Evaluates a tuix::Expr against rows.
+ *
+ * On construction the expression tree is compiled into a flat plan: a postfix sequence of steps,
+ * each of which writes one register. Operand types are resolved once -- from literals and casts at
+ * construction, and from the column types of the first row -- so that evaluating a row only
+ * dispatches on the pre-resolved types, and intermediate values stay unboxed in the registers
+ * instead of being written to the builder. Only the final result is materialized as a tuix::Field.
+ * eval_batch runs the same plan one step at a time over column vectors, decoded from a batch of
+ * rows or loaded directly from the columns of a ColumnSource.
+ *
+ * Expressions the plan does not support (complex-type creation and the Opaque vector UDFs) are
+ * evaluated by interpreting the tree directly with eval_helper.
+ */
 class FlatbuffersExpressionEvaluator {
 public:
-  FlatbuffersExpressionEvaluator(const tuix::Expr *expr) : builder(), expr(expr) {}
+  FlatbuffersExpressionEvaluator(const tuix::Expr *expr)
+    : builder(), expr(expr), plan(), regs(), batch_regs(), plan_supported(true) {
+    compile_helper(expr);
+    if (plan_supported) {
+      resolve_types();
+      regs.resize(plan.size());
+      // Literals are decoded once here; run_plan never overwrites their registers
+      for (uint32_t i = 0; i < plan.size(); i++) {
+        if (plan[i].op == tuix::ExprUnion_Literal) {
+          load_field(plan[i].expr->expr_as_Literal()->value(), regs[i]);
+        }
+      }
+    }
+  }
+
+  /**
+   * Evaluate the stored expression on the given row. Return a Field containing the result.
+   * Warning: The Field points to internally-managed memory that may be overwritten the next time
+   * eval is called. Therefore it is only valid until the next call to eval.
+   */
+  const tuix::Field *eval(const tuix::Row *row) {
+    builder.Clear();
+    flatbuffers::Offset<tuix::Field> result_offset;
+    if (plan_supported && run_plan(row)) {
+      const PlanValue &result = regs.back();
+      if (is_view(result)) {
+        // The result is an unmodified column or literal, so return it without copying
+        return result.field;
+      }
+      result_offset = materialize(result, builder);
+    } else {
+      result_offset = eval_helper(row, expr);
+    }
+    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, result_offset);
+  }
+
+  /**
+   * Evaluate the stored expression on a batch of rows, one plan step at a time over the whole
+   * batch. The result is available from batch_result and batch_result_at until the next call to
+   * eval_batch, and may refer into the rows, so the rows must outlive it.
+   *
+   * Returns false if the expression cannot be evaluated in batch mode, in which case the caller
+   * should evaluate each row with eval instead. This is also the case for a bare column or
+   * literal, for which eval returns the input field itself rather than a copy.
+   */
+  bool eval_batch(const tuix::Row *const *rows, uint32_t num_rows) {
+    if (!plan_supported || plan.size() == 1) return false;
+    batch_regs.resize(plan.size());
+    for (uint32_t s = 0; s < plan.size(); s++) {
+      bool done = plan[s].op == tuix::ExprUnion_Col
+        ? load_batch_column(s, rows, num_rows) : run_batch_step(s, num_rows);
+      if (!done) return false;
+    }
+    return true;
+  }
+
+  /**
+   * Like eval_batch, but over rows [start, start + num_rows) of the given columns, which are loaded
+   * into the batch registers without assembling any rows. A bare column or literal is evaluated
+   * too. Returns false if the expression refers to a column that the source cannot load.
+   */
+  bool eval_batch(const ColumnSource &source, uint32_t start, uint32_t num_rows) {
+    if (!plan_supported) return false;
+    batch_regs.resize(plan.size());
+    for (uint32_t s = 0; s < plan.size(); s++) {
+      bool done = plan[s].op == tuix::ExprUnion_Col
+        ? load_batch_column(s, source, start, num_rows) : run_batch_step(s, num_rows);
+      if (!done) return false;
+    }
+    return true;
+  }
+
+  /** Whether the expression is a bare column reference, and if so to which column. */
+  bool is_column_ref(uint32_t *col_num) const {
+    if (expr->expr_type() != tuix::ExprUnion_Col) return false;
+    *col_num = expr->expr_as_Col()->col_num();
+    return true;
+  }
+
+  const ColumnVector &batch_result() const {
+    return batch_regs.back();
+  }
+
+  /**
+   * Materialize the k-th value of the last batch as a Field. The Field is only valid until the
+   * next call to eval or batch_result_at.
+   */
+  const tuix::Field *batch_result_at(uint32_t k) {
+    builder.Clear();
+    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, batch_result_at(k, builder));
+  }
+
+  /**
+   * Write the k-th value of the last batch directly into the given builder, for example that of the
+   * output row it belongs to.
+   */
+  flatbuffers::Offset<tuix::Field> batch_result_at(
+    uint32_t k, flatbuffers::FlatBufferBuilder &out_builder) const {
+    PlanValue v;
+    batch_regs.back().get(k, v);
+    return materialize(v, out_builder);
+  }
+
+private:
+  /**
+   * One step of a compiled plan. The step with index i writes register i; args are the registers
+   * of its children, which always precede it. type is the result type of the step, or
+   * FieldUnion_NONE if it depends on a column type that has not been seen yet. operand_type is the
+   * resolved input type for steps that dispatch on it (casts, arithmetic, and comparisons).
+   */
+  struct PlanStep {
+    tuix::ExprUnion op;
+    const tuix::Expr *expr;
+    uint32_t args[3];
+    tuix::FieldUnion type;
+    tuix::FieldUnion operand_type;
+  };
+
+  /**
+   * Append the steps for the given expression to the plan and return the register holding its
+   * result. Clears plan_supported if the expression contains a node the plan cannot evaluate.
+   */
+  uint32_t compile_helper(const tuix::Expr *e) {
+    PlanStep step;
+    step.op = e->expr_type();
+    step.expr = e;
+    step.args[0] = step.args[1] = step.args[2] = 0;
+    step.type = tuix::FieldUnion_NONE;
+    step.operand_type = tuix::FieldUnion_NONE;
+
+    switch (e->expr_type()) {
+    case tuix::ExprUnion_Col:
+    case tuix::ExprUnion_Literal:
+      break;
+    case tuix::ExprUnion_Cast:
+      step.args[0] = compile_helper(e->expr_as_Cast()->value());
+      break;
+    case tuix::ExprUnion_Add:
+      compile_binary(step, e->expr_as_Add());
+      break;
+    case tuix::ExprUnion_Subtract:
+      compile_binary(step, e->expr_as_Subtract());
+      break;
+    case tuix::ExprUnion_Multiply:
+      compile_binary(step, e->expr_as_Multiply());
+      break;
+    case tuix::ExprUnion_Divide:
+      compile_binary(step, e->expr_as_Divide());
+      break;
+    case tuix::ExprUnion_And:
+      compile_binary(step, e->expr_as_And());
+      break;
+    case tuix::ExprUnion_Or:
+      compile_binary(step, e->expr_as_Or());
+      break;
+    case tuix::ExprUnion_Not:
+      step.args[0] = compile_helper(e->expr_as_Not()->child());
+      break;
+    case tuix::ExprUnion_LessThan:
+      compile_binary(step, e->expr_as_LessThan());
+      break;
+    case tuix::ExprUnion_LessThanOrEqual:
+      compile_binary(step, e->expr_as_LessThanOrEqual());
+      break;
+    case tuix::ExprUnion_GreaterThan:
+      compile_binary(step, e->expr_as_GreaterThan());
+      break;
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      compile_binary(step, e->expr_as_GreaterThanOrEqual());
+      break;
+    case tuix::ExprUnion_EqualTo:
+      compile_binary(step, e->expr_as_EqualTo());
+      break;
+    case tuix::ExprUnion_Contains:
+      compile_binary(step, e->expr_as_Contains());
+      break;
+    case tuix::ExprUnion_Substring:
+    {
+      auto ss = e->expr_as_Substring();
+      step.args[0] = compile_helper(ss->str());
+      step.args[1] = compile_helper(ss->pos());
+      step.args[2] = compile_helper(ss->len());
+      break;
+    }
+    case tuix::ExprUnion_If:
+    {
+      auto i = e->expr_as_If();
+      step.args[0] = compile_helper(i->predicate());
+      step.args[1] = compile_helper(i->true_value());
+      step.args[2] = compile_helper(i->false_value());
+      break;
+    }
+    case tuix::ExprUnion_IsNull:
+      step.args[0] = compile_helper(e->expr_as_IsNull()->child());
+      break;
+    case tuix::ExprUnion_Year:
+      step.args[0] = compile_helper(e->expr_as_Year()->child());
+      break;
+    case tuix::ExprUnion_Exp:
+      step.args[0] = compile_helper(e->expr_as_Exp()->child());
+      break;
+    default:
+      plan_supported = false;
+      return 0;
+    }
+
+    plan.push_back(step);
+    return plan.size() - 1;
+  }
+
+  template<typename T>
+  void compile_binary(PlanStep &step, const T *e) {
+    step.args[0] = compile_helper(e->left());
+    step.args[1] = compile_helper(e->right());
+  }
+
+  static tuix::FieldUnion field_type_for(tuix::ColType t) {
+    switch (t) {
+    case tuix::ColType_IntegerType: return tuix::FieldUnion_IntegerField;
+    case tuix::ColType_LongType: return tuix::FieldUnion_LongField;
+    case tuix::ColType_FloatType: return tuix::FieldUnion_FloatField;
+    case tuix::ColType_DoubleType: return tuix::FieldUnion_DoubleField;
+    case tuix::ColType_StringType: return tuix::FieldUnion_StringField;
+    default: return tuix::FieldUnion_NONE;
+    }
+  }
+
+  static bool is_numeric(tuix::FieldUnion t) {
+    return t == tuix::FieldUnion_IntegerField || t == tuix::FieldUnion_LongField
+      || t == tuix::FieldUnion_FloatField || t == tuix::FieldUnion_DoubleField;
+  }
+
+  /**
+   * Return the common type of two operands, throwing if both are known and differ. Returns
+   * FieldUnion_NONE if neither is known yet.
+   */
+  static tuix::FieldUnion common_type(
+    tuix::FieldUnion left, tuix::FieldUnion right, const char *op_name) {
+    if (left != tuix::FieldUnion_NONE && right != tuix::FieldUnion_NONE && left != right) {
+      throw std::runtime_error(
+        std::string(op_name)
+        + std::string(" can't operate on values of different types (")
+        + std::string(tuix::EnumNameFieldUnion(left))
+        + std::string(" and ")
+        + std::string(tuix::EnumNameFieldUnion(right))
+        + std::string(")"));
+    }
+    return left != tuix::FieldUnion_NONE ? left : right;
+  }
+
+  static void require_type(
+    tuix::FieldUnion actual, tuix::FieldUnion expected, const char *op_name) {
+    if (actual != tuix::FieldUnion_NONE && actual != expected) {
+      throw std::runtime_error(
+        std::string(op_name)
+        + std::string(" requires ")
+        + std::string(tuix::EnumNameFieldUnion(expected))
+        + std::string(", not ")
+        + std::string(tuix::EnumNameFieldUnion(actual)));
+    }
+  }
+
+  /**
+   * Assign a result type to every step, checking operand types along the way. Checks that involve
+   * a column whose type has not been seen yet are deferred until it has. Throws if the expression
+   * is ill-typed, and clears plan_supported if the operand types call for a case that only
+   * eval_helper implements.
+   */
+  void resolve_types() {
+    for (auto &step : plan) {
+      const char *op_name = tuix::EnumNameExprUnion(step.op);
+      tuix::FieldUnion arg0 = plan[step.args[0]].type;
+      tuix::FieldUnion arg1 = plan[step.args[1]].type;
+      tuix::FieldUnion arg2 = plan[step.args[2]].type;
+      switch (step.op) {
+      case tuix::ExprUnion_Col:
+        // Bound by run_plan when a row is loaded
+        break;
+
+      case tuix::ExprUnion_Literal:
+        step.type = step.expr->expr_as_Literal()->value()->value_type();
+        break;
+
+      case tuix::ExprUnion_Cast:
+      {
+        auto target_type = step.expr->expr_as_Cast()->target_type();
+        step.operand_type = arg0;
+        step.type = field_type_for(target_type);
+        switch (arg0) {
+        case tuix::FieldUnion_NONE:
+          break;
+        case tuix::FieldUnion_IntegerField:
+        case tuix::FieldUnion_LongField:
+        case tuix::FieldUnion_FloatField:
+        case tuix::FieldUnion_DoubleField:
+        case tuix::FieldUnion_DateField:
+          if (step.type == tuix::FieldUnion_StringField) {
+            plan_supported = false;
+          } else if (step.type == tuix::FieldUnion_NONE) {
+            throw std::runtime_error(
+              std::string("Can't cast ")
+              + std::string(tuix::EnumNameFieldUnion(arg0))
+              + std::string(" to ")
+              + std::string(tuix::EnumNameColType(target_type)));
+          }
+          break;
+        case tuix::FieldUnion_StringField:
+          if (!is_numeric(step.type)) {
+            throw std::runtime_error(
+              std::string("Can't cast String to ")
+              + std::string(tuix::EnumNameColType(target_type)));
+          }
+          break;
+        case tuix::FieldUnion_ArrayField:
+        case tuix::FieldUnion_MapField:
+          plan_supported = false;
+          break;
+        default:
+          throw std::runtime_error(
+            std::string("Can't evaluate cast on ")
+            + std::string(tuix::EnumNameFieldUnion(arg0)));
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Add:
+      case tuix::ExprUnion_Subtract:
+      case tuix::ExprUnion_Multiply:
+      case tuix::ExprUnion_Divide:
+      {
+        tuix::FieldUnion t = common_type(arg0, arg1, op_name);
+        if (t != tuix::FieldUnion_NONE && !is_numeric(t)) {
+          throw std::runtime_error(
+            std::string("Can't evaluate ")
+            + std::string(op_name)
+            + std::string(" on ")
+            + std::string(tuix::EnumNameFieldUnion(t)));
+        }
+        step.operand_type = t;
+        step.type = t;
+        break;
+      }
+
+      case tuix::ExprUnion_LessThan:
+      case tuix::ExprUnion_LessThanOrEqual:
+      case tuix::ExprUnion_GreaterThan:
+      case tuix::ExprUnion_GreaterThanOrEqual:
+      case tuix::ExprUnion_EqualTo:
+      {
+        tuix::FieldUnion t = common_type(arg0, arg1, op_name);
+        switch (t) {
+        case tuix::FieldUnion_NONE:
+        case tuix::FieldUnion_IntegerField:
+        case tuix::FieldUnion_LongField:
+        case tuix::FieldUnion_FloatField:
+        case tuix::FieldUnion_DoubleField:
+        case tuix::FieldUnion_StringField:
+        case tuix::FieldUnion_DateField:
+        case tuix::FieldUnion_TimestampField:
+          break;
+        case tuix::FieldUnion_ArrayField:
+          plan_supported = false;
+          break;
+        default:
+          throw std::runtime_error(
+            std::string("Can't evaluate ")
+            + std::string(op_name)
+            + std::string(" on ")
+            + std::string(tuix::EnumNameFieldUnion(t)));
+        }
+        step.operand_type = t;
+        step.type = tuix::FieldUnion_BooleanField;
+        break;
+      }
+
+      case tuix::ExprUnion_And:
+      case tuix::ExprUnion_Or:
+        require_type(arg0, tuix::FieldUnion_BooleanField, op_name);
+        require_type(arg1, tuix::FieldUnion_BooleanField, op_name);
+        step.type = tuix::FieldUnion_BooleanField;
+        break;
+
+      case tuix::ExprUnion_Not:
+        require_type(arg0, tuix::FieldUnion_BooleanField, op_name);
+        step.type = tuix::FieldUnion_BooleanField;
+        break;
+
+      case tuix::ExprUnion_Contains:
+        require_type(arg0, tuix::FieldUnion_StringField, op_name);
+        require_type(arg1, tuix::FieldUnion_StringField, op_name);
+        step.type = tuix::FieldUnion_BooleanField;
+        break;
+
+      case tuix::ExprUnion_Substring:
+        require_type(arg0, tuix::FieldUnion_StringField, op_name);
+        require_type(arg1, tuix::FieldUnion_IntegerField, op_name);
+        require_type(arg2, tuix::FieldUnion_IntegerField, op_name);
+        step.type = tuix::FieldUnion_StringField;
+        break;
+
+      case tuix::ExprUnion_If:
+        require_type(arg0, tuix::FieldUnion_BooleanField, op_name);
+        step.type = common_type(arg1, arg2, op_name);
+        break;
+
+      case tuix::ExprUnion_IsNull:
+        step.type = tuix::FieldUnion_BooleanField;
+        break;
+
+      case tuix::ExprUnion_Year:
+        require_type(arg0, tuix::FieldUnion_DateField, op_name);
+        step.type = tuix::FieldUnion_IntegerField;
+        break;
+
+      case tuix::ExprUnion_Exp:
+        require_type(arg0, tuix::FieldUnion_DoubleField, op_name);
+        step.type = tuix::FieldUnion_DoubleField;
+        break;
+
+      default:
+        plan_supported = false;
+        break;
+      }
+    }
+  }
+
+  /** Load a tuix::Field into a register without copying any variable-length data. */
+  static void load_field(const tuix::Field *f, PlanValue &out) {
+    out.type = f->value_type();
+    out.is_null = f->is_null();
+    out.field = f;
+    switch (f->value_type()) {
+    case tuix::FieldUnion_BooleanField:
+      out.b = f->value_as_BooleanField()->value();
+      break;
+    case tuix::FieldUnion_IntegerField:
+      out.i = f->value_as_IntegerField()->value();
+      break;
+    case tuix::FieldUnion_LongField:
+      out.l = f->value_as_LongField()->value();
+      break;
+    case tuix::FieldUnion_FloatField:
+      out.f = f->value_as_FloatField()->value();
+      break;
+    case tuix::FieldUnion_DoubleField:
+      out.d = f->value_as_DoubleField()->value();
+      break;
+    case tuix::FieldUnion_DateField:
+      out.i = f->value_as_DateField()->value();
+      break;
+    case tuix::FieldUnion_TimestampField:
+      out.u = f->value_as_TimestampField()->value();
+      break;
+    case tuix::FieldUnion_StringField:
+    {
+      auto sf = f->value_as_StringField();
+      out.str = sf->value() != nullptr ? sf->value()->data() : nullptr;
+      out.str_len = sf->value() != nullptr ? std::min(sf->length(), sf->value()->size()) : 0;
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  template<template<typename T> class Operation>
+  static void run_arithmetic(
+    const PlanStep &step, const PlanValue &left, const PlanValue &right, PlanValue &out) {
+    out.type = step.type;
+    out.is_null = left.is_null || right.is_null;
+    switch (step.operand_type) {
+    case tuix::FieldUnion_IntegerField:
+      out.i = out.is_null ? 0 : Operation<int32_t>()(left.i, right.i);
+      break;
+    case tuix::FieldUnion_LongField:
+      out.l = out.is_null ? 0 : Operation<int64_t>()(left.l, right.l);
+      break;
+    case tuix::FieldUnion_FloatField:
+      out.f = out.is_null ? 0 : Operation<float>()(left.f, right.f);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      out.d = out.is_null ? 0 : Operation<double>()(left.d, right.d);
+      break;
+    default:
+      break;
+    }
+  }
+
+  template<template<typename T> class Operation>
+  static void run_comparison(
+    const PlanStep &step, const PlanValue &left, const PlanValue &right, PlanValue &out) {
+    out.type = tuix::FieldUnion_BooleanField;
+    out.is_null = left.is_null || right.is_null;
+    out.b = false;
+    if (out.is_null) return;
+    switch (step.operand_type) {
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      out.b = Operation<int32_t>()(left.i, right.i);
+      break;
+    case tuix::FieldUnion_LongField:
+      out.b = Operation<int64_t>()(left.l, right.l);
+      break;
+    case tuix::FieldUnion_FloatField:
+      out.b = Operation<float>()(left.f, right.f);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      out.b = Operation<double>()(left.d, right.d);
+      break;
+    case tuix::FieldUnion_TimestampField:
+      out.b = Operation<uint64_t>()(left.u, right.u);
+      break;
+    case tuix::FieldUnion_StringField:
+      out.b = Operation<int>()(compare_plan_strings(left, right), 0);
+      break;
+    default:
+      break;
+    }
+  }
+
+  /**
+   * Run the plan on the given row, leaving the result in the last register. Returns false if a
+   * column type seen in this row forces the expression back onto eval_helper.
+   */
+  bool run_plan(const tuix::Row *row) {
+    for (uint32_t i = 0; i < plan.size(); i++) {
+      const PlanStep &step = plan[i];
+      PlanValue &out = regs[i];
+      switch (step.op) {
+      case tuix::ExprUnion_Col:
+      {
+        const tuix::Field *f = get_column(row, step.expr->expr_as_Col()->col_num());
+        if (f->value_type() != step.type) {
+          // First row, or a row whose column types differ from the last one: rebind
+          plan[i].type = f->value_type();
+          resolve_types();
+          if (!plan_supported) return false;
+        }
+        load_field(f, out);
+        break;
+      }
+
+      case tuix::ExprUnion_Literal:
+        break;
+
+      default:
+        out.field = nullptr;
+        run_step(step, regs[step.args[0]], regs[step.args[1]], regs[step.args[2]], out);
+        break;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Run one non-leaf step given the values of its arguments. Unused arguments may be any register.
+   */
+  static void run_step(
+    const PlanStep &step, const PlanValue &a0, const PlanValue &a1, const PlanValue &a2,
+    PlanValue &out) {
+    switch (step.op) {
+      case tuix::ExprUnion_Cast:
+      {
+        const PlanValue &value = a0;
+        out.type = step.type;
+        out.is_null = value.is_null;
+        double d = 0;
+        int64_t l = 0;
+        bool integral = true;
+        switch (step.operand_type) {
+        case tuix::FieldUnion_IntegerField:
+        case tuix::FieldUnion_DateField:
+          l = value.i;
+          break;
+        case tuix::FieldUnion_LongField:
+          l = value.l;
+          break;
+        case tuix::FieldUnion_FloatField:
+          d = value.f;
+          integral = false;
+          break;
+        case tuix::FieldUnion_DoubleField:
+          d = value.d;
+          integral = false;
+          break;
+        case tuix::FieldUnion_StringField:
+          if (!value.is_null) {
+            std::string s(reinterpret_cast<const char *>(value.str), value.str_len);
+            switch (step.type) {
+            case tuix::FieldUnion_IntegerField: l = std::stol(s); break;
+            case tuix::FieldUnion_LongField: l = std::stoll(s); break;
+            case tuix::FieldUnion_FloatField: d = std::stof(s); integral = false; break;
+            default: d = std::stod(s); integral = false; break;
+            }
+          }
+          break;
+        default:
+          break;
+        }
+        switch (step.type) {
+        case tuix::FieldUnion_IntegerField:
+          out.i = integral ? static_cast<int32_t>(l) : static_cast<int32_t>(d);
+          break;
+        case tuix::FieldUnion_LongField:
+          out.l = integral ? l : static_cast<int64_t>(d);
+          break;
+        case tuix::FieldUnion_FloatField:
+          out.f = integral ? static_cast<float>(l) : static_cast<float>(d);
+          break;
+        case tuix::FieldUnion_DoubleField:
+          out.d = integral ? static_cast<double>(l) : d;
+          break;
+        default:
+          break;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Add:
+        run_arithmetic<std::plus>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_Subtract:
+        run_arithmetic<std::minus>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_Multiply:
+        run_arithmetic<std::multiplies>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_Divide:
+        run_arithmetic<std::divides>(step, a0, a1, out);
+        break;
+
+      case tuix::ExprUnion_And:
+      {
+        const PlanValue &left = a0;
+        const PlanValue &right = a1;
+        out.type = tuix::FieldUnion_BooleanField;
+        if ((!left.is_null && !left.b) || (!right.is_null && !right.b)) {
+          out.b = false;
+          out.is_null = false;
+        } else {
+          out.is_null = left.is_null || right.is_null;
+          out.b = !out.is_null;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Or:
+      {
+        const PlanValue &left = a0;
+        const PlanValue &right = a1;
+        out.type = tuix::FieldUnion_BooleanField;
+        if ((!left.is_null && left.b) || (!right.is_null && right.b)) {
+          out.b = true;
+          out.is_null = false;
+        } else {
+          out.is_null = left.is_null || right.is_null;
+          out.b = false;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Not:
+      {
+        const PlanValue &child = a0;
+        out.type = tuix::FieldUnion_BooleanField;
+        out.b = !child.b;
+        out.is_null = child.is_null;
+        break;
+      }
+
+      case tuix::ExprUnion_LessThan:
+        run_comparison<std::less>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_LessThanOrEqual:
+        run_comparison<std::less_equal>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_GreaterThan:
+        run_comparison<std::greater>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_GreaterThanOrEqual:
+        run_comparison<std::greater_equal>(step, a0, a1, out);
+        break;
+      case tuix::ExprUnion_EqualTo:
+        run_comparison<std::equal_to>(step, a0, a1, out);
+        break;
+
+      case tuix::ExprUnion_Substring:
+      {
+        const PlanValue &str = a0;
+        const PlanValue &pos = a1;
+        const PlanValue &len = a2;
+        out.type = tuix::FieldUnion_StringField;
+        out.is_null = str.is_null || pos.is_null || len.is_null;
+        out.str = nullptr;
+        out.str_len = 0;
+        if (!out.is_null) {
+          // Same bounds logic as eval_helper, which mirrors Spark's ByteArray.subStringSQL
+          int32_t start = 0;
+          int32_t end;
+          if (pos.i > 0) {
+            start = pos.i - 1;
+          } else if (pos.i < 0) {
+            start = str.str_len + pos.i;
+          }
+          if ((static_cast<int32_t>(str.str_len) - start) < len.i) {
+            end = str.str_len;
+          } else {
+            end = start + len.i;
+          }
+          start = std::max(start, 0);
+          if (start > end) {
+            start = end;
+          }
+          out.str = str.str + start;
+          out.str_len = static_cast<uint32_t>(end - start);
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Contains:
+      {
+        const PlanValue &left = a0;
+        const PlanValue &right = a1;
+        out.type = tuix::FieldUnion_BooleanField;
+        out.is_null = left.is_null || right.is_null;
+        out.b = false;
+        if (!out.is_null) {
+          // Every string contains the empty string, as in Spark
+          const uint8_t *last = left.str + left.str_len;
+          out.b = right.str_len == 0
+            || std::search(left.str, last, right.str, right.str + right.str_len) != last;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_If:
+      {
+        const PlanValue &predicate = a0;
+        if (!predicate.is_null) {
+          out = predicate.b ? a1 : a2;
+        } else {
+          out = a1;
+          out.is_null = true;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_IsNull:
+        out.type = tuix::FieldUnion_BooleanField;
+        out.b = a0.is_null;
+        out.is_null = false;
+        break;
+
+      case tuix::ExprUnion_Year:
+      {
+        const PlanValue &child = a0;
+        out.type = tuix::FieldUnion_IntegerField;
+        out.is_null = child.is_null;
+        out.i = 0;
+        if (!child.is_null) {
+          // This is an approximation
+          // TODO take into account leap seconds
+          uint64_t date = 86400L * child.i;
+          struct tm tm;
+          secs_to_tm(date, &tm);
+          out.i = 1900 + tm.tm_year;
+        }
+        break;
+      }
+
+      case tuix::ExprUnion_Exp:
+      {
+        const PlanValue &child = a0;
+        out.type = tuix::FieldUnion_DoubleField;
+        out.is_null = child.is_null;
+        out.d = child.is_null ? 0.0 : std::exp(child.d);
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  static const tuix::Field *get_column(const tuix::Row *row, uint32_t col_num) {
+    if (col_num >= row->field_values()->size()) {
+      throw std::runtime_error(
+        std::string("Column ")
+        + std::to_string(col_num)
+        + std::string(" out of range for row of ")
+        + std::to_string(row->field_values()->size())
+        + std::string(" fields"));
+    }
+    return row->field_values()->Get(col_num);
+  }
+
+  template<template<typename T> class Operation, typename T>
+  static void batch_arithmetic(const T *left, const T *right, T *out, uint32_t n) {
+    Operation<T> op;
+    for (uint32_t k = 0; k < n; k++) {
+      out[k] = op(left[k], right[k]);
+    }
+  }
+
+  template<template<typename T> class Operation, typename T>
+  static void batch_comparison(
+    const T *left, const T *right, const uint8_t *is_null, uint8_t *out, uint32_t n) {
+    Operation<T> op;
+    for (uint32_t k = 0; k < n; k++) {
+      out[k] = static_cast<uint8_t>(op(left[k], right[k])) & static_cast<uint8_t>(!is_null[k]);
+    }
+  }
+
+  template<typename From, typename To>
+  static void batch_cast(const From *in, To *out, uint32_t n) {
+    for (uint32_t k = 0; k < n; k++) {
+      out[k] = static_cast<To>(in[k]);
+    }
+  }
+
+  static void or_nulls(const ColumnVector &left, const ColumnVector &right, ColumnVector &out) {
+    const uint8_t *l = left.is_null.data(), *r = right.is_null.data();
+    uint8_t *o = out.is_null.data();
+    for (uint32_t k = 0; k < out.size; k++) {
+      o[k] = l[k] | r[k];
+    }
+  }
+
+  template<template<typename T> class Operation>
+  bool batch_arithmetic_step(
+    const PlanStep &step, const ColumnVector &left, const ColumnVector &right, ColumnVector &out) {
+    uint32_t n = out.size;
+    switch (step.operand_type) {
+    case tuix::FieldUnion_IntegerField:
+      batch_arithmetic<Operation>(left.i.data(), right.i.data(), out.i.data(), n);
+      break;
+    case tuix::FieldUnion_LongField:
+      batch_arithmetic<Operation>(left.l.data(), right.l.data(), out.l.data(), n);
+      break;
+    case tuix::FieldUnion_FloatField:
+      batch_arithmetic<Operation>(left.f.data(), right.f.data(), out.f.data(), n);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      batch_arithmetic<Operation>(left.d.data(), right.d.data(), out.d.data(), n);
+      break;
+    default:
+      return false;
+    }
+    or_nulls(left, right, out);
+    return true;
+  }
+
+  template<template<typename T> class Operation>
+  bool batch_comparison_step(
+    const PlanStep &step, const ColumnVector &left, const ColumnVector &right, ColumnVector &out) {
+    uint32_t n = out.size;
+    or_nulls(left, right, out);
+    const uint8_t *is_null = out.is_null.data();
+    switch (step.operand_type) {
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      batch_comparison<Operation>(left.i.data(), right.i.data(), is_null, out.b.data(), n);
+      break;
+    case tuix::FieldUnion_LongField:
+      batch_comparison<Operation>(left.l.data(), right.l.data(), is_null, out.b.data(), n);
+      break;
+    case tuix::FieldUnion_FloatField:
+      batch_comparison<Operation>(left.f.data(), right.f.data(), is_null, out.b.data(), n);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      batch_comparison<Operation>(left.d.data(), right.d.data(), is_null, out.b.data(), n);
+      break;
+    case tuix::FieldUnion_TimestampField:
+      batch_comparison<Operation>(left.u.data(), right.u.data(), is_null, out.b.data(), n);
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  template<typename From>
+  static bool batch_cast_to(const From *in, ColumnVector &out) {
+    switch (out.type) {
+    case tuix::FieldUnion_IntegerField: batch_cast(in, out.i.data(), out.size); break;
+    case tuix::FieldUnion_LongField: batch_cast(in, out.l.data(), out.size); break;
+    case tuix::FieldUnion_FloatField: batch_cast(in, out.f.data(), out.size); break;
+    case tuix::FieldUnion_DoubleField: batch_cast(in, out.d.data(), out.size); break;
+    default: return false;
+    }
+    return true;
+  }
+
+  bool batch_cast_step(const PlanStep &step, const ColumnVector &value, ColumnVector &out) {
+    bool ok = false;
+    switch (step.operand_type) {
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField: ok = batch_cast_to(value.i.data(), out); break;
+    case tuix::FieldUnion_LongField: ok = batch_cast_to(value.l.data(), out); break;
+    case tuix::FieldUnion_FloatField: ok = batch_cast_to(value.f.data(), out); break;
+    case tuix::FieldUnion_DoubleField: ok = batch_cast_to(value.d.data(), out); break;
+    default: break;
+    }
+    if (ok) {
+      out.is_null = value.is_null;
+    }
+    return ok;
+  }
 
   /**
-   * Evaluate the stored expression on the given row. Return a Field containing the result.
-   * Warning: The Field points to internally-managed memory that may be overwritten the next time
-   * eval is called. Therefore it is only valid until the next call to eval.
+   * Load the column read by column step s from a batch of rows into batch register s. Returns false
+   * if the batch must be evaluated row-at-a-time instead.
    */
-  const tuix::Field *eval(const tuix::Row *row) {
-    builder.Clear();
-    flatbuffers::Offset<tuix::Field> result_offset = eval_helper(row, expr);
-    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, result_offset);
+  bool load_batch_column(uint32_t s, const tuix::Row *const *rows, uint32_t n) {
+    const PlanStep &step = plan[s];
+    ColumnVector &out = batch_regs[s];
+    uint32_t col_num = step.expr->expr_as_Col()->col_num();
+    PlanValue v;
+    out.resize(step.type, n);
+    for (uint32_t k = 0; k < n; k++) {
+      const tuix::Field *f = get_column(rows[k], col_num);
+      if (f->value_type() != step.type) {
+        plan[s].type = f->value_type();
+        resolve_types();
+        // A column that changes type partway through a batch falls back to the row path
+        if (!plan_supported || k > 0) return false;
+        out.resize(step.type, n);
+      }
+      load_field(f, v);
+      out.set(k, v);
+    }
+    return true;
+  }
+
+  /** Like load_batch_column, but loading rows [start, start + n) of a column of the source. */
+  bool load_batch_column(uint32_t s, const ColumnSource &source, uint32_t start, uint32_t n) {
+    uint32_t col_num = plan[s].expr->expr_as_Col()->col_num();
+    if (col_num >= source.num_columns() || !source.has_column(col_num)) return false;
+    tuix::FieldUnion type = source.field_type(col_num);
+    if (type != plan[s].type) {
+      plan[s].type = type;
+      resolve_types();
+      if (!plan_supported) return false;
+    }
+    return source.load(col_num, start, n, batch_regs[s]);
+  }
+
+  /**
+   * Run step s of the plan, other than a column step, over a batch of n rows, writing batch
+   * register s. Steps without a specialized loop run row by row through run_step. Returns false if
+   * the batch must be evaluated row-at-a-time instead.
+   */
+  bool run_batch_step(uint32_t s, uint32_t n) {
+    const PlanStep &step = plan[s];
+    ColumnVector &out = batch_regs[s];
+
+    switch (step.op) {
+    case tuix::ExprUnion_Literal:
+    {
+      const PlanValue &v = regs[s];
+      out.resize(v.type, n);
+      for (uint32_t k = 0; k < n; k++) {
+        out.set(k, v);
+      }
+      return true;
+    }
+
+    default:
+      break;
+    }
+
+    out.resize(step.type, n);
+    const ColumnVector &a0 = batch_regs[step.args[0]];
+    const ColumnVector &a1 = batch_regs[step.args[1]];
+    const ColumnVector &a2 = batch_regs[step.args[2]];
+    bool done = false;
+    switch (step.op) {
+    case tuix::ExprUnion_Add:
+      done = batch_arithmetic_step<std::plus>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_Subtract:
+      done = batch_arithmetic_step<std::minus>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_Multiply:
+      done = batch_arithmetic_step<std::multiplies>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_Divide:
+      // Integer division goes through run_step so that the zero values held in null slots are
+      // never used as divisors
+      if (step.operand_type == tuix::FieldUnion_FloatField
+          || step.operand_type == tuix::FieldUnion_DoubleField) {
+        done = batch_arithmetic_step<std::divides>(step, a0, a1, out);
+      }
+      break;
+    case tuix::ExprUnion_LessThan:
+      done = batch_comparison_step<std::less>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_LessThanOrEqual:
+      done = batch_comparison_step<std::less_equal>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_GreaterThan:
+      done = batch_comparison_step<std::greater>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      done = batch_comparison_step<std::greater_equal>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_EqualTo:
+      done = batch_comparison_step<std::equal_to>(step, a0, a1, out);
+      break;
+    case tuix::ExprUnion_Cast:
+      done = batch_cast_step(step, a0, out);
+      break;
+    case tuix::ExprUnion_And:
+    {
+      // Three-valued logic: false if either side is definitely false, else null if either is null
+      const uint8_t *lb = a0.b.data(), *ln = a0.is_null.data();
+      const uint8_t *rb = a1.b.data(), *rn = a1.is_null.data();
+      uint8_t *ob = out.b.data(), *on = out.is_null.data();
+      for (uint32_t k = 0; k < n; k++) {
+        uint8_t definitely_false = (!ln[k] & !lb[k]) | (!rn[k] & !rb[k]);
+        on[k] = !definitely_false & (ln[k] | rn[k]);
+        ob[k] = !definitely_false & !on[k];
+      }
+      done = true;
+      break;
+    }
+    case tuix::ExprUnion_Or:
+    {
+      const uint8_t *lb = a0.b.data(), *ln = a0.is_null.data();
+      const uint8_t *rb = a1.b.data(), *rn = a1.is_null.data();
+      uint8_t *ob = out.b.data(), *on = out.is_null.data();
+      for (uint32_t k = 0; k < n; k++) {
+        uint8_t definitely_true = (!ln[k] & lb[k]) | (!rn[k] & rb[k]);
+        on[k] = !definitely_true & (ln[k] | rn[k]);
+        ob[k] = definitely_true;
+      }
+      done = true;
+      break;
+    }
+    case tuix::ExprUnion_Not:
+    {
+      const uint8_t *cb = a0.b.data();
+      uint8_t *ob = out.b.data();
+      for (uint32_t k = 0; k < n; k++) {
+        ob[k] = !cb[k];
+      }
+      out.is_null = a0.is_null;
+      done = true;
+      break;
+    }
+    case tuix::ExprUnion_IsNull:
+    {
+      const uint8_t *cn = a0.is_null.data();
+      uint8_t *ob = out.b.data(), *on = out.is_null.data();
+      for (uint32_t k = 0; k < n; k++) {
+        ob[k] = cn[k];
+        on[k] = 0;
+      }
+      done = true;
+      break;
+    }
+    default:
+      break;
+    }
+
+    if (!done) {
+      PlanValue v0, v1, v2, result;
+      for (uint32_t k = 0; k < n; k++) {
+        a0.get(k, v0);
+        a1.get(k, v1);
+        a2.get(k, v2);
+        result.field = nullptr;
+        run_step(step, v0, v1, v2, result);
+        out.set(k, result);
+      }
+    }
+    return true;
+  }
+
+  static bool is_view(const PlanValue &v) {
+    return v.field != nullptr && v.field->is_null() == v.is_null;
+  }
+
+  /** Write a value to the given builder as a tuix::Field. */
+  static flatbuffers::Offset<tuix::Field> materialize(
+    const PlanValue &v, flatbuffers::FlatBufferBuilder &builder) {
+    switch (v.type) {
+    case tuix::FieldUnion_BooleanField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_BooleanField,
+        tuix::CreateBooleanField(builder, v.b).Union(),
+        v.is_null);
+    case tuix::FieldUnion_IntegerField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_IntegerField,
+        tuix::CreateIntegerField(builder, v.i).Union(),
+        v.is_null);
+    case tuix::FieldUnion_LongField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_LongField,
+        tuix::CreateLongField(builder, v.l).Union(),
+        v.is_null);
+    case tuix::FieldUnion_FloatField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_FloatField,
+        tuix::CreateFloatField(builder, v.f).Union(),
+        v.is_null);
+    case tuix::FieldUnion_DoubleField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_DoubleField,
+        tuix::CreateDoubleField(builder, v.d).Union(),
+        v.is_null);
+    case tuix::FieldUnion_DateField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_DateField,
+        tuix::CreateDateField(builder, v.i).Union(),
+        v.is_null);
+    case tuix::FieldUnion_TimestampField:
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_TimestampField,
+        tuix::CreateTimestampField(builder, v.u).Union(),
+        v.is_null);
+    case tuix::FieldUnion_StringField:
+    {
+      auto str = builder.CreateVector(v.str, v.str_len);
+      return tuix::CreateField(
+        builder,
+        tuix::FieldUnion_StringField,
+        tuix::CreateStringField(builder, str, v.str_len).Union(),
+        v.is_null);
+    }
+    default:
+      // Other types are only carried as views of the tuix::Field they were loaded from
+      if (v.field == nullptr) {
+        throw std::runtime_error(
+          std::string("Can't materialize computed value of type ")
+          + std::string(tuix::EnumNameFieldUnion(v.type)));
+      }
+      return flatbuffers_copy<tuix::Field>(v.field, builder, v.is_null);
+    }
   }
 
-private:
   /**
    * Evaluate the given expression on the given row. Return the offset (within builder) of the Field
    * containing the result. This offset is only valid until the next call to eval.
@@ -650,8 +1908,6 @@ private:
 
     case tuix::ExprUnion_Contains:
     {
-      // TODO: handle Contains(str, "")
-
       auto c = static_cast<const tuix::Contains *>(expr->expr());
       auto left_offset = eval_helper(row, c->left());
       auto right_offset = eval_helper(row, c->right());
@@ -680,7 +1936,8 @@ private:
           last,
           flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(), 0),
           flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(), right_field->length()));
-        bool result = (it != last);
+        // Every string contains the empty string, as in Spark
+        bool result = right_field->length() == 0 || it != last;
         return tuix::CreateField(
           builder,
           tuix::FieldUnion_BooleanField,
@@ -1073,12 +2330,23 @@ private:
 
   flatbuffers::FlatBufferBuilder builder;
   const tuix::Expr *expr;
+  std::vector<PlanStep> plan;
+  std::vector<PlanValue> regs;
+  std::vector<ColumnVector> batch_regs;
+  bool plan_supported;
+
+  friend class FlatbuffersSortOrderEvaluator;
 };
 
+/**
+ * Evaluates a tuix::SortExpr. Rows are compared through normalized sort keys: the sort expressions
+ * are evaluated once per row and encoded into a byte string whose memcmp order is the sort order,
+ * so that sorting and merging compare bytes instead of re-evaluating expressions.
+ */
 class FlatbuffersSortOrderEvaluator {
 public:
   FlatbuffersSortOrderEvaluator(const tuix::SortExpr *sort_expr)
-    : sort_expr(sort_expr), builder() {
+    : sort_expr(sort_expr) {
     for (auto sort_order_it = sort_expr->sort_order()->begin();
          sort_order_it != sort_expr->sort_order()->end(); ++sort_order_it) {
       sort_order_evaluators.emplace_back(
@@ -1104,61 +2372,206 @@ public:
     }
   }
 
-  bool less_than(const tuix::Row *row1, const tuix::Row *row2) {
-    builder.Clear();
-    const tuix::Row *a = nullptr, *b = nullptr;
+  /**
+   * Append the normalized sort key of the given row to key.
+   *
+   * Each sort expression contributes a null marker byte followed by an order-preserving encoding of
+   * its value: big-endian integers with the sign bit flipped, IEEE floats with the sign bit flipped
+   * (or all bits inverted if negative), and strings with 0x00 escaped as 0x00 0xFF and terminated
+   * by 0x00 0x00. For descending order all of its bytes are inverted. Nulls therefore sort first
+   * in ascending order and last in descending order, as in Spark. Fixed-width values are padded
+   * when null, so keys made only of fixed-width values all have the same length.
+   */
+  void append_key(const tuix::Row *row, std::vector<uint8_t> &key) {
     for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
-      switch (sort_expr->sort_order()->Get(i)->direction()) {
-      case tuix::SortDirection_Ascending:
-        a = row1;
-        b = row2;
-        break;
-      case tuix::SortDirection_Descending:
-        a = row2;
-        b = row1;
-        break;
+      size_t start = key.size();
+      encode_field(sort_order_evaluators[i]->eval(row), key);
+      if (sort_expr->sort_order()->Get(i)->direction() == tuix::SortDirection_Descending) {
+        for (size_t j = start; j < key.size(); j++) {
+          key[j] = ~key[j];
+        }
+      }
+    }
+  }
+
+  /**
+   * Evaluate the sort expressions on rows [start, start + n) of the given columns, for
+   * append_batch_key. Returns false if any of them cannot be evaluated over the columns, in which
+   * case the caller should use append_key on the rows instead.
+   */
+  bool eval_batch(const ColumnSource &source, uint32_t start, uint32_t n) {
+    for (auto it = sort_order_evaluators.begin(); it != sort_order_evaluators.end(); ++it) {
+      if (!(*it)->eval_batch(source, start, n) || !has_value_key((*it)->batch_result().type)) {
+        return false;
       }
+    }
+    return true;
+  }
 
-      // Evaluate the field of comparison for rows a and b. Because the first evaluation returns a
-      // temporary pointer that is invalidated by the second evaluation, we must copy the result of
-      // the first evaluation before performing the second evaluation. For simplicity, we then
-      // maintain offsets into builder rather than pointers, because offsets will not be invalidated
-      // by further operations.
-      auto a_eval_offset = flatbuffers_copy(sort_order_evaluators[i]->eval(a), builder);
-      auto b_eval_offset = flatbuffers_copy(sort_order_evaluators[i]->eval(b), builder);
+  /** Like append_key, but for the k-th row of the last batch evaluated by eval_batch. */
+  void append_batch_key(uint32_t k, std::vector<uint8_t> &key) const {
+    PlanValue v;
+    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
+      size_t start = key.size();
+      sort_order_evaluators[i]->batch_result().get(k, v);
+      encode_value(v, key);
+      if (sort_expr->sort_order()->Get(i)->direction() == tuix::SortDirection_Descending) {
+        for (size_t j = start; j < key.size(); j++) {
+          key[j] = ~key[j];
+        }
+      }
+    }
+  }
 
-      bool a_less_than_b =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::LessThan, std::less>(
-              builder,
-              flatbuffers::GetTemporaryPointer<tuix::Field>(builder, a_eval_offset),
-              flatbuffers::GetTemporaryPointer<tuix::Field>(builder, b_eval_offset)))
-          ->value())->value();
-      bool b_less_than_a =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::LessThan, std::less>(
-              builder,
-              flatbuffers::GetTemporaryPointer<tuix::Field>(builder, b_eval_offset),
-              flatbuffers::GetTemporaryPointer<tuix::Field>(builder, a_eval_offset)))
-          ->value())->value();
+  /** Compare two normalized sort keys, returning <0, 0, or >0 as memcmp does. */
+  static int compare_keys(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len) {
+    size_t n = std::min(a_len, b_len);
+    int c = n == 0 ? 0 : memcmp(a, b, n);
+    if (c != 0) return c;
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+  }
+
+  static int compare_keys(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+    return compare_keys(a.data(), a.size(), b.data(), b.size());
+  }
+
+  bool less_than(const tuix::Row *row1, const tuix::Row *row2) {
+    key1.clear();
+    key2.clear();
+    append_key(row1, key1);
+    append_key(row2, key2);
+    return compare_keys(key1, key2) < 0;
+  }
+
+private:
+  static void append_be(std::vector<uint8_t> &key, uint64_t x, uint32_t num_bytes) {
+    for (uint32_t i = num_bytes; i > 0; i--) {
+      key.push_back(static_cast<uint8_t>(x >> (8 * (i - 1))));
+    }
+  }
+
+  static uint32_t encode_float(float x) {
+    uint32_t bits;
+    if (x != x) {
+      bits = 0x7fc00000u; // All NaNs sort together, after positive infinity
+    } else {
+      if (x == 0.0f) x = 0.0f; // Fold -0.0 into 0.0
+      memcpy(&bits, &x, sizeof(bits));
+    }
+    return (bits & 0x80000000u) ? ~bits : (bits ^ 0x80000000u);
+  }
+
+  static uint64_t encode_double(double x) {
+    uint64_t bits;
+    if (x != x) {
+      bits = 0x7ff8000000000000ull;
+    } else {
+      if (x == 0.0) x = 0.0;
+      memcpy(&bits, &x, sizeof(bits));
+    }
+    return (bits & 0x8000000000000000ull) ? ~bits : (bits ^ 0x8000000000000000ull);
+  }
+
+  /** Whether values of the given type are encoded by encode_value. */
+  static bool has_value_key(tuix::FieldUnion type) {
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+    case tuix::FieldUnion_LongField:
+    case tuix::FieldUnion_TimestampField:
+    case tuix::FieldUnion_FloatField:
+    case tuix::FieldUnion_DoubleField:
+    case tuix::FieldUnion_StringField:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /** Append the ascending key encoding of an unboxed value, whose type has_value_key. */
+  static void encode_value(const PlanValue &v, std::vector<uint8_t> &key) {
+    bool is_null = v.is_null;
+    key.push_back(is_null ? 0 : 1);
+    switch (v.type) {
+    case tuix::FieldUnion_BooleanField:
+      key.push_back(is_null ? 0 : v.b);
+      break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      append_be(key, is_null ? 0 : static_cast<uint32_t>(v.i) ^ 0x80000000u, 4);
+      break;
+    case tuix::FieldUnion_LongField:
+      append_be(key, is_null ? 0 : static_cast<uint64_t>(v.l) ^ 0x8000000000000000ull, 8);
+      break;
+    case tuix::FieldUnion_TimestampField:
+      append_be(key, is_null ? 0 : v.u, 8);
+      break;
+    case tuix::FieldUnion_FloatField:
+      append_be(key, is_null ? 0 : encode_float(v.f), 4);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      append_be(key, is_null ? 0 : encode_double(v.d), 8);
+      break;
+    case tuix::FieldUnion_StringField:
+      if (is_null) break;
+      for (uint32_t i = 0; i < v.str_len; i++) {
+        key.push_back(v.str[i]);
+        if (v.str[i] == 0) key.push_back(0xFF);
+      }
+      key.push_back(0);
+      key.push_back(0);
+      break;
+    default:
+      break;
+    }
+  }
+
+public:
+  /**
+   * Append the ascending key encoding of a single field to key. Two fields of the same type have
+   * equal encodings exactly when they are equal or both null.
+   */
+  static void encode_field(const tuix::Field *f, std::vector<uint8_t> &key) {
+    if (has_value_key(f->value_type())) {
+      PlanValue v;
+      FlatbuffersExpressionEvaluator::load_field(f, v);
+      encode_value(v, key);
+      return;
+    }
 
-      if (a_less_than_b) {
-        return true;
-      } else if (b_less_than_a) {
-        return false;
+    bool is_null = f->is_null();
+    switch (f->value_type()) {
+    case tuix::FieldUnion_ArrayField:
+    {
+      // Arrays compare lexicographically, with a shorter prefix sorting first
+      key.push_back(is_null ? 0 : 1);
+      if (is_null) break;
+      for (auto elem : *f->value_as_ArrayField()->value()) {
+        if (elem->value_type() != tuix::FieldUnion_DoubleField) {
+          throw std::runtime_error(
+            std::string("For comparison, only Array[Double] is supported, but array contained ")
+            + std::string(tuix::EnumNameFieldUnion(elem->value_type())));
+        }
+        key.push_back(1);
+        append_be(key, encode_double(elem->value_as_DoubleField()->value()), 8);
       }
+      key.push_back(0);
+      break;
+    }
+    default:
+      throw std::runtime_error(
+        std::string("Can't sort on ")
+        + std::string(tuix::EnumNameFieldUnion(f->value_type())));
     }
-    return false;
   }
 
 private:
   const tuix::SortExpr *sort_expr;
-  flatbuffers::FlatBufferBuilder builder;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> sort_order_evaluators;
+  // Scratch space for less_than
+  std::vector<uint8_t> key1;
+  std::vector<uint8_t> key2;
 };
 
 class FlatbuffersJoinExprEvaluator {
@@ -1229,6 +2642,24 @@ public:
     return true;
   }
 
+  /**
+   * Append the normalized join key of the given row to key, using the primary or foreign key
+   * expressions according to the row's tag. Rows from either table have equal keys exactly when
+   * they are in the same join group. Returns false if any key field is null, in which case the row
+   * cannot match any other row.
+   */
+  bool append_key(const tuix::Row *row, std::vector<uint8_t> &key) {
+    auto &evaluators = is_primary(row) ? left_key_evaluators : right_key_evaluators;
+    for (uint32_t i = 0; i < evaluators.size(); i++) {
+      const tuix::Field *f = evaluators[i]->eval(row);
+      if (f->is_null()) {
+        return false;
+      }
+      FlatbuffersSortOrderEvaluator::encode_field(f, key);
+    }
+    return true;
+  }
+
 private:
   flatbuffers::FlatBufferBuilder builder;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> left_key_evaluators;
@@ -1278,10 +2709,481 @@ private:
   std::unique_ptr<FlatbuffersExpressionEvaluator> evaluate_evaluator;
 };
 
+/**
+ * Native implementation of a built-in aggregate function, selected by its tuix::AggregateKind. The
+ * aggregation buffers are kept in typed C++ state, one slot per group, so that updating a group
+ * with an input row builds no flatbuffers and switching between groups copies nothing. A buffer is
+ * converted to and from its tuix::Field form only when a partial aggregate is loaded from or
+ * written to a row.
+ */
+class Accumulator {
+public:
+  virtual ~Accumulator() {}
+
+  /**
+   * Discard the state of all groups and make room for `num_groups` groups, whose state is undefined
+   * until loaded. Frees the memory held by the previous groups.
+   */
+  virtual void reset(uint32_t num_groups) = 0;
+
+  /** Add a slot for one more group, whose state is undefined until loaded. */
+  virtual void add_group() = 0;
+
+  /** Load the aggregation buffer of group `g` from the fields of `agg_row` starting at `offset`. */
+  virtual void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) = 0;
+
+  /** Update the aggregation buffer of group `g` with the given input row. */
+  virtual void update(uint32_t g, const tuix::Row *row) = 0;
+
+  /**
+   * Write the fields of the aggregation buffer of group `g` to `builder`, appending their offsets to
+   * `fields`.
+   */
+  virtual void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+                     std::vector<flatbuffers::Offset<tuix::Field>> &fields) = 0;
+
+  /** The number of bytes of enclave memory held by the state of all groups. */
+  virtual size_t memory_usage() const = 0;
+
+  /**
+   * Return a native accumulator for the given aggregate expression, or nullptr if it must be
+   * computed by evaluating its update expressions.
+   */
+  static std::unique_ptr<Accumulator> create(const tuix::AggregateExpr *expr);
+
+protected:
+  static const tuix::Field *buffer_field(const tuix::Row *agg_row, uint32_t i) {
+    return agg_row->field_values()->Get(i);
+  }
+
+  static int64_t long_value(const tuix::Field *f) {
+    switch (f->value_type()) {
+    case tuix::FieldUnion_ByteField: return f->value_as_ByteField()->value();
+    case tuix::FieldUnion_ShortField: return f->value_as_ShortField()->value();
+    case tuix::FieldUnion_IntegerField: return f->value_as_IntegerField()->value();
+    case tuix::FieldUnion_LongField: return f->value_as_LongField()->value();
+    default:
+      throw std::runtime_error(
+        std::string("Can't aggregate ")
+        + std::string(tuix::EnumNameFieldUnion(f->value_type()))
+        + std::string(" as an integral value"));
+    }
+  }
+
+  static double double_value(const tuix::Field *f) {
+    switch (f->value_type()) {
+    case tuix::FieldUnion_FloatField: return f->value_as_FloatField()->value();
+    case tuix::FieldUnion_DoubleField: return f->value_as_DoubleField()->value();
+    default: return static_cast<double>(long_value(f));
+    }
+  }
+
+  static flatbuffers::Offset<tuix::Field> long_field(
+    flatbuffers::FlatBufferBuilder &builder, int64_t value, bool is_null) {
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_LongField, tuix::CreateLongField(builder, value).Union(), is_null);
+  }
+
+  static flatbuffers::Offset<tuix::Field> double_field(
+    flatbuffers::FlatBufferBuilder &builder, double value, bool is_null) {
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_DoubleField, tuix::CreateDoubleField(builder, value).Union(),
+      is_null);
+  }
+
+  static flatbuffers::Offset<tuix::Field> boolean_field(
+    flatbuffers::FlatBufferBuilder &builder, bool value) {
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_BooleanField, tuix::CreateBooleanField(builder, value).Union(),
+      false);
+  }
+};
+
+/**
+ * An Accumulator whose per-group state is a fixed-size Slot, stored contiguously and indexed by
+ * group.
+ */
+template<typename Slot>
+class SlotAccumulator : public Accumulator {
+public:
+  void reset(uint32_t num_groups) {
+    std::vector<Slot>(num_groups).swap(slots);
+  }
+
+  void add_group() {
+    slots.emplace_back();
+  }
+
+  size_t memory_usage() const {
+    return slots.size() * sizeof(Slot);
+  }
+
+protected:
+  std::vector<Slot> slots;
+};
+
+/** Holds a copy of one Field per group, for accumulators whose buffer is an input value. */
+class FieldSlots {
+public:
+  FieldSlots() : builder(), values(), values_size(0) {}
+
+  void reset(uint32_t num_groups) {
+    std::vector<std::vector<uint8_t>>(num_groups).swap(values);
+    values_size = 0;
+  }
+
+  void add_group() {
+    values.emplace_back();
+  }
+
+  void set(uint32_t g, const tuix::Field *f) {
+    builder.Clear();
+    builder.Finish(flatbuffers_copy(f, builder));
+    values_size -= values[g].size();
+    values[g].assign(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+    values_size += values[g].size();
+  }
+
+  const tuix::Field *get(uint32_t g) const {
+    return flatbuffers::GetRoot<tuix::Field>(values[g].data());
+  }
+
+  size_t memory_usage() const {
+    return values.size() * sizeof(std::vector<uint8_t>) + values_size;
+  }
+
+private:
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<std::vector<uint8_t>> values;
+  size_t values_size;
+};
+
+class CountAccumulator : public SlotAccumulator<int64_t> {
+public:
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    slots[g] = buffer_field(agg_row, offset)->value_as_LongField()->value();
+  }
+
+  void update(uint32_t g, const tuix::Row *) {
+    slots[g]++;
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    fields.push_back(long_field(builder, slots[g], false));
+  }
+};
+
+struct SumSlot {
+  int64_t long_sum;
+  double double_sum;
+  bool is_null;
+};
+
+/** Sum of an input, into a Long or Double buffer. As with Add, a null input makes the sum null. */
+class SumAccumulator : public SlotAccumulator<SumSlot> {
+public:
+  SumAccumulator(const tuix::Expr *input) : input(input), is_double(false) {}
+
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    const tuix::Field *f = buffer_field(agg_row, offset);
+    // The buffer type is that of the aggregate's result, which is the same for every group
+    is_double = f->value_type() == tuix::FieldUnion_DoubleField;
+    SumSlot &s = slots[g];
+    s.is_null = f->is_null();
+    s.long_sum = 0;
+    s.double_sum = 0;
+    if (is_double) {
+      s.double_sum = f->value_as_DoubleField()->value();
+    } else {
+      s.long_sum = long_value(f);
+    }
+  }
+
+  void update(uint32_t g, const tuix::Row *row) {
+    const tuix::Field *f = input.eval(row);
+    SumSlot &s = slots[g];
+    if (s.is_null || f->is_null()) {
+      s.is_null = true;
+    } else if (is_double) {
+      s.double_sum += double_value(f);
+    } else {
+      s.long_sum += long_value(f);
+    }
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    const SumSlot &s = slots[g];
+    fields.push_back(is_double
+                     ? double_field(builder, s.double_sum, s.is_null)
+                     : long_field(builder, s.long_sum, s.is_null));
+  }
+
+private:
+  FlatbuffersExpressionEvaluator input;
+  bool is_double;
+};
+
+struct AverageSlot {
+  double sum;
+  int64_t count;
+  bool sum_is_null;
+};
+
+/** Sum and count of an input, for Average. Every row is counted, as by the update expressions. */
+class AverageAccumulator : public SlotAccumulator<AverageSlot> {
+public:
+  AverageAccumulator(const tuix::Expr *input) : input(input) {}
+
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    const tuix::Field *f = buffer_field(agg_row, offset);
+    AverageSlot &s = slots[g];
+    s.sum = f->value_as_DoubleField()->value();
+    s.sum_is_null = f->is_null();
+    s.count = buffer_field(agg_row, offset + 1)->value_as_LongField()->value();
+  }
+
+  void update(uint32_t g, const tuix::Row *row) {
+    const tuix::Field *f = input.eval(row);
+    AverageSlot &s = slots[g];
+    if (s.sum_is_null || f->is_null()) {
+      s.sum_is_null = true;
+    } else {
+      s.sum += double_value(f);
+    }
+    s.count++;
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    const AverageSlot &s = slots[g];
+    fields.push_back(double_field(builder, s.sum, s.sum_is_null));
+    fields.push_back(long_field(builder, s.count, false));
+  }
+
+private:
+  FlatbuffersExpressionEvaluator input;
+};
+
+/**
+ * Maximum or minimum of an input, skipping nulls. Values are compared by their normalized sort
+ * keys, so the current extreme is copied only when it changes.
+ */
+template<bool is_max>
+class ExtremumAccumulator : public Accumulator {
+public:
+  ExtremumAccumulator(const tuix::Expr *input)
+    : input(input), values(), keys(), keys_size(0), candidate_key() {}
+
+  void reset(uint32_t num_groups) {
+    values.reset(num_groups);
+    std::vector<std::vector<uint8_t>>(num_groups).swap(keys);
+    keys_size = 0;
+  }
+
+  void add_group() {
+    values.add_group();
+    keys.emplace_back();
+  }
+
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    const tuix::Field *f = buffer_field(agg_row, offset);
+    values.set(g, f);
+    candidate_key.clear();
+    if (!f->is_null()) {
+      FlatbuffersSortOrderEvaluator::encode_field(f, candidate_key);
+    }
+    set_key(g);
+  }
+
+  void update(uint32_t g, const tuix::Row *row) {
+    const tuix::Field *f = input.eval(row);
+    if (f->is_null()) {
+      return;
+    }
+    candidate_key.clear();
+    FlatbuffersSortOrderEvaluator::encode_field(f, candidate_key);
+    // A group has a value exactly when its key is non-empty, because every encoded field is
+    bool has_value = !keys[g].empty();
+    int c = has_value ? FlatbuffersSortOrderEvaluator::compare_keys(candidate_key, keys[g]) : 0;
+    if (!has_value || (is_max ? c > 0 : c < 0)) {
+      values.set(g, f);
+      set_key(g);
+    }
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    fields.push_back(flatbuffers_copy(values.get(g), builder));
+  }
+
+  size_t memory_usage() const {
+    return values.memory_usage() + keys.size() * sizeof(std::vector<uint8_t>) + keys_size;
+  }
+
+private:
+  void set_key(uint32_t g) {
+    keys_size -= keys[g].size();
+    keys[g].assign(candidate_key.begin(), candidate_key.end());
+    keys_size += keys[g].size();
+  }
+
+  FlatbuffersExpressionEvaluator input;
+  FieldSlots values;
+  // The normalized sort key of each group's value, or empty if the group has no value yet
+  std::vector<std::vector<uint8_t>> keys;
+  size_t keys_size;
+  std::vector<uint8_t> candidate_key;
+};
+
+/** First or last value of an input, including nulls, with a flag recording whether it is set. */
+template<bool is_first>
+class FirstLastAccumulator : public Accumulator {
+public:
+  FirstLastAccumulator(const tuix::Expr *input) : input(input), values(), value_set() {}
+
+  void reset(uint32_t num_groups) {
+    values.reset(num_groups);
+    std::vector<uint8_t>(num_groups).swap(value_set);
+  }
+
+  void add_group() {
+    values.add_group();
+    value_set.push_back(false);
+  }
+
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    values.set(g, buffer_field(agg_row, offset));
+    value_set[g] = buffer_field(agg_row, offset + 1)->value_as_BooleanField()->value();
+  }
+
+  void update(uint32_t g, const tuix::Row *row) {
+    if (!is_first || !value_set[g]) {
+      values.set(g, input.eval(row));
+      value_set[g] = true;
+    }
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    fields.push_back(flatbuffers_copy(values.get(g), builder));
+    fields.push_back(boolean_field(builder, value_set[g]));
+  }
+
+  size_t memory_usage() const {
+    return values.memory_usage() + value_set.size();
+  }
+
+private:
+  FlatbuffersExpressionEvaluator input;
+  FieldSlots values;
+  std::vector<uint8_t> value_set;
+};
+
+struct VectorSumSlot {
+  std::vector<double> sum;
+  bool is_null;
+};
+
+/** Elementwise sum of Array[Double] inputs, as by VectorAdd. */
+class VectorSumAccumulator : public SlotAccumulator<VectorSumSlot> {
+public:
+  VectorSumAccumulator(const tuix::Expr *input) : input(input), sums_size(0) {}
+
+  void reset(uint32_t num_groups) {
+    SlotAccumulator<VectorSumSlot>::reset(num_groups);
+    sums_size = 0;
+  }
+
+  void load(uint32_t g, const tuix::Row *agg_row, uint32_t offset) {
+    const tuix::Field *f = buffer_field(agg_row, offset);
+    VectorSumSlot &s = slots[g];
+    s.is_null = f->is_null();
+    sums_size -= s.sum.size() * sizeof(double);
+    s.sum.clear();
+    add(s, f);
+  }
+
+  void update(uint32_t g, const tuix::Row *row) {
+    const tuix::Field *f = input.eval(row);
+    VectorSumSlot &s = slots[g];
+    if (s.is_null || f->is_null()) {
+      s.is_null = true;
+    } else {
+      add(s, f);
+    }
+  }
+
+  void write(uint32_t g, flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) {
+    const VectorSumSlot &s = slots[g];
+    std::vector<flatbuffers::Offset<tuix::Field>> elements;
+    if (!s.is_null) {
+      for (double x : s.sum) {
+        elements.push_back(double_field(builder, x, false));
+      }
+    }
+    fields.push_back(
+      tuix::CreateField(
+        builder,
+        tuix::FieldUnion_ArrayField,
+        tuix::CreateArrayFieldDirect(builder, &elements).Union(),
+        s.is_null));
+  }
+
+  size_t memory_usage() const {
+    return SlotAccumulator<VectorSumSlot>::memory_usage() + sums_size;
+  }
+
+private:
+  void add(VectorSumSlot &s, const tuix::Field *f) {
+    if (f->value_type() != tuix::FieldUnion_ArrayField) {
+      throw std::runtime_error(
+        std::string("VectorSum can't operate on ")
+        + std::string(tuix::EnumNameFieldUnion(f->value_type())));
+    }
+    auto v = f->value_as_ArrayField()->value();
+    if (s.sum.size() < v->size()) {
+      sums_size += (v->size() - s.sum.size()) * sizeof(double);
+      s.sum.resize(v->size(), 0.0);
+    }
+    for (flatbuffers::uoffset_t i = 0; i < v->size(); i++) {
+      if (v->Get(i)->value_type() != tuix::FieldUnion_DoubleField) {
+        throw std::runtime_error(
+          std::string("VectorSum expected Array[Double], but the array contained ")
+          + std::string(tuix::EnumNameFieldUnion(v->Get(i)->value_type())));
+      }
+      s.sum[i] += v->Get(i)->value_as_DoubleField()->value();
+    }
+  }
+
+  FlatbuffersExpressionEvaluator input;
+  // Bytes held by the elements of all groups' sums
+  size_t sums_size;
+};
+
+inline std::unique_ptr<Accumulator> Accumulator::create(const tuix::AggregateExpr *expr) {
+  Accumulator *result = nullptr;
+  switch (expr->kind()) {
+  case tuix::AggregateKind_Count: result = new CountAccumulator(); break;
+  case tuix::AggregateKind_Sum: result = new SumAccumulator(expr->input()); break;
+  case tuix::AggregateKind_Average: result = new AverageAccumulator(expr->input()); break;
+  case tuix::AggregateKind_Max: result = new ExtremumAccumulator<true>(expr->input()); break;
+  case tuix::AggregateKind_Min: result = new ExtremumAccumulator<false>(expr->input()); break;
+  case tuix::AggregateKind_First: result = new FirstLastAccumulator<true>(expr->input()); break;
+  case tuix::AggregateKind_Last: result = new FirstLastAccumulator<false>(expr->input()); break;
+  case tuix::AggregateKind_VectorSum: result = new VectorSumAccumulator(expr->input()); break;
+  default: break;
+  }
+  return std::unique_ptr<Accumulator>(result);
+}
+
 class FlatbuffersAggOpEvaluator {
 public:
   FlatbuffersAggOpEvaluator(uint8_t *buf, size_t len)
-    : a(nullptr), builder(), builder2() {
+    : a(nullptr), builder(), builder2(), init_builder(), init_row(nullptr), group(0),
+      num_groups(1) {
     flatbuffers::Verifier v(buf, len);
     if (!v.VerifyBuffer<tuix::AggregateOp>(nullptr)) {
       throw std::runtime_error(
@@ -1302,10 +3204,94 @@ public:
           new AggregateExpressionEvaluator(e)));
     }
 
+    // Use native accumulators only if every aggregate has one, because the update expressions
+    // of the others read the whole aggregation buffer
+    uint32_t offset = 0;
+    for (auto e : *agg_op->aggregate_expressions()) {
+      std::unique_ptr<Accumulator> acc = Accumulator::create(e);
+      if (!acc) {
+        accumulators.clear();
+        accumulator_offsets.clear();
+        break;
+      }
+      accumulators.push_back(std::move(acc));
+      accumulator_offsets.push_back(offset);
+      offset += e->initial_values()->size();
+    }
+    if (!accumulators.empty()) {
+      std::vector<flatbuffers::Offset<tuix::Field>> init_fields;
+      for (auto&& e : aggregate_evaluators) {
+        for (auto f : e->initial_values(nullptr)) {
+          init_fields.push_back(flatbuffers_copy<tuix::Field>(f, init_builder));
+        }
+      }
+      init_row = flatbuffers::GetTemporaryPointer<tuix::Row>(
+        init_builder, tuix::CreateRowDirect(init_builder, &init_fields));
+      for (auto&& acc : accumulators) {
+        acc->reset(num_groups);
+      }
+    }
+
+    reset_group();
+  }
+
+  /**
+   * Whether the aggregation buffers are native, in which case the evaluator can hold the partial
+   * aggregates of many groups at once in typed form (see add_group). Otherwise it holds a single
+   * aggregation buffer, which must be saved and restored with get_partial_agg and set.
+   */
+  bool has_group_slots() const {
+    return !accumulators.empty();
+  }
+
+  /** Whether there are no grouping expressions, so that all rows belong to a single group. */
+  bool is_global() const {
+    return grouping_evaluators.empty();
+  }
+
+  /**
+   * Add a group with the initial aggregation buffer and make it the current group, returning its
+   * index. Requires has_group_slots().
+   */
+  uint32_t add_group() {
+    for (auto&& acc : accumulators) {
+      acc->add_group();
+    }
+    group = num_groups++;
+    reset_group();
+    return group;
+  }
+
+  /** Make the given group, returned by add_group, the one that the other methods operate on. */
+  void select_group(uint32_t g) {
+    group = g;
+    a = nullptr;
+  }
+
+  /** Discard all groups, leaving a single current group with the initial aggregation buffer. */
+  void clear_groups() {
+    num_groups = 1;
+    group = 0;
+    for (auto&& acc : accumulators) {
+      acc->reset(num_groups);
+    }
     reset_group();
   }
 
+  /** The number of bytes of enclave memory held by the aggregation buffers of all groups. */
+  size_t groups_memory_usage() const {
+    size_t result = 0;
+    for (auto&& acc : accumulators) {
+      result += acc->memory_usage();
+    }
+    return result;
+  }
+
   void reset_group() {
+    if (!accumulators.empty()) {
+      load_accumulators(init_row);
+      return;
+    }
     builder2.Clear();
     // Write initial values to a
     std::vector<flatbuffers::Offset<tuix::Field>> init_fields;
@@ -1319,6 +3305,10 @@ public:
   }
 
   void set(const tuix::Row *agg_row) {
+    if (!accumulators.empty()) {
+      load_accumulators(agg_row ? agg_row : init_row);
+      return;
+    }
     builder2.Clear();
     if (agg_row) {
       a = flatbuffers::GetTemporaryPointer<tuix::Row>(
@@ -1329,6 +3319,13 @@ public:
   }
 
   void aggregate(const tuix::Row *row) {
+    if (!accumulators.empty()) {
+      for (auto&& acc : accumulators) {
+        acc->update(group, row);
+      }
+      a = nullptr;
+      return;
+    }
     builder.Clear();
     flatbuffers::Offset<tuix::Row> concat;
 
@@ -1356,10 +3353,21 @@ public:
   }
 
   const tuix::Row *get_partial_agg() {
+    if (a == nullptr) {
+      // Materialize the aggregation buffer from the native accumulators
+      builder2.Clear();
+      std::vector<flatbuffers::Offset<tuix::Field>> fields;
+      for (auto&& acc : accumulators) {
+        acc->write(group, builder2, fields);
+      }
+      a = flatbuffers::GetTemporaryPointer<tuix::Row>(
+        builder2, tuix::CreateRowDirect(builder2, &fields));
+    }
     return a;
   }
 
   const tuix::Row *evaluate() {
+    get_partial_agg();
     builder.Clear();
     std::vector<flatbuffers::Offset<tuix::Field>> output_fields;
     for (auto&& e : aggregate_evaluators) {
@@ -1396,14 +3404,56 @@ public:
     return true;
   }
 
+  /**
+   * Return a Row of the values of the grouping expressions for the given row. The result is
+   * invalidated by the next call to any method of this evaluator other than `set` or `reset_group`.
+   */
+  const tuix::Row *group_values(const tuix::Row *row) {
+    builder.Clear();
+    std::vector<flatbuffers::Offset<tuix::Field>> fields;
+    for (auto&& e : grouping_evaluators) {
+      fields.push_back(flatbuffers_copy<tuix::Field>(e->eval(row), builder));
+    }
+    return flatbuffers::GetTemporaryPointer<tuix::Row>(
+      builder, tuix::CreateRowDirect(builder, &fields));
+  }
+
+  /**
+   * Append the normalized grouping key of the given row to `key`. Two rows have equal keys exactly
+   * when they belong to the same group, with null grouping values forming their own group.
+   */
+  void append_group_key(const tuix::Row *row, std::vector<uint8_t> &key) {
+    for (auto&& e : grouping_evaluators) {
+      FlatbuffersSortOrderEvaluator::encode_field(e->eval(row), key);
+    }
+  }
+
 private:
-  // Pointer into builder2
+  void load_accumulators(const tuix::Row *agg_row) {
+    for (uint32_t i = 0; i < accumulators.size(); i++) {
+      accumulators[i]->load(group, agg_row, accumulator_offsets[i]);
+    }
+    a = nullptr;
+  }
+
+  // Pointer into builder2. When using native accumulators, null if it is stale.
   const tuix::Row *a;
 
   flatbuffers::FlatBufferBuilder builder;
   flatbuffers::FlatBufferBuilder builder2;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> grouping_evaluators;
   std::vector<std::unique_ptr<AggregateExpressionEvaluator>> aggregate_evaluators;
+
+  // Native accumulators for all aggregate expressions, or empty to evaluate update expressions.
+  // Each accumulator's buffer starts at the corresponding offset in the aggregation buffer.
+  std::vector<std::unique_ptr<Accumulator>> accumulators;
+  std::vector<uint32_t> accumulator_offsets;
+  // Initial aggregation buffer, for resetting the accumulators
+  flatbuffers::FlatBufferBuilder init_builder;
+  const tuix::Row *init_row;
+  // The group whose aggregation buffer the accumulators operate on, and the number of groups
+  uint32_t group;
+  uint32_t num_groups;
 };
 
 #endif
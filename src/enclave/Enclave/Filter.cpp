@@ -1,5 +1,6 @@
 #include "Filter.h"
 
+#include "BlockStats.h"
 #include "ExpressionEvaluation.h"
 #include "FlatbuffersReaders.h"
 #include "FlatbuffersWriters.h"
@@ -7,6 +8,70 @@
 
 using namespace edu::berkeley::cs::rise::opaque;
 
+static void check_condition_type(tuix::FieldUnion type) {
+  if (type != tuix::FieldUnion_BooleanField) {
+    throw std::runtime_error(
+      std::string("Filter expression expected to return BooleanField, instead returned ")
+      + std::string(tuix::EnumNameFieldUnion(type)));
+  }
+}
+
+/** Append the rows that satisfy the condition, evaluating it a batch at a time where possible. */
+static void filter_rows(FlatbuffersExpressionEvaluator &condition_eval,
+                        const tuix::Row *const *rows, uint32_t n, RowWriter &w) {
+  if (condition_eval.eval_batch(rows, n)) {
+    const ColumnVector &result = condition_eval.batch_result();
+    check_condition_type(result.type);
+    for (uint32_t k = 0; k < n; k++) {
+      if (result.is_null[k]) {
+        throw std::runtime_error("Filter expression returned null");
+      }
+      if (result.b[k]) {
+        w.append(rows[k]);
+      }
+    }
+  } else {
+    for (uint32_t k = 0; k < n; k++) {
+      const tuix::Field *condition_result = condition_eval.eval(rows[k]);
+      check_condition_type(condition_result->value_type());
+      if (condition_result->is_null()) {
+        throw std::runtime_error("Filter expression returned null");
+      }
+      if (static_cast<const tuix::BooleanField *>(condition_result->value())->value()) {
+        w.append(rows[k]);
+      }
+    }
+  }
+}
+
+/**
+ * Append the rows among [start, start + n) of the given columns that satisfy the condition,
+ * evaluating it over the columns and assembling only the rows that are kept. Returns false,
+ * appending nothing, if the condition cannot be evaluated over the columns.
+ */
+static bool filter_columns(FlatbuffersExpressionEvaluator &condition_eval,
+                           const ColumnSource &columns, uint32_t start, uint32_t n,
+                           RowWriter &w) {
+  if (!condition_eval.eval_batch(columns, start, n)) {
+    return false;
+  }
+  const ColumnVector &result = condition_eval.batch_result();
+  check_condition_type(result.type);
+  for (uint32_t k = 0; k < n; k++) {
+    if (result.is_null[k]) {
+      throw std::runtime_error("Filter expression returned null");
+    }
+    if (result.b[k]) {
+      w.append_fields(
+        columns.num_columns(),
+        [&](uint32_t j, flatbuffers::FlatBufferBuilder &builder) {
+          return columns.write_field(start + k, j, builder);
+        });
+    }
+  }
+  return true;
+}
+
 void filter(uint8_t *condition, size_t condition_length,
             uint8_t *input_rows, size_t input_rows_length,
             uint8_t **output_rows, size_t *output_rows_length) {
@@ -14,25 +79,55 @@ void filter(uint8_t *condition, size_t condition_length,
   BufferRefView<tuix::FilterExpr> condition_buf(condition, condition_length);
   condition_buf.verify();
   FlatbuffersExpressionEvaluator condition_eval(condition_buf.root()->condition());
+  BlockStatsFilter stats_filter(condition_buf.root()->condition());
 
-  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  EncryptedBlocksToEncryptedBlockReader r(
+    BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  EncryptedBlockToRowReader block_reader;
+  EncryptedBlockToColumnReader column_reader;
   RowWriter w;
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-    const tuix::Field *condition_result = condition_eval.eval(row);
-    if (condition_result->value_type() != tuix::FieldUnion_BooleanField) {
-      throw std::runtime_error(
-        std::string("Filter expression expected to return BooleanField, instead returned ")
-        + std::string(tuix::EnumNameFieldUnion(condition_result->value_type())));
+  std::vector<const tuix::Row *> rows;
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    // Skip blocks whose statistics show that none of their rows can match, without decrypting them
+    if (!stats_filter.may_match(*it)) {
+      continue;
     }
-    if (condition_result->is_null()) {
-      throw std::runtime_error("Filter expression returned null");
+
+    // Keep columnar input columnar, and keep statistics for downstream filters
+    w.set_format(it->format());
+    w.set_block_stats(it->enc_stats() != nullptr);
+    rows.clear();
+
+    if (EncryptedBlockToColumnReader::supports(it->format())) {
+      // Evaluate the condition over the columns a batch at a time, and only assemble rows for
+      // batches that it cannot be evaluated on by column
+      column_reader.reset(*it);
+      const ColumnSource &columns = column_reader.source();
+      for (uint32_t start = 0; start < columns.num_rows(); start += EVAL_BATCH_SIZE) {
+        uint32_t n = std::min(EVAL_BATCH_SIZE, columns.num_rows() - start);
+        if (!filter_columns(condition_eval, columns, start, n, w)) {
+          if (rows.empty()) {
+            const tuix::Rows *block_rows = column_reader.assemble_rows();
+            for (auto row = block_rows->rows()->begin(); row != block_rows->rows()->end(); ++row) {
+              rows.push_back(*row);
+            }
+          }
+          filter_rows(condition_eval, &rows[start], n, w);
+        }
+      }
+      continue;
+    }
+
+    block_reader.reset(*it);
+    while (block_reader.has_next()) {
+      rows.push_back(block_reader.next());
     }
 
-    bool keep_row = static_cast<const tuix::BooleanField *>(condition_result->value())->value();
-    if (keep_row) {
-      w.append(row);
+    // Evaluate the condition a batch at a time, producing a selection of rows to keep
+    for (uint32_t start = 0; start < rows.size(); start += EVAL_BATCH_SIZE) {
+      uint32_t n = std::min(EVAL_BATCH_SIZE, static_cast<uint32_t>(rows.size()) - start);
+      filter_rows(condition_eval, &rows[start], n, w);
     }
   }
 
@@ -243,13 +243,16 @@ flatbuffers::Offset<tuix::Field> flatbuffers_copy(
   case tuix::FieldUnion_StringField:
   {
     auto string_field = static_cast<const tuix::StringField *>(field->value());
-    std::vector<uint8_t> string_data(string_field->value()->begin(),
-                                     string_field->value()->end());
+    // Copy the bytes straight from the source buffer rather than through a temporary vector
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> string_data;
+    if (string_field->value() != nullptr) {
+      string_data = builder.CreateVector(
+        string_field->value()->data(), string_field->value()->size());
+    }
     return tuix::CreateField(
       builder,
       tuix::FieldUnion_StringField,
-      tuix::CreateStringFieldDirect(
-        builder, &string_data, string_field->length()).Union(),
+      tuix::CreateStringField(builder, string_data, string_field->length()).Union(),
       is_null);
   }
   case tuix::FieldUnion_DateField:
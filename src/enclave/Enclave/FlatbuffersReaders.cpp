@@ -1,16 +1,111 @@
 #include "FlatbuffersReaders.h"
 
-void EncryptedBlockToRowReader::reset(const tuix::EncryptedBlock *encrypted_block) {
-  uint32_t num_rows = encrypted_block->num_rows();
+void EncryptedBlockToColumnReader::reset(const tuix::EncryptedBlock *encrypted_block,
+                                         const std::vector<bool> *columns) {
+  rows = nullptr;
+  if (!supports(encrypted_block->format())) {
+    throw std::runtime_error(
+      std::string("Cannot read EncryptedBlock in format ")
+      + std::string(tuix::EnumNameBlockFormat(encrypted_block->format()))
+      + std::string(" by column"));
+  }
+  if (encrypted_block->format() == tuix::BlockFormat_ColumnChunks) {
+    read_column_chunks(encrypted_block, columns);
+    source_ptr = &columns_reader;
+    return;
+  }
 
-  const size_t rows_len = dec_size(encrypted_block->enc_rows()->size());
-  rows_buf.reset(new uint8_t[rows_len]);
+  const size_t block_len = dec_size(encrypted_block->enc_rows()->size());
+  block_buf.reset(new uint8_t[block_len]);
+  const uint8_t format_aad = encrypted_block->format();
   decrypt(encrypted_block->enc_rows()->data(), encrypted_block->enc_rows()->size(),
-          rows_buf.get());
-  BufferRefView<tuix::Rows> buf(rows_buf.get(), rows_len);
-  buf.verify();
+          block_buf.get(), &format_aad, 1);
+
+  uint32_t num_rows;
+  if (encrypted_block->format() == tuix::BlockFormat_Columnar) {
+    BufferRefView<tuix::ColumnarRows> buf(block_buf.get(), block_len);
+    buf.verify();
+
+    const tuix::ColumnarRows *columnar = buf.root();
+    if (columnar->columns() == nullptr) {
+      throw std::runtime_error("ColumnarRows is missing its columns");
+    }
+    columns_reader.reset(
+      columnar->num_rows(),
+      std::vector<const tuix::Column *>(columnar->columns()->begin(), columnar->columns()->end()));
+    source_ptr = &columns_reader;
+    num_rows = columnar->num_rows();
+  } else {
+    BufferRefView<tuix::PackedRows> buf(block_buf.get(), block_len);
+    buf.verify();
+
+    packed_reader.reset(new PackedRowsReader(buf.root()));
+    source_ptr = packed_reader.get();
+    num_rows = packed_reader->num_rows();
+  }
+
+  if (num_rows != encrypted_block->num_rows()) {
+    throw std::runtime_error(
+      std::string("EncryptedBlock claimed to contain ")
+      + std::to_string(encrypted_block->num_rows())
+      + std::string(" rows but actually contains ")
+      + std::to_string(num_rows)
+      + std::string(" rows"));
+  }
+}
+
+const tuix::Rows *EncryptedBlockToColumnReader::assemble_rows() {
+  if (rows == nullptr) {
+    rows_builder.Clear();
+    source_ptr->write_rows(rows_builder);
+    rows = flatbuffers::GetRoot<tuix::Rows>(rows_builder.GetBufferPointer());
+  }
+  return rows;
+}
+
+void EncryptedBlockToRowReader::reset(const tuix::EncryptedBlock *encrypted_block,
+                                      const std::vector<bool> *columns) {
+  uint32_t num_rows = encrypted_block->num_rows();
+  this->encrypted_block = encrypted_block;
+  streaming = false;
+
+  if (EncryptedBlockToColumnReader::supports(encrypted_block->format())) {
+    if (!column_reader) {
+      column_reader.reset(new EncryptedBlockToColumnReader);
+    }
+    column_reader->reset(encrypted_block, columns);
+    rows = column_reader->assemble_rows();
+  } else if (encrypted_block->format() == tuix::BlockFormat_RowChunks) {
+    // Concatenate the chunks for the range-style interface
+    if (encrypted_block->enc_row_chunks() == nullptr) {
+      throw std::runtime_error("EncryptedBlock in RowChunks format is missing its chunks");
+    }
+    if (!rows_builder) {
+      rows_builder.reset(new flatbuffers::FlatBufferBuilder);
+    }
+    rows_builder->Clear();
+    std::vector<flatbuffers::Offset<tuix::Row>> row_offsets;
+    for (uint32_t i = 0; i < encrypted_block->enc_row_chunks()->size(); i++) {
+      const tuix::Rows *chunk_rows = read_row_chunk(i);
+      for (auto it = chunk_rows->rows()->begin(); it != chunk_rows->rows()->end(); ++it) {
+        row_offsets.push_back(flatbuffers_copy(*it, *rows_builder));
+      }
+    }
+    rows_builder->Finish(tuix::CreateRowsDirect(*rows_builder, &row_offsets));
+    rows = flatbuffers::GetRoot<tuix::Rows>(rows_builder->GetBufferPointer());
+  } else {
+    const size_t rows_len = dec_size(encrypted_block->enc_rows()->size());
+    rows_buf.reset(new uint8_t[rows_len]);
+    const uint8_t format_aad = encrypted_block->format();
+    decrypt(encrypted_block->enc_rows()->data(), encrypted_block->enc_rows()->size(),
+            rows_buf.get(), &format_aad, 1);
+
+    BufferRefView<tuix::Rows> buf(rows_buf.get(), rows_len);
+    buf.verify();
+
+    rows = buf.root();
+  }
 
-  rows = buf.root();
   if (rows->rows()->size() != num_rows) {
     throw std::runtime_error(
       std::string("EncryptedBlock claimed to contain ")
@@ -24,6 +119,121 @@ void EncryptedBlockToRowReader::reset(const tuix::EncryptedBlock *encrypted_bloc
   initialized = true;
 }
 
+void EncryptedBlockToRowReader::reset_streaming(const tuix::EncryptedBlock *encrypted_block) {
+  if (encrypted_block->format() != tuix::BlockFormat_RowChunks) {
+    reset(encrypted_block);
+    return;
+  }
+  if (encrypted_block->enc_row_chunks() == nullptr
+      || encrypted_block->enc_row_chunks()->size() == 0) {
+    throw std::runtime_error("EncryptedBlock in RowChunks format is missing its chunks");
+  }
+
+  this->encrypted_block = encrypted_block;
+  streaming = true;
+  chunk_idx = 0;
+  rows_before_chunk = 0;
+  rows = read_row_chunk(0);
+  row_idx = 0;
+  initialized = true;
+}
+
+bool EncryptedBlockToRowReader::next_row_chunk() {
+  while (row_idx == rows->rows()->size()) {
+    if (chunk_idx + 1 == encrypted_block->enc_row_chunks()->size()) {
+      if (rows_before_chunk + rows->rows()->size() != encrypted_block->num_rows()) {
+        throw std::runtime_error(
+          std::string("EncryptedBlock claimed to contain ")
+          + std::to_string(encrypted_block->num_rows())
+          + std::string(" rows but its chunks contain ")
+          + std::to_string(rows_before_chunk + rows->rows()->size())
+          + std::string(" rows"));
+      }
+      return false;
+    }
+    rows_before_chunk += rows->rows()->size();
+    chunk_idx++;
+    rows = read_row_chunk(chunk_idx);
+    row_idx = 0;
+  }
+  return true;
+}
+
+const tuix::Rows *EncryptedBlockToRowReader::read_row_chunk(uint32_t i) {
+  auto block_id = encrypted_block->block_id();
+  auto enc_chunk = encrypted_block->enc_row_chunks()->Get(i)->enc_chunk();
+  if (block_id == nullptr || enc_chunk == nullptr
+      || enc_chunk->size() < SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE) {
+    throw std::runtime_error("EncryptedBlock in RowChunks format is missing its chunks");
+  }
+
+  // Reuse the buffer's capacity across chunks
+  row_chunk_buf.resize(dec_size(enc_chunk->size()));
+  const uint8_t format_aad = encrypted_block->format();
+  decrypt(enc_chunk->data(), enc_chunk->size(), row_chunk_buf.data(), &format_aad, 1);
+  BufferRefView<tuix::RowChunk> buf(row_chunk_buf.data(), row_chunk_buf.size());
+  buf.verify();
+
+  const tuix::RowChunk *chunk = buf.root();
+  if (chunk->block_id() == nullptr || chunk->block_id()->size() != block_id->size()
+      || memcmp(chunk->block_id()->data(), block_id->data(), block_id->size()) != 0
+      || chunk->index() != i
+      || chunk->num_chunks() != encrypted_block->enc_row_chunks()->size()
+      || chunk->rows() == nullptr || chunk->rows()->rows() == nullptr) {
+    throw std::runtime_error(
+      std::string("Row chunk ")
+      + std::to_string(i)
+      + std::string(" does not belong to its EncryptedBlock"));
+  }
+  return chunk->rows();
+}
+
+void EncryptedBlockToColumnReader::read_column_chunks(
+  const tuix::EncryptedBlock *encrypted_block, const std::vector<bool> *columns) {
+  auto block_id = encrypted_block->block_id();
+  auto enc_columns = encrypted_block->enc_columns();
+  if (block_id == nullptr || enc_columns == nullptr) {
+    throw std::runtime_error("EncryptedBlock in ColumnChunks format is missing its chunks");
+  }
+
+  // Decrypt the needed chunks as one batch
+  const uint32_t num_cols = enc_columns->size();
+  chunk_bufs.resize(num_cols);
+  std::vector<uint32_t> needed;
+  std::vector<CryptoBatchItem> batch;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    if (columns != nullptr && !(j < columns->size() && (*columns)[j])) {
+      continue;
+    }
+
+    auto enc_chunk = enc_columns->Get(j)->enc_chunk();
+    chunk_bufs[j].resize(dec_size(enc_chunk->size()));
+    needed.push_back(j);
+    batch.push_back(CryptoBatchItem{enc_chunk->data(), enc_chunk->size(), chunk_bufs[j].data()});
+  }
+  const uint8_t format_aad = encrypted_block->format();
+  decrypt_batch(batch, &format_aad, 1);
+
+  std::vector<const tuix::Column *> chunk_columns(num_cols, nullptr);
+  for (uint32_t j : needed) {
+    BufferRefView<tuix::ColumnChunk> buf(chunk_bufs[j].data(), chunk_bufs[j].size());
+    buf.verify();
+
+    const tuix::ColumnChunk *chunk = buf.root();
+    if (chunk->block_id() == nullptr || chunk->block_id()->size() != block_id->size()
+        || memcmp(chunk->block_id()->data(), block_id->data(), block_id->size()) != 0
+        || chunk->index() != j || chunk->num_columns() != num_cols
+        || chunk->num_rows() != encrypted_block->num_rows() || chunk->column() == nullptr) {
+      throw std::runtime_error(
+        std::string("Column chunk ")
+        + std::to_string(j)
+        + std::string(" does not belong to its EncryptedBlock"));
+    }
+    chunk_columns[j] = chunk->column();
+  }
+  columns_reader.reset(encrypted_block->num_rows(), chunk_columns);
+}
+
 RowReader::RowReader(BufferRefView<tuix::EncryptedBlocks> buf) {
   reset(buf);
 }
@@ -38,8 +248,10 @@ void RowReader::reset(BufferRefView<tuix::EncryptedBlocks> buf) {
 }
 
 void RowReader::reset(const tuix::EncryptedBlocks *encrypted_blocks) {
+  prefetched.clear();
   this->encrypted_blocks = encrypted_blocks;
   block_idx = 0;
+  prefetch_depth = 0;
   init_block_reader();
 }
 
@@ -67,9 +279,35 @@ const tuix::Row *RowReader::next() {
   return block_reader.next();
 }
 
+void RowReader::enable_prefetch(uint32_t max_depth) {
+  prefetch_depth = max_depth;
+  prefetch_next_blocks();
+}
+
 void RowReader::init_block_reader() {
   if (block_idx < encrypted_blocks->blocks()->size()) {
-    block_reader.reset(encrypted_blocks->blocks()->Get(block_idx));
+    if (!prefetched.empty() && prefetched.front()->block_idx == block_idx) {
+      prefetched.front()->task.wait();
+      std::swap(block_reader, prefetched.front()->reader);
+      prefetched.pop_front();
+    } else {
+      prefetched.clear();
+      block_reader.reset_streaming(encrypted_blocks->blocks()->Get(block_idx));
+    }
+    prefetch_next_blocks();
+  }
+}
+
+void RowReader::prefetch_next_blocks() {
+  // Without workers a prefetched block would only be decrypted when the reader reaches it, so it
+  // would hold its memory early for no overlap
+  const uint32_t depth = std::min(prefetch_depth, num_workers());
+  uint32_t next_idx = prefetched.empty() ? block_idx + 1 : prefetched.back()->block_idx + 1;
+  while (next_idx <= block_idx + depth && next_idx < encrypted_blocks->blocks()->size()) {
+    prefetched.emplace_back(
+      new PrefetchedBlock(encrypted_blocks->blocks()->Get(next_idx), next_idx));
+    prefetched.back()->task.submit();
+    next_idx++;
   }
 }
 
@@ -90,6 +328,21 @@ uint32_t SortedRunsReader::num_runs() {
   return sorted_runs->runs()->size();
 }
 
+const tuix::EncryptedBlock *SortedRunsReader::first_block() {
+  if (num_runs() == 0 || sorted_runs->runs()->Get(0)->blocks()->size() == 0) {
+    return nullptr;
+  }
+  return sorted_runs->runs()->Get(0)->blocks()->Get(0);
+}
+
+tuix::BlockFormat SortedRunsReader::block_format() {
+  return first_block() != nullptr ? first_block()->format() : tuix::BlockFormat_RowMajor;
+}
+
+bool SortedRunsReader::block_stats() {
+  return first_block() != nullptr && first_block()->enc_stats() != nullptr;
+}
+
 bool SortedRunsReader::run_has_next(uint32_t run_idx) {
   return run_readers[run_idx].has_next();
 }
@@ -97,3 +350,8 @@ bool SortedRunsReader::run_has_next(uint32_t run_idx) {
 const tuix::Row *SortedRunsReader::next_from_run(uint32_t run_idx) {
   return run_readers[run_idx].next();
 }
+
+void SortedRunsReader::enable_prefetch(uint32_t run_idx) {
+  // A merge keeps many runs open at once, so only the next block of each is kept ahead
+  run_readers[run_idx].enable_prefetch(1);
+}
@@ -1,25 +1,99 @@
+#include <deque>
+#include <memory>
+
+#include "Columnar.h"
 #include "Flatbuffers.h"
+#include "PackedRows.h"
+#include "WorkerPool.h"
 
 #ifndef FLATBUFFERS_READERS_H
 #define FLATBUFFERS_READERS_H
 
 using namespace edu::berkeley::cs::rise::opaque;
 
+/**
+ * A reader for the columns of an EncryptedBlock in a columnar or packed format, which lets
+ * operators work on the columns directly instead of on rows assembled from them.
+ */
+class EncryptedBlockToColumnReader {
+public:
+  EncryptedBlockToColumnReader() : source_ptr(nullptr), rows(nullptr) {}
+
+  /** Whether blocks in the given format can be read by column. */
+  static bool supports(tuix::BlockFormat format) {
+    return format == tuix::BlockFormat_Columnar || format == tuix::BlockFormat_ColumnChunks
+      || format == tuix::BlockFormat_Packed;
+  }
+
+  /**
+   * Decrypt and check the given block, whose format must be supported. If `columns` is given,
+   * only the columns j with `(*columns)[j]` are guaranteed to be read. Blocks in the ColumnChunks
+   * format then skip decrypting the other columns.
+   */
+  void reset(const tuix::EncryptedBlock *encrypted_block,
+             const std::vector<bool> *columns = nullptr);
+
+  /** The columns of the block. Only valid until the next reset. */
+  const ColumnSource &source() const {
+    return *source_ptr;
+  }
+
+  /**
+   * The block transposed into Rows, for callers that cannot work on the columns. The fields of
+   * columns that were not read are null placeholders. Only valid until the next reset.
+   */
+  const tuix::Rows *assemble_rows();
+
+private:
+  void read_column_chunks(const tuix::EncryptedBlock *encrypted_block,
+                          const std::vector<bool> *columns);
+
+  // The decrypted ColumnarRows or PackedRows
+  std::unique_ptr<uint8_t> block_buf;
+  std::vector<std::vector<uint8_t>> chunk_bufs;
+  ColumnsReader columns_reader;
+  std::unique_ptr<PackedRowsReader> packed_reader;
+  // Whichever of the readers holds the current block
+  const ColumnSource *source_ptr;
+  flatbuffers::FlatBufferBuilder rows_builder;
+  // The assembled rows, or null if they have not been assembled since the last reset
+  const tuix::Rows *rows;
+};
+
 /**
  * A reader for Row objects within an EncryptedBlock object that provides both iterator-based and
- * range-style interfaces.
+ * range-style interfaces. Blocks in the columnar and packed formats are converted back into Rows on
+ * reset, using an EncryptedBlockToColumnReader.
  */
 class EncryptedBlockToRowReader {
 public:
-  EncryptedBlockToRowReader() : rows(nullptr), initialized(false) {}
+  EncryptedBlockToRowReader()
+    : encrypted_block(nullptr), streaming(false), chunk_idx(0), rows_before_chunk(0),
+      rows(nullptr), initialized(false) {}
+
+  /**
+   * Decrypt the given block. If `columns` is given, only the columns j with `(*columns)[j]` are
+   * guaranteed to be read. Blocks in the ColumnChunks format then skip decrypting the other
+   * columns, whose fields are left as null placeholders.
+   */
+  void reset(const tuix::EncryptedBlock *encrypted_block,
+             const std::vector<bool> *columns = nullptr);
 
-  void reset(const tuix::EncryptedBlock *encrypted_block);
+  /**
+   * Like reset, but a block in the RowChunks format is decrypted and verified one chunk at a time
+   * as next() reaches it, into a single reused buffer, so that only one chunk's plaintext is held
+   * at once. Only the iterator-based interface may be used until the next reset.
+   */
+  void reset_streaming(const tuix::EncryptedBlock *encrypted_block);
 
   bool has_next() {
-    return initialized && row_idx < rows->rows()->size();
+    return initialized && (row_idx < rows->rows()->size() || (streaming && next_row_chunk()));
   }
 
   const tuix::Row *next() {
+    if (streaming && row_idx == rows->rows()->size()) {
+      next_row_chunk();
+    }
     return rows->rows()->Get(row_idx++);
   }
 
@@ -32,7 +106,26 @@ public:
   }
 
 private:
+  /** Decrypt and verify chunk `i` of a RowChunks block into row_chunk_buf and return its rows. */
+  const tuix::Rows *read_row_chunk(uint32_t i);
+  /**
+   * Move to the next non-empty chunk of a streamed RowChunks block, returning false at the end of
+   * the block.
+   */
+  bool next_row_chunk();
+
+  const tuix::EncryptedBlock *encrypted_block;
+  bool streaming;
+  uint32_t chunk_idx;
+  // Number of rows in the chunks before chunk_idx
+  uint32_t rows_before_chunk;
+  std::vector<uint8_t> row_chunk_buf;
+
   std::unique_ptr<uint8_t> rows_buf;
+  // Reads blocks in the columnar formats, whose rows it assembles
+  std::unique_ptr<EncryptedBlockToColumnReader> column_reader;
+  // Holds the concatenated chunks of a RowChunks block
+  std::unique_ptr<flatbuffers::FlatBufferBuilder> rows_builder;
   const tuix::Rows *rows;
   uint32_t row_idx;
   bool initialized;
@@ -52,12 +145,37 @@ public:
   /** Access the next Row. Invalidates any previously-returned Row pointers. */
   const tuix::Row *next();
 
+  /**
+   * Decrypt and verify the blocks following the current one ahead of time on the enclave's worker
+   * threads (see WorkerPool.h), so that next() does not stall on decryption when the current block
+   * runs out. One block is kept ahead per worker, up to `max_depth`, each holding as much enclave
+   * memory as the current block. Without workers, nothing is prefetched.
+   */
+  void enable_prefetch(uint32_t max_depth = UINT32_MAX);
+
 private:
+  /** A block being decrypted ahead of the consumer. */
+  struct PrefetchedBlock {
+    PrefetchedBlock(const tuix::EncryptedBlock *block, uint32_t block_idx)
+      : block_idx(block_idx), reader(),
+        task([this, block]() { reader.reset_streaming(block); }) {}
+
+    uint32_t block_idx;
+    EncryptedBlockToRowReader reader;
+    // Declared last so that it is destroyed, and hence finished, before the reader it fills
+    WorkerTask task;
+  };
+
   void init_block_reader();
+  void prefetch_next_blocks();
 
   const tuix::EncryptedBlocks *encrypted_blocks;
   uint32_t block_idx;
   EncryptedBlockToRowReader block_reader;
+  // Maximum number of blocks to keep ahead, or 0 if prefetching is disabled
+  uint32_t prefetch_depth;
+  // Consecutive blocks following block_idx, in order
+  std::deque<std::unique_ptr<PrefetchedBlock>> prefetched;
 };
 
 /**
@@ -73,14 +191,22 @@ public:
   void reset(BufferRefView<tuix::SortedRuns> buf);
 
   uint32_t num_runs();
+  /** The layout of the first block of the first run, or RowMajor if there are no blocks. */
+  tuix::BlockFormat block_format();
+  /** Whether the first block of the first run carries statistics. */
+  bool block_stats();
   bool run_has_next(uint32_t run_idx);
   /**
    * Access the next Row from the given run. Invalidates any previously-returned Row pointers from
    * the same run.
    */
   const tuix::Row *next_from_run(uint32_t run_idx);
+  /** Decrypt the next block of the given run ahead of time. See RowReader::enable_prefetch. */
+  void enable_prefetch(uint32_t run_idx);
 
 private:
+  const tuix::EncryptedBlock *first_block();
+
   const tuix::SortedRuns *sorted_runs;
   std::vector<RowReader> run_readers;
 };
@@ -1,5 +1,7 @@
 #include "FlatbuffersWriters.h"
 
+#include <sgx_trts.h>
+
 void RowWriter::clear() {
   builder.Clear();
   rows_vector.clear();
@@ -76,24 +78,178 @@ void RowWriter::maybe_finish_block() {
 
 void RowWriter::finish_block() {
   builder.Finish(tuix::CreateRowsDirect(builder, &rows_vector));
-  size_t enc_rows_len = enc_size(builder.GetSize());
+  const tuix::Rows *rows = flatbuffers::GetRoot<tuix::Rows>(builder.GetBufferPointer());
 
-  uint8_t *enc_rows_ptr = nullptr;
-  ocall_malloc(enc_rows_len, &enc_rows_ptr);
+  std::vector<tuix::FieldUnion> field_types;
+  tuix::BlockFormat block_format = format;
+  if (format != tuix::BlockFormat_RowMajor && format != tuix::BlockFormat_RowChunks
+      && !columnar_field_types(rows, &field_types)) {
+    block_format = tuix::BlockFormat_RowMajor;
+  }
 
-  std::unique_ptr<uint8_t, decltype(&ocall_free)> enc_rows(enc_rows_ptr, &ocall_free);
-  encrypt(builder.GetBufferPointer(), builder.GetSize(), enc_rows.get());
+  // The format is stored in the clear, so it is authenticated as the additional data of the row
+  // data, and of each of its chunks
+  const uint8_t format_aad = block_format;
+  // The statistics are bound to the block by the MAC of enc_rows, or by block_id
+  std::vector<uint8_t> tag;
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> enc_rows;
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> enc_block_id;
+  flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<tuix::EncryptedColumnChunk>>>
+    enc_columns;
+  flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<tuix::EncryptedRowChunk>>>
+    enc_row_chunks;
+  if (block_format == tuix::BlockFormat_RowMajor) {
+    enc_rows = encrypt_buffer(builder, &format_aad, 1, &tag);
+  } else if (block_format == tuix::BlockFormat_Columnar) {
+    columnar_builder.Clear();
+    rows_to_columnar(rows, columnar_builder);
+    enc_rows = encrypt_buffer(columnar_builder, &format_aad, 1, &tag);
+  } else if (block_format == tuix::BlockFormat_Packed) {
+    columnar_builder.Clear();
+    rows_to_packed(rows, columnar_builder);
+    enc_rows = encrypt_buffer(columnar_builder, &format_aad, 1, &tag);
+  } else if (block_format == tuix::BlockFormat_RowChunks) {
+    uint8_t block_id[BLOCK_ID_SIZE];
+    sgx_read_rand(block_id, BLOCK_ID_SIZE);
+    tag.assign(block_id, block_id + BLOCK_ID_SIZE);
+
+    // Split the rows into consecutive chunks of about MAX_ROW_CHUNK_SIZE bytes
+    std::vector<std::vector<flatbuffers::Offset<tuix::Row>>> chunk_rows;
+    for (auto it = rows->rows()->begin(); it != rows->rows()->end(); ++it) {
+      if (chunk_rows.empty() || chunk_builders[chunk_rows.size() - 1]->GetSize()
+          >= MAX_ROW_CHUNK_SIZE) {
+        chunk_rows.emplace_back();
+        if (chunk_builders.size() < chunk_rows.size()) {
+          chunk_builders.emplace_back(new flatbuffers::FlatBufferBuilder);
+        }
+        chunk_builders[chunk_rows.size() - 1]->Clear();
+      }
+      chunk_rows.back().push_back(flatbuffers_copy(*it, *chunk_builders[chunk_rows.size() - 1]));
+    }
+
+    const uint32_t num_chunks = chunk_rows.size();
+    std::vector<const flatbuffers::FlatBufferBuilder *> chunks(num_chunks);
+    for (uint32_t i = 0; i < num_chunks; i++) {
+      flatbuffers::FlatBufferBuilder &chunk_builder = *chunk_builders[i];
+      auto chunk_block_id = chunk_builder.CreateVector(block_id, BLOCK_ID_SIZE);
+      auto chunk_rows_offset = tuix::CreateRowsDirect(chunk_builder, &chunk_rows[i]);
+      chunk_builder.Finish(
+        tuix::CreateRowChunk(chunk_builder, chunk_block_id, i, num_chunks, chunk_rows_offset));
+      chunks[i] = &chunk_builder;
+    }
+
+    auto enc_chunk_bufs = encrypt_buffers(chunks, &format_aad, 1);
+    std::vector<flatbuffers::Offset<tuix::EncryptedRowChunk>> enc_chunks(num_chunks);
+    for (uint32_t i = 0; i < num_chunks; i++) {
+      enc_chunks[i] = tuix::CreateEncryptedRowChunk(enc_block_builder, enc_chunk_bufs[i]);
+    }
+
+    enc_block_id = enc_block_builder.CreateVector(block_id, BLOCK_ID_SIZE);
+    enc_row_chunks = enc_block_builder.CreateVector(enc_chunks);
+  } else {
+    // Encrypt each column separately, binding the chunks to the block with a random identifier
+    uint8_t block_id[BLOCK_ID_SIZE];
+    sgx_read_rand(block_id, BLOCK_ID_SIZE);
+    tag.assign(block_id, block_id + BLOCK_ID_SIZE);
+
+    const uint32_t num_cols = field_types.size();
+    while (chunk_builders.size() < num_cols) {
+      chunk_builders.emplace_back(new flatbuffers::FlatBufferBuilder);
+    }
+    std::vector<const flatbuffers::FlatBufferBuilder *> chunks(num_cols);
+    for (uint32_t j = 0; j < num_cols; j++) {
+      flatbuffers::FlatBufferBuilder &chunk_builder = *chunk_builders[j];
+      chunk_builder.Clear();
+      auto column = build_column(rows, j, field_types[j], chunk_builder);
+      auto chunk_block_id = chunk_builder.CreateVector(block_id, BLOCK_ID_SIZE);
+      chunk_builder.Finish(
+        tuix::CreateColumnChunk(
+          chunk_builder, chunk_block_id, j, num_cols, rows_vector.size(), column));
+      chunks[j] = &chunk_builder;
+    }
+
+    auto enc_chunk_bufs = encrypt_buffers(chunks, &format_aad, 1);
+    std::vector<flatbuffers::Offset<tuix::EncryptedColumnChunk>> enc_chunks(num_cols);
+    for (uint32_t j = 0; j < num_cols; j++) {
+      enc_chunks[j] = tuix::CreateEncryptedColumnChunk(enc_block_builder, enc_chunk_bufs[j]);
+    }
+
+    enc_block_id = enc_block_builder.CreateVector(block_id, BLOCK_ID_SIZE);
+    enc_columns = enc_block_builder.CreateVector(enc_chunks);
+  }
+
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> enc_stats;
+  if (block_stats) {
+    columnar_builder.Clear();
+    if (write_block_stats(rows, tag, columnar_builder)) {
+      enc_stats = encrypt_buffer(columnar_builder, nullptr, 0);
+    }
+  }
 
   enc_block_vector.push_back(
     tuix::CreateEncryptedBlock(
       enc_block_builder,
       rows_vector.size(),
-      enc_block_builder.CreateVector(enc_rows.get(), enc_rows_len)));
+      enc_rows,
+      block_format,
+      enc_block_id,
+      enc_columns,
+      enc_stats,
+      enc_row_chunks));
 
   builder.Clear();
+  columnar_builder.Clear();
   rows_vector.clear();
 }
 
+flatbuffers::Offset<flatbuffers::Vector<uint8_t>> RowWriter::encrypt_buffer(
+  const flatbuffers::FlatBufferBuilder &plaintext, const uint8_t *aad, uint32_t aad_length,
+  std::vector<uint8_t> *mac) {
+  size_t enc_len = enc_size(plaintext.GetSize());
+
+  uint8_t *enc_ptr = nullptr;
+  ocall_malloc(enc_len, &enc_ptr);
+
+  std::unique_ptr<uint8_t, decltype(&ocall_free)> enc(enc_ptr, &ocall_free);
+  encrypt(plaintext.GetBufferPointer(), plaintext.GetSize(), enc.get(), aad, aad_length);
+  if (mac != nullptr) {
+    mac->assign(enc.get() + enc_len - SGX_AESGCM_MAC_SIZE, enc.get() + enc_len);
+  }
+
+  return enc_block_builder.CreateVector(enc.get(), enc_len);
+}
+
+std::vector<flatbuffers::Offset<flatbuffers::Vector<uint8_t>>> RowWriter::encrypt_buffers(
+  const std::vector<const flatbuffers::FlatBufferBuilder *> &plaintexts,
+  const uint8_t *aad, uint32_t aad_length) {
+  // Encrypt into a single untrusted allocation, rather than one per buffer
+  size_t total_enc_len = 0;
+  for (auto plaintext : plaintexts) {
+    total_enc_len += enc_size(plaintext->GetSize());
+  }
+
+  uint8_t *enc_ptr = nullptr;
+  ocall_malloc(total_enc_len, &enc_ptr);
+  std::unique_ptr<uint8_t, decltype(&ocall_free)> enc(enc_ptr, &ocall_free);
+
+  std::vector<CryptoBatchItem> batch(plaintexts.size());
+  uint8_t *out = enc.get();
+  for (size_t i = 0; i < plaintexts.size(); i++) {
+    batch[i].input = plaintexts[i]->GetBufferPointer();
+    batch[i].input_length = plaintexts[i]->GetSize();
+    batch[i].output = out;
+    out += enc_size(batch[i].input_length);
+  }
+  encrypt_batch(batch, aad, aad_length);
+
+  std::vector<flatbuffers::Offset<flatbuffers::Vector<uint8_t>>> result(plaintexts.size());
+  for (size_t i = 0; i < plaintexts.size(); i++) {
+    result[i] = enc_block_builder.CreateVector(
+      batch[i].output, enc_size(batch[i].input_length));
+  }
+  return result;
+}
+
 flatbuffers::Offset<tuix::EncryptedBlocks> RowWriter::finish_blocks() {
   if (rows_vector.size() > 0) {
     finish_block();
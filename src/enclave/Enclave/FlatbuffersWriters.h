@@ -1,4 +1,7 @@
 #include "Flatbuffers.h"
+#include "Columnar.h"
+#include "PackedRows.h"
+#include "BlockStats.h"
 
 #ifndef FLATBUFFERS_WRITERS_H
 #define FLATBUFFERS_WRITERS_H
@@ -22,11 +25,29 @@ public:
 class RowWriter {
 public:
   RowWriter()
-    : builder(), rows_vector(), total_num_rows(0), untrusted_alloc(),
+    : builder(), rows_vector(), total_num_rows(0), format(tuix::BlockFormat_RowMajor),
+      block_stats(false), columnar_builder(), untrusted_alloc(),
       enc_block_builder(1024, &untrusted_alloc), finished(false) {}
 
   void clear();
 
+  /**
+   * Set the layout of the blocks written from now on. Blocks requested in a columnar or packed
+   * format are written row-major if their rows have no such representation (see
+   * columnar_field_types).
+   */
+  void set_format(tuix::BlockFormat format) {
+    this->format = format;
+  }
+
+  /**
+   * Set whether the blocks written from now on carry encrypted per-column statistics, which let
+   * filters skip them (see BlockStatsFilter).
+   */
+  void set_block_stats(bool block_stats) {
+    this->block_stats = block_stats;
+  }
+
   /** Append the given Row. */
   void append(const tuix::Row *row);
 
@@ -36,6 +57,22 @@ public:
   /** Concatenate the fields of the two given `Row`s and append the resulting single Row. */
   void append(const tuix::Row *row1, const tuix::Row *row2);
 
+  /**
+   * Append a Row of `num_fields` fields, each of which is written directly into this writer by
+   * `write_field(i, builder)`, which returns the offset of the Field it wrote. This lets computed
+   * values be materialized once, in place, instead of being built elsewhere and then copied.
+   */
+  template<typename F>
+  void append_fields(uint32_t num_fields, F write_field) {
+    std::vector<flatbuffers::Offset<tuix::Field>> field_values(num_fields);
+    for (uint32_t i = 0; i < num_fields; i++) {
+      field_values[i] = write_field(i, builder);
+    }
+    rows_vector.push_back(tuix::CreateRowDirect(builder, &field_values));
+    total_num_rows++;
+    maybe_finish_block();
+  }
+
   /** Expose the stored rows as a buffer. */
   UntrustedBufferRef<tuix::EncryptedBlocks> output_buffer();
 
@@ -48,12 +85,35 @@ public:
 private:
   void maybe_finish_block();
   void finish_block();
+  /**
+   * Encrypt the finished buffer in `plaintext` with the given additional authenticated data (see
+   * encrypt) into a vector in enc_block_builder. If `mac` is given, it is set to the MAC of the
+   * ciphertext.
+   */
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encrypt_buffer(
+    const flatbuffers::FlatBufferBuilder &plaintext, const uint8_t *aad, uint32_t aad_length,
+    std::vector<uint8_t> *mac = nullptr);
+  /**
+   * Encrypt the finished buffers in `plaintexts` as one batch with the given additional
+   * authenticated data (see encrypt_batch), writing each ciphertext into a vector in
+   * enc_block_builder.
+   */
+  std::vector<flatbuffers::Offset<flatbuffers::Vector<uint8_t>>> encrypt_buffers(
+    const std::vector<const flatbuffers::FlatBufferBuilder *> &plaintexts,
+    const uint8_t *aad, uint32_t aad_length);
   flatbuffers::Offset<tuix::EncryptedBlocks> finish_blocks();
 
   flatbuffers::FlatBufferBuilder builder;
   std::vector<flatbuffers::Offset<tuix::Row>> rows_vector;
   uint32_t total_num_rows;
 
+  tuix::BlockFormat format;
+  bool block_stats;
+  flatbuffers::FlatBufferBuilder columnar_builder;
+  // One builder per chunk for the ColumnChunks and RowChunks formats, so that the chunks are
+  // encrypted together
+  std::vector<std::unique_ptr<flatbuffers::FlatBufferBuilder>> chunk_builders;
+
   // For writing the resulting EncryptedBlocks
   UntrustedMemoryAllocator untrusted_alloc;
   flatbuffers::FlatBufferBuilder enc_block_builder;
@@ -64,6 +124,43 @@ private:
   friend class SortedRunsWriter;
 };
 
+/**
+ * Append-only container for plaintext rows held in enclave memory, for operators that need to read
+ * the same rows repeatedly. Rows are stored contiguously in a single builder and addressed by index.
+ */
+class RowArena {
+public:
+  RowArena() : builder(), offsets() {}
+
+  void clear() {
+    builder.Clear();
+    offsets.clear();
+  }
+
+  /** Append a copy of the given Row. */
+  void append(const tuix::Row *row) {
+    offsets.push_back(flatbuffers_copy(row, builder));
+  }
+
+  uint32_t num_rows() const {
+    return offsets.size();
+  }
+
+  /** The number of bytes used by the stored rows. */
+  size_t size() const {
+    return builder.GetSize();
+  }
+
+  /** Access the given Row. Invalidated by the next call to `append` or `clear`. */
+  const tuix::Row *get(uint32_t i) {
+    return flatbuffers::GetTemporaryPointer<tuix::Row>(builder, offsets[i]);
+  }
+
+private:
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<tuix::Row>> offsets;
+};
+
 /** Append-only container for rows wrapped in tuix::SortedRuns. */
 class SortedRunsWriter {
 public:
@@ -71,6 +168,16 @@ public:
 
   void clear();
 
+  /** Set the layout of the blocks written from now on. See RowWriter::set_format. */
+  void set_format(tuix::BlockFormat format) {
+    container.set_format(format);
+  }
+
+  /** See RowWriter::set_block_stats. */
+  void set_block_stats(bool block_stats) {
+    container.set_block_stats(block_stats);
+  }
+
   /** Append the given Row. */
   void append(const tuix::Row *row);
 
@@ -80,6 +187,12 @@ public:
   /** Concatenate the fields of the two given `Row`s and append the resulting single Row. */
   void append(const tuix::Row *row1, const tuix::Row *row2);
 
+  /** See RowWriter::append_fields. */
+  template<typename F>
+  void append_fields(uint32_t num_fields, F write_field) {
+    container.append_fields(num_fields, write_field);
+  }
+
   /**
    * Wrap all rows written since the last call to this method into a single sorted run.
    */
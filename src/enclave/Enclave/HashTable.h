@@ -0,0 +1,151 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef HASH_TABLE_H
+#define HASH_TABLE_H
+
+/**
+ * An open-addressing hash table with linear probing that maps byte-string keys, such as normalized
+ * join or grouping keys, to uint32_t values. Keys are copied into a contiguous arena owned by the
+ * table, so callers can pass temporary key buffers.
+ */
+class ByteKeyHashTable {
+public:
+  ByteKeyHashTable() : slots(INITIAL_CAPACITY), keys(), num_keys(0) {}
+
+  /** Return a pointer to the value for the given key, or nullptr if the key is absent. */
+  uint32_t *find(const uint8_t *key, uint32_t key_len) {
+    uint64_t h = hash(key, key_len);
+    for (size_t i = h & mask(); slots[i].occupied; i = (i + 1) & mask()) {
+      if (matches(slots[i], h, key, key_len)) {
+        return &slots[i].value;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Return a reference to the value for the given key, first inserting the key with the given value
+   * if it is absent. Sets `inserted` to indicate which happened. The reference is invalidated by the
+   * next insertion.
+   */
+  uint32_t &insert(const uint8_t *key, uint32_t key_len, uint32_t value, bool *inserted) {
+    // Keep the load factor at most 3/4
+    if ((num_keys + 1) * 4 > slots.size() * 3) {
+      grow();
+    }
+
+    uint64_t h = hash(key, key_len);
+    size_t i = h & mask();
+    for (; slots[i].occupied; i = (i + 1) & mask()) {
+      if (matches(slots[i], h, key, key_len)) {
+        *inserted = false;
+        return slots[i].value;
+      }
+    }
+
+    Slot &s = slots[i];
+    s.occupied = true;
+    s.hash = h;
+    s.key_offset = keys.size();
+    s.key_len = key_len;
+    s.value = value;
+    keys.insert(keys.end(), key, key + key_len);
+    num_keys++;
+    *inserted = true;
+    return s.value;
+  }
+
+  /** Call f(key, key_len, value) for each entry, in unspecified order. */
+  template<typename F>
+  void for_each(F f) {
+    for (auto it = slots.begin(); it != slots.end(); ++it) {
+      if (it->occupied) {
+        f(keys.data() + it->key_offset, it->key_len, it->value);
+      }
+    }
+  }
+
+  uint32_t size() const {
+    return num_keys;
+  }
+
+  /** The number of bytes of enclave memory held by the table. */
+  size_t memory_usage() const {
+    return slots.size() * sizeof(Slot) + keys.size();
+  }
+
+  void clear() {
+    slots.assign(INITIAL_CAPACITY, Slot());
+    keys.clear();
+    num_keys = 0;
+  }
+
+  /**
+   * Hash the given key. Different seeds give independent hash functions, for example to
+   * repartition keys that collided under the default seed.
+   */
+  static uint64_t hash(const uint8_t *key, uint32_t key_len, uint64_t seed = 0) {
+    uint64_t h = (0x9e3779b97f4a7c15ull + seed * 0xc2b2ae3d27d4eb4full) ^ key_len;
+    uint32_t i = 0;
+    for (; i + 8 <= key_len; i += 8) {
+      uint64_t w;
+      memcpy(&w, key + i, 8);
+      h = (h ^ w) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    }
+    if (i < key_len) {
+      uint64_t w = 0;
+      memcpy(&w, key + i, key_len - i);
+      h = (h ^ w) * 0xff51afd7ed558ccdull;
+    }
+    // Finalize so that the low bits used to pick a slot depend on every key byte
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+private:
+  static const size_t INITIAL_CAPACITY = 16;
+
+  struct Slot {
+    Slot() : hash(0), key_offset(0), key_len(0), value(0), occupied(false) {}
+    uint64_t hash;
+    size_t key_offset;
+    uint32_t key_len;
+    uint32_t value;
+    bool occupied;
+  };
+
+  size_t mask() const {
+    return slots.size() - 1;
+  }
+
+  bool matches(const Slot &s, uint64_t h, const uint8_t *key, uint32_t key_len) const {
+    return s.hash == h && s.key_len == key_len
+      && (key_len == 0 || memcmp(keys.data() + s.key_offset, key, key_len) == 0);
+  }
+
+  void grow() {
+    std::vector<Slot> old_slots(slots.size() * 2);
+    old_slots.swap(slots);
+    for (auto it = old_slots.begin(); it != old_slots.end(); ++it) {
+      if (it->occupied) {
+        size_t i = it->hash & mask();
+        while (slots[i].occupied) {
+          i = (i + 1) & mask();
+        }
+        slots[i] = *it;
+      }
+    }
+  }
+
+  std::vector<Slot> slots;
+  std::vector<uint8_t> keys;
+  uint32_t num_keys;
+};
+
+#endif
@@ -1,8 +1,13 @@
 #include "Join.h"
 
+#include <list>
+#include <memory>
+#include <sgx_thread.h>
+
 #include "ExpressionEvaluation.h"
 #include "FlatbuffersReaders.h"
 #include "FlatbuffersWriters.h"
+#include "HashTable.h"
 #include "common.h"
 
 void scan_collect_last_primary(
@@ -40,18 +45,91 @@ void scan_collect_last_primary(
   w.output_buffer(output_rows, output_rows_length);
 }
 
+/**
+ * The primary rows of the current join group. The rows are kept as plaintext in enclave memory so
+ * that each matching foreign row can be joined against them without re-encrypting and re-decrypting
+ * the group. A group larger than `max_cache_size` bytes is instead spilled to encrypted untrusted
+ * memory, which is encrypted once and decrypted once per matching foreign row. Each spilled group
+ * is counted in `num_spilled` if it is given.
+ */
+class PrimaryGroup {
+public:
+  PrimaryGroup(size_t max_cache_size, uint32_t *num_spilled)
+    : max_cache_size(max_cache_size), num_spilled(num_spilled), cache(), spilled(),
+      is_spilled(false), spilled_buf() {}
+
+  void clear() {
+    cache.clear();
+    if (is_spilled) {
+      spilled.clear();
+      spilled_buf.reset();
+      is_spilled = false;
+    }
+  }
+
+  void append(const tuix::Row *row) {
+    if (is_spilled) {
+      if (spilled_buf) {
+        throw std::runtime_error("Invalid attempt to add a primary row to a group after joining it");
+      }
+      spilled.append(row);
+      return;
+    }
+
+    cache.append(row);
+    if (cache.size() > max_cache_size) {
+      for (uint32_t i = 0; i < cache.num_rows(); i++) {
+        spilled.append(cache.get(i));
+      }
+      cache.clear();
+      is_spilled = true;
+      if (num_spilled != nullptr) {
+        (*num_spilled)++;
+      }
+    }
+  }
+
+  /** Call f on each primary row of the group. */
+  template<typename F>
+  void for_each(F f) {
+    if (!is_spilled) {
+      for (uint32_t i = 0; i < cache.num_rows(); i++) {
+        f(cache.get(i));
+      }
+      return;
+    }
+
+    if (!spilled_buf) {
+      spilled_buf.reset(new UntrustedBufferRef<tuix::EncryptedBlocks>(spilled.output_buffer()));
+    }
+    RowReader reader(spilled_buf->view());
+    while (reader.has_next()) {
+      f(reader.next());
+    }
+  }
+
+private:
+  size_t max_cache_size;
+  uint32_t *num_spilled;
+  RowArena cache;
+  RowWriter spilled;
+  bool is_spilled;
+  std::unique_ptr<UntrustedBufferRef<tuix::EncryptedBlocks>> spilled_buf;
+};
+
 void non_oblivious_sort_merge_join(
   uint8_t *join_expr, size_t join_expr_length,
   uint8_t *input_rows, size_t input_rows_length,
   uint8_t *join_row, size_t join_row_length,
-  uint8_t **output_rows, size_t *output_rows_length) {
+  uint8_t **output_rows, size_t *output_rows_length,
+  size_t max_group_cache_size, uint32_t *num_spilled_groups) {
 
   FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
   RowReader j(BufferRefView<tuix::EncryptedBlocks>(join_row, join_row_length));
   RowWriter w;
 
-  RowWriter primary_group;
+  PrimaryGroup primary_group(max_group_cache_size, num_spilled_groups);
   FlatbuffersTemporaryRow last_primary_of_group;
   while (j.has_next()) {
     const tuix::Row *row = j.next();
@@ -78,25 +156,220 @@ void non_oblivious_sort_merge_join(
       // Output the joined rows resulting from this foreign row
       if (last_primary_of_group.get()
           && join_expr_eval.is_same_group(last_primary_of_group.get(), current)) {
-        auto primary_group_buffer = primary_group.output_buffer();
-        RowReader primary_group_reader(primary_group_buffer.view());
-        while (primary_group_reader.has_next()) {
-          const tuix::Row *primary = primary_group_reader.next();
-
-          if (!join_expr_eval.is_same_group(primary, current)) {
-            throw std::runtime_error(
-              std::string("Invariant violation: rows of primary_group "
-                          "are not of the same group: ")
-              + to_string(primary)
-              + std::string(" vs ")
-              + to_string(current));
-          }
+        primary_group.for_each([&](const tuix::Row *primary) {
+            if (!join_expr_eval.is_same_group(primary, current)) {
+              throw std::runtime_error(
+                std::string("Invariant violation: rows of primary_group "
+                            "are not of the same group: ")
+                + to_string(primary)
+                + std::string(" vs ")
+                + to_string(current));
+            }
 
-          w.append(primary, current);
-        }
+            w.append(primary, current);
+          });
+      }
+    }
+  }
+
+  w.output_buffer(output_rows, output_rows_length);
+}
+
+// Marks the end of a chain of rows that share a join key in a JoinHashTable
+static const uint32_t NO_NEXT_ROW = UINT32_MAX;
+
+/**
+ * A hash table over the rows of one side of a join, keyed by normalized join key. The table maps
+ * each key to the most recently added row with that key, and rows with the same key are chained
+ * through next_row. Once built, the table is only read, so it can be probed concurrently.
+ */
+class JoinHashTable {
+public:
+  /** Build the table from the given rows. Rows with a null join key are skipped. */
+  JoinHashTable(FlatbuffersJoinExprEvaluator &join_expr_eval,
+                BufferRefView<tuix::EncryptedBlocks> buf) {
+    std::vector<uint8_t> key;
+    RowReader r(buf);
+    while (r.has_next()) {
+      const tuix::Row *row = r.next();
+      key.clear();
+      if (!join_expr_eval.append_key(row, key)) {
+        continue;
+      }
+
+      uint32_t row_idx = rows.num_rows();
+      rows.append(row);
+      bool inserted;
+      uint32_t &head = table.insert(key.data(), key.size(), row_idx, &inserted);
+      next_row.push_back(inserted ? NO_NEXT_ROW : head);
+      head = row_idx;
+    }
+  }
+
+  /** Call f on each row whose join key equals the given key. */
+  template<typename F>
+  void for_each_match(const std::vector<uint8_t> &key, F f) {
+    uint32_t *head = table.find(key.data(), key.size());
+    if (head == nullptr) {
+      return;
+    }
+    for (uint32_t i = *head; i != NO_NEXT_ROW; i = next_row[i]) {
+      f(rows.get(i));
+    }
+  }
+
+private:
+  RowArena rows;
+  std::vector<uint32_t> next_row;
+  ByteKeyHashTable table;
+};
+
+void non_oblivious_hash_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *primary_rows, size_t primary_rows_length,
+  uint8_t *foreign_rows, size_t foreign_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+  JoinHashTable table(
+    join_expr_eval, BufferRefView<tuix::EncryptedBlocks>(primary_rows, primary_rows_length));
+
+  // Stream the foreign rows through the table in a single pass
+  RowReader f(BufferRefView<tuix::EncryptedBlocks>(foreign_rows, foreign_rows_length));
+  f.enable_prefetch();
+  RowWriter w;
+  std::vector<uint8_t> key;
+  while (f.has_next()) {
+    const tuix::Row *current = f.next();
+    key.clear();
+    if (!join_expr_eval.append_key(current, key)) {
+      continue;
+    }
+
+    table.for_each_match(key, [&](const tuix::Row *primary) {
+        w.append(primary, current);
+      });
+  }
+
+  w.output_buffer(output_rows, output_rows_length);
+}
+
+/**
+ * Hash tables built from broadcast join inputs, most recently used first, so that each enclave
+ * decrypts and indexes a broadcast input once rather than once per task. An entry is keyed by the
+ * join expression followed by the IV and MAC of each encrypted block or column chunk of the input,
+ * which together identify its ciphertext.
+ */
+static std::list<std::pair<std::vector<uint8_t>, std::shared_ptr<JoinHashTable>>>
+broadcast_tables;
+static sgx_thread_mutex_t broadcast_tables_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
+/** Holds a mutex for the lifetime of this object. */
+class MutexGuard {
+public:
+  MutexGuard(sgx_thread_mutex_t *mutex) : mutex(mutex) {
+    sgx_thread_mutex_lock(mutex);
+  }
+  ~MutexGuard() {
+    sgx_thread_mutex_unlock(mutex);
+  }
+
+private:
+  sgx_thread_mutex_t *mutex;
+};
+
+std::shared_ptr<JoinHashTable> get_broadcast_table(
+  FlatbuffersJoinExprEvaluator &join_expr_eval,
+  uint8_t *join_expr, size_t join_expr_length,
+  BufferRefView<tuix::EncryptedBlocks> build_buf) {
+
+  build_buf.verify();
+  std::vector<uint8_t> cache_key(join_expr, join_expr + join_expr_length);
+  auto append_iv_and_mac = [&](const flatbuffers::Vector<uint8_t> *ciphertext) {
+    if (ciphertext == nullptr
+        || ciphertext->size() < SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE) {
+      throw std::runtime_error("Broadcast join input contains a truncated encrypted block");
+    }
+    cache_key.insert(cache_key.end(), ciphertext->data(), ciphertext->data() + SGX_AESGCM_IV_SIZE);
+    cache_key.insert(cache_key.end(),
+                     ciphertext->data() + ciphertext->size() - SGX_AESGCM_MAC_SIZE,
+                     ciphertext->data() + ciphertext->size());
+  };
+  for (auto block : *build_buf.root()->blocks()) {
+    if (block->format() == tuix::BlockFormat_ColumnChunks && block->enc_columns() != nullptr) {
+      for (auto chunk : *block->enc_columns()) {
+        append_iv_and_mac(chunk->enc_chunk());
+      }
+    } else if (block->format() == tuix::BlockFormat_RowChunks
+               && block->enc_row_chunks() != nullptr) {
+      for (auto chunk : *block->enc_row_chunks()) {
+        append_iv_and_mac(chunk->enc_chunk());
+      }
+    } else {
+      append_iv_and_mac(block->enc_rows());
+    }
+  }
+
+  {
+    MutexGuard guard(&broadcast_tables_lock);
+    for (auto it = broadcast_tables.begin(); it != broadcast_tables.end(); ++it) {
+      if (it->first == cache_key) {
+        broadcast_tables.splice(broadcast_tables.begin(), broadcast_tables, it);
+        return broadcast_tables.front().second;
       }
     }
   }
 
+  // Build outside the lock so that other joins are not blocked. Concurrent tasks that miss on the
+  // same input may each build it; only the first to finish is cached.
+  std::shared_ptr<JoinHashTable> table(new JoinHashTable(join_expr_eval, build_buf));
+
+  MutexGuard guard(&broadcast_tables_lock);
+  for (auto it = broadcast_tables.begin(); it != broadcast_tables.end(); ++it) {
+    if (it->first == cache_key) {
+      return it->second;
+    }
+  }
+  broadcast_tables.emplace_front(std::move(cache_key), table);
+  while (broadcast_tables.size() > MAX_BROADCAST_JOIN_TABLES) {
+    broadcast_tables.pop_back();
+  }
+  return table;
+}
+
+void broadcast_hash_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *build_rows, size_t build_rows_length,
+  uint8_t *stream_rows, size_t stream_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+  std::shared_ptr<JoinHashTable> table = get_broadcast_table(
+    join_expr_eval, join_expr, join_expr_length,
+    BufferRefView<tuix::EncryptedBlocks>(build_rows, build_rows_length));
+
+  RowReader r(BufferRefView<tuix::EncryptedBlocks>(stream_rows, stream_rows_length));
+  r.enable_prefetch();
+  RowWriter w;
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *current = r.next();
+    key.clear();
+    if (!join_expr_eval.append_key(current, key)) {
+      continue;
+    }
+
+    // Output rows always put the primary row first, whichever side was broadcast
+    if (join_expr_eval.is_primary(current)) {
+      table->for_each_match(key, [&](const tuix::Row *foreign) {
+          w.append(current, foreign);
+        });
+    } else {
+      table->for_each_match(key, [&](const tuix::Row *primary) {
+          w.append(primary, current);
+        });
+    }
+  }
+
   w.output_buffer(output_rows, output_rows_length);
 }
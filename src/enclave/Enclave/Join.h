@@ -1,6 +1,8 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "define.h"
+
 #ifndef JOIN_H
 #define JOIN_H
 
@@ -9,10 +11,43 @@ void scan_collect_last_primary(
   uint8_t *input_rows, size_t input_rows_length,
   uint8_t **output_rows, size_t *output_rows_length);
 
+/**
+ * Join the given rows, which are sorted by join key with each group's primary rows first, joining
+ * each foreign row with the primary rows of its group. `join_row` holds the primary rows of the
+ * group that ends the previous partition (see scan_collect_last_primary).
+ *
+ * A group's primary rows are spilled to encrypted untrusted memory once they exceed
+ * max_group_cache_size bytes. Only tests pass a smaller value, so that small groups spill; the
+ * number of spilled groups is then added to num_spilled_groups if it is given.
+ */
 void non_oblivious_sort_merge_join(
     uint8_t *join_expr, size_t join_expr_length,
     uint8_t *input_rows, size_t input_rows_length,
     uint8_t *join_row, size_t join_row_length,
+    uint8_t **output_rows, size_t *output_rows_length,
+    size_t max_group_cache_size = MAX_JOIN_GROUP_CACHE_SIZE,
+    uint32_t *num_spilled_groups = nullptr);
+
+/**
+ * Join the given primary and foreign rows, which must cover the same range of join keys, by
+ * building a hash table over the primary rows inside the enclave and probing it with each foreign
+ * row. Neither input needs to be sorted. Rows with a null join key match nothing.
+ */
+void non_oblivious_hash_join(
+    uint8_t *join_expr, size_t join_expr_length,
+    uint8_t *primary_rows, size_t primary_rows_length,
+    uint8_t *foreign_rows, size_t foreign_rows_length,
+    uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Join each of the given stream rows against all of the given build rows, which are the broadcast
+ * side of the join and may be the primary or the foreign table. The hash table built from the build
+ * rows is cached inside the enclave, so tasks that join against the same broadcast input share it.
+ */
+void broadcast_hash_join(
+    uint8_t *join_expr, size_t join_expr_length,
+    uint8_t *build_rows, size_t build_rows_length,
+    uint8_t *stream_rows, size_t stream_rows_length,
     uint8_t **output_rows, size_t *output_rows_length);
 
 #endif
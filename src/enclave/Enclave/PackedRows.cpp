@@ -0,0 +1,289 @@
+#include "PackedRows.h"
+
+#include "ExpressionEvaluation.h"
+
+namespace {
+
+/** The width of a slot holding a value of the given type, or 0 if it has no packed encoding. */
+uint32_t slot_width(tuix::ColType type) {
+  switch (type) {
+  case tuix::ColType_BooleanType:
+  case tuix::ColType_ByteType:
+    return 1;
+  case tuix::ColType_ShortType:
+    return 2;
+  case tuix::ColType_IntegerType:
+  case tuix::ColType_DateType:
+  case tuix::ColType_FloatType:
+    return 4;
+  case tuix::ColType_LongType:
+  case tuix::ColType_TimestampType:
+  case tuix::ColType_DoubleType:
+  case tuix::ColType_StringType:
+  case tuix::ColType_BinaryType:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/** Store the value of the given field in its slot as a T. */
+template<typename T, typename TuixField>
+void store_value(const tuix::Field *field, uint8_t *slot) {
+  const TuixField *value = static_cast<const TuixField *>(field->value());
+  T v = value != nullptr ? static_cast<T>(value->value()) : T();
+  memcpy(slot, &v, sizeof(T));
+}
+
+/** Append the bytes of the given field to `var_data` and store their location in its slot. */
+template<typename TuixField>
+void store_var_len(const tuix::Field *field, uint8_t *slot, std::vector<uint8_t> &var_data) {
+  const TuixField *value = static_cast<const TuixField *>(field->value());
+  uint32_t offset = var_data.size();
+  uint32_t len = 0;
+  if (value != nullptr && value->value() != nullptr) {
+    len = std::min(value->length(), value->value()->size());
+    var_data.insert(var_data.end(), value->value()->data(), value->value()->data() + len);
+  }
+  memcpy(slot, &offset, sizeof(uint32_t));
+  memcpy(slot + sizeof(uint32_t), &len, sizeof(uint32_t));
+}
+
+}
+
+bool rows_to_packed(const tuix::Rows *rows, flatbuffers::FlatBufferBuilder &builder) {
+  std::vector<tuix::FieldUnion> field_types;
+  if (!columnar_field_types(rows, &field_types)) {
+    return false;
+  }
+
+  const uint32_t num_rows = rows->rows()->size();
+  const uint32_t num_cols = field_types.size();
+  std::vector<uint8_t> types(num_cols);
+  std::vector<uint32_t> slot_offsets(num_cols);
+  uint32_t record_width = (num_cols + 7) / 8;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    tuix::ColType col_type;
+    column_type_for(field_types[j], &col_type);
+    types[j] = col_type;
+    slot_offsets[j] = record_width;
+    record_width += slot_width(col_type);
+  }
+
+  // Slots of null values are left zeroed
+  std::vector<uint8_t> records(static_cast<size_t>(num_rows) * record_width);
+  std::vector<uint8_t> var_data;
+  for (uint32_t i = 0; i < num_rows; i++) {
+    uint8_t *record = records.data() + static_cast<size_t>(i) * record_width;
+    auto fields = rows->rows()->Get(i)->field_values();
+    for (uint32_t j = 0; j < num_cols; j++) {
+      const tuix::Field *field = fields->Get(j);
+      uint8_t *slot = record + slot_offsets[j];
+      if (field->is_null()) {
+        record[j / 8] |= 1 << (j % 8);
+        continue;
+      }
+      switch (field_types[j]) {
+      case tuix::FieldUnion_BooleanField:
+        store_value<uint8_t, tuix::BooleanField>(field, slot);
+        break;
+      case tuix::FieldUnion_ByteField:
+        store_value<int8_t, tuix::ByteField>(field, slot);
+        break;
+      case tuix::FieldUnion_ShortField:
+        store_value<int16_t, tuix::ShortField>(field, slot);
+        break;
+      case tuix::FieldUnion_IntegerField:
+        store_value<int32_t, tuix::IntegerField>(field, slot);
+        break;
+      case tuix::FieldUnion_DateField:
+        store_value<int32_t, tuix::DateField>(field, slot);
+        break;
+      case tuix::FieldUnion_LongField:
+        store_value<int64_t, tuix::LongField>(field, slot);
+        break;
+      case tuix::FieldUnion_TimestampField:
+        store_value<int64_t, tuix::TimestampField>(field, slot);
+        break;
+      case tuix::FieldUnion_FloatField:
+        store_value<float, tuix::FloatField>(field, slot);
+        break;
+      case tuix::FieldUnion_DoubleField:
+        store_value<double, tuix::DoubleField>(field, slot);
+        break;
+      case tuix::FieldUnion_StringField:
+        store_var_len<tuix::StringField>(field, slot, var_data);
+        break;
+      case tuix::FieldUnion_BinaryField:
+        store_var_len<tuix::BinaryField>(field, slot, var_data);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  builder.Finish(tuix::CreatePackedRowsDirect(builder, num_rows, &types, &records, &var_data));
+  return true;
+}
+
+PackedRowsReader::PackedRowsReader(const tuix::PackedRows *packed)
+  : n(packed->num_rows()), types(), slot_offsets(), record_width(0), records(nullptr),
+    var_data(nullptr) {
+  if (packed->types() == nullptr || packed->records() == nullptr) {
+    throw std::runtime_error("PackedRows is missing its records");
+  }
+
+  const uint32_t num_cols = packed->types()->size();
+  types.resize(num_cols);
+  slot_offsets.resize(num_cols);
+  record_width = (num_cols + 7) / 8;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    types[j] = static_cast<tuix::ColType>(packed->types()->Get(j));
+    if (slot_width(types[j]) == 0) {
+      throw std::runtime_error(
+        std::string("No packed encoding for column type ")
+        + std::to_string(packed->types()->Get(j)));
+    }
+    slot_offsets[j] = record_width;
+    record_width += slot_width(types[j]);
+  }
+
+  if (packed->records()->size() != static_cast<uint64_t>(n) * record_width) {
+    throw std::runtime_error(
+      std::string("PackedRows claimed to contain ")
+      + std::to_string(n)
+      + std::string(" records of ")
+      + std::to_string(record_width)
+      + std::string(" bytes but actually contains ")
+      + std::to_string(packed->records()->size())
+      + std::string(" bytes"));
+  }
+  records = packed->records()->data();
+
+  // Every variable-length value must lie within var_data
+  const uint64_t var_data_size = packed->var_data() != nullptr ? packed->var_data()->size() : 0;
+  var_data = packed->var_data() != nullptr ? packed->var_data()->data() : nullptr;
+  for (uint32_t j = 0; j < num_cols; j++) {
+    if (types[j] != tuix::ColType_StringType && types[j] != tuix::ColType_BinaryType) {
+      continue;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      uint64_t end = static_cast<uint64_t>(read_slot<uint32_t>(i, j))
+        + read_slot<uint32_t>(i, j, sizeof(uint32_t));
+      if (end > var_data_size) {
+        throw std::runtime_error(
+          std::string("Value in row ")
+          + std::to_string(i)
+          + std::string(" of PackedRows lies outside its variable-length data"));
+      }
+    }
+  }
+}
+
+bool PackedRowsReader::load(uint32_t j, uint32_t start, uint32_t count, ColumnVector &out) const {
+  out.resize(field_type(j), count);
+  switch (types[j]) {
+  case tuix::ColType_BooleanType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.b[k] = get_bool(start + k, j);
+    }
+    break;
+  case tuix::ColType_IntegerType:
+  case tuix::ColType_DateType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.i[k] = get_int(start + k, j);
+    }
+    break;
+  case tuix::ColType_LongType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.l[k] = get_long(start + k, j);
+    }
+    break;
+  case tuix::ColType_TimestampType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.u[k] = static_cast<uint64_t>(get_long(start + k, j));
+    }
+    break;
+  case tuix::ColType_FloatType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.f[k] = get_float(start + k, j);
+    }
+    break;
+  case tuix::ColType_DoubleType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.d[k] = get_double(start + k, j);
+    }
+    break;
+  case tuix::ColType_StringType:
+    for (uint32_t k = 0; k < count; k++) {
+      out.str[k] = get_bytes(start + k, j, &out.str_len[k]);
+    }
+    break;
+  default:
+    // Bytes, shorts, and binary values are held as Fields, which the records do not contain
+    return false;
+  }
+  for (uint32_t k = 0; k < count; k++) {
+    out.is_null[k] = is_null(start + k, j);
+  }
+  return true;
+}
+
+flatbuffers::Offset<tuix::Field> PackedRowsReader::write_field(
+  uint32_t i, uint32_t j, flatbuffers::FlatBufferBuilder &builder) const {
+  bool null = is_null(i, j);
+  switch (types[j]) {
+  case tuix::ColType_BooleanType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_BooleanField,
+      tuix::CreateBooleanField(builder, get_bool(i, j)).Union(), null);
+  case tuix::ColType_ByteType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_ByteField,
+      tuix::CreateByteField(builder, get_byte(i, j)).Union(), null);
+  case tuix::ColType_ShortType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_ShortField,
+      tuix::CreateShortField(builder, get_short(i, j)).Union(), null);
+  case tuix::ColType_IntegerType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_IntegerField,
+      tuix::CreateIntegerField(builder, get_int(i, j)).Union(), null);
+  case tuix::ColType_DateType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_DateField,
+      tuix::CreateDateField(builder, get_int(i, j)).Union(), null);
+  case tuix::ColType_LongType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_LongField,
+      tuix::CreateLongField(builder, get_long(i, j)).Union(), null);
+  case tuix::ColType_TimestampType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_TimestampField,
+      tuix::CreateTimestampField(builder, static_cast<uint64_t>(get_long(i, j))).Union(), null);
+  case tuix::ColType_FloatType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_FloatField,
+      tuix::CreateFloatField(builder, get_float(i, j)).Union(), null);
+  case tuix::ColType_DoubleType:
+    return tuix::CreateField(
+      builder, tuix::FieldUnion_DoubleField,
+      tuix::CreateDoubleField(builder, get_double(i, j)).Union(), null);
+  default:
+  {
+    uint32_t len;
+    const uint8_t *bytes = get_bytes(i, j, &len);
+    auto value = builder.CreateVector(bytes, len);
+    if (types[j] == tuix::ColType_StringType) {
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_StringField,
+        tuix::CreateStringField(builder, value, len).Union(), null);
+    } else {
+      return tuix::CreateField(
+        builder, tuix::FieldUnion_BinaryField,
+        tuix::CreateBinaryField(builder, value, len).Union(), null);
+    }
+  }
+  }
+}
@@ -0,0 +1,117 @@
+#include <cstring>
+
+#include "Columnar.h"
+#include "Flatbuffers.h"
+
+#ifndef PACKED_ROWS_H
+#define PACKED_ROWS_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * Write the given Rows as a PackedRows object and finish it as the root of `builder`. Returns
+ * false, leaving `builder` in an unspecified state, if the rows have no packed representation
+ * (see columnar_field_types).
+ */
+bool rows_to_packed(const tuix::Rows *rows, flatbuffers::FlatBufferBuilder &builder);
+
+/**
+ * Typed access to the values of a PackedRows object. Each accessor reads its slot directly, so
+ * callers that know the type of a column avoid dispatching on tuix::FieldUnion for every value.
+ * The accessor for a column must match its type, and the PackedRows must outlive the reader.
+ *
+ * As a ColumnSource, the reader loads whole columns of the records through these accessors, so
+ * that operators evaluate expressions over packed blocks without unpacking them into Rows.
+ */
+class PackedRowsReader : public ColumnSource {
+public:
+  /** Check the given PackedRows and prepare to read it. Throws if it is corrupt. */
+  PackedRowsReader(const tuix::PackedRows *packed);
+
+  uint32_t num_rows() const {
+    return n;
+  }
+
+  uint32_t num_columns() const {
+    return types.size();
+  }
+
+  bool has_column(uint32_t) const {
+    return true;
+  }
+
+  tuix::FieldUnion field_type(uint32_t j) const {
+    return column_field_type(types[j]);
+  }
+
+  bool load(uint32_t j, uint32_t start, uint32_t count, ColumnVector &out) const;
+
+  flatbuffers::Offset<tuix::Field> write_field(
+    uint32_t i, uint32_t j, flatbuffers::FlatBufferBuilder &builder) const;
+
+  tuix::ColType type(uint32_t j) const {
+    return types[j];
+  }
+
+  bool is_null(uint32_t i, uint32_t j) const {
+    return (record(i)[j / 8] >> (j % 8)) & 1;
+  }
+
+  bool get_bool(uint32_t i, uint32_t j) const {
+    return read_slot<uint8_t>(i, j) != 0;
+  }
+
+  int8_t get_byte(uint32_t i, uint32_t j) const {
+    return read_slot<int8_t>(i, j);
+  }
+
+  int16_t get_short(uint32_t i, uint32_t j) const {
+    return read_slot<int16_t>(i, j);
+  }
+
+  /** Read a value of IntegerType or DateType. */
+  int32_t get_int(uint32_t i, uint32_t j) const {
+    return read_slot<int32_t>(i, j);
+  }
+
+  /** Read a value of LongType or TimestampType. */
+  int64_t get_long(uint32_t i, uint32_t j) const {
+    return read_slot<int64_t>(i, j);
+  }
+
+  float get_float(uint32_t i, uint32_t j) const {
+    return read_slot<float>(i, j);
+  }
+
+  double get_double(uint32_t i, uint32_t j) const {
+    return read_slot<double>(i, j);
+  }
+
+  /** Read a value of StringType or BinaryType, returning its bytes and setting `len`. */
+  const uint8_t *get_bytes(uint32_t i, uint32_t j, uint32_t *len) const {
+    *len = read_slot<uint32_t>(i, j, sizeof(uint32_t));
+    return var_data + read_slot<uint32_t>(i, j);
+  }
+
+private:
+  const uint8_t *record(uint32_t i) const {
+    return records + static_cast<size_t>(i) * record_width;
+  }
+
+  template<typename T>
+  T read_slot(uint32_t i, uint32_t j, uint32_t skip = 0) const {
+    T value;
+    memcpy(&value, record(i) + slot_offsets[j] + skip, sizeof(T));
+    return value;
+  }
+
+  uint32_t n;
+  std::vector<tuix::ColType> types;
+  // Offset of each column's slot within a record
+  std::vector<uint32_t> slot_offsets;
+  uint32_t record_width;
+  const uint8_t *records;
+  const uint8_t *var_data;
+};
+
+#endif
@@ -5,6 +5,59 @@
 #include "FlatbuffersWriters.h"
 #include "common.h"
 
+/** Evaluate the project list on the given rows, appending one output row per input row. */
+static void project_rows(
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> &project_eval_list,
+  const tuix::Row *const *rows, uint32_t n, std::vector<bool> &batched, RowWriter &w) {
+  // Evaluate each output column a batch at a time, then assemble the output rows from the
+  // resulting column vectors. Values are written straight into the output row; plain column
+  // references are not batched, so eval returns the input field and it is copied only once.
+  for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+    batched[j] = project_eval_list[j]->eval_batch(rows, n);
+  }
+  for (uint32_t k = 0; k < n; k++) {
+    const tuix::Row *row = rows[k];
+    w.append_fields(
+      project_eval_list.size(),
+      [&](uint32_t j, flatbuffers::FlatBufferBuilder &builder) {
+        return batched[j]
+          ? project_eval_list[j]->batch_result_at(k, builder)
+          : flatbuffers_copy<tuix::Field>(project_eval_list[j]->eval(row), builder);
+      });
+  }
+}
+
+/**
+ * Like project_rows, but for rows [start, start + n) of the given columns, without assembling the
+ * input rows. Plain column references are copied straight from their column. Returns false,
+ * appending nothing, if an expression cannot be evaluated over the columns.
+ */
+static bool project_columns(
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> &project_eval_list,
+  const ColumnSource &columns, uint32_t start, uint32_t n, RowWriter &w) {
+  const uint32_t no_column = UINT32_MAX;
+  std::vector<uint32_t> copied(project_eval_list.size(), no_column);
+  for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+    uint32_t col_num;
+    if (project_eval_list[j]->is_column_ref(&col_num) && col_num < columns.num_columns()
+        && columns.has_column(col_num)) {
+      copied[j] = col_num;
+    } else if (!project_eval_list[j]->eval_batch(columns, start, n)) {
+      return false;
+    }
+  }
+  for (uint32_t k = 0; k < n; k++) {
+    w.append_fields(
+      project_eval_list.size(),
+      [&](uint32_t j, flatbuffers::FlatBufferBuilder &builder) {
+        return copied[j] != no_column
+          ? columns.write_field(start + k, copied[j], builder)
+          : project_eval_list[j]->batch_result_at(k, builder);
+      });
+  }
+  return true;
+}
+
 void project(uint8_t *project_list, size_t project_list_length,
              uint8_t *input_rows, size_t input_rows_length,
              uint8_t **output_rows, size_t *output_rows_length) {
@@ -20,17 +73,63 @@ void project(uint8_t *project_list, size_t project_list_length,
     project_eval_list.emplace_back(new FlatbuffersExpressionEvaluator(*it));
   }
 
-  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  // Only decrypt the columns the project list refers to, where the input format allows it
+  std::vector<bool> input_columns;
+  if (project_expr->input_columns() != nullptr) {
+    for (auto it = project_expr->input_columns()->begin();
+         it != project_expr->input_columns()->end(); ++it) {
+      if (*it >= input_columns.size()) {
+        input_columns.resize(*it + 1);
+      }
+      input_columns[*it] = true;
+    }
+  }
+
+  EncryptedBlocksToEncryptedBlockReader r(
+    BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  EncryptedBlockToRowReader block_reader;
+  EncryptedBlockToColumnReader column_reader;
   RowWriter w;
 
-  std::vector<const tuix::Field *> out_fields(project_eval_list.size());
+  std::vector<bool> batched(project_eval_list.size());
+  std::vector<const tuix::Row *> rows;
+
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    // Keep columnar input columnar, and keep statistics for downstream filters
+    w.set_format(it->format());
+    w.set_block_stats(it->enc_stats() != nullptr);
+    rows.clear();
+
+    if (EncryptedBlockToColumnReader::supports(it->format())) {
+      // Evaluate the project list over the columns a batch at a time, and only assemble rows for
+      // batches that it cannot be evaluated on by column
+      column_reader.reset(
+        *it, project_expr->input_columns() != nullptr ? &input_columns : nullptr);
+      const ColumnSource &columns = column_reader.source();
+      for (uint32_t start = 0; start < columns.num_rows(); start += EVAL_BATCH_SIZE) {
+        uint32_t n = std::min(EVAL_BATCH_SIZE, columns.num_rows() - start);
+        if (!project_columns(project_eval_list, columns, start, n, w)) {
+          if (rows.empty()) {
+            const tuix::Rows *block_rows = column_reader.assemble_rows();
+            for (auto row = block_rows->rows()->begin(); row != block_rows->rows()->end(); ++row) {
+              rows.push_back(*row);
+            }
+          }
+          project_rows(project_eval_list, &rows[start], n, batched, w);
+        }
+      }
+      continue;
+    }
+
+    block_reader.reset(*it, project_expr->input_columns() != nullptr ? &input_columns : nullptr);
+    while (block_reader.has_next()) {
+      rows.push_back(block_reader.next());
+    }
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-    for (uint32_t j = 0; j < project_eval_list.size(); j++) {
-      out_fields[j] = project_eval_list[j]->eval(row);
+    for (uint32_t start = 0; start < rows.size(); start += EVAL_BATCH_SIZE) {
+      uint32_t n = std::min(EVAL_BATCH_SIZE, static_cast<uint32_t>(rows.size()) - start);
+      project_rows(project_eval_list, &rows[start], n, batched, w);
     }
-    w.append(out_fields);
   }
 
   w.output_buffer(output_rows, output_rows_length);
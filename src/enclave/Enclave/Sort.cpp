@@ -1,16 +1,80 @@
 #include "Sort.h"
 
 #include <algorithm>
-#include <queue>
 
 #include "ExpressionEvaluation.h"
 #include "FlatbuffersReaders.h"
 #include "FlatbuffersWriters.h"
 
-class MergeItem {
- public:
-  const tuix::Row *v;
-  uint32_t run_idx;
+/** The index of a row in its block, with the location of its sort key in a shared key buffer. */
+struct KeyedRow {
+  uint32_t key_offset;
+  uint32_t key_len;
+  uint32_t index;
+};
+
+/**
+ * A tournament tree of losers for merging k sorted runs. Internal node i (1 <= i < k) holds the
+ * run that lost the match played there, and node 0 holds the overall winner. Advancing the winning
+ * run replays only the matches on its path to the root, at one key comparison per level. The sort
+ * key of each run's current row is cached, so it is computed once per row.
+ */
+class LoserTree {
+public:
+  LoserTree(uint32_t k) : k(k), tree(k), rows(k, nullptr), keys(k), exhausted(k, true) {}
+
+  /** Set the current row of the given run, or mark the run as exhausted if row is null. */
+  void set(uint32_t run, const tuix::Row *row, FlatbuffersSortOrderEvaluator &sort_eval) {
+    rows[run] = row;
+    exhausted[run] = row == nullptr;
+    keys[run].clear();
+    if (row != nullptr) sort_eval.append_key(row, keys[run]);
+  }
+
+  /** Play all matches. Must be called once after the first row of each run has been set. */
+  void build() {
+    tree[0] = k > 1 ? build(1) : 0;
+  }
+
+  /** Replay the matches of the winning run after its current row has been replaced. */
+  void replay_winner() {
+    uint32_t s = tree[0];
+    for (uint32_t t = (s + k) / 2; t > 0; t /= 2) {
+      if (beats(tree[t], s)) std::swap(tree[t], s);
+    }
+    tree[0] = s;
+  }
+
+  bool empty() { return exhausted[tree[0]]; }
+  uint32_t winner() { return tree[0]; }
+  const tuix::Row *winner_row() { return rows[tree[0]]; }
+
+private:
+  /** Return the winner of the subtree rooted at the given node, recording losers on the way. */
+  uint32_t build(uint32_t node) {
+    if (node >= k) return node - k;
+    uint32_t a = build(2 * node);
+    uint32_t b = build(2 * node + 1);
+    if (beats(a, b)) {
+      tree[node] = b;
+      return a;
+    } else {
+      tree[node] = a;
+      return b;
+    }
+  }
+
+  bool beats(uint32_t a, uint32_t b) {
+    if (exhausted[a] || exhausted[b]) return !exhausted[a];
+    int c = FlatbuffersSortOrderEvaluator::compare_keys(keys[a], keys[b]);
+    return c < 0 || (c == 0 && a < b);
+  }
+
+  uint32_t k;
+  std::vector<uint32_t> tree;
+  std::vector<const tuix::Row *> rows;
+  std::vector<std::vector<uint8_t>> keys;
+  std::vector<bool> exhausted;
 };
 
 void external_merge(
@@ -20,73 +84,279 @@ void external_merge(
   SortedRunsWriter &w,
   FlatbuffersSortOrderEvaluator &sort_eval) {
 
-  // Maintain a priority queue with one row per run
-  auto compare = [&sort_eval](const MergeItem &a, const MergeItem &b) {
-    return sort_eval.less_than(b.v, a.v);
+  // Initialize the loser tree with the first row from each run
+  LoserTree tree(num_runs);
+  for (uint32_t i = 0; i < num_runs; i++) {
+    debug("external_merge: Read first row from run %d\n", run_start + i);
+    r.enable_prefetch(run_start + i);
+    tree.set(i, r.run_has_next(run_start + i) ? r.next_from_run(run_start + i) : nullptr,
+             sort_eval);
+  }
+  tree.build();
+
+  // Merge the runs, each time reading another row from the run that the smallest row came from
+  while (!tree.empty()) {
+    uint32_t run = tree.winner();
+    w.append(tree.winner_row());
+    tree.set(run, r.run_has_next(run_start + run) ? r.next_from_run(run_start + run) : nullptr,
+             sort_eval);
+    tree.replay_winner();
+  }
+  w.finish_run();
+}
+
+// Blocks with fewer rows than this are sorted by comparison, which beats radix sort's fixed
+// per-pass cost on small inputs
+static const uint32_t RADIX_SORT_MIN_ROWS = 256;
+// Fixed-width keys up to this length are radix sorted on all of their bytes. Longer and
+// variable-length keys are radix sorted on a prefix of this length, then by comparison within each
+// group of rows sharing that prefix.
+static const uint32_t RADIX_SORT_MAX_KEY_BYTES = 16;
+
+/**
+ * Stable LSD radix sort of rows by key bytes [0, num_bytes), where byte_at(row, i) returns byte i
+ * of the row's key. Passes in which all rows share the same byte are skipped, which makes null
+ * markers and the high bytes of small integers free.
+ */
+template<typename ByteAt>
+void lsd_radix_sort(std::vector<KeyedRow> &rows, std::vector<KeyedRow> &scratch,
+                    uint32_t num_bytes, ByteAt byte_at) {
+  scratch.resize(rows.size());
+  for (uint32_t pos = num_bytes; pos > 0; pos--) {
+    uint32_t offsets[257] = {0};
+    for (auto it = rows.begin(); it != rows.end(); ++it) {
+      offsets[byte_at(*it, pos - 1) + 1]++;
+    }
+    bool single_bucket = false;
+    for (uint32_t b = 1; b <= 256; b++) {
+      if (offsets[b] == rows.size()) single_bucket = true;
+      offsets[b] += offsets[b - 1];
+    }
+    if (single_bucket) continue;
+
+    for (auto it = rows.begin(); it != rows.end(); ++it) {
+      scratch[offsets[byte_at(*it, pos - 1)]++] = *it;
+    }
+    rows.swap(scratch);
+  }
+}
+
+/** Sort rows by their normalized sort keys, which are stored in key_data. */
+void sort_keyed_rows(std::vector<KeyedRow> &rows, const uint8_t *key_data) {
+  auto less_than = [key_data](const KeyedRow &a, const KeyedRow &b) {
+    return FlatbuffersSortOrderEvaluator::compare_keys(
+      key_data + a.key_offset, a.key_len, key_data + b.key_offset, b.key_len) < 0;
   };
-  std::priority_queue<MergeItem, std::vector<MergeItem>, decltype(compare)>
-    queue(compare);
+  if (rows.size() < RADIX_SORT_MIN_ROWS) {
+    std::sort(rows.begin(), rows.end(), less_than);
+    return;
+  }
 
-  // Initialize the priority queue with the first row from each run
-  for (uint32_t i = run_start; i < run_start + num_runs; i++) {
-    debug("external_merge: Read first row from run %d\n", i);
-    MergeItem item;
-    item.v = r.next_from_run(i);
-    item.run_idx = i;
-    queue.push(item);
+  bool fixed_width = true;
+  for (auto it = rows.begin(); it != rows.end(); ++it) {
+    if (it->key_len != rows[0].key_len) {
+      fixed_width = false;
+      break;
+    }
   }
 
-  // Merge the runs using the priority queue
-  while (!queue.empty()) {
-    MergeItem item = queue.top();
-    queue.pop();
-    w.append(item.v);
+  std::vector<KeyedRow> scratch;
+  if (fixed_width && rows[0].key_len <= RADIX_SORT_MAX_KEY_BYTES) {
+    lsd_radix_sort(rows, scratch, rows[0].key_len, [key_data](const KeyedRow &r, uint32_t i) {
+        return key_data[r.key_offset + i];
+      });
+    return;
+  }
 
-    // Read another row from the same run that this one came from
-    if (r.run_has_next(item.run_idx)) {
-      item.v = r.next_from_run(item.run_idx);
-      queue.push(item);
+  // Radix sort on a zero-padded key prefix. Padding with zeros preserves the key order, because a
+  // key that is a prefix of another sorts first.
+  auto prefix_byte = [key_data](const KeyedRow &r, uint32_t i) -> uint8_t {
+    return i < r.key_len ? key_data[r.key_offset + i] : 0;
+  };
+  lsd_radix_sort(rows, scratch, RADIX_SORT_MAX_KEY_BYTES, prefix_byte);
+
+  // Finish each group of rows that share a prefix by comparing full keys
+  auto group_start = rows.begin();
+  while (group_start != rows.end()) {
+    auto group_end = group_start + 1;
+    while (group_end != rows.end()) {
+      bool same_prefix = true;
+      for (uint32_t i = 0; i < RADIX_SORT_MAX_KEY_BYTES && same_prefix; i++) {
+        same_prefix = prefix_byte(*group_start, i) == prefix_byte(*group_end, i);
+      }
+      if (!same_prefix) break;
+      ++group_end;
+    }
+    if (group_end - group_start > 1) {
+      std::sort(group_start, group_end, less_than);
     }
+    group_start = group_end;
   }
-  w.finish_run();
 }
 
+/**
+ * Sort the rows of the given block into a new run of w. If `intermediate` is true, the run will
+ * only be read by a later merge pass, so it is written in the RowChunks format, which the merge
+ * reads one chunk at a time, and without statistics.
+ */
 void sort_single_encrypted_block(
   SortedRunsWriter &w,
   const tuix::EncryptedBlock *block,
-  FlatbuffersSortOrderEvaluator &sort_eval) {
+  FlatbuffersSortOrderEvaluator &sort_eval,
+  bool intermediate) {
+
+  // Sorted runs keep the layout of their input, where runs of equal keys compress well, and its
+  // statistics, which become selective once the rows are sorted
+  w.set_format(intermediate ? tuix::BlockFormat_RowChunks : block->format());
+  w.set_block_stats(!intermediate && block->enc_stats() != nullptr);
+
+  // Compute each row's sort key once up front, so sorting works on bytes only
+  std::vector<uint8_t> keys;
+  std::vector<KeyedRow> sort_ptrs;
+  sort_ptrs.reserve(block->num_rows());
+  std::vector<const tuix::Row *> rows;
+
+  if (EncryptedBlockToColumnReader::supports(block->format())) {
+    // Compute the keys over the columns a batch at a time, and only assemble the rows for batches
+    // whose keys cannot be computed by column. The output rows are written straight from the
+    // columns in sorted order.
+    EncryptedBlockToColumnReader r;
+    r.reset(block);
+    const ColumnSource &columns = r.source();
+    for (uint32_t start = 0; start < columns.num_rows(); start += EVAL_BATCH_SIZE) {
+      uint32_t n = std::min(EVAL_BATCH_SIZE, columns.num_rows() - start);
+      bool batched = sort_eval.eval_batch(columns, start, n);
+      if (!batched && rows.empty()) {
+        const tuix::Rows *block_rows = r.assemble_rows();
+        for (auto it = block_rows->rows()->begin(); it != block_rows->rows()->end(); ++it) {
+          rows.push_back(*it);
+        }
+      }
+      for (uint32_t k = 0; k < n; k++) {
+        uint32_t key_offset = keys.size();
+        if (batched) {
+          sort_eval.append_batch_key(k, keys);
+        } else {
+          sort_eval.append_key(rows[start + k], keys);
+        }
+        sort_ptrs.push_back(
+          KeyedRow{key_offset, static_cast<uint32_t>(keys.size()) - key_offset, start + k});
+      }
+    }
+
+    sort_keyed_rows(sort_ptrs, keys.data());
+
+    for (auto it = sort_ptrs.begin(); it != sort_ptrs.end(); ++it) {
+      w.append_fields(
+        columns.num_columns(),
+        [&](uint32_t j, flatbuffers::FlatBufferBuilder &builder) {
+          return columns.write_field(it->index, j, builder);
+        });
+    }
+    w.finish_run();
+    return;
+  }
 
   EncryptedBlockToRowReader r;
   r.reset(block);
-  std::vector<const tuix::Row *> sort_ptrs(r.begin(), r.end());
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    uint32_t key_offset = keys.size();
+    sort_eval.append_key(*it, keys);
+    sort_ptrs.push_back(
+      KeyedRow{key_offset, static_cast<uint32_t>(keys.size()) - key_offset,
+               static_cast<uint32_t>(rows.size())});
+    rows.push_back(*it);
+  }
 
-  std::sort(
-    sort_ptrs.begin(), sort_ptrs.end(),
-    [&sort_eval](const tuix::Row *a, const tuix::Row *b) {
-      return sort_eval.less_than(a, b);
-    });
+  sort_keyed_rows(sort_ptrs, keys.data());
 
   for (auto it = sort_ptrs.begin(); it != sort_ptrs.end(); ++it) {
-    w.append(*it);
+    w.append(rows[it->index]);
   }
   w.finish_run();
 }
 
+/**
+ * Merge all runs in r into a single sorted run and write it to output_rows. We merge B runs at a
+ * time by decrypting an EncryptedBlock from each one, merging them within the enclave using a loser
+ * tree, and re-encrypting to a different buffer, until only one run remains. Resets r.
+ *
+ * The output is written in `output_format`, with statistics if `output_stats` is true. The runs of
+ * earlier passes are only read by the next pass, so they are written in the RowChunks format, which
+ * external_merge streams chunk by chunk instead of holding a decrypted block per run.
+ *
+ * B is `max_num_streams`. If `num_intermediate_passes` is given, it is incremented for each pass
+ * whose runs are merged again by a later pass.
+ */
+void merge_all_runs(SortedRunsReader &r, FlatbuffersSortOrderEvaluator &sort_eval,
+                    tuix::BlockFormat output_format, bool output_stats,
+                    uint32_t max_num_streams, uint32_t *num_intermediate_passes,
+                    uint8_t **output_rows, size_t *output_rows_length) {
+  if (max_num_streams < 2) {
+    throw std::runtime_error(
+      std::string("Cannot merge sorted runs ") + std::to_string(max_num_streams) + " at a time");
+  }
+
+  SortedRunsWriter w;
+  // Holds the runs produced by the previous pass while the next pass reads them
+  std::unique_ptr<UntrustedBufferRef<tuix::SortedRuns>> runs_buf;
+  while (true) {
+    debug("merge_all_runs: Merging %d runs, up to %d at a time\n",
+         r.num_runs(), max_num_streams);
+
+    w.clear();
+    const bool last_pass = r.num_runs() <= max_num_streams;
+    w.set_format(last_pass ? output_format : tuix::BlockFormat_RowChunks);
+    w.set_block_stats(last_pass && output_stats);
+    for (uint32_t run_start = 0; run_start < r.num_runs(); run_start += max_num_streams) {
+      uint32_t num_runs =
+        std::min(max_num_streams, static_cast<uint32_t>(r.num_runs()) - run_start);
+      debug("merge_all_runs: Merging buffers %d-%d\n", run_start, run_start + num_runs - 1);
+
+      external_merge(r, run_start, num_runs, w, sort_eval);
+    }
+
+    if (w.num_runs() > 1) {
+      if (num_intermediate_passes != nullptr) {
+        (*num_intermediate_passes)++;
+      }
+      runs_buf.reset(new UntrustedBufferRef<tuix::SortedRuns>(w.output_buffer()));
+      r.reset(runs_buf->view());
+    } else {
+      // Done merging. Return the single remaining sorted run, or an empty one if there were no runs.
+      w.as_row_writer()->output_buffer(output_rows, output_rows_length);
+      return;
+    }
+  }
+}
+
 void external_sort(uint8_t *sort_order, size_t sort_order_length,
                    uint8_t *input_rows, size_t input_rows_length,
-                   uint8_t **output_rows, size_t *output_rows_length) {
+                   uint8_t **output_rows, size_t *output_rows_length,
+                   uint32_t max_num_streams, uint32_t *num_intermediate_passes) {
   FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
 
   // 1. Sort each EncryptedBlock individually by decrypting it, sorting within the enclave, and
   // re-encrypting to a different buffer.
   SortedRunsWriter w;
+  tuix::BlockFormat output_format = tuix::BlockFormat_RowMajor;
+  bool output_stats = false;
   {
     EncryptedBlocksToEncryptedBlockReader r(
       BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+    if (r.begin() != r.end()) {
+      output_format = r.begin()->format();
+      output_stats = r.begin()->enc_stats() != nullptr;
+    }
+    // With more than one block, the runs are merged afterwards
+    uint32_t num_blocks = 0;
+    for (auto it = r.begin(); it != r.end(); ++it) {
+      num_blocks++;
+    }
     uint32_t i = 0;
     for (auto it = r.begin(); it != r.end(); ++it, ++i) {
       debug("Sorting buffer %d with %d rows\n", i, it->num_rows());
-      sort_single_encrypted_block(w, *it, sort_eval);
+      sort_single_encrypted_block(w, *it, sort_eval, num_blocks > 1);
     }
 
     if (w.num_runs() <= 1) {
@@ -96,38 +366,26 @@ void external_sort(uint8_t *sort_order, size_t sort_order_length,
     }
   }
 
-  // 2. Merge sorted runs. Initially each buffer forms a sorted run. We merge B runs at a time by
-  // decrypting an EncryptedBlock from each one, merging them within the enclave using a priority
-  // queue, and re-encrypting to a different buffer.
+  // 2. Merge sorted runs. Initially each buffer forms a sorted run.
   auto runs_buf = w.output_buffer();
   SortedRunsReader r(runs_buf.view());
-  while (r.num_runs() > 1) {
-    debug("external_sort: Merging %d runs, up to %d at a time\n",
-         r.num_runs(), MAX_NUM_STREAMS);
-
-    w.clear();
-    for (uint32_t run_start = 0; run_start < r.num_runs(); run_start += MAX_NUM_STREAMS) {
-      uint32_t num_runs =
-        std::min(MAX_NUM_STREAMS, static_cast<uint32_t>(r.num_runs()) - run_start);
-      debug("external_sort: Merging buffers %d-%d\n", run_start, run_start + num_runs - 1);
-
-      external_merge(r, run_start, num_runs, w, sort_eval);
-    }
+  merge_all_runs(r, sort_eval, output_format, output_stats, max_num_streams,
+                 num_intermediate_passes, output_rows, output_rows_length);
+}
 
-    if (w.num_runs() > 1) {
-      runs_buf = w.output_buffer();
-      r.reset(runs_buf.view());
-    } else {
-      // Done merging. Return the single remaining sorted run.
-      w.as_row_writer()->output_buffer(output_rows, output_rows_length);
-      return;
-    }
-  }
+void merge_sorted_runs(uint8_t *sort_order, size_t sort_order_length,
+                       uint8_t *input_runs, size_t input_runs_length,
+                       uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  SortedRunsReader r(BufferRefView<tuix::SortedRuns>(input_runs, input_runs_length));
+  merge_all_runs(r, sort_eval, r.block_format(), r.block_stats(), MAX_NUM_STREAMS, nullptr,
+                 output_rows, output_rows_length);
 }
 
 void sample(uint8_t *input_rows, size_t input_rows_length,
 			uint8_t **output_rows, size_t *output_rows_length) {
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  r.enable_prefetch();
   RowWriter w;
 
   // Sample ~5% of the rows or 1000 rows, whichever is greater
@@ -138,12 +396,11 @@ void sample(uint8_t *input_rows, size_t input_rows_length,
     sampling_ratio = 16383;
   }
 
+  BufferedRandom random;
   while (r.has_next()) {
     const tuix::Row *row = r.next();
 
-    uint16_t rand;
-    sgx_read_rand(reinterpret_cast<uint8_t *>(&rand), 2);
-    if (rand <= sampling_ratio) {
+    if (random.next_uint16() <= sampling_ratio) {
       w.append(row);
     }
   }
@@ -187,56 +444,54 @@ void partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
                         uint8_t *input_rows, size_t input_rows_length,
                         uint8_t *boundary_rows, size_t boundary_rows_length,
                         uint8_t **output_partition_ptrs, size_t *output_partition_lengths) {
-  // Sort the input rows
-  uint8_t *sorted_rows;
-  size_t sorted_rows_length;
-  external_sort(sort_order, sort_order_length,
-                input_rows, input_rows_length,
-                &sorted_rows, &sorted_rows_length);
-
-  // Scan through the input rows and copy each to the appropriate output partition specified by the
-  // ranges encoded in the given boundary_rows. A range contains all rows greater than or equal to
-  // one boundary row and less than the next boundary row. The first range contains all rows less
-  // than the first boundary row, and the last range contains all rows greater than or equal to the
-  // last boundary row.
+  // Copy each input row to the appropriate output partition specified by the ranges encoded in the
+  // given boundary_rows. A range contains all rows greater than or equal to one boundary row and
+  // less than the next boundary row. The first range contains all rows less than the first boundary
+  // row, and the last range contains all rows greater than or equal to the last boundary row.
   FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
-  RowReader r(BufferRefView<tuix::EncryptedBlocks>(sorted_rows, sorted_rows_length));
-  RowWriter w;
-  uint32_t output_partition_idx = 0;
 
+  // Encode the boundary rows as sort keys once, so each input row costs O(log p) key comparisons
+  std::vector<std::vector<uint8_t>> boundary_keys;
   RowReader b(BufferRefView<tuix::EncryptedBlocks>(boundary_rows, boundary_rows_length));
-  // Invariant: b_upper is the first boundary row strictly greater than the current range, or
-  // nullptr if we are in the last range
-  FlatbuffersTemporaryRow b_upper(b.has_next() ? b.next() : nullptr);
-
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-
-    // Advance boundary rows to maintain the invariant on b_upper
-    while (b_upper.get() != nullptr && !sort_eval.less_than(row, b_upper.get())) {
-      b_upper.set(b.has_next() ? b.next() : nullptr);
+  while (b.has_next()) {
+    boundary_keys.emplace_back();
+    sort_eval.append_key(b.next(), boundary_keys.back());
+  }
 
-      // Write out the newly-finished partition
-      w.output_buffer(
-        &output_partition_ptrs[output_partition_idx],
-        &output_partition_lengths[output_partition_idx]);
-      w.clear();
-      output_partition_idx++;
+  // Partitions keep the layout and statistics of their input
+  EncryptedBlocksToEncryptedBlockReader input_blocks(
+    BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  std::vector<std::unique_ptr<RowWriter>> writers;
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    writers.emplace_back(new RowWriter());
+    if (input_blocks.begin() != input_blocks.end()) {
+      writers.back()->set_format(input_blocks.begin()->format());
+      writers.back()->set_block_stats(input_blocks.begin()->enc_stats() != nullptr);
     }
-
-    w.append(row);
   }
 
-  // Write out the final partition. If there were fewer boundary rows than expected output
-  // partitions, write out enough empty partitions to ensure the expected number of output
-  // partitions.
-  while (output_partition_idx < num_partitions) {
-    w.output_buffer(
-      &output_partition_ptrs[output_partition_idx],
-      &output_partition_lengths[output_partition_idx]);
-    w.clear();
-    output_partition_idx++;
+  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  r.enable_prefetch();
+  std::vector<uint8_t> row_key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    row_key.clear();
+    sort_eval.append_key(row, row_key);
+
+    // The row belongs to the range after the last boundary less than or equal to it
+    uint32_t output_partition_idx = std::upper_bound(
+      boundary_keys.begin(), boundary_keys.end(), row_key,
+      [](const std::vector<uint8_t> &key, const std::vector<uint8_t> &boundary) {
+        return FlatbuffersSortOrderEvaluator::compare_keys(key, boundary) < 0;
+      }) - boundary_keys.begin();
+    // If there were more boundary rows than expected, the extra ranges go to the last partition
+    output_partition_idx = std::min(output_partition_idx, num_partitions - 1);
+    writers[output_partition_idx]->append(row);
   }
 
-  ocall_free(sorted_rows);
+  // Write out all partitions, including empty ones, to ensure the expected number of output
+  // partitions. Each partition preserves the relative order of its input rows.
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    writers[i]->output_buffer(&output_partition_ptrs[i], &output_partition_lengths[i]);
+  }
 }
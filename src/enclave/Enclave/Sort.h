@@ -1,6 +1,8 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "define.h"
+
 #ifndef _SORT_H_
 #define _SORT_H_
 
@@ -9,10 +11,24 @@
  * into enclave memory, sorting them using quicksort, and re-encrypting them to untrusted memory.
  * The granularity of decryption is a tuix::EncryptedBlock, which should fit entirely in enclave
  * memory.
+ *
+ * The sorted blocks are merged up to max_num_streams at a time. Only tests pass a smaller value,
+ * so that small inputs need intermediate merge passes; their number is then added to
+ * num_intermediate_passes if it is given.
  */
 void external_sort(uint8_t *sort_order, size_t sort_order_length,
                    uint8_t *input_rows, size_t input_rows_length,
-                   uint8_t **output_rows, size_t *output_rows_length);
+                   uint8_t **output_rows, size_t *output_rows_length,
+                   uint32_t max_num_streams = MAX_NUM_STREAMS,
+                   uint32_t *num_intermediate_passes = nullptr);
+
+/**
+ * Merge the sorted runs in input_runs, which must contain a tuix::SortedRuns object, into a single
+ * sorted run, merging up to MAX_NUM_STREAMS runs at a time.
+ */
+void merge_sorted_runs(uint8_t *sort_order, size_t sort_order_length,
+                       uint8_t *input_runs, size_t input_runs_length,
+                       uint8_t **output_rows, size_t *output_rows_length);
 
 /**
  * For distributed sorting, sample rows from a partition of data so they can be collected to a
@@ -35,7 +51,8 @@ void find_range_bounds(uint8_t *sort_order, size_t sort_order_length,
 /**
  * For distributed sorting, range-partition the input partition according to the specified
  * boundaries. The boundaries should be obtained by broadcasting the output of find_range_bounds to
- * each partition.
+ * each partition. Each row is assigned by binary search over the boundaries, so the input does not
+ * need to be sorted; rows keep their relative order within each output partition.
  *
  * The range partitioning is expressed as an array of buffers, one per output partition.
  */
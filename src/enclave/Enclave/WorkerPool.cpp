@@ -0,0 +1,123 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <sgx_thread.h>
+
+namespace {
+
+// Guards all of the state below, as well as the state of every WorkerTask
+sgx_thread_mutex_t pool_lock = SGX_THREAD_MUTEX_INITIALIZER;
+// Signaled when a task is queued or the workers are stopped
+sgx_thread_cond_t task_queued = SGX_THREAD_COND_INITIALIZER;
+// Broadcast when a worker finishes a task
+sgx_thread_cond_t task_done = SGX_THREAD_COND_INITIALIZER;
+
+std::deque<WorkerTask *> queue;
+uint32_t active_workers = 0;
+bool stopping = false;
+
+void dequeue(WorkerTask *task) {
+  auto it = std::find(queue.begin(), queue.end(), task);
+  if (it != queue.end()) {
+    queue.erase(it);
+  }
+}
+
+}
+
+WorkerTask::~WorkerTask() {
+  sgx_thread_mutex_lock(&pool_lock);
+  if (state == Queued) {
+    dequeue(this);
+    state = Idle;
+  }
+  while (state == Running) {
+    sgx_thread_cond_wait(&task_done, &pool_lock);
+  }
+  sgx_thread_mutex_unlock(&pool_lock);
+}
+
+void WorkerTask::submit() {
+  sgx_thread_mutex_lock(&pool_lock);
+  if (state == Idle && active_workers > 0 && !stopping) {
+    state = Queued;
+    queue.push_back(this);
+    sgx_thread_cond_signal(&task_queued);
+  }
+  sgx_thread_mutex_unlock(&pool_lock);
+}
+
+void WorkerTask::wait() {
+  sgx_thread_mutex_lock(&pool_lock);
+  if (state == Idle || state == Queued) {
+    // No worker has started the task, so run it here rather than wait for one
+    if (state == Queued) {
+      dequeue(this);
+    }
+    state = Running;
+    sgx_thread_mutex_unlock(&pool_lock);
+    run();
+    sgx_thread_mutex_lock(&pool_lock);
+    state = Done;
+  }
+  while (state == Running) {
+    sgx_thread_cond_wait(&task_done, &pool_lock);
+  }
+  sgx_thread_mutex_unlock(&pool_lock);
+
+  if (failed) {
+    throw std::runtime_error(error);
+  }
+}
+
+void WorkerTask::run() {
+  try {
+    fn();
+  } catch (const std::runtime_error &e) {
+    failed = true;
+    error = e.what();
+  } catch (...) {
+    failed = true;
+    error = "Worker task failed";
+  }
+}
+
+void worker_loop() {
+  sgx_thread_mutex_lock(&pool_lock);
+  active_workers++;
+  while (true) {
+    while (queue.empty() && !stopping) {
+      sgx_thread_cond_wait(&task_queued, &pool_lock);
+    }
+    if (stopping) {
+      break;
+    }
+
+    WorkerTask *task = queue.front();
+    queue.pop_front();
+    task->state = WorkerTask::Running;
+    sgx_thread_mutex_unlock(&pool_lock);
+    task->run();
+    sgx_thread_mutex_lock(&pool_lock);
+    task->state = WorkerTask::Done;
+    sgx_thread_cond_broadcast(&task_done);
+  }
+  active_workers--;
+  sgx_thread_mutex_unlock(&pool_lock);
+}
+
+void stop_workers() {
+  sgx_thread_mutex_lock(&pool_lock);
+  stopping = true;
+  sgx_thread_cond_broadcast(&task_queued);
+  sgx_thread_mutex_unlock(&pool_lock);
+}
+
+uint32_t num_workers() {
+  sgx_thread_mutex_lock(&pool_lock);
+  uint32_t result = active_workers;
+  sgx_thread_mutex_unlock(&pool_lock);
+  return result;
+}
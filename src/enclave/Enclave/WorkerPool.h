@@ -0,0 +1,66 @@
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+/**
+ * A unit of work that may run on one of the enclave's worker threads (see worker_loop). A task that
+ * no worker has started by the time its result is needed runs on the thread that waits for it, so
+ * tasks complete even if the host never lends the enclave any workers.
+ *
+ * The function must only touch state owned by the task's submitter, and must signal errors by
+ * throwing a std::runtime_error, which is rethrown by wait().
+ */
+class WorkerTask {
+public:
+  WorkerTask(std::function<void()> fn)
+    : fn(fn), state(Idle), failed(false), error() {}
+  WorkerTask(const WorkerTask &) = delete;
+  WorkerTask &operator=(const WorkerTask &) = delete;
+
+  /** Removes the task from the queue if it has not started, or waits for it if it is running. */
+  ~WorkerTask();
+
+  /** Queue the task to run on the next idle worker. Does nothing if there are no workers. */
+  void submit();
+
+  /**
+   * Block until the task has run, running it on the calling thread if no worker has started it.
+   * Rethrows the error raised by the task, if any.
+   */
+  void wait();
+
+private:
+  enum State {
+    Idle,
+    Queued,
+    Running,
+    Done,
+  };
+
+  /** Run the function and record its error. Must be called without holding the pool lock. */
+  void run();
+
+  std::function<void()> fn;
+  State state;
+  bool failed;
+  std::string error;
+
+  friend void worker_loop();
+};
+
+/**
+ * Run queued tasks on the calling thread until stop_workers() is called. Untrusted host threads
+ * lend themselves to the enclave by entering this function through ecall_worker_loop.
+ */
+void worker_loop();
+
+/** Make all threads in worker_loop() return once they finish their current task. */
+void stop_workers();
+
+/** The number of threads currently in worker_loop(). */
+uint32_t num_workers();
+
+#endif
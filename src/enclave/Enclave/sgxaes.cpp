@@ -16,11 +16,27 @@ GcmContext::GcmContext() {
 	memset(this,0,sizeof(*this));
 }
 
+GcmKey::GcmKey(const KeySchedule* ks) : ks(ks) {
+	intel_aes_gcmINIT(htbl,ks->ks,ks->nr);
+}
+
 AesGcm::AesGcm(const KeySchedule* ks, const unsigned char* iv, size_t iv_len) {
 	memset(this,0,sizeof(*this));
 	state=New;
 	gctx.ks=ks;
 	intel_aes_gcmINIT(gctx.htbl,gctx.ks->ks,gctx.ks->nr);
+	init(iv,iv_len);
+}
+
+AesGcm::AesGcm(const GcmKey* key, const unsigned char* iv, size_t iv_len) {
+	memset(this,0,sizeof(*this));
+	state=New;
+	gctx.ks=key->ks;
+	memcpy(gctx.htbl,key->htbl,sizeof(gctx.htbl));
+	init(iv,iv_len);
+}
+
+void AesGcm::init(const unsigned char* iv, size_t iv_len) {
 	if (iv_len==12) {
 		memcpy(gctx.ctr,iv,12);
 		gctx.ctr[15]=1;
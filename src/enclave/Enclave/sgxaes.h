@@ -42,6 +42,15 @@ struct GcmContext {
 	};
 };
 
+/* The GHASH table of a key, which depends only on the key schedule. Computing it once per key
+   lets each AesGcm skip intel_aes_gcmINIT. */
+struct GcmKey {
+	const KeySchedule* ks;
+	unsigned char htbl[16*AES_BLOCK_SIZE];
+
+	GcmKey(const KeySchedule* ks);
+};
+
 struct Tag {
 	unsigned char t[16];
 };
@@ -53,11 +62,15 @@ struct AesGcm {
 	State state;
 
 	AesGcm(const KeySchedule* ks, const unsigned char* iv, size_t iv_len);
+	AesGcm(const GcmKey* key, const unsigned char* iv, size_t iv_len);
 	AesGcm(const AesGcm& other);
 	void aad(const unsigned char* data, size_t data_len);
 	void encrypt(const unsigned char* plaintext, size_t plaintext_len, unsigned char* ciphertext, size_t ciphertext_len);
 	void decrypt(const unsigned char* ciphertext, size_t ciphertext_len, unsigned char* plaintext, size_t plaintext_len);
 	Tag tag() const;
+
+private:
+	void init(const unsigned char* iv, size_t iv_len);
 };
 
 extern "C" {
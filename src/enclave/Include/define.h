@@ -3,6 +3,29 @@
 
 #define MAX_BLOCK_SIZE 1000000
 
+// Bytes of the random identifier that binds the separately encrypted columns of a block together
+#define BLOCK_ID_SIZE 16u
+
 #define MAX_NUM_STREAMS 40u
 
+// Bytes of plaintext rows per separately encrypted chunk of a block in the RowChunks format
+#define MAX_ROW_CHUNK_SIZE 65536
+
+#define EVAL_BATCH_SIZE 1024u
+
+// Bytes of plaintext primary rows a join group may hold in enclave memory before it spills
+#define MAX_JOIN_GROUP_CACHE_SIZE 32000000
+
+// Number of broadcast join hash tables each enclave keeps for reuse across tasks
+#define MAX_BROADCAST_JOIN_TABLES 4u
+
+// Bytes of enclave memory a hash aggregation table may use before new groups spill
+#define MAX_HASH_AGGREGATE_TABLE_SIZE 32000000
+
+// Number of partitions that rows of spilled groups are divided into at each level of recursion
+#define HASH_AGGREGATE_SPILL_FANOUT 16u
+
+// Recursion depth beyond which a hash aggregation keeps all groups in memory rather than spilling
+#define MAX_HASH_AGGREGATE_SPILL_DEPTH 4u
+
 #endif // DEFINE_H
@@ -93,6 +93,7 @@ import org.apache.spark.sql.catalyst.util.ArrayBasedMapData
 import org.apache.spark.sql.catalyst.util.ArrayData
 import org.apache.spark.sql.catalyst.util.MapData
 import org.apache.spark.sql.execution.aggregate.ScalaUDAF
+import org.apache.spark.sql.internal.SQLConf
 import org.apache.spark.sql.types._
 import org.apache.spark.storage.StorageLevel
 import org.apache.spark.unsafe.types.CalendarInterval
@@ -255,25 +256,89 @@ object Utils extends Logging {
   val sharedKey: Array[Byte] = "Opaque devel key".getBytes("UTF-8")
   assert(sharedKey.size == GCM_KEY_LENGTH)
   
-  def encrypt(data: Array[Byte]): Array[Byte] = {
-    val random = SecureRandom.getInstance("SHA1PRNG")
-    val cipherKey = new SecretKeySpec(sharedKey, "AES")
-    val iv = new Array[Byte](GCM_IV_LENGTH)
-    random.nextBytes(iv)
-    val spec = new GCMParameterSpec(GCM_TAG_LENGTH * 8, iv)
-    val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
-    cipher.init(Cipher.ENCRYPT_MODE, cipherKey, spec)
-    val cipherText = cipher.doFinal(data)    
-    iv ++ cipherText
+  /** Source of the random IVs used by the driver. */
+  private lazy val ivRandom = new SecureRandom()
+
+  /**
+   * The native AES-GCM implementation used by the driver, which runs the enclave's AES-NI code on
+   * the host (see HostEncryptBatch in App.cpp). If the enclave library cannot be loaded or the CPU
+   * lacks the instructions it needs, the driver falls back to SunJCE.
+   */
+  private lazy val hostCrypto: Option[SGXEnclave] =
+    try {
+      val enclave = new SGXEnclave()
+      if (enclave.HostAesGcmSupported()) {
+        Some(enclave)
+      } else {
+        logWarning("CPU does not support AES-NI with AVX. Falling back to SunJCE for encryption.")
+        None
+      }
+    } catch {
+      case e: LinkageError =>
+        logWarning(s"Could not load native AES-GCM ($e). Falling back to SunJCE for encryption.")
+        None
+    }
+
+  def encrypt(data: Array[Byte]): Array[Byte] = encryptMany(Seq(data)).head
+
+  def decrypt(data: Array[Byte]): Array[Byte] = decryptMany(Seq(data)).head
+
+  /**
+   * Encrypts each buffer under the shared key with a fresh random IV, producing
+   * IV || ciphertext || MAC. The output buffers are allocated once at their final size and filled
+   * in place, natively in a single call if possible.
+   *
+   * The MACs also cover `aad`, which is not encrypted and must be passed to [[decryptMany]] again.
+   */
+  def encryptMany(
+      plaintexts: Seq[Array[Byte]], aad: Array[Byte] = Array.empty): Seq[Array[Byte]] = {
+    val ivs = new Array[Byte](plaintexts.size * GCM_IV_LENGTH)
+    ivRandom.nextBytes(ivs)
+    val ciphertexts =
+      plaintexts.map(p => new Array[Byte](GCM_IV_LENGTH + p.length + GCM_TAG_LENGTH)).toArray
+    hostCrypto match {
+      case Some(enclave) =>
+        enclave.HostEncryptBatch(sharedKey, aad, ivs, plaintexts.toArray, ciphertexts)
+      case None =>
+        val cipherKey = new SecretKeySpec(sharedKey, "AES")
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
+        for ((data, i) <- plaintexts.zipWithIndex) {
+          val ciphertext = ciphertexts(i)
+          System.arraycopy(ivs, i * GCM_IV_LENGTH, ciphertext, 0, GCM_IV_LENGTH)
+          cipher.init(Cipher.ENCRYPT_MODE, cipherKey,
+            new GCMParameterSpec(GCM_TAG_LENGTH * 8, ciphertext, 0, GCM_IV_LENGTH))
+          cipher.updateAAD(aad)
+          cipher.doFinal(data, 0, data.length, ciphertext, GCM_IV_LENGTH)
+        }
+    }
+    ciphertexts
   }
-  
-  def decrypt(data: Array[Byte]): Array[Byte] = {
-    val cipherKey = new SecretKeySpec(sharedKey, "AES")
-    val iv = data.take(GCM_IV_LENGTH)
-    val cipherText = data.drop(GCM_IV_LENGTH)
-    val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
-    cipher.init(Cipher.DECRYPT_MODE, cipherKey, new GCMParameterSpec(GCM_TAG_LENGTH * 8, iv))
-    cipher.doFinal(cipherText)
+
+  /**
+   * Decrypts and verifies buffers produced by [[encryptMany]] or by an enclave with the same
+   * additional authenticated data.
+   */
+  def decryptMany(
+      ciphertexts: Seq[Array[Byte]], aad: Array[Byte] = Array.empty): Seq[Array[Byte]] = {
+    for (c <- ciphertexts) {
+      require(c.length >= GCM_IV_LENGTH + GCM_TAG_LENGTH, s"Ciphertext too short: ${c.length}")
+    }
+    hostCrypto match {
+      case Some(enclave) =>
+        val plaintexts =
+          ciphertexts.map(c => new Array[Byte](c.length - GCM_IV_LENGTH - GCM_TAG_LENGTH)).toArray
+        enclave.HostDecryptBatch(sharedKey, aad, ciphertexts.toArray, plaintexts)
+        plaintexts
+      case None =>
+        val cipherKey = new SecretKeySpec(sharedKey, "AES")
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
+        for (data <- ciphertexts) yield {
+          cipher.init(Cipher.DECRYPT_MODE, cipherKey,
+            new GCMParameterSpec(GCM_TAG_LENGTH * 8, data, 0, GCM_IV_LENGTH))
+          cipher.updateAAD(aad)
+          cipher.doFinal(data, GCM_IV_LENGTH, data.length - GCM_IV_LENGTH)
+        }
+    }
   }
 
   var eid = 0L
@@ -648,6 +713,393 @@ object Utils extends Logging {
 
   val MaxBlockSize = 1000
 
+  /** Length of the random identifier that binds the separately encrypted columns of a block. */
+  val BlockIdLength = 16
+
+  /**
+   * The tuix.BlockFormat of newly encrypted tables. Tables are stored as fixed-width records if
+   * spark.opaque.packedRows is set. Otherwise they are stored column by column if
+   * spark.opaque.columnarBlocks is set, with each column encrypted separately if
+   * spark.opaque.encryptColumnsSeparately is also set. Must be called on the driver.
+   */
+  def blockFormat: Byte = {
+    val conf = SQLConf.get
+    if (conf.getConfString("spark.opaque.packedRows", "false").toBoolean) {
+      tuix.BlockFormat.Packed
+    } else if (!conf.getConfString("spark.opaque.columnarBlocks", "false").toBoolean) {
+      tuix.BlockFormat.RowMajor
+    } else if (conf.getConfString("spark.opaque.encryptColumnsSeparately", "false").toBoolean) {
+      tuix.BlockFormat.ColumnChunks
+    } else {
+      tuix.BlockFormat.Columnar
+    }
+  }
+
+  /**
+   * Whether newly encrypted tables carry encrypted per-block statistics, which let filters skip
+   * blocks without decrypting them. Set by spark.opaque.blockStats. Must be called on the driver.
+   */
+  def blockStats: Boolean =
+    SQLConf.get.getConfString("spark.opaque.blockStats", "false").toBoolean
+
+  /**
+   * The order in which tuix.ColumnStats records the smallest and largest values of the given type,
+   * matching the enclave's sort key encoding, or None if the enclave does not order the type.
+   */
+  private def statsOrdering(dataType: DataType): Option[Ordering[Any]] = dataType match {
+    case BooleanType => Some(Ordering.Boolean.on[Any](_.asInstanceOf[Boolean]))
+    case IntegerType | DateType => Some(Ordering.Int.on[Any](_.asInstanceOf[Int]))
+    case LongType => Some(Ordering.Long.on[Any](_.asInstanceOf[Long]))
+    // Timestamps are stored as tuix.TimestampField's unsigned value
+    case TimestampType => Some(Ordering.fromLessThan[Any]((a, b) =>
+      java.lang.Long.compareUnsigned(a.asInstanceOf[Long], b.asInstanceOf[Long]) < 0))
+    case FloatType => Some(Ordering.fromLessThan[Any]((a, b) =>
+      java.lang.Float.compare(a.asInstanceOf[Float], b.asInstanceOf[Float]) < 0))
+    case DoubleType => Some(Ordering.fromLessThan[Any]((a, b) =>
+      java.lang.Double.compare(a.asInstanceOf[Double], b.asInstanceOf[Double]) < 0))
+    case StringType => Some(Ordering.fromLessThan[Any]((a, b) =>
+      a.asInstanceOf[UTF8String].compareTo(b.asInstanceOf[UTF8String]) < 0))
+    case _ => None
+  }
+
+  /** Accumulates the statistics of the rows of one block for a tuix.BlockStats. */
+  private class BlockStatsAccumulator(types: Seq[DataType]) {
+    private val orderings = types.map(statsOrdering)
+    private val mins = new Array[Any](types.size)
+    private val maxs = new Array[Any](types.size)
+    private val nullCounts = new Array[Int](types.size)
+    private val hasValue = new Array[Boolean](types.size)
+
+    def add(row: InternalRow): Unit = {
+      for (j <- types.indices) {
+        if (row.isNullAt(j)) {
+          nullCounts(j) += 1
+        } else {
+          for (ordering <- orderings(j)) {
+            val value = row.get(j, types(j)) match {
+              case s: UTF8String => s.clone()
+              case v => v
+            }
+            if (!hasValue(j) || ordering.lt(value, mins(j))) mins(j) = value
+            if (!hasValue(j) || ordering.gt(value, maxs(j))) maxs(j) = value
+            hasValue(j) = true
+          }
+        }
+      }
+    }
+
+    /**
+     * Serialize the statistics of the rows added since the last call as a tuix.BlockStats bound
+     * to the given block tag, and return its offset.
+     */
+    def finish(builder: FlatBufferBuilder, blockTag: Array[Byte], numRows: Int): Int = {
+      val columnOffsets = for (j <- types.indices) yield {
+        val (min, max) =
+          if (hasValue(j)) {
+            (flatbuffersCreateField(builder, mins(j), types(j), false),
+              flatbuffersCreateField(builder, maxs(j), types(j), false))
+          } else {
+            (0, 0)
+          }
+        tuix.ColumnStats.createColumnStats(builder, min, max, nullCounts(j))
+      }
+      val result = tuix.BlockStats.createBlockStats(
+        builder,
+        tuix.BlockStats.createBlockTagVector(builder, blockTag),
+        numRows,
+        tuix.BlockStats.createColumnsVector(builder, columnOffsets.toArray))
+      java.util.Arrays.fill(nullCounts, 0)
+      java.util.Arrays.fill(hasValue, false)
+      result
+    }
+  }
+
+  /** Whether rows of the given types can be stored in a tuix.ColumnarRows or tuix.PackedRows. */
+  def columnarSupported(types: Seq[DataType]): Boolean = types.forall {
+    case BooleanType | ByteType | ShortType | IntegerType | DateType | LongType | TimestampType
+       | FloatType | DoubleType | StringType | BinaryType => true
+    case _ => false
+  }
+
+  /** Approximate size of the given row in a tuix.ColumnarRows, for splitting rows into blocks. */
+  private def columnarSize(row: InternalRow, types: Seq[DataType]): Int =
+    types.zipWithIndex.map {
+      case (StringType, i) if !row.isNullAt(i) => 4 + row.getUTF8String(i).numBytes
+      case (BinaryType, i) if !row.isNullAt(i) => 4 + row.getBinary(i).length
+      case _ => 8
+    }.sum
+
+  /**
+   * Serialize column `j` of the given rows, which has the given type, as a tuix.Column. Returns the
+   * offset of the written tuix.Column. The type must satisfy [[columnarSupported]].
+   */
+  private def flatbuffersCreateColumn(
+      builder: FlatBufferBuilder, rows: Seq[InternalRow], dataType: DataType, j: Int): Int = {
+    val nulls = new Array[Byte]((rows.size + 7) / 8)
+    for ((row, i) <- rows.zipWithIndex if row.isNullAt(j)) {
+      nulls(i / 8) = (nulls(i / 8) | (1 << (i % 8))).toByte
+    }
+    val nullsOffset = tuix.Column.createNullsVector(builder, nulls)
+
+    def values[T: scala.reflect.ClassTag](get: InternalRow => T, zero: T): Array[T] =
+      rows.map(row => if (row.isNullAt(j)) zero else get(row)).toArray
+
+    var intsOffset, longsOffset, floatsOffset, doublesOffset, dataOffset, offsetsOffset = 0
+    val colType = dataType match {
+      case BooleanType =>
+        dataOffset = tuix.Column.createDataVector(
+          builder, values(r => (if (r.getBoolean(j)) 1 else 0).toByte, 0.toByte))
+        tuix.ColType.BooleanType
+      case ByteType =>
+        dataOffset = tuix.Column.createDataVector(builder, values(_.getByte(j), 0.toByte))
+        tuix.ColType.ByteType
+      case ShortType =>
+        intsOffset = tuix.Column.createIntsVector(builder, values(_.getShort(j).toInt, 0))
+        tuix.ColType.ShortType
+      case IntegerType =>
+        intsOffset = tuix.Column.createIntsVector(builder, values(_.getInt(j), 0))
+        tuix.ColType.IntegerType
+      case DateType =>
+        intsOffset = tuix.Column.createIntsVector(builder, values(_.getInt(j), 0))
+        tuix.ColType.DateType
+      case LongType =>
+        longsOffset = tuix.Column.createLongsVector(builder, values(_.getLong(j), 0L))
+        tuix.ColType.LongType
+      case TimestampType =>
+        longsOffset = tuix.Column.createLongsVector(builder, values(_.getLong(j), 0L))
+        tuix.ColType.TimestampType
+      case FloatType =>
+        floatsOffset = tuix.Column.createFloatsVector(builder, values(_.getFloat(j), 0.0f))
+        tuix.ColType.FloatType
+      case DoubleType =>
+        doublesOffset = tuix.Column.createDoublesVector(builder, values(_.getDouble(j), 0.0))
+        tuix.ColType.DoubleType
+      case StringType | BinaryType =>
+        val bytes =
+          if (dataType == StringType) values(_.getUTF8String(j).getBytes, Array.empty[Byte])
+          else values(_.getBinary(j), Array.empty[Byte])
+        dataOffset = tuix.Column.createDataVector(builder, Array.concat(bytes: _*))
+        offsetsOffset = tuix.Column.createOffsetsVector(
+          builder, bytes.scanLeft(0)(_ + _.length))
+        if (dataType == StringType) tuix.ColType.StringType else tuix.ColType.BinaryType
+    }
+
+    tuix.Column.createColumn(
+      builder, colType, nullsOffset, intsOffset, longsOffset, floatsOffset, doublesOffset,
+      dataOffset, offsetsOffset, tuix.ColumnEncoding.Plain, 0, 0, 0L, 0)
+  }
+
+  /**
+   * Serialize the given rows column by column as a tuix.ColumnarRows. Returns the offset of the
+   * written tuix.ColumnarRows. The types must satisfy [[columnarSupported]].
+   */
+  private def flatbuffersCreateColumnarRows(
+      builder: FlatBufferBuilder, rows: Seq[InternalRow], types: Seq[DataType]): Int = {
+    val columnOffsets = types.zipWithIndex.map {
+      case (dataType, j) => flatbuffersCreateColumn(builder, rows, dataType, j)
+    }
+    tuix.ColumnarRows.createColumnarRows(
+      builder,
+      rows.size,
+      tuix.ColumnarRows.createColumnsVector(builder, columnOffsets.toArray))
+  }
+
+  /** The width of a slot holding a value of the given type in a tuix.PackedRows record. */
+  private def packedSlotWidth(colType: Byte): Int = colType match {
+    case tuix.ColType.BooleanType | tuix.ColType.ByteType => 1
+    case tuix.ColType.ShortType => 2
+    case tuix.ColType.IntegerType | tuix.ColType.DateType | tuix.ColType.FloatType => 4
+    case _ => 8
+  }
+
+  /**
+   * Serialize the given rows as fixed-width records in a tuix.PackedRows. Returns the offset of the
+   * written tuix.PackedRows. The types must satisfy [[columnarSupported]].
+   */
+  private def flatbuffersCreatePackedRows(
+      builder: FlatBufferBuilder, rows: Seq[InternalRow], types: Seq[DataType]): Int = {
+    val colTypes = types.map {
+      case BooleanType => tuix.ColType.BooleanType
+      case ByteType => tuix.ColType.ByteType
+      case ShortType => tuix.ColType.ShortType
+      case IntegerType => tuix.ColType.IntegerType
+      case DateType => tuix.ColType.DateType
+      case LongType => tuix.ColType.LongType
+      case TimestampType => tuix.ColType.TimestampType
+      case FloatType => tuix.ColType.FloatType
+      case DoubleType => tuix.ColType.DoubleType
+      case StringType => tuix.ColType.StringType
+      case BinaryType => tuix.ColType.BinaryType
+    }
+    val nullBytes = (types.size + 7) / 8
+    val recordWidth = nullBytes + colTypes.map(packedSlotWidth).sum
+
+    // Slots of null values are left zeroed
+    val records = ByteBuffer.allocate(rows.size * recordWidth).order(ByteOrder.LITTLE_ENDIAN)
+    val varData = new java.io.ByteArrayOutputStream
+    def putBytes(bytes: Array[Byte]): Unit = {
+      records.putInt(varData.size)
+      records.putInt(bytes.length)
+      varData.write(bytes)
+    }
+    for ((row, i) <- rows.zipWithIndex) {
+      val start = i * recordWidth
+      records.position(start + nullBytes)
+      for ((dataType, j) <- types.zipWithIndex) {
+        if (row.isNullAt(j)) {
+          records.put(start + j / 8, (records.get(start + j / 8) | (1 << (j % 8))).toByte)
+          records.position(records.position + packedSlotWidth(colTypes(j)))
+        } else {
+          dataType match {
+            case BooleanType => records.put((if (row.getBoolean(j)) 1 else 0).toByte)
+            case ByteType => records.put(row.getByte(j))
+            case ShortType => records.putShort(row.getShort(j))
+            case IntegerType | DateType => records.putInt(row.getInt(j))
+            case LongType | TimestampType => records.putLong(row.getLong(j))
+            case FloatType => records.putFloat(row.getFloat(j))
+            case DoubleType => records.putDouble(row.getDouble(j))
+            case StringType => putBytes(row.getUTF8String(j).getBytes)
+            case BinaryType => putBytes(row.getBinary(j))
+          }
+        }
+      }
+    }
+
+    tuix.PackedRows.createPackedRows(
+      builder,
+      rows.size,
+      tuix.PackedRows.createTypesVector(builder, colTypes.toArray),
+      tuix.PackedRows.createRecordsVector(builder, records.array),
+      tuix.PackedRows.createVarDataVector(builder, varData.toByteArray))
+  }
+
+  /** Read the rows stored in the given tuix.PackedRows as Spark SQL [[InternalRow]]s. */
+  private def flatbuffersExtractPackedRows(packed: tuix.PackedRows): Seq[InternalRow] = {
+    val colTypes = (0 until packed.typesLength).map(packed.types(_).toByte)
+    val nullBytes = (colTypes.size + 7) / 8
+    val slotOffsets = colTypes.scanLeft(nullBytes)(_ + packedSlotWidth(_))
+    val records = packed.recordsAsByteBuffer.slice.order(ByteOrder.LITTLE_ENDIAN)
+    val varData = new Array[Byte](packed.varDataLength)
+    if (varData.nonEmpty) {
+      packed.varDataAsByteBuffer.get(varData)
+    }
+    val recordWidth = slotOffsets.last
+
+    for (i <- 0 until packed.numRows.toInt) yield {
+      val start = i * recordWidth
+      def bytes(slot: Int): Array[Byte] = {
+        val offset = records.getInt(slot)
+        java.util.Arrays.copyOfRange(varData, offset, offset + records.getInt(slot + 4))
+      }
+      InternalRow.fromSeq(
+        for ((colType, j) <- colTypes.zipWithIndex) yield {
+          val slot = start + slotOffsets(j)
+          if ((records.get(start + j / 8) & (1 << (j % 8))) != 0) {
+            null
+          } else {
+            colType match {
+              case tuix.ColType.BooleanType => records.get(slot) != 0
+              case tuix.ColType.ByteType => records.get(slot)
+              case tuix.ColType.ShortType => records.getShort(slot)
+              case tuix.ColType.IntegerType | tuix.ColType.DateType => records.getInt(slot)
+              case tuix.ColType.LongType | tuix.ColType.TimestampType => records.getLong(slot)
+              case tuix.ColType.FloatType => records.getFloat(slot)
+              case tuix.ColType.DoubleType => records.getDouble(slot)
+              case tuix.ColType.StringType => UTF8String.fromBytes(bytes(slot))
+              case tuix.ColType.BinaryType => bytes(slot)
+            }
+          }
+        })
+    }
+  }
+
+  /**
+   * Unpack `count` unsigned integers of `bitWidth` bits each, stored least significant bit first
+   * in the packed vector of the given tuix.Column.
+   */
+  private def unpackBits(col: tuix.Column, bitWidth: Int, count: Int): Array[Long] = {
+    val packed = new Array[Byte](col.packedLength)
+    if (packed.nonEmpty) {
+      col.packedAsByteBuffer.get(packed)
+    }
+    val values = new Array[Long](count)
+    var bit = 0L
+    for (i <- 0 until count) {
+      var value = 0L
+      var b = 0
+      while (b < bitWidth) {
+        val shift = (bit % 8).toInt
+        val take = math.min(8 - shift, bitWidth - b)
+        value |= (((packed((bit / 8).toInt) & 0xff) >> shift) & ((1 << take) - 1)).toLong << b
+        b += take
+        bit += take
+      }
+      values(i) = value
+    }
+    values
+  }
+
+  /**
+   * Decode the values of the given integral tuix.Column, which may be compressed as described by
+   * tuix.ColumnEncoding.
+   */
+  private def integralColumnValues(col: tuix.Column, numRows: Int): Int => Long = {
+    val ints = col.`type`.toByte match {
+      case tuix.ColType.LongType | tuix.ColType.TimestampType => false
+      case _ => true
+    }
+    def plain(k: Int): Long = if (ints) col.ints(k).toLong else col.longs(k)
+    col.encoding.toByte match {
+      case tuix.ColumnEncoding.FrameOfReference =>
+        val deltas = unpackBits(col, col.bitWidth, numRows)
+        (i: Int) => col.base + deltas(i)
+      case tuix.ColumnEncoding.RunLength =>
+        val values = new Array[Long](numRows)
+        var start = 0
+        for (r <- 0 until col.runEndsLength) {
+          val end = col.runEnds(r).toInt
+          java.util.Arrays.fill(values, start, end, plain(r))
+          start = end
+        }
+        (i: Int) => values(i)
+      case _ => plain _
+    }
+  }
+
+  /** Read the rows stored in the given tuix.Columns as Spark SQL [[InternalRow]]s. */
+  private def flatbuffersExtractColumns(
+      numRows: Int, tuixColumns: Seq[tuix.Column]): Seq[InternalRow] = {
+    val columns = for (col <- tuixColumns) yield {
+      val data = new Array[Byte](col.dataLength)
+      if (data.nonEmpty) {
+        col.dataAsByteBuffer.get(data)
+      }
+      // Dictionary-encoded columns store each row's index into the distinct values
+      val codes =
+        if (col.encoding == tuix.ColumnEncoding.Dictionary) unpackBits(col, col.bitWidth, numRows)
+        else null
+      def bytes(i: Int): Array[Byte] = {
+        val k = if (codes != null) codes(i).toInt else i
+        java.util.Arrays.copyOfRange(data, col.offsets(k).toInt, col.offsets(k + 1).toInt)
+      }
+      lazy val integral = integralColumnValues(col, numRows)
+
+      val get: Int => Any = col.`type`.toByte match {
+        case tuix.ColType.BooleanType => (i: Int) => data(i) != 0
+        case tuix.ColType.ByteType => (i: Int) => data(i)
+        case tuix.ColType.ShortType => (i: Int) => integral(i).toShort
+        case tuix.ColType.IntegerType | tuix.ColType.DateType => (i: Int) => integral(i).toInt
+        case tuix.ColType.LongType | tuix.ColType.TimestampType => (i: Int) => integral(i)
+        case tuix.ColType.FloatType => (i: Int) => col.floats(i)
+        case tuix.ColType.DoubleType => (i: Int) => col.doubles(i)
+        case tuix.ColType.StringType => (i: Int) => UTF8String.fromBytes(bytes(i))
+        case tuix.ColType.BinaryType => (i: Int) => bytes(i)
+      }
+      (i: Int) => if ((col.nulls(i / 8) & (1 << (i % 8))) != 0) null else get(i)
+    }
+    for (i <- 0 until numRows) yield InternalRow.fromSeq(columns.map(_(i)))
+  }
+
   /**
    * Encrypts the given Spark SQL [[InternalRow]]s into a [[Block]] (a serialized
    * tuix.EncryptedBlocks).
@@ -655,64 +1107,166 @@ object Utils extends Logging {
    * If `useEnclave` is true, it will attempt to use the local enclave. Otherwise, it will attempt
    * to use the local encryption key, which is intended to be available only on the driver, not the
    * workers.
+   *
+   * The rows are stored in the given tuix.BlockFormat if their types allow it, and as tuix.Rows
+   * otherwise. If `stats` is true, each block also carries an encrypted tuix.BlockStats.
    */
   def encryptInternalRowsFlatbuffers(
       rows: Seq[InternalRow],
       types: Seq[DataType],
-      useEnclave: Boolean): Block = {
+      useEnclave: Boolean,
+      format: Byte = tuix.BlockFormat.RowMajor,
+      stats: Boolean = false): Block = {
     // For the encrypted blocks
     val builder2 = new FlatBufferBuilder
     val encryptedBlockOffsets = ArrayBuilder.make[Int]
+    val blockStats = if (stats) Some(new BlockStatsAccumulator(types)) else None
+
+    // The row data and column chunks of a block are authenticated together with the block's
+    // format byte, so that the untrusted host cannot change how the enclave parses them
+    def encryptBytes(plaintexts: Seq[Array[Byte]], aad: Array[Byte]): Seq[Array[Byte]] =
+      if (useEnclave) {
+        val (enclave, eid) = initEnclave()
+        plaintexts.map(enclave.Encrypt(eid, _, aad))
+      } else {
+        encryptMany(plaintexts, aad)
+      }
 
-    // 1. Serialize the rows as plaintext using tuix.Rows
-    var builder = new FlatBufferBuilder
-    var rowsOffsets = ArrayBuilder.make[Int]
-
-    def finishBlock(): Unit = {
-      val rowsOffsetsArray = rowsOffsets.result
-      builder.finish(
-        tuix.Rows.createRows(
-          builder,
-          tuix.Rows.createRowsVector(
-            builder,
-            rowsOffsetsArray)))
-      val plaintext = builder.sizedByteArray()
-
-      // 2. Encrypt the row data and put it into a tuix.EncryptedBlock
-      val ciphertext =
-        if (useEnclave) {
-          val (enclave, eid) = initEnclave()
-          enclave.Encrypt(eid, plaintext)
-        } else {
-          encrypt(plaintext)
-        }
+    // 2. Encrypt the statistics of the block's rows, bound to the block by the given tag
+    def encryptStats(numRows: Int, blockTag: Array[Byte]): Int = blockStats match {
+      case Some(acc) =>
+        val builder = new FlatBufferBuilder
+        builder.finish(acc.finish(builder, blockTag, numRows))
+        tuix.EncryptedBlock.createEncStatsVector(
+          builder2, encryptBytes(Seq(builder.sizedByteArray()), Array.empty).head)
+      case None => 0
+    }
 
+    // 2. Encrypt the row data and put it into a tuix.EncryptedBlock
+    def encryptBlock(numRows: Int, plaintext: Array[Byte], format: Byte): Unit = {
+      val encRows = encryptBytes(Seq(plaintext), Array(format)).head
+      val encStats = encryptStats(numRows, encRows.takeRight(GCM_TAG_LENGTH))
       encryptedBlockOffsets += tuix.EncryptedBlock.createEncryptedBlock(
         builder2,
-        rowsOffsetsArray.size,
-        tuix.EncryptedBlock.createEncRowsVector(builder2, ciphertext))
+        numRows,
+        tuix.EncryptedBlock.createEncRowsVector(builder2, encRows),
+        format,
+        0,
+        0,
+        encStats,
+        0)
+    }
 
-      builder = new FlatBufferBuilder
-      rowsOffsets = ArrayBuilder.make[Int]
+    // 2. Encrypt each column separately, binding the chunks to the block with a random identifier
+    def encryptColumnChunks(blockRows: Seq[InternalRow]): Unit = {
+      val blockId = new Array[Byte](BlockIdLength)
+      ivRandom.nextBytes(blockId)
+      val chunks = types.zipWithIndex.map {
+        case (dataType, j) =>
+          val builder = new FlatBufferBuilder
+          builder.finish(
+            tuix.ColumnChunk.createColumnChunk(
+              builder,
+              tuix.ColumnChunk.createBlockIdVector(builder, blockId),
+              j,
+              types.size,
+              blockRows.size,
+              flatbuffersCreateColumn(builder, blockRows, dataType, j)))
+          builder.sizedByteArray()
+      }
+      val encChunks = encryptBytes(chunks, Array(tuix.BlockFormat.ColumnChunks))
+      val chunkOffsets = encChunks.map { encChunk =>
+        tuix.EncryptedColumnChunk.createEncryptedColumnChunk(
+          builder2, tuix.EncryptedColumnChunk.createEncChunkVector(builder2, encChunk))
+      }
+      val encStats = encryptStats(blockRows.size, blockId)
+      encryptedBlockOffsets += tuix.EncryptedBlock.createEncryptedBlock(
+        builder2,
+        blockRows.size,
+        0,
+        tuix.BlockFormat.ColumnChunks,
+        tuix.EncryptedBlock.createBlockIdVector(builder2, blockId),
+        tuix.EncryptedBlock.createEncColumnsVector(builder2, chunkOffsets.toArray),
+        encStats,
+        0)
     }
 
-    for (row <- rows) {
-      rowsOffsets += tuix.Row.createRow(
-        builder,
-        tuix.Row.createFieldValuesVector(
-          builder,
-          row.toSeq(types).zip(types).zipWithIndex.map {
-            case ((value, dataType), i) =>
-              flatbuffersCreateField(builder, value, dataType, row.isNullAt(i))
-          }.toArray),
-        false)
+    if (format != tuix.BlockFormat.RowMajor && columnarSupported(types)) {
+      // 1. Serialize each block of rows as plaintext using tuix.ColumnarRows, tuix.ColumnChunks or
+      // tuix.PackedRows
+      var blockRows = ArrayBuilder.make[InternalRow]
+      var numRows = 0
+      var blockSize = 0
+
+      def finishBlock(): Unit = {
+        if (format == tuix.BlockFormat.ColumnChunks) {
+          encryptColumnChunks(blockRows.result)
+        } else if (format == tuix.BlockFormat.Packed) {
+          val builder = new FlatBufferBuilder
+          builder.finish(flatbuffersCreatePackedRows(builder, blockRows.result, types))
+          encryptBlock(numRows, builder.sizedByteArray(), tuix.BlockFormat.Packed)
+        } else {
+          val builder = new FlatBufferBuilder
+          builder.finish(flatbuffersCreateColumnarRows(builder, blockRows.result, types))
+          encryptBlock(numRows, builder.sizedByteArray(), tuix.BlockFormat.Columnar)
+        }
+        blockRows = ArrayBuilder.make[InternalRow]
+        numRows = 0
+        blockSize = 0
+      }
+
+      for (row <- rows) {
+        // The rows may be reused by their iterator, so keep copies
+        blockRows += row.copy()
+        blockStats.foreach(_.add(row))
+        numRows += 1
+        blockSize += columnarSize(row, types)
 
-      if (builder.offset() > MaxBlockSize) {
+        if (blockSize > MaxBlockSize) {
+          finishBlock()
+        }
+      }
+      if (numRows > 0) {
+        finishBlock()
+      }
+    } else {
+      // 1. Serialize the rows as plaintext using tuix.Rows
+      var builder = new FlatBufferBuilder
+      var rowsOffsets = ArrayBuilder.make[Int]
+
+      def finishBlock(): Unit = {
+        val rowsOffsetsArray = rowsOffsets.result
+        builder.finish(
+          tuix.Rows.createRows(
+            builder,
+            tuix.Rows.createRowsVector(
+              builder,
+              rowsOffsetsArray)))
+        encryptBlock(rowsOffsetsArray.size, builder.sizedByteArray(), tuix.BlockFormat.RowMajor)
+
+        builder = new FlatBufferBuilder
+        rowsOffsets = ArrayBuilder.make[Int]
+      }
+
+      for (row <- rows) {
+        blockStats.foreach(_.add(row))
+        rowsOffsets += tuix.Row.createRow(
+          builder,
+          tuix.Row.createFieldValuesVector(
+            builder,
+            row.toSeq(types).zip(types).zipWithIndex.map {
+              case ((value, dataType), i) =>
+                flatbuffersCreateField(builder, value, dataType, row.isNullAt(i))
+            }.toArray),
+          false)
+
+        if (builder.offset() > MaxBlockSize) {
+          finishBlock()
+        }
+      }
+      if (builder.offset() > 0) {
         finishBlock()
       }
-    }
-    if (builder.offset() > 0) {
-      finishBlock()
     }
 
     // 3. Put the tuix.EncryptedBlock objects into a tuix.EncryptedBlocks
@@ -743,28 +1297,85 @@ object Utils extends Logging {
     val encryptedBlocks = tuix.EncryptedBlocks.getRootAsEncryptedBlocks(buf)
     (for (i <- 0 until encryptedBlocks.blocksLength) yield {
       val encryptedBlock = encryptedBlocks.blocks(i)
-      val ciphertextBuf = encryptedBlock.encRowsAsByteBuffer
-      val ciphertext = new Array[Byte](ciphertextBuf.remaining)
-      ciphertextBuf.get(ciphertext)
-
-      // 2. Decrypt the row data
-      val plaintext = decrypt(ciphertext)
-
-      // 1. Deserialize the tuix.Rows and return them as Scala InternalRow objects
-      val rows = tuix.Rows.getRootAsRows(ByteBuffer.wrap(plaintext))
-      for (j <- 0 until rows.rowsLength) yield {
-        val row = rows.rows(j)
-        assert(!row.isDummy)
-        InternalRow.fromSeq(
-          for (k <- 0 until row.fieldValuesLength) yield {
-            val field: Any =
-              if (!row.fieldValues(k).isNull()) {
-                flatbuffersExtractFieldValue(row.fieldValues(k))
-              } else {
-                null
-              }
-            field
-          })
+      def decryptBuffers(ciphertextBufs: Seq[ByteBuffer]): Seq[ByteBuffer] = {
+        val ciphertexts = ciphertextBufs.map { ciphertextBuf =>
+          val ciphertext = new Array[Byte](ciphertextBuf.remaining)
+          ciphertextBuf.get(ciphertext)
+          ciphertext
+        }
+        decryptMany(ciphertexts, Array(encryptedBlock.format)).map(ByteBuffer.wrap(_))
+      }
+      def extractRows(rows: tuix.Rows): Seq[InternalRow] =
+        for (j <- 0 until rows.rowsLength) yield {
+          val row = rows.rows(j)
+          assert(!row.isDummy)
+          InternalRow.fromSeq(
+            for (k <- 0 until row.fieldValuesLength) yield {
+              val field: Any =
+                if (!row.fieldValues(k).isNull()) {
+                  flatbuffersExtractFieldValue(row.fieldValues(k))
+                } else {
+                  null
+                }
+              field
+            })
+        }
+
+      if (encryptedBlock.format == tuix.BlockFormat.RowChunks) {
+        // 2. Decrypt each row chunk and check that it belongs to this block
+        val blockId = new Array[Byte](encryptedBlock.blockIdLength)
+        encryptedBlock.blockIdAsByteBuffer.get(blockId)
+        val numChunks = encryptedBlock.encRowChunksLength
+        val plaintexts = decryptBuffers(
+          (0 until numChunks).map(encryptedBlock.encRowChunks(_).encChunkAsByteBuffer))
+        val rows = (for (j <- 0 until numChunks) yield {
+          val chunk = tuix.RowChunk.getRootAsRowChunk(plaintexts(j))
+          val chunkBlockId = new Array[Byte](chunk.blockIdLength)
+          chunk.blockIdAsByteBuffer.get(chunkBlockId)
+          assert(java.util.Arrays.equals(chunkBlockId, blockId) && chunk.index == j &&
+            chunk.numChunks == numChunks, s"Row chunk $j does not belong to its EncryptedBlock")
+
+          // 1. Deserialize the chunk's tuix.Rows and return them as Scala InternalRow objects
+          extractRows(chunk.rows)
+        }).flatten
+        assert(rows.size == encryptedBlock.numRows,
+          s"EncryptedBlock claimed to contain ${encryptedBlock.numRows} rows but its chunks " +
+            s"contain ${rows.size} rows")
+        rows
+      } else if (encryptedBlock.format == tuix.BlockFormat.ColumnChunks) {
+        // 2. Decrypt each column chunk and check that it belongs to this block
+        val blockId = new Array[Byte](encryptedBlock.blockIdLength)
+        encryptedBlock.blockIdAsByteBuffer.get(blockId)
+        val numColumns = encryptedBlock.encColumnsLength
+        val plaintexts = decryptBuffers(
+          (0 until numColumns).map(encryptedBlock.encColumns(_).encChunkAsByteBuffer))
+        val columns = for (j <- 0 until numColumns) yield {
+          val chunk = tuix.ColumnChunk.getRootAsColumnChunk(plaintexts(j))
+          val chunkBlockId = new Array[Byte](chunk.blockIdLength)
+          chunk.blockIdAsByteBuffer.get(chunkBlockId)
+          assert(java.util.Arrays.equals(chunkBlockId, blockId) && chunk.index == j &&
+            chunk.numColumns == numColumns && chunk.numRows == encryptedBlock.numRows,
+            s"Column chunk $j does not belong to its EncryptedBlock")
+          chunk.column
+        }
+
+        // 1. Read the tuix.Columns and return them as Scala InternalRow objects
+        flatbuffersExtractColumns(encryptedBlock.numRows.toInt, columns)
+      } else {
+        // 2. Decrypt the row data
+        val plaintext = decryptBuffers(Seq(encryptedBlock.encRowsAsByteBuffer)).head
+
+        // 1. Deserialize the tuix.Rows, tuix.ColumnarRows or tuix.PackedRows and return them as
+        // Scala InternalRow objects
+        if (encryptedBlock.format == tuix.BlockFormat.Columnar) {
+          val columnar = tuix.ColumnarRows.getRootAsColumnarRows(plaintext)
+          flatbuffersExtractColumns(
+            columnar.numRows.toInt, (0 until columnar.columnsLength).map(columnar.columns(_)))
+        } else if (encryptedBlock.format == tuix.BlockFormat.Packed) {
+          flatbuffersExtractPackedRows(tuix.PackedRows.getRootAsPackedRows(plaintext))
+        } else {
+          extractRows(tuix.Rows.getRootAsRows(plaintext))
+        }
       }
     }).flatten
   }
@@ -1037,7 +1648,11 @@ object Utils extends Logging {
         builder,
         tuix.ProjectExpr.createProjectListVector(
           builder,
-          projectList.map(expr => flatbuffersSerializeExpression(builder, expr, input)).toArray)))
+          projectList.map(expr => flatbuffersSerializeExpression(builder, expr, input)).toArray),
+        tuix.ProjectExpr.createInputColumnsVector(
+          builder,
+          input.indices.filter(i =>
+            projectList.exists(_.references.exists(_.semanticEquals(input(i))))).toArray)))
     builder.sizedByteArray()
   }
 
@@ -1094,12 +1709,7 @@ object Utils extends Logging {
     groupingExpressions: Seq[Expression],
     aggExpressions: Seq[NamedExpression],
     input: Seq[Attribute]): Array[Byte] = {
-    // aggExpressions contains both grouping expressions and AggregateExpressions. Transform the
-    // grouping expressions into AggregateExpressions that collect the first seen value.
-    val aggExpressionsWithFirst = aggExpressions.map {
-      case Alias(e: AggregateExpression, _) => e
-      case e: NamedExpression => AggregateExpression(First(e, Literal(false)), Final, false)
-    }
+    val aggExpressionsWithFirst = groupingToFirst(aggExpressions)
 
     val aggSchema = aggExpressionsWithFirst.flatMap(_.aggregateFunction.aggBufferAttributes)
     // For aggregation, we concatenate the current aggregate row with the new input row and run
@@ -1117,22 +1727,88 @@ object Utils extends Logging {
         tuix.AggregateOp.createAggregateExpressionsVector(
           builder,
           aggExpressionsWithFirst
-            .map(e => serializeAggExpression(builder, e, input, aggSchema, concatSchema))
+            .map(e => serializeAggExpression(builder, e, input, aggSchema, concatSchema, false))
             .toArray)))
     builder.sizedByteArray()
   }
 
+  /**
+   * Serialize an AggregateOp that combines the partial rows written by
+   * SGXEnclave.NonObliviousPartialAggregate for the same aggregate expressions. Each partial row
+   * holds the values of the grouping expressions, described by groupingAttributes, followed by
+   * the aggregation buffers of aggExpressions. The resulting AggregateOp groups partial rows by
+   * their grouping values and merges their aggregation buffers instead of updating them with input
+   * rows, then evaluates the aggregates as the AggregateOp from [[serializeAggOp]] would.
+   */
+  def serializeMergeAggOp(
+    groupingAttributes: Seq[Attribute],
+    aggExpressions: Seq[NamedExpression]): Array[Byte] = {
+    val aggExpressionsWithFirst = groupingToFirst(aggExpressions)
+
+    val aggSchema = aggExpressionsWithFirst.flatMap(_.aggregateFunction.aggBufferAttributes)
+    val partialSchema = groupingAttributes ++
+      aggExpressionsWithFirst.flatMap(_.aggregateFunction.inputAggBufferAttributes)
+    val concatSchema = aggSchema ++ partialSchema
+
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.AggregateOp.createAggregateOp(
+        builder,
+        tuix.AggregateOp.createGroupingExpressionsVector(
+          builder,
+          groupingAttributes.map(e => flatbuffersSerializeExpression(builder, e, partialSchema))
+            .toArray),
+        tuix.AggregateOp.createAggregateExpressionsVector(
+          builder,
+          aggExpressionsWithFirst
+            .map(e => serializeAggExpression(
+              builder, e, partialSchema, aggSchema, concatSchema, true))
+            .toArray)))
+    builder.sizedByteArray()
+  }
+
+  /** Attributes for the grouping values that begin each partial aggregate row. */
+  def partialAggGroupingAttributes(groupingExpressions: Seq[Expression]): Seq[Attribute] =
+    groupingExpressions.zipWithIndex.map {
+      case (e, i) => AttributeReference(s"_group$i", e.dataType, e.nullable)()
+    }
+
+  /**
+   * aggExpressions contains both grouping expressions and AggregateExpressions. Transform the
+   * grouping expressions into AggregateExpressions that collect the first seen value.
+   */
+  private def groupingToFirst(aggExpressions: Seq[NamedExpression]): Seq[AggregateExpression] =
+    aggExpressions.map {
+      case Alias(e: AggregateExpression, _) => e
+      case e: NamedExpression => AggregateExpression(First(e, Literal(false)), Final, false)
+    }
+
   /**
    * Serialize an AggregateExpression into a tuix.AggregateExpr. Returns the offset of the written
    * tuix.AggregateExpr.
+   *
+   * If merge is true, the update expressions combine the aggregation buffer with another
+   * aggregation buffer for the same expression, given by the function's inputAggBufferAttributes,
+   * rather than with an input row.
    */
   def serializeAggExpression(
     builder: FlatBufferBuilder, e: AggregateExpression, input: Seq[Attribute],
-    aggSchema: Seq[Attribute], concatSchema: Seq[Attribute]): Int = {
+    aggSchema: Seq[Attribute], concatSchema: Seq[Attribute], merge: Boolean): Int = {
+    def serializeUpdateExprs(updateExprs: Seq[Expression]): Int =
+      tuix.AggregateExpr.createUpdateExprsVector(
+        builder,
+        updateExprs.map(u => flatbuffersSerializeExpression(builder, u, concatSchema)).toArray)
+    // Let the enclave update the aggregation buffer natively from the given input expression.
+    // Merging buffers always uses the update expressions.
+    def nativeKind(kind: Byte): Byte = if (merge) tuix.AggregateKind.Generic else kind
+    def nativeInput(child: Expression): Int =
+      if (merge) 0 else flatbuffersSerializeExpression(builder, child, input)
+
     (e.aggregateFunction: @unchecked) match {
       case avg @ Average(child) =>
         val sum = avg.aggBufferAttributes(0)
         val count = avg.aggBufferAttributes(1)
+        val Seq(otherSum, otherCount) = avg.inputAggBufferAttributes
 
         // TODO: support aggregating null values
         // TODO: support DecimalType to match Spark SQL behavior
@@ -1143,18 +1819,24 @@ object Utils extends Logging {
             Array(
               /* sum = */ flatbuffersSerializeExpression(builder, Literal(0.0), input),
               /* count = */ flatbuffersSerializeExpression(builder, Literal(0L), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* sum = */ flatbuffersSerializeExpression(
-                builder, Add(sum, Cast(child, DoubleType)), concatSchema),
-              /* count = */ flatbuffersSerializeExpression(
-                builder, Add(count, Literal(1L)), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(
+                /* sum = */ Add(sum, otherSum),
+                /* count = */ Add(count, otherCount))
+            } else {
+              Seq(
+                /* sum = */ Add(sum, Cast(child, DoubleType)),
+                /* count = */ Add(count, Literal(1L)))
+            }),
           flatbuffersSerializeExpression(
-            builder, Divide(sum, Cast(count, DoubleType)), aggSchema))
+            builder, Divide(sum, Cast(count, DoubleType)), aggSchema),
+          nativeKind(tuix.AggregateKind.Average),
+          nativeInput(child))
 
       case c @ Count(children) =>
         val count = c.aggBufferAttributes(0)
+        val Seq(otherCount) = c.inputAggBufferAttributes
 
         // TODO: support skipping null values
         tuix.AggregateExpr.createAggregateExpr(
@@ -1163,17 +1845,21 @@ object Utils extends Logging {
             builder,
             Array(
               /* count = */ flatbuffersSerializeExpression(builder, Literal(0L), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* count = */ flatbuffersSerializeExpression(
-                builder, Add(count, Literal(1L)), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(/* count = */ Add(count, otherCount))
+            } else {
+              Seq(/* count = */ Add(count, Literal(1L)))
+            }),
           flatbuffersSerializeExpression(
-            builder, count, aggSchema))
+            builder, count, aggSchema),
+          nativeKind(tuix.AggregateKind.Count),
+          0)
 
       case f @ First(child, Literal(false, BooleanType)) =>
         val first = f.aggBufferAttributes(0)
         val valueSet = f.aggBufferAttributes(1)
+        val Seq(otherFirst, otherValueSet) = f.inputAggBufferAttributes
 
         // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
@@ -1184,18 +1870,24 @@ object Utils extends Logging {
               /* first = */ flatbuffersSerializeExpression(
                 builder, Literal.create(null, child.dataType), input),
               /* valueSet = */ flatbuffersSerializeExpression(builder, Literal(false), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* first = */ flatbuffersSerializeExpression(
-                builder, If(valueSet, first, child), concatSchema),
-              /* valueSet = */ flatbuffersSerializeExpression(
-                builder, Literal(true), concatSchema))),
-          flatbuffersSerializeExpression(builder, first, aggSchema))
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(
+                /* first = */ If(valueSet, first, otherFirst),
+                /* valueSet = */ Or(valueSet, otherValueSet))
+            } else {
+              Seq(
+                /* first = */ If(valueSet, first, child),
+                /* valueSet = */ Literal(true))
+            }),
+          flatbuffersSerializeExpression(builder, first, aggSchema),
+          nativeKind(tuix.AggregateKind.First),
+          nativeInput(child))
 
       case l @ Last(child, Literal(false, BooleanType)) =>
         val last = l.aggBufferAttributes(0)
-        // val valueSet = l.aggBufferAttributes(1)
+        val valueSet = l.aggBufferAttributes(1)
+        val Seq(otherLast, otherValueSet) = l.inputAggBufferAttributes
 
         // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
@@ -1206,17 +1898,23 @@ object Utils extends Logging {
               /* last = */ flatbuffersSerializeExpression(
                 builder, Literal.create(null, child.dataType), input),
               /* valueSet = */ flatbuffersSerializeExpression(builder, Literal(false), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* last = */ flatbuffersSerializeExpression(
-                builder, child, concatSchema),
-              /* valueSet = */ flatbuffersSerializeExpression(
-                builder, Literal(true), concatSchema))),
-          flatbuffersSerializeExpression(builder, last, aggSchema))
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(
+                /* last = */ If(otherValueSet, otherLast, last),
+                /* valueSet = */ Or(valueSet, otherValueSet))
+            } else {
+              Seq(
+                /* last = */ child,
+                /* valueSet = */ Literal(true))
+            }),
+          flatbuffersSerializeExpression(builder, last, aggSchema),
+          nativeKind(tuix.AggregateKind.Last),
+          nativeInput(child))
 
       case m @ Max(child) =>
         val max = m.aggBufferAttributes(0)
+        val Seq(otherMax) = m.inputAggBufferAttributes
 
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -1225,16 +1923,21 @@ object Utils extends Logging {
             Array(
               /* max = */ flatbuffersSerializeExpression(
                 builder, Literal.create(null, child.dataType), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* max = */ flatbuffersSerializeExpression(
-                builder, If(Or(IsNull(max), GreaterThan(child, max)), child, max), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(/* max = */ If(IsNull(otherMax), max,
+                If(Or(IsNull(max), GreaterThan(otherMax, max)), otherMax, max)))
+            } else {
+              Seq(/* max = */ If(Or(IsNull(max), GreaterThan(child, max)), child, max))
+            }),
           flatbuffersSerializeExpression(
-            builder, max, aggSchema))
+            builder, max, aggSchema),
+          nativeKind(tuix.AggregateKind.Max),
+          nativeInput(child))
 
       case m @ Min(child) =>
         val min = m.aggBufferAttributes(0)
+        val Seq(otherMin) = m.inputAggBufferAttributes
 
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -1243,16 +1946,21 @@ object Utils extends Logging {
             Array(
               /* min = */ flatbuffersSerializeExpression(
                 builder, Literal.create(null, child.dataType), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* min = */ flatbuffersSerializeExpression(
-                builder, If(Or(IsNull(min), LessThan(child, min)), child, min), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(/* min = */ If(IsNull(otherMin), min,
+                If(Or(IsNull(min), LessThan(otherMin, min)), otherMin, min)))
+            } else {
+              Seq(/* min = */ If(Or(IsNull(min), LessThan(child, min)), child, min))
+            }),
           flatbuffersSerializeExpression(
-            builder, min, aggSchema))
+            builder, min, aggSchema),
+          nativeKind(tuix.AggregateKind.Min),
+          nativeInput(child))
 
       case s @ Sum(child) =>
         val sum = s.aggBufferAttributes(0)
+        val Seq(otherSum) = s.inputAggBufferAttributes
 
         val sumDataType = s.dataType
 
@@ -1264,16 +1972,20 @@ object Utils extends Logging {
             Array(
               /* sum = */ flatbuffersSerializeExpression(
                 builder, Cast(Literal(0), sumDataType), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* sum = */ flatbuffersSerializeExpression(
-                builder, Add(sum, Cast(child, sumDataType)), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(/* sum = */ Add(sum, otherSum))
+            } else {
+              Seq(/* sum = */ Add(sum, Cast(child, sumDataType)))
+            }),
           flatbuffersSerializeExpression(
-            builder, sum, aggSchema))
+            builder, sum, aggSchema),
+          nativeKind(tuix.AggregateKind.Sum),
+          nativeInput(child))
 
       case vs @ ScalaUDAF(Seq(child), _: VectorSum, _, _) =>
         val sum = vs.aggBufferAttributes(0)
+        val Seq(otherSum) = vs.inputAggBufferAttributes
 
         val sumDataType = vs.dataType
 
@@ -1285,13 +1997,16 @@ object Utils extends Logging {
             Array(
               /* sum = */ flatbuffersSerializeExpression(
                 builder, Literal(Array[Double]()), input))),
-          tuix.AggregateExpr.createUpdateExprsVector(
-            builder,
-            Array(
-              /* sum = */ flatbuffersSerializeExpression(
-                builder, VectorAdd(sum, child), concatSchema))),
+          serializeUpdateExprs(
+            if (merge) {
+              Seq(/* sum = */ VectorAdd(sum, otherSum))
+            } else {
+              Seq(/* sum = */ VectorAdd(sum, child))
+            }),
           flatbuffersSerializeExpression(
-            builder, sum, aggSchema))
+            builder, sum, aggSchema),
+          nativeKind(tuix.AggregateKind.VectorSum),
+          nativeInput(child))
     }
   }
 
@@ -1305,17 +2020,73 @@ object Utils extends Logging {
     val builder = new FlatBufferBuilder
     builder.finish(
       tuix.EncryptedBlocks.createEncryptedBlocks(
-        builder, tuix.EncryptedBlocks.createBlocksVector(builder, allBlocks.map { encryptedBlock =>
-          val encRows = new Array[Byte](encryptedBlock.encRowsLength)
-          encryptedBlock.encRowsAsByteBuffer.get(encRows)
-          tuix.EncryptedBlock.createEncryptedBlock(
-            builder,
-            encryptedBlock.numRows,
-            tuix.EncryptedBlock.createEncRowsVector(builder, encRows))
-        }.toArray)))
+        builder, tuix.EncryptedBlocks.createBlocksVector(
+          builder, allBlocks.map(copyEncryptedBlock(builder, _)).toArray)))
     Block(builder.sizedByteArray())
   }
 
+  /**
+   * Wrap each of the given blocks, which must already be sorted, as one run of a tuix.SortedRuns
+   * object so they can be merged in the enclave without re-sorting.
+   */
+  def encryptedBlocksToSortedRuns(blocks: Seq[Block]): Array[Byte] = {
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.SortedRuns.createSortedRuns(
+        builder, tuix.SortedRuns.createRunsVector(builder, blocks.map { block =>
+          val encryptedBlocks =
+            tuix.EncryptedBlocks.getRootAsEncryptedBlocks(ByteBuffer.wrap(block.bytes))
+          tuix.EncryptedBlocks.createEncryptedBlocks(
+            builder, tuix.EncryptedBlocks.createBlocksVector(
+              builder,
+              (0 until encryptedBlocks.blocksLength).map { i =>
+                copyEncryptedBlock(builder, encryptedBlocks.blocks(i))
+              }.toArray))
+        }.toArray)))
+    builder.sizedByteArray()
+  }
+
+  private def copyEncryptedBlock(
+      builder: FlatBufferBuilder, encryptedBlock: tuix.EncryptedBlock): Int = {
+    val encRows = new Array[Byte](encryptedBlock.encRowsLength)
+    if (encRows.nonEmpty) {
+      encryptedBlock.encRowsAsByteBuffer.get(encRows)
+    }
+    val blockId = new Array[Byte](encryptedBlock.blockIdLength)
+    if (blockId.nonEmpty) {
+      encryptedBlock.blockIdAsByteBuffer.get(blockId)
+    }
+    val encStats = new Array[Byte](encryptedBlock.encStatsLength)
+    if (encStats.nonEmpty) {
+      encryptedBlock.encStatsAsByteBuffer.get(encStats)
+    }
+    val encColumns = (0 until encryptedBlock.encColumnsLength).map { j =>
+      val chunk = encryptedBlock.encColumns(j)
+      val encChunk = new Array[Byte](chunk.encChunkLength)
+      chunk.encChunkAsByteBuffer.get(encChunk)
+      tuix.EncryptedColumnChunk.createEncryptedColumnChunk(
+        builder, tuix.EncryptedColumnChunk.createEncChunkVector(builder, encChunk))
+    }
+    val encRowChunks = (0 until encryptedBlock.encRowChunksLength).map { j =>
+      val chunk = encryptedBlock.encRowChunks(j)
+      val encChunk = new Array[Byte](chunk.encChunkLength)
+      chunk.encChunkAsByteBuffer.get(encChunk)
+      tuix.EncryptedRowChunk.createEncryptedRowChunk(
+        builder, tuix.EncryptedRowChunk.createEncChunkVector(builder, encChunk))
+    }
+    tuix.EncryptedBlock.createEncryptedBlock(
+      builder,
+      encryptedBlock.numRows,
+      tuix.EncryptedBlock.createEncRowsVector(builder, encRows),
+      encryptedBlock.format,
+      if (blockId.isEmpty) 0 else tuix.EncryptedBlock.createBlockIdVector(builder, blockId),
+      if (encColumns.isEmpty) 0
+      else tuix.EncryptedBlock.createEncColumnsVector(builder, encColumns.toArray),
+      if (encStats.isEmpty) 0 else tuix.EncryptedBlock.createEncStatsVector(builder, encStats),
+      if (encRowChunks.isEmpty) 0
+      else tuix.EncryptedBlock.createEncRowChunksVector(builder, encRowChunks.toArray))
+  }
+
   def emptyBlock: Block = {
     val builder = new FlatBufferBuilder
     builder.finish(
@@ -52,36 +52,25 @@ object EncryptedSortExec {
             Block(sortedRows)
           }
         } else {
-          // Collect a sample of the input rows
-          val sampled = time("non-oblivious sort - Sample") {
-            Utils.concatEncryptedBlocks(childRDD.map { block =>
-              val (enclave, eid) = Utils.initEnclave()
-              val sampledBlock = enclave.Sample(eid, block.bytes)
-              Block(sampledBlock)
-            }.collect)
-          }
-          // Find range boundaries parceled out to a single worker
-          val boundaries = time("non-oblivious sort - FindRangeBounds") {
-            childRDD.context.parallelize(Array(sampled.bytes), 1).map { sampledBytes =>
-              val (enclave, eid) = Utils.initEnclave()
-              enclave.FindRangeBounds(eid, orderSer, numPartitions, sampledBytes)
-            }.collect.head
-          }
-          // Broadcast the range boundaries and use them to partition the input
-          childRDD.flatMap { block =>
+          val boundaries = findRangeBounds(Seq(childRDD), orderSer, numPartitions)
+          // Sort each partition locally before partitioning it. Partitioning preserves the order of
+          // the rows, so each piece is a sorted run, and each reducer receives exactly one run per
+          // map-side partition. This is the one full sort in the pipeline: partitioning itself does
+          // not sort, and the reducer only merges. Sorting after the shuffle instead would do the
+          // same comparisons per row, but over the many small pieces that range partitioning cuts
+          // each block into. That makes many more runs, and so more merge passes that each
+          // re-encrypt and re-decrypt every row.
+          val sortedChildRDD = childRDD.map { block =>
             val (enclave, eid) = Utils.initEnclave()
-            val partitions = enclave.PartitionForSort(
-              eid, orderSer, numPartitions, block.bytes, boundaries)
-            partitions.zipWithIndex.map {
-              case (partition, i) => (i, Block(partition))
-            }
+            Block(enclave.ExternalSort(eid, orderSer, block.bytes))
           }
-          // Shuffle the input to achieve range partitioning and sort locally
+          // Shuffle the sorted runs to achieve range partitioning and merge them locally
+          partitionByRange(sortedChildRDD, orderSer, numPartitions, boundaries)
             .groupByKey(numPartitions).map {
               case (i, blocks) =>
                 val (enclave, eid) = Utils.initEnclave()
-                Block(enclave.ExternalSort(
-                  eid, orderSer, Utils.concatEncryptedBlocks(blocks.toSeq).bytes))
+                Block(enclave.MergeSortedRuns(
+                  eid, orderSer, Utils.encryptedBlocksToSortedRuns(blocks.toSeq)))
             }
         }
       Utils.ensureCached(result)
@@ -89,4 +78,46 @@ object EncryptedSortExec {
       result
     }
   }
+
+  /**
+   * Find the boundary rows that split the rows of the given RDDs into numPartitions ranges of the
+   * sort order, by sampling the rows and sorting the sample on a single worker.
+   */
+  def findRangeBounds(
+      rdds: Seq[RDD[Block]], orderSer: Array[Byte], numPartitions: Int): Array[Byte] = {
+    // Collect a sample of the input rows
+    val sampled = time("non-oblivious sort - Sample") {
+      Utils.concatEncryptedBlocks(rdds.flatMap { rdd =>
+        rdd.map { block =>
+          val (enclave, eid) = Utils.initEnclave()
+          val sampledBlock = enclave.Sample(eid, block.bytes)
+          Block(sampledBlock)
+        }.collect
+      })
+    }
+    // Find range boundaries parceled out to a single worker
+    time("non-oblivious sort - FindRangeBounds") {
+      rdds.head.context.parallelize(Array(sampled.bytes), 1).map { sampledBytes =>
+        val (enclave, eid) = Utils.initEnclave()
+        enclave.FindRangeBounds(eid, orderSer, numPartitions, sampledBytes)
+      }.collect.head
+    }
+  }
+
+  /**
+   * Split each block of the given RDD into numPartitions pieces according to the given range
+   * boundaries, keyed by the index of the range. The pieces keep the relative order of the rows.
+   */
+  def partitionByRange(
+      rdd: RDD[Block], orderSer: Array[Byte], numPartitions: Int,
+      boundaries: Array[Byte]): RDD[(Int, Block)] = {
+    rdd.flatMap { block =>
+      val (enclave, eid) = Utils.initEnclave()
+      val partitions = enclave.PartitionForSort(
+        eid, orderSer, numPartitions, block.bytes, boundaries)
+      partitions.zipWithIndex.map {
+        case (partition, i) => (i, Block(partition))
+      }
+    }
+  }
 }
@@ -28,9 +28,19 @@ class SGXEnclave extends java.io.Serializable {
 
   @native def Filter(eid: Long, condition: Array[Byte], input: Array[Byte]): Array[Byte]
 
-  @native def Encrypt(eid: Long, plaintext: Array[Byte]): Array[Byte]
+  // aad is additional data that the MAC covers but that is not encrypted (see Utils.encryptMany)
+  @native def Encrypt(eid: Long, plaintext: Array[Byte], aad: Array[Byte]): Array[Byte]
   @native def Decrypt(eid: Long, ciphertext: Array[Byte]): Array[Byte]
 
+  // AES-GCM on the host under the given key, outside any enclave
+  @native def HostAesGcmSupported(): Boolean
+  @native def HostEncryptBatch(
+    key: Array[Byte], aad: Array[Byte], ivs: Array[Byte], plaintexts: Array[Array[Byte]],
+    ciphertexts: Array[Array[Byte]]): Unit
+  @native def HostDecryptBatch(
+    key: Array[Byte], aad: Array[Byte], ciphertexts: Array[Array[Byte]],
+    plaintexts: Array[Array[Byte]]): Unit
+
   @native def Sample(eid: Long, input: Array[Byte]): Array[Byte]
   @native def FindRangeBounds(
     eid: Long, order: Array[Byte], numPartitions: Int, input: Array[Byte]): Array[Byte]
@@ -38,17 +48,39 @@ class SGXEnclave extends java.io.Serializable {
     eid: Long, order: Array[Byte], numPartitions: Int, input: Array[Byte],
     boundaries: Array[Byte]): Array[Array[Byte]]
   @native def ExternalSort(eid: Long, order: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def MergeSortedRuns(eid: Long, order: Array[Byte], runs: Array[Byte]): Array[Byte]
+  // Testing entry point: ExternalSort merging at most maxNumStreams runs at a time. Also returns
+  // the number of intermediate merge passes.
+  @native def TestExternalSort(
+    eid: Long, order: Array[Byte], input: Array[Byte], maxNumStreams: Int): (Array[Byte], Int)
 
   @native def ScanCollectLastPrimary(
     eid: Long, joinExpr: Array[Byte], input: Array[Byte]): Array[Byte]
   @native def NonObliviousSortMergeJoin(
     eid: Long, joinExpr: Array[Byte], input: Array[Byte], joinRow: Array[Byte]): Array[Byte]
+  // Testing entry point: NonObliviousSortMergeJoin spilling each group whose primary rows exceed
+  // maxGroupCacheSize bytes. Also returns the number of spilled groups.
+  @native def TestSortMergeJoin(
+    eid: Long, joinExpr: Array[Byte], input: Array[Byte], joinRow: Array[Byte],
+    maxGroupCacheSize: Long): (Array[Byte], Int)
+  @native def NonObliviousHashJoin(
+    eid: Long, joinExpr: Array[Byte], primaryRows: Array[Byte],
+    foreignRows: Array[Byte]): Array[Byte]
+  @native def BroadcastHashJoin(
+    eid: Long, joinExpr: Array[Byte], buildRows: Array[Byte],
+    streamRows: Array[Byte]): Array[Byte]
 
-  @native def NonObliviousAggregateStep1(
-    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): (Array[Byte], Array[Byte], Array[Byte])
-  @native def NonObliviousAggregateStep2(
-    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte], nextPartitionFirstRow: Array[Byte],
-    prevPartitionLastGroup: Array[Byte], prevPartitionLastRow: Array[Byte]): Array[Byte]
+  @native def NonObliviousAggregate(
+    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): (Array[Byte], Array[Byte])
+  @native def NonObliviousHashAggregate(
+    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): Array[Byte]
+  // Testing entry point: NonObliviousHashAggregate spilling groups once the table holds
+  // maxTableSize bytes. Also returns the deepest level of spilling.
+  @native def TestHashAggregate(
+    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte],
+    maxTableSize: Long): (Array[Byte], Int)
+  @native def NonObliviousPartialAggregate(
+    eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): Array[Byte]
 
   // Remote attestation, enclave side
   @native def RemoteAttestation0(eid: Long): Array[Byte]
@@ -74,9 +74,12 @@ case class EncryptedLocalTableScanExec(
       }.toSeq
 
     // Encrypt each local partition
+    val format = Utils.blockFormat
+    val stats = Utils.blockStats
     val encryptedPartitions: Seq[Block] =
       slicedPlaintextData.map(slice =>
-        Utils.encryptInternalRowsFlatbuffers(slice, output.map(_.dataType), useEnclave = false))
+        Utils.encryptInternalRowsFlatbuffers(
+          slice, output.map(_.dataType), useEnclave = false, format = format, stats = stats))
 
     // Make an RDD from the encrypted partitions
     sqlContext.sparkContext.parallelize(encryptedPartitions)
@@ -89,9 +92,11 @@ case class EncryptExec(child: SparkPlan)
   override def output: Seq[Attribute] = child.output
 
   override def executeBlocked(): RDD[Block] = {
+    val format = Utils.blockFormat
+    val stats = Utils.blockStats
     child.execute().mapPartitions { rowIter =>
       Iterator(Utils.encryptInternalRowsFlatbuffers(
-        rowIter.toSeq, output.map(_.dataType), useEnclave = true))
+        rowIter.toSeq, output.map(_.dataType), useEnclave = true, format = format, stats = stats))
     }
   }
 }
@@ -235,37 +240,98 @@ case class EncryptedAggregateExec(
 
   override def executeBlocked(): RDD[Block] = {
     val aggExprSer = Utils.serializeAggOp(groupingExpressions, aggExpressions, child.output)
+    val mergeAggExprSer = Utils.serializeMergeAggOp(
+      Utils.partialAggGroupingAttributes(groupingExpressions), aggExpressions)
 
     timeOperator(
       child.asInstanceOf[OpaqueOperatorExec].executeBlocked(),
       "EncryptedAggregateExec") { childRDD =>
 
-      val (firstRows, lastGroups, lastRows) = childRDD.map { block =>
+      // Aggregate each partition in a single pass. Groups that may span partitions are returned
+      // as partial aggregates instead.
+      val aggregated = childRDD.map { block =>
         val (enclave, eid) = Utils.initEnclave()
-        val (firstRow, lastGroup, lastRow) = enclave.NonObliviousAggregateStep1(
+        val (outputRows, boundaryPartials) = enclave.NonObliviousAggregate(
           eid, aggExprSer, block.bytes)
-        (Block(firstRow), Block(lastGroup), Block(lastRow))
-      }.collect.unzip3
-
-      // Send first row to previous partition and last group to next partition
-      val shiftedFirstRows = firstRows.drop(1) :+ Utils.emptyBlock
-      val shiftedLastGroups = Utils.emptyBlock +: lastGroups.dropRight(1)
-      val shiftedLastRows = Utils.emptyBlock +: lastRows.dropRight(1)
-      val shifted = (shiftedFirstRows, shiftedLastGroups, shiftedLastRows).zipped.toSeq
-      assert(shifted.size == childRDD.partitions.length)
-      val shiftedRDD = sparkContext.parallelize(shifted, childRDD.partitions.length)
+        (Block(outputRows), Block(boundaryPartials))
+      }
+      Utils.ensureCached(aggregated)
+
+      // Each partition contributes at most two boundary partials, so merge them all on a single
+      // worker
+      val boundaryPartials = Utils.concatEncryptedBlocks(aggregated.map(_._2).collect)
+      val boundaryGroups = sparkContext.parallelize(Array(boundaryPartials.bytes), 1).map {
+        boundaryPartialsBytes =>
+          val (enclave, eid) = Utils.initEnclave()
+          Block(enclave.NonObliviousHashAggregate(eid, mergeAggExprSer, boundaryPartialsBytes))
+      }
+
+      aggregated.map(_._1).union(boundaryGroups)
+    }
+  }
+}
+
+/**
+ * Groups its input by hashing the grouping keys inside the enclave instead of sorting. Each
+ * partition is first reduced to one partial aggregate row per group, so that only partial rows
+ * are shuffled. The partial rows are range-partitioned on their grouping values so that each group
+ * falls in a single partition, where they are merged by hashing again.
+ */
+case class EncryptedHashAggregateExec(
+    groupingExpressions: Seq[Expression],
+    aggExpressions: Seq[NamedExpression],
+    child: SparkPlan)
+  extends UnaryExecNode with OpaqueOperatorExec {
+  import Utils.time
+
+  override def producedAttributes: AttributeSet =
+    AttributeSet(aggExpressions) -- AttributeSet(groupingExpressions)
+
+  override def output: Seq[Attribute] = aggExpressions.map(_.toAttribute)
+
+  override def executeBlocked(): RDD[Block] = {
+    val aggExprSer = Utils.serializeAggOp(groupingExpressions, aggExpressions, child.output)
 
-      childRDD.zipPartitions(shiftedRDD) { (blockIter, boundaryIter) =>
-        (blockIter.toSeq, boundaryIter.toSeq) match {
-          case (Seq(block), Seq(Tuple3(
-            nextPartitionFirstRow, prevPartitionLastGroup, prevPartitionLastRow))) =>
+    val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    Utils.ensureCached(childRDD)
+    time("Force child of EncryptedHashAggregateExec") { childRDD.count }
+
+    time("EncryptedHashAggregateExec") {
+      val numPartitions = childRDD.partitions.length
+      val result =
+        if (numPartitions <= 1) {
+          childRDD.map { block =>
+            val (enclave, eid) = Utils.initEnclave()
+            Block(enclave.NonObliviousHashAggregate(eid, aggExprSer, block.bytes))
+          }
+        } else {
+          // Partial rows hold the values of the grouping expressions followed by the
+          // aggregation buffers
+          val groupingAttributes = Utils.partialAggGroupingAttributes(groupingExpressions)
+          val partialOrderSer = Utils.serializeSortOrder(
+            groupingAttributes.map(a => SortOrder(a, Ascending)), groupingAttributes)
+          val mergeAggExprSer = Utils.serializeMergeAggOp(groupingAttributes, aggExpressions)
+
+          val partialRDD = childRDD.map { block =>
             val (enclave, eid) = Utils.initEnclave()
-            Iterator(Block(enclave.NonObliviousAggregateStep2(
-              eid, aggExprSer, block.bytes,
-              nextPartitionFirstRow.bytes, prevPartitionLastGroup.bytes,
-              prevPartitionLastRow.bytes)))
+            Block(enclave.NonObliviousPartialAggregate(eid, aggExprSer, block.bytes))
+          }
+          Utils.ensureCached(partialRDD)
+          time("EncryptedHashAggregateExec - partial aggregate") { partialRDD.count }
+
+          val boundaries =
+            EncryptedSortExec.findRangeBounds(Seq(partialRDD), partialOrderSer, numPartitions)
+          EncryptedSortExec.partitionByRange(partialRDD, partialOrderSer, numPartitions, boundaries)
+            .groupByKey(numPartitions).map {
+              case (i, blocks) =>
+                val (enclave, eid) = Utils.initEnclave()
+                Block(enclave.NonObliviousHashAggregate(
+                  eid, mergeAggExprSer, Utils.concatEncryptedBlocks(blocks.toSeq).bytes))
+            }
         }
-      }
+      Utils.ensureCached(result)
+      result.count
+      result
     }
   }
 }
@@ -309,6 +375,107 @@ case class EncryptedSortMergeJoinExec(
   }
 }
 
+/**
+ * Joins the primary (left) and foreign (right) inputs, which are tagged as for
+ * [[EncryptedSortMergeJoinExec]], without sorting them. Both inputs are range-partitioned on the
+ * join keys using the same boundaries, and each partition is joined inside the enclave by building
+ * a hash table over its primary rows and streaming its foreign rows through it.
+ */
+case class EncryptedHashJoinExec(
+    joinType: JoinType,
+    leftKeys: Seq[Expression],
+    rightKeys: Seq[Expression],
+    leftSchema: Seq[Attribute],
+    rightSchema: Seq[Attribute],
+    output: Seq[Attribute],
+    left: SparkPlan,
+    right: SparkPlan)
+  extends BinaryExecNode with OpaqueOperatorExec {
+  import Utils.time
+
+  override def executeBlocked(): RDD[Block] = {
+    val joinExprSer = Utils.serializeJoinExpression(
+      joinType, leftKeys, rightKeys, leftSchema, rightSchema)
+    // The join keys are at the same positions in the tagged rows of both inputs, so a sort order
+    // serialized against the left input also applies to the right
+    val orderSer = Utils.serializeSortOrder(leftKeys.map(k => SortOrder(k, Ascending)), left.output)
+
+    val leftRDD = left.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    val rightRDD = right.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    Utils.ensureCached(leftRDD)
+    time("Force left child of EncryptedHashJoinExec") { leftRDD.count }
+    Utils.ensureCached(rightRDD)
+    time("Force right child of EncryptedHashJoinExec") { rightRDD.count }
+
+    time("EncryptedHashJoinExec") {
+      val numPartitions = math.max(leftRDD.partitions.length, rightRDD.partitions.length)
+      val (leftPartitioned, rightPartitioned) =
+        if (numPartitions <= 1) {
+          (leftRDD.map(block => (0, block)), rightRDD.map(block => (0, block)))
+        } else {
+          val boundaries =
+            EncryptedSortExec.findRangeBounds(Seq(leftRDD, rightRDD), orderSer, numPartitions)
+          (EncryptedSortExec.partitionByRange(leftRDD, orderSer, numPartitions, boundaries),
+            EncryptedSortExec.partitionByRange(rightRDD, orderSer, numPartitions, boundaries))
+        }
+
+      val result = leftPartitioned.cogroup(rightPartitioned, numPartitions).map {
+        case (i, (primaryBlocks, foreignBlocks)) =>
+          val (enclave, eid) = Utils.initEnclave()
+          Block(enclave.NonObliviousHashJoin(
+            eid, joinExprSer,
+            Utils.concatEncryptedBlocks(primaryBlocks.toSeq).bytes,
+            Utils.concatEncryptedBlocks(foreignBlocks.toSeq).bytes))
+      }
+      Utils.ensureCached(result)
+      result.count
+      result
+    }
+  }
+}
+
+/**
+ * Joins the tagged primary (left) and foreign (right) inputs by broadcasting the smaller one,
+ * selected by buildLeft, to every partition of the other. Each enclave decrypts and indexes the
+ * broadcast input once and reuses it across tasks, so the streamed side is neither sorted nor
+ * shuffled.
+ */
+case class EncryptedBroadcastHashJoinExec(
+    joinType: JoinType,
+    leftKeys: Seq[Expression],
+    rightKeys: Seq[Expression],
+    leftSchema: Seq[Attribute],
+    rightSchema: Seq[Attribute],
+    output: Seq[Attribute],
+    buildLeft: Boolean,
+    left: SparkPlan,
+    right: SparkPlan)
+  extends BinaryExecNode with OpaqueOperatorExec {
+  import Utils.time
+
+  override def executeBlocked(): RDD[Block] = {
+    val joinExprSer = Utils.serializeJoinExpression(
+      joinType, leftKeys, rightKeys, leftSchema, rightSchema)
+
+    val (buildPlan, streamPlan) = if (buildLeft) (left, right) else (right, left)
+    val buildRDD = buildPlan.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    val buildBlock = time("EncryptedBroadcastHashJoinExec - collect build side") {
+      Utils.concatEncryptedBlocks(buildRDD.collect)
+    }
+    val broadcastBlock = sparkContext.broadcast(buildBlock)
+
+    timeOperator(
+      streamPlan.asInstanceOf[OpaqueOperatorExec].executeBlocked(),
+      "EncryptedBroadcastHashJoinExec") { streamRDD =>
+      streamRDD.map { block =>
+        val (enclave, eid) = Utils.initEnclave()
+        Block(enclave.BroadcastHashJoin(
+          eid, joinExprSer, broadcastBlock.value.bytes, block.bytes))
+      }
+    }
+  }
+}
+
 case class EncryptedUnionExec(
     left: SparkPlan,
     right: SparkPlan)
@@ -30,6 +30,7 @@ import org.apache.spark.sql.catalyst.plans.JoinType
 import org.apache.spark.sql.catalyst.plans.logical.BinaryNode
 import org.apache.spark.sql.catalyst.plans.logical.LeafNode
 import org.apache.spark.sql.catalyst.plans.logical.LogicalPlan
+import org.apache.spark.sql.catalyst.plans.logical.Statistics
 import org.apache.spark.sql.catalyst.plans.logical.UnaryNode
 
 /**
@@ -67,19 +68,21 @@ case class EncryptedLocalRelation(
   }
 
   override protected def stringArgs = Iterator(output)
+
+  override def computeStats(): Statistics = Statistics(
+    sizeInBytes = output.map(n => BigInt(n.dataType.defaultSize)).sum * plaintextData.length)
 }
 
 case class EncryptedBlockRDD(
     output: Seq[Attribute],
     rdd: RDD[Block])
-  extends OpaqueOperator with MultiInstanceRelation {
-
-  override def children: Seq[LogicalPlan] = Nil
+  extends LeafNode with MultiInstanceRelation with OpaqueOperator {
 
   override def newInstance(): EncryptedBlockRDD.this.type =
     EncryptedBlockRDD(output.map(_.newInstance()), rdd).asInstanceOf[this.type]
 
-  override def producedAttributes: AttributeSet = outputSet
+  // The size of the encrypted data is unknown without scanning it, so assume it is large
+  override def computeStats(): Statistics = Statistics(sizeInBytes = conf.defaultSizeInBytes)
 }
 
 case class EncryptedProject(projectList: Seq[NamedExpression], child: OpaqueOperator)
@@ -110,6 +113,17 @@ case class EncryptedAggregate(
   override def output: Seq[Attribute] = aggExpressions.map(_.toAttribute)
 }
 
+case class EncryptedHashAggregate(
+    groupingExpressions: Seq[Expression],
+    aggExpressions: Seq[NamedExpression],
+    child: OpaqueOperator)
+  extends UnaryNode with OpaqueOperator {
+
+  override def producedAttributes: AttributeSet =
+    AttributeSet(aggExpressions) -- AttributeSet(groupingExpressions)
+  override def output: Seq[Attribute] = aggExpressions.map(_.toAttribute)
+}
+
 case class EncryptedJoin(
     left: OpaqueOperator,
     right: OpaqueOperator,
@@ -24,12 +24,15 @@ import org.apache.spark.sql.InMemoryRelationMatcher
 import org.apache.spark.sql.UndoCollapseProject
 import org.apache.spark.sql.catalyst.expressions.And
 import org.apache.spark.sql.catalyst.expressions.Ascending
+import org.apache.spark.sql.catalyst.expressions.Expression
 import org.apache.spark.sql.catalyst.expressions.IsNotNull
+import org.apache.spark.sql.catalyst.expressions.NamedExpression
 import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.catalyst.plans.logical._
 import org.apache.spark.sql.catalyst.rules.Rule
 import org.apache.spark.sql.execution.SparkPlan
 import org.apache.spark.sql.execution.datasources.LogicalRelation
+import org.apache.spark.sql.internal.SQLConf
 
 object EncryptLocalRelation extends Rule[LogicalPlan] {
   def apply(plan: LogicalPlan): LogicalPlan = plan transform {
@@ -53,6 +56,16 @@ object ConvertToOpaqueOperators extends Rule[LogicalPlan] {
     }.nonEmpty
   }
 
+  /**
+   * Whether to group by hashing rather than sorting. Global aggregates always use the sort-based
+   * operator, which merges the partial aggregates of all partitions on a single worker. That
+   * produces exactly one output row, even from empty input, whereas the hash-based operator would
+   * produce one from each partition after its shuffle.
+   */
+  private def useHashAggregate(groupingExprs: Seq[Expression]): Boolean =
+    groupingExprs.nonEmpty &&
+      SQLConf.get.getConfString("spark.opaque.hashAggregateEnabled", "true").toBoolean
+
   def apply(plan: LogicalPlan): LogicalPlan = plan transformUp {
     case l @ LogicalRelation(baseRelation: EncryptedScan, _, _, false) =>
       EncryptedBlockRDD(l.output, baseRelation.buildBlockedScan())
@@ -78,21 +91,21 @@ object ConvertToOpaqueOperators extends Rule[LogicalPlan] {
         left.asInstanceOf[OpaqueOperator], right.asInstanceOf[OpaqueOperator], joinType, condition)
 
     case p @ Aggregate(groupingExprs, aggExprs, child) if isEncrypted(p) =>
-      UndoCollapseProject.separateProjectAndAgg(p) match {
-        case Some((projectExprs, aggExprs)) =>
-          EncryptedProject(
-            projectExprs,
-            EncryptedAggregate(
-              groupingExprs, aggExprs,
-              EncryptedSort(
-                groupingExprs.map(e => SortOrder(e, Ascending)),
-                child.asInstanceOf[OpaqueOperator])))
-        case None =>
+      def aggregate(aggExprs: Seq[NamedExpression]): OpaqueOperator =
+        if (useHashAggregate(groupingExprs)) {
+          EncryptedHashAggregate(groupingExprs, aggExprs, child.asInstanceOf[OpaqueOperator])
+        } else {
           EncryptedAggregate(
             groupingExprs, aggExprs,
             EncryptedSort(
               groupingExprs.map(e => SortOrder(e, Ascending)),
               child.asInstanceOf[OpaqueOperator]))
+        }
+      UndoCollapseProject.separateProjectAndAgg(p) match {
+        case Some((projectExprs, aggExprs)) =>
+          EncryptedProject(projectExprs, aggregate(aggExprs))
+        case None =>
+          aggregate(aggExprs)
       }
 
     case p @ Union(Seq(left, right)) if isEncrypted(p) =>
@@ -26,9 +26,12 @@ import org.apache.spark.sql.catalyst.expressions.Literal
 import org.apache.spark.sql.catalyst.expressions.NamedExpression
 import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.catalyst.planning.ExtractEquiJoinKeys
+import org.apache.spark.sql.catalyst.plans.Inner
+import org.apache.spark.sql.catalyst.plans.JoinType
 import org.apache.spark.sql.catalyst.plans.logical.Join
 import org.apache.spark.sql.catalyst.plans.logical.LogicalPlan
 import org.apache.spark.sql.execution.SparkPlan
+import org.apache.spark.sql.internal.SQLConf
 
 import edu.berkeley.cs.rise.opaque.execution._
 import edu.berkeley.cs.rise.opaque.logical._
@@ -51,16 +54,42 @@ object OpaqueOperators extends Strategy {
           val (rightProjSchema, rightKeysProj, _) = tagForJoin(rightKeys, right.output, false)
           val leftProj = EncryptedProjectExec(leftProjSchema, planLater(left))
           val rightProj = EncryptedProjectExec(rightProjSchema, planLater(right))
-          val unioned = EncryptedUnionExec(leftProj, rightProj)
-          val sorted = EncryptedSortExec(sortForJoin(leftKeysProj, tag, unioned.output), unioned)
-          val joined = EncryptedSortMergeJoinExec(
-            joinType,
-            leftKeysProj,
-            rightKeysProj,
-            leftProjSchema.map(_.toAttribute),
-            rightProjSchema.map(_.toAttribute),
-            (leftProjSchema ++ rightProjSchema).map(_.toAttribute),
-            sorted)
+          val joined =
+            broadcastLeft(joinType, left, right) match {
+              case Some(buildLeft) =>
+                EncryptedBroadcastHashJoinExec(
+                  joinType,
+                  leftKeysProj,
+                  rightKeysProj,
+                  leftProjSchema.map(_.toAttribute),
+                  rightProjSchema.map(_.toAttribute),
+                  (leftProjSchema ++ rightProjSchema).map(_.toAttribute),
+                  buildLeft,
+                  leftProj,
+                  rightProj)
+              case None if canHashJoin(joinType, left) =>
+                EncryptedHashJoinExec(
+                  joinType,
+                  leftKeysProj,
+                  rightKeysProj,
+                  leftProjSchema.map(_.toAttribute),
+                  rightProjSchema.map(_.toAttribute),
+                  (leftProjSchema ++ rightProjSchema).map(_.toAttribute),
+                  leftProj,
+                  rightProj)
+              case None =>
+                val unioned = EncryptedUnionExec(leftProj, rightProj)
+                val sorted =
+                  EncryptedSortExec(sortForJoin(leftKeysProj, tag, unioned.output), unioned)
+                EncryptedSortMergeJoinExec(
+                  joinType,
+                  leftKeysProj,
+                  rightKeysProj,
+                  leftProjSchema.map(_.toAttribute),
+                  rightProjSchema.map(_.toAttribute),
+                  (leftProjSchema ++ rightProjSchema).map(_.toAttribute),
+                  sorted)
+            }
           val tagsDropped = EncryptedProjectExec(dropTags(left.output, right.output), joined)
           val filtered = condition match {
             case Some(condition) => EncryptedFilterExec(condition, tagsDropped)
@@ -73,6 +102,9 @@ object OpaqueOperators extends Strategy {
     case a @ EncryptedAggregate(groupingExpressions, aggExpressions, child) =>
       EncryptedAggregateExec(groupingExpressions, aggExpressions, planLater(child)) :: Nil
 
+    case EncryptedHashAggregate(groupingExpressions, aggExpressions, child) =>
+      EncryptedHashAggregateExec(groupingExpressions, aggExpressions, planLater(child)) :: Nil
+
     case EncryptedUnion(left, right) =>
       EncryptedUnionExec(planLater(left), planLater(right)) :: Nil
 
@@ -88,6 +120,36 @@ object OpaqueOperators extends Strategy {
     case _ => Nil
   }
 
+  /**
+   * For an inner join with a side estimated below spark.sql.autoBroadcastJoinThreshold, return
+   * whether to broadcast the left side (rather than the right), preferring the smaller side.
+   * Return None if neither side should be broadcast.
+   */
+  private def broadcastLeft(
+      joinType: JoinType, left: LogicalPlan, right: LogicalPlan): Option[Boolean] = {
+    val threshold = SQLConf.get.autoBroadcastJoinThreshold
+    if (joinType != Inner || threshold < 0) {
+      None
+    } else {
+      val leftSize = left.stats.sizeInBytes
+      val rightSize = right.stats.sizeInBytes
+      if (rightSize <= threshold && rightSize <= leftSize) Some(false)
+      else if (leftSize <= threshold) Some(true)
+      else None
+    }
+  }
+
+  /**
+   * Whether to join by building a hash table over the primary (left) side instead of sorting both
+   * sides. This requires an inner join whose primary side is estimated to fit in enclave memory,
+   * as configured by spark.opaque.hashJoinThreshold (in bytes; set to -1 to disable).
+   */
+  private def canHashJoin(joinType: JoinType, primary: LogicalPlan): Boolean = {
+    val threshold = SQLConf.get.getConfString(
+      "spark.opaque.hashJoinThreshold", (32L * 1000 * 1000).toString).toLong
+    joinType == Inner && primary.stats.sizeInBytes <= threshold
+  }
+
   private def tagForJoin(
       keys: Seq[Expression], input: Seq[Attribute], isLeft: Boolean)
     : (Seq[NamedExpression], Seq[NamedExpression], NamedExpression) = {
@@ -20,6 +20,8 @@ package edu.berkeley.cs.rise.opaque
 import java.sql.Timestamp
 
 import scala.collection.mutable
+import scala.reflect.ClassTag
+import scala.reflect.classTag
 import scala.util.Random
 
 import org.apache.log4j.Level
@@ -31,7 +33,12 @@ import org.apache.spark.sql.Row
 import org.apache.spark.sql.SQLContext
 import org.apache.spark.sql.SQLImplicits
 import org.apache.spark.sql.SparkSession
+import org.apache.spark.sql.catalyst.CatalystTypeConverters
+import org.apache.spark.sql.catalyst.expressions.Ascending
+import org.apache.spark.sql.catalyst.expressions.Attribute
+import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.functions._
+import org.apache.spark.sql.execution.SparkPlan
 import org.apache.spark.sql.types._
 import org.apache.spark.storage.StorageLevel
 import org.apache.spark.unsafe.types.CalendarInterval
@@ -41,7 +48,13 @@ import org.scalatest.BeforeAndAfterAll
 import org.scalatest.FunSuite
 
 import edu.berkeley.cs.rise.opaque.benchmark._
+import edu.berkeley.cs.rise.opaque.execution.Block
 import edu.berkeley.cs.rise.opaque.execution.EncryptedBlockRDDScanExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedBroadcastHashJoinExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedHashAggregateExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedHashJoinExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedSortMergeJoinExec
+import edu.berkeley.cs.rise.opaque.execution.OpaqueOperatorExec
 import edu.berkeley.cs.rise.opaque.expressions.DotProduct.dot
 import edu.berkeley.cs.rise.opaque.expressions.VectorMultiply.vectormultiply
 import edu.berkeley.cs.rise.opaque.expressions.VectorSum
@@ -103,6 +116,54 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     }
   }
 
+  def withConf[A](key: String, value: String)(f: => A): A = {
+    spark.conf.set(key, value)
+    try f finally spark.conf.unset(key)
+  }
+
+  /**
+   * Collect the result of the given join with the given thresholds for broadcast and hash joins,
+   * checking that the encrypted plan uses the join operator T.
+   */
+  def collectJoin[T <: SparkPlan : ClassTag](
+      securityLevel: SecurityLevel, broadcastThreshold: Long, hashJoinThreshold: Long)(
+      join: => DataFrame): Set[Row] = {
+    withConf("spark.sql.autoBroadcastJoinThreshold", broadcastThreshold.toString) {
+      withConf("spark.opaque.hashJoinThreshold", hashJoinThreshold.toString) {
+        val df = join
+        if (securityLevel == Encrypted) {
+          val plan = df.queryExecution.executedPlan
+          assert(plan.find(classTag[T].runtimeClass.isInstance(_)).isDefined,
+            s"Expected a ${classTag[T].runtimeClass.getSimpleName} in\n$plan")
+        }
+        df.collect.toSet
+      }
+    }
+  }
+
+  /**
+   * Return all encrypted blocks of the given encrypted plan, concatenated in partition order, for
+   * calling testing entry points of the enclave.
+   */
+  def encryptedInput(plan: SparkPlan): Block =
+    Utils.concatEncryptedBlocks(plan.asInstanceOf[OpaqueOperatorExec].executeBlocked().collect)
+
+  /** Decrypt the rows of the given block, whose columns are `output`, into Spark SQL Rows. */
+  def collectBlock(block: Block, output: Seq[Attribute]): Seq[Row] = {
+    val toRow = CatalystTypeConverters.createToScalaConverter(
+      StructType(output.map(a => StructField(a.name, a.dataType, a.nullable))))
+    Utils.decryptBlockFlatbuffers(block).map(toRow(_).asInstanceOf[Row])
+  }
+
+  def sortMergeJoin(securityLevel: SecurityLevel)(join: => DataFrame): Set[Row] =
+    collectJoin[EncryptedSortMergeJoinExec](securityLevel, -1, -1)(join)
+
+  def hashJoin(securityLevel: SecurityLevel)(join: => DataFrame): Set[Row] =
+    collectJoin[EncryptedHashJoinExec](securityLevel, -1, Long.MaxValue)(join)
+
+  def broadcastJoin(securityLevel: SecurityLevel)(join: => DataFrame): Set[Row] =
+    collectJoin[EncryptedBroadcastHashJoinExec](securityLevel, Long.MaxValue, -1)(join)
+
   def withLoggingOff[A](f: () => A): A = {
     val sparkLoggers = Seq(
       "org.apache.spark",
@@ -150,6 +211,14 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     makeDF(data, securityLevel, "ShortType", "TimestampType").collect
   }
 
+  testAgainstSpark("project timestamps") { securityLevel =>
+    val base = Timestamp.valueOf("2017-12-02 03:04:00").getTime
+    val data = for (i <- 0 until 256) yield
+      (i, new Timestamp(base + i * 1000L), new Timestamp(base - i * 60000L))
+    val df = makeDF(data, securityLevel, "id", "ts1", "ts2")
+    df.select($"id", $"ts1", when($"id" > 127, $"ts1").otherwise($"ts2").as("ts")).collect
+  }
+
   testAgainstSpark("create DataFrame with ArrayType") { securityLevel =>
     val array: Array[Int] = Array(0, -128, 127, 1)
     val data = Seq(
@@ -283,6 +352,30 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     df.sort($"x", $"y").collect
   }
 
+  testAgainstSpark("sort descending with negative values") { securityLevel =>
+    val data = Random.shuffle((-128 until 128).map(x => (x / 16, x.toDouble, x.toLong)).toSeq)
+    val df = makeDF(data, securityLevel, "x", "y", "z")
+    df.sort($"x".desc, $"y", $"z".desc).collect
+  }
+
+  testAgainstSpark("sort with multiple merge passes") { securityLevel =>
+    // Each input block becomes a run, and there are dozens of blocks. Merging only two runs at a
+    // time makes the merge write intermediate runs and merge them again.
+    val data = Random.shuffle((0 until 2048).map(x => (abc(x), x.toLong)).toSeq)
+    val df = makeDF(data, securityLevel, "str", "x")
+    if (securityLevel == Encrypted) {
+      val plan = df.queryExecution.executedPlan
+      val order = Utils.serializeSortOrder(Seq(SortOrder(plan.output(1), Ascending)), plan.output)
+      val (enclave, eid) = Utils.initEnclave()
+      val (sorted, numIntermediatePasses) =
+        enclave.TestExternalSort(eid, order, encryptedInput(plan).bytes, 2)
+      assert(numIntermediatePasses > 0)
+      collectBlock(Block(sorted), plan.output)
+    } else {
+      df.sort($"x").collect.toSeq
+    }
+  }
+
   testAgainstSpark("join") { securityLevel =>
     val p_data = for (i <- 1 to 16) yield (i, i.toString, i * 10)
     val f_data = for (i <- 1 to 256 - 16) yield (i, (i % 16).toString, i * 10)
@@ -307,6 +400,91 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     p.join(f, $"join_col_1" === $"join_col_2").collect.toSet
   }
 
+  testAgainstSpark("sort-merge join") { securityLevel =>
+    val p_data = for (i <- 1 to 16) yield (i, i.toString, i * 10)
+    val f_data = for (i <- 1 to 256 - 16) yield (i, (i % 16).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "pk", "x")
+    val f = makeDF(f_data, securityLevel, "id", "fk", "x")
+    sortMergeJoin(securityLevel) { p.join(f, $"pk" === $"fk") }
+  }
+
+  testAgainstSpark("sort-merge join on column 1") { securityLevel =>
+    val p_data = for (i <- 1 to 16) yield (i.toString, i * 10)
+    val f_data = for (i <- 1 to 256 - 16) yield ((i % 16).toString, (i * 10).toString, i.toFloat)
+    val p = makeDF(p_data, securityLevel, "pk", "x")
+    val f = makeDF(f_data, securityLevel, "fk", "x", "y")
+    sortMergeJoin(securityLevel) { p.join(f, $"pk" === $"fk") }
+  }
+
+  testAgainstSpark("non-foreign-key sort-merge join") { securityLevel =>
+    val p_data = for (i <- 1 to 128) yield (i, (i % 16).toString, i * 10)
+    val f_data = for (i <- 1 to 256 - 128) yield (i, (i % 16).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "join_col_1", "x")
+    val f = makeDF(f_data, securityLevel, "id", "join_col_2", "x")
+    sortMergeJoin(securityLevel) { p.join(f, $"join_col_1" === $"join_col_2") }
+  }
+
+  testAgainstSpark("non-foreign-key sort-merge join spilling primary groups") { securityLevel =>
+    // Each group has 32 primary rows, far more than fit in a 256-byte cache, so every group is
+    // joined from encrypted untrusted memory. The primary rows of a group precede its foreign rows,
+    // so none is added to a group after the group has been joined.
+    val p_data = for (i <- 1 to 128) yield (i, (i % 4).toString, i * 10)
+    val f_data = for (i <- 1 to 64) yield (i, (i % 8).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "join_col_1", "x")
+    val f = makeDF(f_data, securityLevel, "id", "join_col_2", "x")
+    withConf("spark.sql.autoBroadcastJoinThreshold", "-1") {
+      withConf("spark.opaque.hashJoinThreshold", "-1") {
+        val df = p.join(f, $"join_col_1" === $"join_col_2")
+        if (securityLevel == Encrypted) {
+          val (enclave, eid) = Utils.initEnclave()
+          var numSpilledGroups = 0
+          // Run the join as EncryptedSortMergeJoinExec does, passing the primary rows that end
+          // each partition on to the next, but through the testing entry point
+          val plan = df.queryExecution.executedPlan.transform {
+            case j: EncryptedSortMergeJoinExec =>
+              val joinExpr = Utils.serializeJoinExpression(
+                j.joinType, j.leftKeys, j.rightKeys, j.leftSchema, j.rightSchema)
+              val blocks = j.child.asInstanceOf[OpaqueOperatorExec].executeBlocked().collect
+              val joinRows = Utils.emptyBlock +: blocks.dropRight(1).map { block =>
+                Block(enclave.ScanCollectLastPrimary(eid, joinExpr, block.bytes))
+              }
+              val joined = blocks.zip(joinRows).map {
+                case (block, joinRow) =>
+                  val (rows, n) = enclave.TestSortMergeJoin(
+                    eid, joinExpr, block.bytes, joinRow.bytes, 256)
+                  numSpilledGroups += n
+                  Block(rows)
+              }
+              EncryptedBlockRDDScanExec(
+                j.output, spark.sparkContext.parallelize(joined, joined.length))
+          }
+          val result = collectBlock(encryptedInput(plan), plan.output).toSet
+          assert(numSpilledGroups >= 4)
+          result
+        } else {
+          df.collect.toSet
+        }
+      }
+    }
+  }
+
+  testAgainstSpark("hash join") { securityLevel =>
+    val p_data = for (i <- 1 to 128) yield (i, (i % 16).toString, i * 10)
+    val f_data = for (i <- 1 to 256) yield (i, (i % 20).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "join_col_1", "x")
+    val f = makeDF(f_data, securityLevel, "id", "join_col_2", "x")
+    hashJoin(securityLevel) { p.join(f, $"join_col_1" === $"join_col_2") }
+  }
+
+  testAgainstSpark("broadcast hash join") { securityLevel =>
+    val p_data = for (i <- 1 to 16) yield (i, i.toString, i * 10)
+    val f_data = for (i <- 1 to 256) yield (i, (i % 20).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "join_col_1", "x")
+    val f = makeDF(f_data, securityLevel, "id", "join_col_2", "x")
+    broadcastJoin(securityLevel) { p.join(f, $"join_col_1" === $"join_col_2") } ++
+      broadcastJoin(securityLevel) { f.join(p, $"join_col_2" === $"join_col_1") }
+  }
+
   def abc(i: Int): String = (i % 3) match {
     case 0 => "A"
     case 1 => "B"
@@ -377,18 +555,175 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
       .collect.sortBy { case Row(str: String, _, _) => str }
   }
 
+  testAgainstSpark("aggregate with many groups") { securityLevel =>
+    val data = for (i <- 0 until 2048) yield (i % 300, i.toLong, i.toDouble)
+    val df = makeDF(data, securityLevel, "k", "x", "y")
+
+    df.groupBy("k").agg(sum("x").as("totalX"), max("y").as("maxY"), count("y").as("countY"))
+      .collect.sortBy { case Row(k: Int, _, _, _) => k }
+  }
+
+  testAgainstSpark("aggregate on multiple grouping columns") { securityLevel =>
+    val data = for (i <- 0 until 1024) yield (abc(i), i % 7, i, i.toDouble)
+    val df = makeDF(data, securityLevel, "s", "k", "x", "y")
+
+    df.groupBy("s", "k")
+      .agg(avg("y").as("avgY"), min("x").as("minX"), max("y").as("maxY"), count("x").as("n"))
+      .collect.sortBy { case Row(s: String, k: Int, _, _, _, _) => (s, k) }
+  }
+
+  testAgainstSpark("hash aggregate spilling to several levels") { securityLevel =>
+    // A table of at most 1 KB holds only a few of these groups, so the groups that spill to each
+    // partition spill again
+    val data = for (i <- 0 until 8192) yield (i % 2048, i.toLong, i.toDouble)
+    val df = makeDF(data, securityLevel, "k", "x", "y")
+    val agg = df.groupBy("k")
+      .agg(sum("x").as("totalX"), max("y").as("maxY"), count("y").as("countY"))
+    def sorted(rows: Seq[Row]): Seq[Row] = rows.sortBy { case Row(k: Int, _, _, _) => k }
+    if (securityLevel == Encrypted) {
+      val aggExec = agg.queryExecution.executedPlan.collect {
+        case a: EncryptedHashAggregateExec => a
+      }.head
+      val aggOp = Utils.serializeAggOp(
+        aggExec.groupingExpressions, aggExec.aggExpressions, aggExec.child.output)
+      val mergeAggOp = Utils.serializeMergeAggOp(
+        Utils.partialAggGroupingAttributes(aggExec.groupingExpressions), aggExec.aggExpressions)
+      val (enclave, eid) = Utils.initEnclave()
+
+      // Input rows, updating native accumulators
+      val input = encryptedInput(aggExec.child)
+      val (aggregated, aggregatedDepth) = enclave.TestHashAggregate(eid, aggOp, input.bytes, 1024)
+      assert(aggregatedDepth >= 2)
+
+      // The partial rows of each partition, merged by the update expressions of Generic aggregates
+      val partials = Utils.concatEncryptedBlocks(
+        aggExec.child.asInstanceOf[OpaqueOperatorExec].executeBlocked().collect.map { block =>
+          Block(enclave.NonObliviousPartialAggregate(eid, aggOp, block.bytes))
+        })
+      val (merged, mergedDepth) = enclave.TestHashAggregate(eid, mergeAggOp, partials.bytes, 1024)
+      assert(mergedDepth >= 2)
+
+      Seq(aggregated, merged).map(rows => sorted(collectBlock(Block(rows), aggExec.output)))
+    } else {
+      Seq.fill(2)(sorted(agg.collect))
+    }
+  }
+
+  testAgainstSpark("sort-based aggregate") { securityLevel =>
+    withConf("spark.opaque.hashAggregateEnabled", "false") {
+      val data = for (i <- 0 until 256) yield (abc(i), 1, 1.0f)
+      val words = makeDF(data, securityLevel, "str", "x", "y")
+
+      words.groupBy("str").agg(sum("y").as("totalY"), avg("x").as("avgX"))
+        .collect.sortBy { case Row(str: String, _, _) => str }
+    }
+  }
+
+  testAgainstSpark("columnar blocks") { securityLevel =>
+    withConf("spark.opaque.columnarBlocks", "true") {
+      val data = for (i <- 0 until 256) yield (
+        i, if (i % 7 == 0) null else abc(i), i.toLong * 1000, i.toDouble / 3, i % 2 == 0)
+      val df = makeDF(data, securityLevel, "id", "str", "l", "d", "b")
+      df.filter($"d" > 10.0).select($"id", $"str", $"l" + 1, $"b").collect.toSet
+    }
+  }
+
+  testAgainstSpark("columns encrypted separately") { securityLevel =>
+    withConf("spark.opaque.columnarBlocks", "true") {
+      withConf("spark.opaque.encryptColumnsSeparately", "true") {
+        val data = for (i <- 0 until 256) yield (
+          i, if (i % 7 == 0) null else abc(i), i.toLong * 1000, i.toDouble / 3, i % 2 == 0)
+        val df = makeDF(data, securityLevel, "id", "str", "l", "d", "b")
+        (df.select($"str", $"d" * 2).collect ++
+          df.filter($"b").select($"id", $"l").collect).toSet
+      }
+    }
+  }
+
+  testAgainstSpark("filter and project by column") { securityLevel =>
+    withConf("spark.opaque.columnarBlocks", "true") {
+      for (separately <- Seq("false", "true")) yield {
+        withConf("spark.opaque.encryptColumnsSeparately", separately) {
+          // Short columns are not loaded by column, so expressions on them fall back to rows
+          val data = for (i <- 0 until 2048) yield (
+            i, if (i % 7 == 0) null else abc(i % 5), i.toShort, i.toDouble / 3)
+          val df = makeDF(data, securityLevel, "id", "str", "s", "d")
+          (df.filter($"str".isNotNull && $"d" < 500.0)
+            .select($"str", lit(1), $"id" * 2, $"d").collect ++
+            df.filter($"s" > 1000).select($"s", $"id").collect).toSet
+        }
+      }
+    }
+  }
+
+  testAgainstSpark("compressed columnar blocks") { securityLevel =>
+    withConf("spark.opaque.columnarBlocks", "true") {
+      // Few distinct strings, runs of equal keys once sorted, and longs in a narrow range
+      val data = for (i <- 0 until 256) yield (
+        i % 4 - 2, if (i % 9 == 0) null else abc(i % 3), Long.MinValue + i * 3, i)
+      val df = makeDF(data, securityLevel, "k", "str", "l", "id")
+      df.sort($"k", $"id").select($"k", $"str", $"l").collect
+    }
+  }
+
+  testAgainstSpark("packed rows") { securityLevel =>
+    withConf("spark.opaque.packedRows", "true") {
+      val data = for (i <- 0 until 256) yield (
+        i, if (i % 7 == 0) null else abc(i), i.toLong * 1000, i.toDouble / 3, i.toShort)
+      val df = makeDF(data, securityLevel, "id", "str", "l", "d", "s")
+      df.filter($"d" > 10.0).select($"id", $"str", $"l" + 1, $"s").sort($"id").collect
+    }
+  }
+
+  testAgainstSpark("filter and sort packed rows by column") { securityLevel =>
+    withConf("spark.opaque.packedRows", "true") {
+      val data = for (i <- 0 until 2048) yield (
+        if (i % 7 == 0) null else abc(i % 11), i % 13 - 6, i.toLong * 31 % 1000, i.toShort)
+      val df = makeDF(data, securityLevel, "str", "k", "l", "s")
+      // Shorts are not loaded by column, so the second filter falls back to rows
+      df.filter($"l" > 100 && $"str".isNotNull).sort($"str".desc, $"k", $"l").collect ++
+        df.filter($"s" > 1000).sort($"l", $"k").collect
+    }
+  }
+
+  testAgainstSpark("block statistics") { securityLevel =>
+    withConf("spark.opaque.blockStats", "true") {
+      val data = for (i <- 0 until 2048) yield (
+        i, if (i % 5 == 0) null else abc(i), i.toLong * 1000, i.toDouble / 3)
+      val df = makeDF(data, securityLevel, "id", "str", "l", "d")
+      // Sorting keeps the statistics, and makes the ranges of id narrow enough to skip blocks
+      val sorted = df.sort($"id")
+      sorted.filter($"id" >= 1500 || $"l" < 20000).filter($"str".isNotNull)
+        .select($"id", $"str", $"d").collect
+    }
+  }
+
   testAgainstSpark("global aggregate") { securityLevel =>
     val data = for (i <- 0 until 256) yield (i, abc(i), 1)
     val words = makeDF(data, securityLevel, "id", "word", "count")
     words.agg(sum("count").as("totalCount")).collect
   }
 
+  testAgainstSpark("global aggregate over empty input") { securityLevel =>
+    val data = for (i <- 0 until 256) yield (i, abc(i), 1)
+    val words = makeDF(data, securityLevel, "id", "word", "count")
+    words.filter($"id" < 0)
+      .agg(sum("count").as("totalCount"), count("id").as("n"), max("id").as("maxId"))
+      .collect
+  }
+
   testAgainstSpark("contains") { securityLevel =>
     val data = for (i <- 0 until 256) yield(i.toString, abc(i))
     val df = makeDF(data, securityLevel, "word", "abc")
     df.filter($"word".contains(lit("1"))).collect
   }
 
+  testAgainstSpark("contains empty string") { securityLevel =>
+    val data = for (i <- 0 until 256) yield(i.toString, abc(i))
+    val df = makeDF(data, securityLevel, "word", "abc")
+    df.filter($"word".contains(lit(""))).select($"word", $"abc".contains(lit(""))).collect
+  }
+
   testAgainstSpark("year") { securityLevel =>
     val data = Seq(Tuple2(1, new java.sql.Date(new java.util.Date().getTime())))
     val df = makeDF(data, securityLevel, "id", "date")
@@ -673,7 +1008,7 @@ class OpaqueMultiplePartitionSuite extends OpaqueOperatorTests {
     val f_data = for (i <- 1 to 256 - 16) yield ((i % 16).toString, (i * 10).toString, i.toFloat)
     val p = makeDF(p_data, securityLevel, "pk", "x")
     val f = makePartitionedDF(f_data, securityLevel, numPartitions + 1, "fk", "x", "y")
-    p.join(f, $"pk" === $"fk").collect.toSet
+    sortMergeJoin(securityLevel) { p.join(f, $"pk" === $"fk") }
   }
 
   testAgainstSpark("non-foreign-key join with high skew") { securityLevel =>
@@ -684,7 +1019,7 @@ class OpaqueMultiplePartitionSuite extends OpaqueOperatorTests {
     val f_data = for (i <- 1 to 128) yield (i, 1)
     val p = makeDF(p_data, securityLevel, "id", "join_col_1")
     val f = makeDF(f_data, securityLevel, "id", "join_col_2")
-    p.join(f, $"join_col_1" === $"join_col_2").collect.toSet
+    sortMergeJoin(securityLevel) { p.join(f, $"join_col_1" === $"join_col_2") }
   }
 
 }
@@ -17,7 +17,14 @@
 
 package edu.berkeley.cs.rise.opaque
 
+import java.nio.ByteBuffer
+
+import com.google.flatbuffers.FlatBufferBuilder
+import edu.berkeley.cs.rise.opaque.execution.Block
 import org.apache.spark.sql.SparkSession
+import org.apache.spark.sql.catalyst.InternalRow
+import org.apache.spark.sql.types.IntegerType
+import org.apache.spark.sql.types.LongType
 import org.scalatest.BeforeAndAfterAll
 import org.scalatest.FunSuite
 
@@ -37,7 +44,70 @@ class QEDSuite extends FunSuite with BeforeAndAfterAll {
     val data = Array[Byte](0, 1, 2)
     val (enclave, eid) = Utils.initEnclave()
     assert(data === Utils.decrypt(Utils.encrypt(data)))
-    assert(data === Utils.decrypt(enclave.Encrypt(eid, data)))
+    assert(data === Utils.decrypt(enclave.Encrypt(eid, data, Array.empty)))
+  }
+
+  test("batch encryption/decryption") {
+    val data = Seq(Array.empty[Byte], Array[Byte](0, 1, 2), Array.tabulate[Byte](1000)(_.toByte))
+    val ciphertexts = Utils.encryptMany(data)
+    assert(Utils.decryptMany(ciphertexts).map(_.toSeq) === data.map(_.toSeq))
+
+    val (enclave, eid) = Utils.initEnclave()
+    val fromEnclave = data.map(enclave.Encrypt(eid, _, Array.empty))
+    assert(Utils.decryptMany(fromEnclave).map(_.toSeq) === data.map(_.toSeq))
+
+    val tampered = ciphertexts(2).clone()
+    tampered(100) = (tampered(100) ^ 1).toByte
+    intercept[Exception] {
+      Utils.decryptMany(Seq(ciphertexts(1), tampered))
+    }
+  }
+
+  test("additional authenticated data") {
+    val data = Seq(Array[Byte](0, 1, 2))
+    val aad = Array[Byte](tuix.BlockFormat.Columnar)
+    val (enclave, eid) = Utils.initEnclave()
+    for (ciphertexts <- Seq(Utils.encryptMany(data, aad), data.map(enclave.Encrypt(eid, _, aad)))) {
+      assert(Utils.decryptMany(ciphertexts, aad).map(_.toSeq) === data.map(_.toSeq))
+      intercept[Exception] {
+        Utils.decryptMany(ciphertexts)
+      }
+      intercept[Exception] {
+        Utils.decryptMany(ciphertexts, Array[Byte](tuix.BlockFormat.Packed))
+      }
+    }
+  }
+
+  test("block format is authenticated") {
+    val rows = Seq(InternalRow(1, 2L), InternalRow(3, 4L))
+    val block = Utils.encryptInternalRowsFlatbuffers(
+      rows, Seq(IntegerType, LongType), useEnclave = false, format = tuix.BlockFormat.Columnar)
+    assert(Utils.decryptBlockFlatbuffers(block) === rows)
+
+    // Relabel the encrypted ColumnarRows as PackedRows
+    val encryptedBlock =
+      tuix.EncryptedBlocks.getRootAsEncryptedBlocks(ByteBuffer.wrap(block.bytes)).blocks(0)
+    val encRows = new Array[Byte](encryptedBlock.encRowsLength)
+    encryptedBlock.encRowsAsByteBuffer.get(encRows)
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.EncryptedBlocks.createEncryptedBlocks(
+        builder,
+        tuix.EncryptedBlocks.createBlocksVector(
+          builder,
+          Array(
+            tuix.EncryptedBlock.createEncryptedBlock(
+              builder,
+              encryptedBlock.numRows,
+              tuix.EncryptedBlock.createEncRowsVector(builder, encRows),
+              tuix.BlockFormat.Packed,
+              0,
+              0,
+              0,
+              0)))))
+    intercept[Exception] {
+      Utils.decryptBlockFlatbuffers(Block(builder.sizedByteArray()))
+    }
   }
 }
 